@@ -2018,6 +2018,9 @@ BENCHFUN
 
                 for (int tiletop = 0; tiletop < imheight; tiletop += tileHskip) {
                     for (int tileleft = 0; tileleft < imwidth ; tileleft += tileWskip) {
+                        if (im.cancelled()) {
+                            continue; // the remaining tiles are skipped, the output is discarded
+                        }
                         //printf("titop=%d tileft=%d\n",tiletop/tileHskip, tileleft/tileWskip);
                         pos = (tiletop / tileHskip) * numtiles_W + tileleft / tileWskip ;
                         int tileright = MIN(imwidth, tileleft + tilewidth);
@@ -23,7 +23,10 @@
 #include <cstdlib>
 #include <utility>
 #include <memory>
+#include <cstring>
+#include <algorithm>
 
+#include "bufferpool.h"
 
 namespace rtengine {
 
@@ -35,6 +38,27 @@ private:
     char alignment;
     size_t allocatedSize;
     int unitSize;
+    size_t capacity; // size of the block pointed to by real if it comes from the BufferPool, 0 otherwise
+
+    void release()
+    {
+        if (capacity) {
+            BufferPool::getInstance()->release(real, capacity);
+        } else if (real) {
+            free(real);
+        }
+        real = nullptr;
+        capacity = 0;
+    }
+
+    void *align(void *block, size_t space, size_t amount) const
+    {
+        void *p = block;
+        if (p && alignment && !std::align(alignment, amount, p, space)) {
+            p = nullptr;
+        }
+        return p;
+    }
 
 public:
     T *data;
@@ -49,6 +73,7 @@ public:
         alignment(align),
         allocatedSize(0),
         unitSize(0),
+        capacity(0),
         data(nullptr)
     {
         if (size) {
@@ -58,9 +83,7 @@ public:
 
     ~AlignedBuffer ()
     {
-        if (real) {
-            free(real);
-        }
+        release();
     }
 
     /** @brief Return true if there's no memory allocated
@@ -78,10 +101,7 @@ public:
     bool resize(size_t size, int structSize=0)
     {
         if (size == 0) {
-            if (real) {
-                free(real);
-            }
-            real = nullptr;
+            release();
             data = nullptr;
             allocatedSize = 0;
             unitSize = 0;
@@ -91,20 +111,39 @@ public:
         size_t elemsz = structSize ? structSize : sizeof(T);
         size_t amount = size * elemsz;
         if (amount != allocatedSize) {
+            const size_t space = amount + alignment;
+            void *p = nullptr;
+            if (capacity && space <= capacity && space >= capacity / 2) {
+                // the current block from the pool is still a good fit
+                p = align(real, capacity, amount);
+            } else {
+                size_t cap = 0;
+                void *block = BufferPool::getInstance()->acquire(space, cap);
+                if (block || capacity) {
+                    if (!block) {
+                        block = malloc(space);
+                    }
+                    p = align(block, cap ? cap : space, amount);
+                    if (p && data) {
+                        // same semantics as realloc
+                        memcpy(p, data, std::min(allocatedSize, amount));
+                    }
+                    release();
+                    real = block;
+                    capacity = cap;
+                } else {
+                    real = realloc(real, space);
+                    p = align(real, space, amount);
+                }
+            }
             unitSize = elemsz;
             allocatedSize = amount;
-            size_t space = amount + alignment;
-            real = realloc(real, space);
-            void *p = real;
-            if (!p || (alignment && !std::align(alignment, amount, p, space))) {
-                if (real) {
-                    free(real);
-                    real = nullptr;
-                    data = nullptr;
-                    allocatedSize = 0;
-                    unitSize = 0;
-                    return false;
-                }
+            if (!p) {
+                release();
+                data = nullptr;
+                allocatedSize = 0;
+                unitSize = 0;
+                return false;
             }
             data = static_cast<T *>(p);
         }
@@ -117,6 +156,7 @@ public:
         std::swap(real, other.real);
         std::swap(alignment, other.alignment);
         std::swap(allocatedSize, other.allocatedSize);
+        std::swap(capacity, other.capacity);
         std::swap(data, other.data);
     }
 
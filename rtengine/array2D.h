@@ -289,6 +289,20 @@ public:
     int width() const { return width_; }
     int height() const { return height_; }
 
+    void swap(array2D<T> &other)
+    {
+        std::swap(width_, other.width_);
+        std::swap(height_, other.height_);
+        const unsigned int f = flags_;
+        flags_ = other.flags_;
+        other.flags_ = f;
+        const bool o = owner_;
+        owner_ = other.owner_;
+        other.owner_ = o;
+        std::swap(ptr_, other.ptr_);
+        buf_.swap(other.buf_);
+    }
+
     operator bool()
     {
         return (width_ > 0 && height_ > 0);
@@ -0,0 +1,148 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bufferpool.h"
+#include "settings.h"
+#include <cstdlib>
+#include <algorithm>
+
+namespace rtengine {
+
+extern const Settings *settings;
+
+namespace {
+
+// sizes are rounded up to this granularity, so that buffers of slightly
+// different sizes (e.g. with/without borders) can share the same blocks
+constexpr size_t GRANULARITY = size_t(1) << 16;
+
+} // namespace
+
+
+BufferPool *BufferPool::getInstance()
+{
+    // never destroyed, as buffers owned by static objects might be
+    // released after the end of main()
+    static BufferPool *instance = new BufferPool();
+    return instance;
+}
+
+
+BufferPool::BufferPool():
+    clock_(0),
+    stats_{0, 0, 0, 0, 0}
+{
+}
+
+
+size_t BufferPool::budget() const
+{
+    return settings ? size_t(std::max(settings->buffer_pool_size, 0)) << 20 : 0;
+}
+
+
+void *BufferPool::acquire(size_t size, size_t &capacity)
+{
+    capacity = 0;
+    if (size < MIN_BLOCK_SIZE || !budget()) {
+        return nullptr;
+    }
+    size = (size + GRANULARITY - 1) / GRANULARITY * GRANULARITY;
+
+    {
+        std::lock_guard<std::mutex> lck(mutex_);
+        // best fit, without wasting more than 1/4 of the block
+        auto best = blocks_.end();
+        for (auto it = blocks_.begin(); it != blocks_.end(); ++it) {
+            if (it->size >= size && it->size <= size + size / 4 && (best == blocks_.end() || it->size < best->size)) {
+                best = it;
+            }
+        }
+        if (best != blocks_.end()) {
+            void *ret = best->ptr;
+            capacity = best->size;
+            stats_.pooled_bytes -= best->size;
+            ++stats_.hits;
+            stats_.bytes_reused += best->size;
+            blocks_.erase(best);
+            return ret;
+        }
+        ++stats_.misses;
+    }
+
+    void *ret = malloc(size);
+    if (ret) {
+        capacity = size;
+    }
+    return ret;
+}
+
+
+void BufferPool::release(void *block, size_t capacity)
+{
+    if (!block) {
+        return;
+    }
+    const size_t b = budget();
+    if (capacity > b) {
+        free(block);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lck(mutex_);
+    evict(b - capacity);
+    blocks_.push_back({block, capacity, ++clock_});
+    stats_.pooled_bytes += capacity;
+}
+
+
+void BufferPool::evict(size_t budget)
+{
+    while (stats_.pooled_bytes > budget && !blocks_.empty()) {
+        auto lru = blocks_.begin();
+        for (auto it = blocks_.begin(); it != blocks_.end(); ++it) {
+            if (it->last_use < lru->last_use) {
+                lru = it;
+            }
+        }
+        free(lru->ptr);
+        stats_.pooled_bytes -= lru->size;
+        ++stats_.evictions;
+        blocks_.erase(lru);
+    }
+}
+
+
+void BufferPool::clear()
+{
+    std::lock_guard<std::mutex> lck(mutex_);
+    for (auto &b : blocks_) {
+        free(b.ptr);
+    }
+    blocks_.clear();
+    stats_.pooled_bytes = 0;
+}
+
+
+BufferPool::Stats BufferPool::get_stats() const
+{
+    std::lock_guard<std::mutex> lck(mutex_);
+    return stats_;
+}
+
+} // namespace rtengine
@@ -0,0 +1,79 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "noncopyable.h"
+#include <mutex>
+#include <vector>
+#include <cstddef>
+
+namespace rtengine {
+
+/**
+ * Pool of large memory blocks, used by AlignedBuffer (and hence by array2D
+ * and the planar images such as Imagefloat). The full-size temporaries
+ * allocated by the processing steps are given back to the pool when they
+ * are destroyed, so that the next run of the pipeline (e.g. after a slider
+ * move) can reuse them instead of going back to malloc and faulting in
+ * fresh pages. The memory kept in the pool is bounded by
+ * Settings::buffer_pool_size (in MB), 0 disables it.
+ */
+class BufferPool: public NonCopyable {
+public:
+    struct Stats {
+        size_t hits;         // allocations served from the pool
+        size_t misses;       // allocations that went to malloc
+        size_t bytes_reused; // total size of the blocks served from the pool
+        size_t evictions;    // blocks freed to stay within the budget
+        size_t pooled_bytes; // memory currently kept in the pool
+    };
+
+    static BufferPool *getInstance();
+
+    // blocks smaller than this are not worth pooling
+    static constexpr size_t MIN_BLOCK_SIZE = size_t(1) << 20;
+
+    // returns a block of at least size bytes, storing its actual size in
+    // capacity, or nullptr if the block should be allocated with malloc
+    // (pool disabled or block too small)
+    void *acquire(size_t size, size_t &capacity);
+    // gives back a block obtained with acquire()
+    void release(void *block, size_t capacity);
+
+    void clear();
+    Stats get_stats() const;
+
+private:
+    BufferPool();
+    size_t budget() const;
+    void evict(size_t budget);
+
+    struct Block {
+        void *ptr;
+        size_t size;
+        unsigned long last_use;
+    };
+
+    mutable std::mutex mutex_;
+    std::vector<Block> blocks_;
+    unsigned long clock_;
+    Stats stats_;
+};
+
+} // namespace rtengine
@@ -2507,6 +2507,52 @@ int crxSetupSubbandData(CrxImage *img, CrxPlaneComp *planeComp, const CrxTile *t
   return 0;
 }
 
+// decodes a single plane of a single tile. The tiles of all the planes are
+// independent of each other: each one has its own bitstreams, subband and
+// wavelet buffers, and writes to a disjoint region of the output. Returns 1
+// if the plane has no data
+int crxDecodeTile(CrxImage *img, CrxTile *tile, uint32_t planeNumber, int imageRow, int imageCol)
+{
+  CrxPlaneComp *planeComp = tile->comps + planeNumber;
+  uint64_t tileMdatOffset = tile->dataOffset + tile->mdatQPDataSize + tile->mdatExtraSize + planeComp->dataOffset;
+
+  if (crxSetupSubbandData(img, planeComp, tile, tileMdatOffset))
+    return -1;
+
+  if (img->levels)
+  {
+    if (crxIdwt53FilterInitialize(planeComp, img->levels, tile->qStep))
+      return -1;
+    for (int i = 0; i < tile->height; ++i)
+    {
+      if (crxIdwt53FilterDecode(planeComp, img->levels - 1, tile->qStep) ||
+          crxIdwt53FilterTransform(planeComp, img->levels - 1))
+        return -1;
+      int32_t *lineData = crxIdwt53FilterGetLine(planeComp, img->levels - 1);
+      crxConvertPlaneLine(img, imageRow + i, imageCol, planeNumber, lineData, tile->width);
+    }
+  }
+  else
+  {
+    // we have the only subband in this case
+    if (!planeComp->subBands->dataSize)
+    {
+      memset(planeComp->subBands->bandBuf, 0, planeComp->subBands->bandSize);
+      return 1;
+    }
+
+    for (int i = 0; i < tile->height; ++i)
+    {
+      if (crxDecodeLine(planeComp->subBands->bandParam, planeComp->subBands->bandBuf))
+        return -1;
+      int32_t *lineData = (int32_t *)planeComp->subBands->bandBuf;
+      crxConvertPlaneLine(img, imageRow + i, imageCol, planeNumber, lineData, tile->width);
+    }
+  }
+
+  return 0;
+}
+
 static unsigned sgetn (int n, unsigned char *s)
 {
     unsigned result = 0;
@@ -2531,43 +2577,11 @@ int DCraw::crxDecodePlane(void *p, uint32_t planeNumber)
     for (int tCol = 0; tCol < img->tileCols; tCol++)
     {
       CrxTile *tile = img->tiles + tRow * img->tileCols + tCol;
-      CrxPlaneComp *planeComp = tile->comps + planeNumber;
-      uint64_t tileMdatOffset = tile->dataOffset + tile->mdatQPDataSize + tile->mdatExtraSize + planeComp->dataOffset;
-
-      // decode single tile
-      if (crxSetupSubbandData(img, planeComp, tile, tileMdatOffset))
+      int res = crxDecodeTile(img, tile, planeNumber, imageRow, imageCol);
+      if (res < 0)
         return -1;
-
-      if (img->levels)
-      {
-        if (crxIdwt53FilterInitialize(planeComp, img->levels, tile->qStep))
-          return -1;
-        for (int i = 0; i < tile->height; ++i)
-        {
-          if (crxIdwt53FilterDecode(planeComp, img->levels - 1, tile->qStep) ||
-              crxIdwt53FilterTransform(planeComp, img->levels - 1))
-            return -1;
-          int32_t *lineData = crxIdwt53FilterGetLine(planeComp, img->levels - 1);
-          crxConvertPlaneLine(img, imageRow + i, imageCol, planeNumber, lineData, tile->width);
-        }
-      }
-      else
-      {
-        // we have the only subband in this case
-        if (!planeComp->subBands->dataSize)
-        {
-          memset(planeComp->subBands->bandBuf, 0, planeComp->subBands->bandSize);
-          return 0;
-        }
-
-        for (int i = 0; i < tile->height; ++i)
-        {
-          if (crxDecodeLine(planeComp->subBands->bandParam, planeComp->subBands->bandBuf))
-            return -1;
-          int32_t *lineData = (int32_t *)planeComp->subBands->bandBuf;
-          crxConvertPlaneLine(img, imageRow + i, imageCol, planeNumber, lineData, tile->width);
-        }
-      }
+      else if (res > 0)
+        return 0;
       imageCol += tile->width;
     }
     imageRow += img->tiles[tRow * img->tileCols].height;
@@ -3307,13 +3321,49 @@ int crxFreeImageData(CrxImage *img)
 void DCraw::crxLoadDecodeLoop(void *img, int nPlanes)
 {
 #ifdef LIBRAW_USE_OPENMP
-  int results[4]; // nPlanes is always <= 4
-#pragma omp parallel for
+  // decode the tiles of all the planes in parallel, rather than just the
+  // planes (at most 4)
+  CrxImage *image = (CrxImage *)img;
+  struct Job {
+    CrxTile *tile;
+    int plane;
+    int row;
+    int col;
+  };
+  std::vector<Job> jobs;
   for (int32_t plane = 0; plane < nPlanes; ++plane)
-    results[plane] = crxDecodePlane(img, plane);
+  {
+    int imageRow = 0;
+    for (int tRow = 0; tRow < image->tileRows; tRow++)
+    {
+      int imageCol = 0;
+      for (int tCol = 0; tCol < image->tileCols; tCol++)
+      {
+        CrxTile *tile = image->tiles + tRow * image->tileCols + tCol;
+        jobs.push_back({tile, plane, imageRow, imageCol});
+        imageCol += tile->width;
+      }
+      imageRow += image->tiles[tRow * image->tileCols].height;
+    }
+  }
 
-  for (int32_t plane = 0; plane < nPlanes; ++plane)
-    if (results[plane])
+  // exceptions (e.g. from crxFillBuffer) can't cross the parallel region
+  std::vector<int> results(jobs.size());
+#pragma omp parallel for schedule(dynamic)
+  for (size_t i = 0; i < jobs.size(); ++i)
+  {
+    try
+    {
+      results[i] = crxDecodeTile(image, jobs[i].tile, jobs[i].plane, jobs[i].row, jobs[i].col);
+    }
+    catch (...)
+    {
+      results[i] = -1;
+    }
+  }
+
+  for (size_t i = 0; i < jobs.size(); ++i)
+    if (results[i] < 0)
       derror();
 #else
   for (int32_t plane = 0; plane < nPlanes; ++plane)
@@ -10,8 +10,13 @@
 #include "stdimagesource.h"
 #include "linalgebra.h"
 #include "settings.h"
+#include "utils.h"
+#include "cpudispatch.h"
 
 #include <giomm.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <sstream>
 #include <iostream>
 #include <fstream>
@@ -29,6 +34,11 @@
 # include <omp.h>
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define ART_CLUT_AVX2
+#  include <immintrin.h>
+#endif
+
 namespace rtengine {
 
 extern const Settings *settings;
@@ -101,10 +111,167 @@ bool loadFile(
     return res;
 }
 
+
+// On-disk cache of the decoded lattices. Each entry is a header followed by
+// the lattice in the same layout used by HaldCLUT, so that it can be mapped
+// read-only and used in place: concurrent processes using the same CLUT
+// then share a single physical copy of it
+const char hald_cache_magic[8] = { 'A', 'R', 'T', 'H', 'L', 'D', '0', '1' };
+
+struct HaldCacheHeader {
+    char magic[8];
+    std::uint32_t level;
+    std::uint32_t reserved;
+    std::uint64_t count;
+    char padding[40]; // keep the lattice 64-byte aligned
+};
+
+static_assert(sizeof(HaldCacheHeader) == 64, "unexpected size of HaldCacheHeader");
+
+
+Glib::ustring get_hald_cache_dir()
+{
+    return Glib::build_filename(options.cacheBaseDir, "clut");
+}
+
+
+std::string get_hald_cache_key(const Glib::ustring &filename)
+{
+    return Glib::Checksum::compute_checksum(Glib::Checksum::CHECKSUM_SHA256, filename + "\n" + getMD5(filename, true));
+}
+
+
+GMappedFile *load_hald_cache(const std::string &key, unsigned int &clut_level, const std::uint16_t *&data)
+{
+    const auto name = Glib::build_filename(get_hald_cache_dir(), key);
+    GMappedFile *mapping = g_mapped_file_new(name.c_str(), FALSE, nullptr);
+    if (!mapping) {
+        return nullptr;
+    }
+
+    const char *contents = g_mapped_file_get_contents(mapping);
+    const std::size_t length = g_mapped_file_get_length(mapping);
+    HaldCacheHeader hdr;
+    bool ok = contents && length >= sizeof(HaldCacheHeader);
+    if (ok) {
+        memcpy(&hdr, contents, sizeof(HaldCacheHeader));
+        const std::uint64_t size = std::uint64_t(hdr.level) * hdr.level * hdr.level;
+        ok = memcmp(hdr.magic, hald_cache_magic, sizeof(hald_cache_magic)) == 0
+            && hdr.level > 1 && hdr.count == size * size * 4 + 4
+            && length == sizeof(HaldCacheHeader) + hdr.count * sizeof(std::uint16_t);
+    }
+
+    if (!ok) {
+        g_mapped_file_unref(mapping);
+        if (settings->verbose) {
+            std::cerr << "HaldCLUT cache - invalid entry: " << key << std::endl;
+        }
+        g_remove(name.c_str());
+        return nullptr;
+    }
+
+    // refresh the modification time, used by trim_hald_cache() to evict
+    // the least-recently used entries
+    g_utime(name.c_str(), nullptr);
+    clut_level = hdr.level;
+    data = reinterpret_cast<const std::uint16_t *>(contents + sizeof(HaldCacheHeader));
+    return mapping;
+}
+
+
+void trim_hald_cache()
+{
+    const goffset max_size = goffset(std::max(settings->clut_cache_size, 0)) * 1024 * 1024;
+    const auto dir_name = get_hald_cache_dir();
+
+    struct Entry {
+        Glib::ustring name;
+        Glib::TimeVal mtime;
+        goffset size;
+    };
+    std::vector<Entry> files;
+    goffset total = 0;
+
+    try {
+        auto enumerator = Gio::File::create_for_path(dir_name)->enumerate_children("standard::name,standard::size,time::modified");
+        while (auto file = enumerator->next_file()) {
+            files.push_back({file->get_name(), file->modification_time(), file->get_size()});
+            total += file->get_size();
+        }
+    } catch (Glib::Exception&) {}
+
+    if (total <= max_size) {
+        return;
+    }
+
+    std::sort(files.begin(), files.end(), [](const Entry &lhs, const Entry &rhs)
+    {
+        return lhs.mtime < rhs.mtime;
+    });
+
+    for (auto entry = files.begin(); entry != files.end() && total > max_size; ++entry) {
+        // entries mapped by other processes stay valid on POSIX systems, on
+        // Windows they can't be removed and are left for the next trim
+        auto pth = Glib::build_filename(dir_name, entry->name);
+        if (g_remove(pth.c_str()) == 0) {
+            total -= entry->size;
+        } else if (settings->verbose) {
+            std::cerr << "HaldCLUT cache - error removing cache file: " << entry->name << std::endl;
+        }
+    }
+}
+
+
+bool store_hald_cache(const std::string &key, const AlignedBuffer<std::uint16_t> &clut_image, unsigned int clut_level)
+{
+    const auto dir = get_hald_cache_dir();
+    if (g_mkdir_with_parents(dir.c_str(), 0777) != 0) {
+        return false;
+    }
+
+    const std::uint64_t size = std::uint64_t(clut_level) * clut_level * clut_level;
+    HaldCacheHeader hdr;
+    memset(&hdr, 0, sizeof(HaldCacheHeader));
+    memcpy(hdr.magic, hald_cache_magic, sizeof(hald_cache_magic));
+    hdr.level = clut_level;
+    hdr.count = size * size * 4 + 4;
+
+    // write to a temporary file first, and then rename it, so that
+    // concurrent readers never see a partially-written entry
+    std::string templ = Glib::build_filename(dir, key + ".tmp-XXXXXX");
+    int fd = Glib::mkstemp(templ);
+    if (fd < 0) {
+        return false;
+    }
+    FILE *out = fdopen(fd, "wb");
+    if (!out) {
+        close(fd);
+        g_remove(templ.c_str());
+        return false;
+    }
+
+    bool ok = fwrite(&hdr, sizeof(HaldCacheHeader), 1, out) == 1;
+    ok = ok && fwrite(clut_image.data, sizeof(std::uint16_t), hdr.count, out) == hdr.count;
+    ok = (fclose(out) == 0) && ok;
+
+    auto name = Glib::build_filename(dir, key);
+    if (!ok || g_rename(templ.c_str(), name.c_str()) != 0) {
+        g_remove(templ.c_str());
+        if (settings->verbose) {
+            std::cerr << "HaldCLUT cache - error storing entry: " << key << std::endl;
+        }
+        return false;
+    }
+
+    trim_hald_cache();
+    return true;
+}
+
+
 #ifdef __SSE2__
-vfloat2 getClutValues(const AlignedBuffer<std::uint16_t>& clut_image, size_t index)
+vfloat2 getClutValues(const std::uint16_t *clut_data, size_t index)
 {
-    const vint v_values = _mm_loadu_si128(reinterpret_cast<const vint*>(clut_image.data + index));
+    const vint v_values = _mm_loadu_si128(reinterpret_cast<const vint*>(clut_data + index));
 #ifdef __SSE4_1__
     return {
         _mm_cvtepi32_ps(_mm_cvtepu16_epi32(v_values)),
@@ -133,6 +300,8 @@ vfloat2 getClutValues(const AlignedBuffer<std::uint16_t>& clut_image, size_t ind
 } // namespace
 
 rtengine::HaldCLUT::HaldCLUT() :
+    clut_data(nullptr),
+    clut_mapping(nullptr),
     clut_level(0),
     flevel_minus_one(0.0f),
     flevel_minus_two(0.0f),
@@ -142,11 +311,41 @@ rtengine::HaldCLUT::HaldCLUT() :
 
 rtengine::HaldCLUT::~HaldCLUT()
 {
+    if (clut_mapping) {
+        g_mapped_file_unref(clut_mapping);
+    }
 }
 
 bool rtengine::HaldCLUT::load(const Glib::ustring& filename)
 {
-    if (loadFile(filename, "", clut_image, clut_level)) {
+    const bool use_cache = settings->clut_cache_size > 0;
+    const std::string key = use_cache ? get_hald_cache_key(filename) : std::string();
+
+    bool ok = false;
+    if (use_cache) {
+        clut_mapping = load_hald_cache(key, clut_level, clut_data);
+        ok = clut_mapping != nullptr;
+        if (ok && settings->verbose > 1) {
+            std::cout << "HaldCLUT cache hit: " << filename << std::endl;
+        }
+    }
+
+    if (!ok && loadFile(filename, "", clut_image, clut_level)) {
+        ok = true;
+        clut_data = clut_image.data;
+        // if the lattice can be stored in the cache, use the mapped copy, so
+        // that it is shared with the other processes using it
+        if (use_cache && store_hald_cache(key, clut_image, clut_level)) {
+            clut_mapping = load_hald_cache(key, clut_level, clut_data);
+            if (clut_mapping) {
+                AlignedBuffer<std::uint16_t>().swap(clut_image);
+            } else {
+                clut_data = clut_image.data;
+            }
+        }
+    }
+
+    if (ok) {
         Glib::ustring name, ext;
         rtengine::CLUTStore::splitClutFilename(filename, name, ext, clut_profile);
 
@@ -162,7 +361,7 @@ bool rtengine::HaldCLUT::load(const Glib::ustring& filename)
 
 rtengine::HaldCLUT::operator bool() const
 {
-    return !clut_image.isEmpty();
+    return clut_data != nullptr;
 }
 
 Glib::ustring rtengine::HaldCLUT::getFilename() const
@@ -175,6 +374,18 @@ Glib::ustring rtengine::HaldCLUT::getProfile() const
     return clut_profile;
 }
 
+rtengine::HaldCLUT::Kernel rtengine::HaldCLUT::bestKernel()
+{
+#ifdef ART_CLUT_AVX2
+    // follows the runtime selection of the instruction set (including the
+    // user override), see cpu::init
+    return cpu::get_isa() != cpu::ISA::SSE2 ? Kernel::AVX2 : Kernel::SCALAR;
+#else
+    return Kernel::SCALAR;
+#endif
+}
+
+
 void rtengine::HaldCLUT::getRGB(
     float strength,
     std::size_t line_size,
@@ -183,6 +394,158 @@ void rtengine::HaldCLUT::getRGB(
     const float* b,
     float* out_rgbx
 ) const
+{
+    getRGB(strength, line_size, r, g, b, out_rgbx, bestKernel());
+}
+
+
+#ifdef ART_CLUT_AVX2
+
+namespace {
+
+#define ART_AVX2 __attribute__((target("avx2")))
+
+ART_AVX2 inline __m256 intp_avx2(__m256 a, __m256 b, __m256 c)
+{
+    return _mm256_add_ps(_mm256_mul_ps(a, b), _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), a), c));
+}
+
+
+// fetches the channels of the lattice nodes at the given indices
+ART_AVX2 inline void fetch_avx2(const int *lattice, __m256i idx, __m256 &cr, __m256 &cg, __m256 &cb)
+{
+    const __m256i mask = _mm256_set1_epi32(0xFFFF);
+    const __m256i i2 = _mm256_slli_epi32(idx, 1);
+    const __m256i rg = _mm256_i32gather_epi32(lattice, i2, 4);
+    const __m256i bx = _mm256_i32gather_epi32(lattice, _mm256_add_epi32(i2, _mm256_set1_epi32(1)), 4);
+    cr = _mm256_cvtepi32_ps(_mm256_and_si256(rg, mask));
+    cg = _mm256_cvtepi32_ps(_mm256_srli_epi32(rg, 16));
+    cb = _mm256_cvtepi32_ps(_mm256_and_si256(bx, mask));
+}
+
+
+// interpolates along red between the nodes idx and idx + 1
+ART_AVX2 inline void lerp_red_avx2(const int *lattice, __m256i idx, __m256 fr, __m256 &outr, __m256 &outg, __m256 &outb)
+{
+    __m256 r0, g0, b0, r1, g1, b1;
+    fetch_avx2(lattice, idx, r0, g0, b0);
+    fetch_avx2(lattice, _mm256_add_epi32(idx, _mm256_set1_epi32(1)), r1, g1, b1);
+    outr = intp_avx2(fr, r1, r0);
+    outg = intp_avx2(fr, g1, g0);
+    outb = intp_avx2(fr, b1, b0);
+}
+
+} // namespace
+
+
+ART_AVX2
+std::size_t rtengine::HaldCLUT::getRGB_avx2(
+    float strength,
+    std::size_t line_size,
+    const float* r,
+    const float* g,
+    const float* b,
+    float* out_rgbx
+) const
+{
+    // trilinear interpolation of 8 pixels at a time. The lattice is stored
+    // as interleaved 16-bit RGBX nodes, so that the 3 channels of a node can
+    // be fetched with 2 gathers of 32 bits each. The arithmetic is the same
+    // as the one of the SSE path of the scalar kernel
+    const int level = clut_level;
+    const int level_square = level * level;
+    const int *lattice = reinterpret_cast<const int *>(clut_data);
+
+    const __m256 v_strength = _mm256_set1_ps(strength);
+    const __m256 v_flevel_minus_one = _mm256_set1_ps(flevel_minus_one);
+    const __m256 v_flevel_minus_two = _mm256_set1_ps(flevel_minus_two);
+    const __m256i v_level = _mm256_set1_epi32(level);
+    const __m256i v_level_square = _mm256_set1_epi32(level_square);
+
+    std::size_t column = 0;
+    for (; column + 8 <= line_size; column += 8) {
+        const __m256 v_r = _mm256_loadu_ps(r + column);
+        const __m256 v_g = _mm256_loadu_ps(g + column);
+        const __m256 v_b = _mm256_loadu_ps(b + column);
+
+        const __m256 tr = _mm256_mul_ps(v_r, v_flevel_minus_one);
+        const __m256 tg = _mm256_mul_ps(v_g, v_flevel_minus_one);
+        const __m256 tb = _mm256_mul_ps(v_b, v_flevel_minus_one);
+        const __m256i ir = _mm256_cvttps_epi32(_mm256_min_ps(tr, v_flevel_minus_two));
+        const __m256i ig = _mm256_cvttps_epi32(_mm256_min_ps(tg, v_flevel_minus_two));
+        const __m256i ib = _mm256_cvttps_epi32(_mm256_min_ps(tb, v_flevel_minus_two));
+        const __m256 fr = _mm256_sub_ps(tr, _mm256_cvtepi32_ps(ir));
+        const __m256 fg = _mm256_sub_ps(tg, _mm256_cvtepi32_ps(ig));
+        const __m256 fb = _mm256_sub_ps(tb, _mm256_cvtepi32_ps(ib));
+
+        const __m256i color = _mm256_add_epi32(ir, _mm256_add_epi32(_mm256_mullo_epi32(ig, v_level), _mm256_mullo_epi32(ib, v_level_square)));
+
+        __m256 r1, g1, b1, r2, g2, b2;
+        lerp_red_avx2(lattice, color, fr, r1, g1, b1);
+        lerp_red_avx2(lattice, _mm256_add_epi32(color, v_level), fr, r2, g2, b2);
+        __m256 out_r = intp_avx2(fg, r2, r1);
+        __m256 out_g = intp_avx2(fg, g2, g1);
+        __m256 out_b = intp_avx2(fg, b2, b1);
+
+        const __m256i color2 = _mm256_add_epi32(color, v_level_square);
+        lerp_red_avx2(lattice, color2, fr, r1, g1, b1);
+        lerp_red_avx2(lattice, _mm256_add_epi32(color2, v_level), fr, r2, g2, b2);
+        r1 = intp_avx2(fg, r2, r1);
+        g1 = intp_avx2(fg, g2, g1);
+        b1 = intp_avx2(fg, b2, b1);
+
+        out_r = intp_avx2(v_strength, intp_avx2(fb, r1, out_r), v_r);
+        out_g = intp_avx2(v_strength, intp_avx2(fb, g1, out_g), v_g);
+        out_b = intp_avx2(v_strength, intp_avx2(fb, b1, out_b), v_b);
+
+        // transpose to RGBX
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 rg_lo = _mm256_unpacklo_ps(out_r, out_g);
+        const __m256 rg_hi = _mm256_unpackhi_ps(out_r, out_g);
+        const __m256 bx_lo = _mm256_unpacklo_ps(out_b, zero);
+        const __m256 bx_hi = _mm256_unpackhi_ps(out_b, zero);
+        const __m256 p04 = _mm256_shuffle_ps(rg_lo, bx_lo, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 p15 = _mm256_shuffle_ps(rg_lo, bx_lo, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 p26 = _mm256_shuffle_ps(rg_hi, bx_hi, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 p37 = _mm256_shuffle_ps(rg_hi, bx_hi, _MM_SHUFFLE(3, 2, 3, 2));
+        float *out = out_rgbx + column * 4;
+        _mm256_storeu_ps(out, _mm256_permute2f128_ps(p04, p15, 0x20));
+        _mm256_storeu_ps(out + 8, _mm256_permute2f128_ps(p26, p37, 0x20));
+        _mm256_storeu_ps(out + 16, _mm256_permute2f128_ps(p04, p15, 0x31));
+        _mm256_storeu_ps(out + 24, _mm256_permute2f128_ps(p26, p37, 0x31));
+    }
+
+    return column;
+}
+
+#undef ART_AVX2
+
+#else // ART_CLUT_AVX2
+
+std::size_t rtengine::HaldCLUT::getRGB_avx2(
+    float strength,
+    std::size_t line_size,
+    const float* r,
+    const float* g,
+    const float* b,
+    float* out_rgbx
+) const
+{
+    return 0;
+}
+
+#endif // ART_CLUT_AVX2
+
+
+void rtengine::HaldCLUT::getRGB(
+    float strength,
+    std::size_t line_size,
+    const float* r,
+    const float* g,
+    const float* b,
+    float* out_rgbx,
+    Kernel kernel
+) const
 {
     const unsigned int level = clut_level; // This is important
 
@@ -192,7 +555,16 @@ void rtengine::HaldCLUT::getRGB(
     const vfloat v_strength = F2V(strength);
 #endif
 
-    for (std::size_t column = 0; column < line_size; ++column, ++r, ++g, ++b, out_rgbx += 4) {
+    std::size_t start = 0;
+    if (kernel == Kernel::AVX2) {
+        start = getRGB_avx2(strength, line_size, r, g, b, out_rgbx);
+        r += start;
+        g += start;
+        b += start;
+        out_rgbx += start * 4;
+    }
+
+    for (std::size_t column = start; column < line_size; ++column, ++r, ++g, ++b, out_rgbx += 4) {
         const unsigned int red = std::min(flevel_minus_two, *r * flevel_minus_one);
         const unsigned int green = std::min(flevel_minus_two, *g * flevel_minus_one);
         const unsigned int blue = std::min(flevel_minus_two, *b * flevel_minus_one);
@@ -207,16 +579,16 @@ void rtengine::HaldCLUT::getRGB(
         size_t index = color * 4;
 
         float tmp1[4] ALIGNED16;
-        tmp1[0] = intp<float>(re, clut_image.data[index + 4], clut_image.data[index]);
-        tmp1[1] = intp<float>(re, clut_image.data[index + 5], clut_image.data[index + 1]);
-        tmp1[2] = intp<float>(re, clut_image.data[index + 6], clut_image.data[index + 2]);
+        tmp1[0] = intp<float>(re, clut_data[index + 4], clut_data[index]);
+        tmp1[1] = intp<float>(re, clut_data[index + 5], clut_data[index + 1]);
+        tmp1[2] = intp<float>(re, clut_data[index + 6], clut_data[index + 2]);
 
         index = (color + level) * 4;
 
         float tmp2[4] ALIGNED16;
-        tmp2[0] = intp<float>(re, clut_image.data[index + 4], clut_image.data[index]);
-        tmp2[1] = intp<float>(re, clut_image.data[index + 5], clut_image.data[index + 1]);
-        tmp2[2] = intp<float>(re, clut_image.data[index + 6], clut_image.data[index + 2]);
+        tmp2[0] = intp<float>(re, clut_data[index + 4], clut_data[index]);
+        tmp2[1] = intp<float>(re, clut_data[index + 5], clut_data[index + 1]);
+        tmp2[2] = intp<float>(re, clut_data[index + 6], clut_data[index + 2]);
 
         out_rgbx[0] = intp<float>(gr, tmp2[0], tmp1[0]);
         out_rgbx[1] = intp<float>(gr, tmp2[1], tmp1[1]);
@@ -224,15 +596,15 @@ void rtengine::HaldCLUT::getRGB(
 
         index = (color + level_square) * 4;
 
-        tmp1[0] = intp<float>(re, clut_image.data[index + 4], clut_image.data[index]);
-        tmp1[1] = intp<float>(re, clut_image.data[index + 5], clut_image.data[index + 1]);
-        tmp1[2] = intp<float>(re, clut_image.data[index + 6], clut_image.data[index + 2]);
+        tmp1[0] = intp<float>(re, clut_data[index + 4], clut_data[index]);
+        tmp1[1] = intp<float>(re, clut_data[index + 5], clut_data[index + 1]);
+        tmp1[2] = intp<float>(re, clut_data[index + 6], clut_data[index + 2]);
 
         index = (color + level + level_square) * 4;
 
-        tmp2[0] = intp<float>(re, clut_image.data[index + 4], clut_image.data[index]);
-        tmp2[1] = intp<float>(re, clut_image.data[index + 5], clut_image.data[index + 1]);
-        tmp2[2] = intp<float>(re, clut_image.data[index + 6], clut_image.data[index + 2]);
+        tmp2[0] = intp<float>(re, clut_data[index + 4], clut_data[index]);
+        tmp2[1] = intp<float>(re, clut_data[index + 5], clut_data[index + 1]);
+        tmp2[2] = intp<float>(re, clut_data[index + 6], clut_data[index + 2]);
 
         tmp1[0] = intp<float>(gr, tmp2[0], tmp1[0]);
         tmp1[1] = intp<float>(gr, tmp2[1], tmp1[1]);
@@ -254,12 +626,12 @@ void rtengine::HaldCLUT::getRGB(
 
         const vfloat v_r = PERMUTEPS(v_rgb, _MM_SHUFFLE(0, 0, 0, 0));
 
-        vfloat2 v_clut_values = getClutValues(clut_image, index);
+        vfloat2 v_clut_values = getClutValues(clut_data, index);
         vfloat v_tmp1 = vintpf(v_r, v_clut_values.y, v_clut_values.x);
 
         index = (color + level) * 4;
 
-        v_clut_values = getClutValues(clut_image, index);
+        v_clut_values = getClutValues(clut_data, index);
         vfloat v_tmp2 = vintpf(v_r, v_clut_values.y, v_clut_values.x);
 
         const vfloat v_g = PERMUTEPS(v_rgb, _MM_SHUFFLE(1, 1, 1, 1));
@@ -268,12 +640,12 @@ void rtengine::HaldCLUT::getRGB(
 
         index = (color + level_square) * 4;
 
-        v_clut_values = getClutValues(clut_image, index);
+        v_clut_values = getClutValues(clut_data, index);
         v_tmp1 = vintpf(v_r, v_clut_values.y, v_clut_values.x);
 
         index = (color + level + level_square) * 4;
 
-        v_clut_values = getClutValues(clut_image, index);
+        v_clut_values = getClutValues(clut_data, index);
         v_tmp2 = vintpf(v_r, v_clut_values.y, v_clut_values.x);
 
         v_tmp1 = vintpf(v_g, v_tmp2, v_tmp1);
@@ -56,6 +56,15 @@ public:
     Glib::ustring getFilename() const;
     Glib::ustring getProfile() const;
 
+    // interpolation kernels: SCALAR processes one pixel at a time, AVX2
+    // processes 8 pixels at a time using gathers from the lattice
+    enum class Kernel {
+        SCALAR,
+        AVX2
+    };
+    // the fastest kernel supported by the CPU we are running on
+    static Kernel bestKernel();
+
     void getRGB(
         float strength,
         std::size_t line_size,
@@ -65,8 +74,30 @@ public:
         float* out_rgbx
     ) const;
 
+    void getRGB(
+        float strength,
+        std::size_t line_size,
+        const float* r,
+        const float* g,
+        const float* b,
+        float* out_rgbx,
+        Kernel kernel
+    ) const;
+
 private:
+    std::size_t getRGB_avx2(
+        float strength,
+        std::size_t line_size,
+        const float* r,
+        const float* g,
+        const float* b,
+        float* out_rgbx
+    ) const;
+
     AlignedBuffer<std::uint16_t> clut_image;
+    // the lattice, either clut_image.data or the mapped cache file
+    const std::uint16_t *clut_data;
+    GMappedFile *clut_mapping;
     unsigned int clut_level;
     float flevel_minus_one;
     float flevel_minus_two;
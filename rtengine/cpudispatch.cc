@@ -0,0 +1,102 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpudispatch.h"
+#include <iostream>
+#include <stdlib.h>
+
+namespace rtengine { namespace cpu {
+
+namespace {
+
+ISA selected_isa = ISA::SSE2;
+
+} // namespace
+
+
+ISA detect_isa()
+{
+#ifdef ART_CPU_DISPATCH
+    // __builtin_cpu_supports also checks that the OS saves the AVX state
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl")) {
+        return ISA::AVX512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return ISA::AVX2;
+    }
+#endif
+    return ISA::SSE2;
+}
+
+
+ISA get_isa()
+{
+    return selected_isa;
+}
+
+
+void init(const std::string &preference)
+{
+    const ISA best = detect_isa();
+    selected_isa = best;
+
+    std::string pref = preference;
+    const char *env = getenv("ART_CPU_ISA");
+    if (env && *env) {
+        pref = env;
+    }
+
+    ISA isa;
+    if (pref.empty() || pref == "auto") {
+        return;
+    } else if (!parse_isa(pref, isa)) {
+        std::cerr << "Warning: unknown instruction set \"" << pref << "\", using " << isa_name(best) << std::endl;
+    } else if (int(isa) > int(best)) {
+        std::cerr << "Warning: instruction set " << isa_name(isa) << " not supported, using " << isa_name(best) << std::endl;
+    } else {
+        selected_isa = isa;
+    }
+}
+
+
+const char *isa_name(ISA isa)
+{
+    switch (isa) {
+    case ISA::AVX512:
+        return "avx512";
+    case ISA::AVX2:
+        return "avx2";
+    default:
+        return "sse2";
+    }
+}
+
+
+bool parse_isa(const std::string &name, ISA &out)
+{
+    for (auto isa : { ISA::SSE2, ISA::AVX2, ISA::AVX512 }) {
+        if (name == isa_name(isa)) {
+            out = isa;
+            return true;
+        }
+    }
+    return false;
+}
+
+}} // namespace rtengine::cpu
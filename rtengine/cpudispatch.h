@@ -0,0 +1,69 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+// kernels can be compiled for several ISA levels only with GCC-compatible
+// compilers on x86, elsewhere the baseline version is the only one
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#  define ART_CPU_DISPATCH
+#endif
+
+namespace rtengine {
+
+/**
+ * Runtime selection of the instruction set used by the kernels compiled for
+ * more than one ISA level (see cpudispatch_targets.h). The selection is made
+ * once by init(), before any processing starts.
+ */
+namespace cpu {
+
+enum class ISA {
+    SSE2,   // baseline, i.e. whatever the build flags enable
+    AVX2,   // AVX2 + FMA
+    AVX512  // AVX-512 F/BW/DQ/VL
+};
+
+// the best ISA supported by both the build and the CPU we are running on
+ISA detect_isa();
+
+// the ISA in use
+ISA get_isa();
+
+// selects the ISA to use. preference is either "auto" or the name of an
+// ISA; the ART_CPU_ISA environment variable, if set, takes precedence. An
+// ISA not supported by the CPU is never selected
+void init(const std::string &preference);
+
+const char *isa_name(ISA isa);
+bool parse_isa(const std::string &name, ISA &out);
+
+} // namespace cpu
+
+} // namespace rtengine
+
+#ifdef ART_CPU_DISPATCH
+#  define ART_DISPATCH(fn)                                              \
+    (rtengine::cpu::get_isa() == rtengine::cpu::ISA::AVX512 ? isa_avx512::fn : \
+     rtengine::cpu::get_isa() == rtengine::cpu::ISA::AVX2 ? isa_avx2::fn :    \
+     isa_sse2::fn)
+#else
+#  define ART_DISPATCH(fn) isa_sse2::fn
+#endif
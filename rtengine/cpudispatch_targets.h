@@ -0,0 +1,81 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Compiles the source file named by ART_DISPATCH_FILE once for each ISA
+// level known to rtengine::cpu. Usage (in foo.cc):
+//
+//   #include ... // all the headers needed
+//   #define ART_DISPATCH_FILE "foo.cc"
+//   #include "cpudispatch_targets.h"
+//
+//   namespace { namespace ART_ISA_NAMESPACE {
+//   ... kernels ...
+//   }}
+//
+//   #ifdef ART_DISPATCH_ONCE
+//   void foo() { ART_DISPATCH(foo_impl)(); }
+//   #endif
+//
+// The code before the inclusion of this file is compiled only once, for the
+// baseline ISA. All the headers must be included there: this way no inline
+// function or template instantiation requiring a newer ISA can be shared
+// with (and then picked by the linker for) the rest of the program.
+//
+// No include guard, this file is included once per pass.
+
+#ifndef ART_ISA_NAMESPACE
+
+#ifdef ART_CPU_DISPATCH
+
+#  define ART_ISA_NAMESPACE isa_avx512
+#  ifdef __clang__
+#    pragma clang attribute push (__attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,avx2,fma"))), apply_to = function)
+#  else
+#    pragma GCC push_options
+#    pragma GCC target("avx512f,avx512bw,avx512dq,avx512vl,avx2,fma")
+#  endif
+#  include ART_DISPATCH_FILE
+#  ifdef __clang__
+#    pragma clang attribute pop
+#  else
+#    pragma GCC pop_options
+#  endif
+#  undef ART_ISA_NAMESPACE
+
+#  define ART_ISA_NAMESPACE isa_avx2
+#  ifdef __clang__
+#    pragma clang attribute push (__attribute__((target("avx2,fma"))), apply_to = function)
+#  else
+#    pragma GCC push_options
+#    pragma GCC target("avx2,fma")
+#  endif
+#  include ART_DISPATCH_FILE
+#  ifdef __clang__
+#    pragma clang attribute pop
+#  else
+#    pragma GCC pop_options
+#  endif
+#  undef ART_ISA_NAMESPACE
+
+#endif // ART_CPU_DISPATCH
+
+// the baseline pass is the including file itself
+#define ART_ISA_NAMESPACE isa_sse2
+#define ART_DISPATCH_ONCE
+
+#endif // ART_ISA_NAMESPACE
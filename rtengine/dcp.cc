@@ -23,6 +23,7 @@
 #include <functional>
 
 #include "dcp.h"
+#include "dcplut.h"
 
 #include "cJSON.h"
 #include "iccmatrices.h"
@@ -782,6 +783,7 @@ struct DCPProfile::ApplyState::Data {
     bool use_tone_curve;
     bool apply_look_table;
     float bl_scale;
+    std::shared_ptr<const DCPStep2LUT> lut; // nullptr for the exact computation
 };
 
 DCPProfile::ApplyState::ApplyState() :
@@ -1513,17 +1515,110 @@ void DCPProfile::setStep2ApplyState(const Glib::ustring& working_space, bool use
                     as_out.data->work[i][j] += mWork[i][k] * xyz_prophoto[k][j];
                 }
     }
+
+    as_out.data->lut = nullptr;
 }
 
-void DCPProfile::step2ApplyTile(float* rc, float* gc, float* bc, int width, int height, int tile_width, const ApplyState& as_in) const
+void DCPProfile::setStep2LUT(const Glib::ustring& working_space, int dim, ApplyState& as)
+{
+    as.data->lut = nullptr;
+    if ((as.data->use_tone_curve || as.data->apply_look_table) && dim > 1) {
+        as.data->lut = getStep2LUT(working_space, *as.data, dim);
+    }
+}
+
+
+std::shared_ptr<const DCPStep2LUT> DCPProfile::getStep2LUT(const Glib::ustring& working_space, const ApplyState::Data& data, int dim)
+{
+    MyMutex::MyLock lock(step2_lut_mutex);
+
+    auto& lut = step2_luts[std::make_tuple(working_space, data.use_tone_curve, data.apply_look_table, data.bl_scale, dim)];
+    if (!lut) {
+        // the Data is copied without its lut, so that the nodes are computed
+        // with the exact transform
+        ApplyState::Data exact = data;
+        exact.lut = nullptr;
+        lut = std::make_shared<const DCPStep2LUT>(dim, [this, &exact](float* r, float* g, float* b, int n) { step2Apply(r, g, b, n, exact); });
+    }
+    return lut;
+}
+
+void DCPProfile::step2Apply(float* r, float* g, float* b, int n, const ApplyState::Data& data) const
 {
 
 #define FCLIP(a) ((a)>0.0?((a)<65535.5?(a):65535.5):0.0)
 #define CLIP01(a) ((a)>0?((a)<1?(a):1):0)
 
-    float exp_scale = as_in.data->bl_scale;
+    const float exp_scale = data.bl_scale;
+
+    for (int x = 0; x < n; x++) {
+        float newr = r[x] * exp_scale;
+        float newg = g[x] * exp_scale;
+        float newb = b[x] * exp_scale;
+
+        if (!data.already_pro_photo) {
+            const float rr = newr, gg = newg, bb = newb;
+            newr = data.pro_photo[0][0] * rr + data.pro_photo[0][1] * gg + data.pro_photo[0][2] * bb;
+            newg = data.pro_photo[1][0] * rr + data.pro_photo[1][1] * gg + data.pro_photo[1][2] * bb;
+            newb = data.pro_photo[2][0] * rr + data.pro_photo[2][1] * gg + data.pro_photo[2][2] * bb;
+        }
+
+        // with looktable and tonecurve we need to clip
+        newr = max(newr, 0.f);
+        newg = max(newg, 0.f);
+        newb = max(newb, 0.f);
+
+        if (data.apply_look_table) {
+            float cnewr = FCLIP(newr);
+            float cnewg = FCLIP(newg);
+            float cnewb = FCLIP(newb);
+
+            float h, s, v;
+            Color::rgb2hsvdcp(cnewr, cnewg, cnewb, h, s, v);
+
+            hsdApply(look_info, look_table, h, s, v);
+            s = CLIP01(s);
+            v = CLIP01(v);
+
+            // RT range correction
+            if (h < 0.0f) {
+                h += 6.0f;
+            } else if (h >= 6.0f) {
+                h -= 6.0f;
+            }
+
+            Color::hsv2rgbdcp( h, s, v, cnewr, cnewg, cnewb);
+
+            newr = cnewr;
+            newg = cnewg;
+            newb = cnewb;
+        }
+
+        if (data.use_tone_curve) {
+            tone_curve.Apply(newr, newg, newb);
+        }
+
+        if (data.already_pro_photo) {
+            r[x] = newr;
+            g[x] = newg;
+            b[x] = newb;
+        } else {
+            r[x] = data.work[0][0] * newr + data.work[0][1] * newg + data.work[0][2] * newb;
+            g[x] = data.work[1][0] * newr + data.work[1][1] * newg + data.work[1][2] * newb;
+            b[x] = data.work[2][0] * newr + data.work[2][1] * newg + data.work[2][2] * newb;
+        }
+    }
 
-    if (!as_in.data->use_tone_curve && !as_in.data->apply_look_table) {
+#undef FCLIP
+#undef CLIP01
+}
+
+void DCPProfile::step2ApplyTile(float* rc, float* gc, float* bc, int width, int height, int tile_width, const ApplyState& as_in) const
+{
+    const ApplyState::Data& data = *as_in.data;
+    float exp_scale = data.bl_scale;
+
+    if (!data.use_tone_curve && !data.apply_look_table) {
         if (exp_scale == 1.f) {
             return;
         }
@@ -1535,80 +1630,31 @@ void DCPProfile::step2ApplyTile(float* rc, float* gc, float* bc, int width, int
                 bc[y * tile_width + x] *= exp_scale;
             }
         }
-    } else {
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                float r = rc[y * tile_width + x];
-                float g = gc[y * tile_width + x];
-                float b = bc[y * tile_width + x];
-
-                r *= exp_scale;
-                g *= exp_scale;
-                b *= exp_scale;
-
-                float newr, newg, newb;
-
-                if (as_in.data->already_pro_photo) {
-                    newr = r;
-                    newg = g;
-                    newb = b;
-                } else {
-                    newr = as_in.data->pro_photo[0][0] * r + as_in.data->pro_photo[0][1] * g + as_in.data->pro_photo[0][2] * b;
-                    newg = as_in.data->pro_photo[1][0] * r + as_in.data->pro_photo[1][1] * g + as_in.data->pro_photo[1][2] * b;
-                    newb = as_in.data->pro_photo[2][0] * r + as_in.data->pro_photo[2][1] * g + as_in.data->pro_photo[2][2] * b;
-                }
-
-                // with looktable and tonecurve we need to clip
-                if (as_in.data->apply_look_table || as_in.data->use_tone_curve) {
-                    newr = max(newr, 0.f);
-                    newg = max(newg, 0.f);
-                    newb = max(newb, 0.f);
-                }
-                // newr = FCLIP(newr);
-                // newg = FCLIP(newg);
-                // newb = FCLIP(newb);
-
-                if (as_in.data->apply_look_table) {
-                    float cnewr = FCLIP(newr);
-                    float cnewg = FCLIP(newg);
-                    float cnewb = FCLIP(newb);
+    } else if (data.lut) {
+        // the pixels outside the domain of the LUT get the exact computation
+        constexpr int BLOCK = 1024;
+        uint8_t outside[BLOCK];
 
-                    float h, s, v;
-                    Color::rgb2hsvdcp(cnewr, cnewg, cnewb, h, s, v);
-
-                    hsdApply(look_info, look_table, h, s, v);
-                    s = CLIP01(s);
-                    v = CLIP01(v);
-
-                    // RT range correction
-                    if (h < 0.0f) {
-                        h += 6.0f;
-                    } else if (h >= 6.0f) {
-                        h -= 6.0f;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x += BLOCK) {
+                const int n = min(BLOCK, width - x);
+                float* r = rc + y * tile_width + x;
+                float* g = gc + y * tile_width + x;
+                float* b = bc + y * tile_width + x;
+
+                if ((*data.lut)(r, g, b, n, outside)) {
+                    for (int i = 0; i < n; i++) {
+                        if (outside[i]) {
+                            step2Apply(r + i, g + i, b + i, 1, data);
+                        }
                     }
-
-                    Color::hsv2rgbdcp( h, s, v, cnewr, cnewg, cnewb);
-
-                    newr = cnewr;
-                    newg = cnewg;
-                    newb = cnewb;
-                }
-
-                if (as_in.data->use_tone_curve) {
-                    tone_curve.Apply(newr, newg, newb);
-                }
-
-                if (as_in.data->already_pro_photo) {
-                    rc[y * tile_width + x] = newr;
-                    gc[y * tile_width + x] = newg;
-                    bc[y * tile_width + x] = newb;
-                } else {
-                    rc[y * tile_width + x] = as_in.data->work[0][0] * newr + as_in.data->work[0][1] * newg + as_in.data->work[0][2] * newb;
-                    gc[y * tile_width + x] = as_in.data->work[1][0] * newr + as_in.data->work[1][1] * newg + as_in.data->work[1][2] * newb;
-                    bc[y * tile_width + x] = as_in.data->work[2][0] * newr + as_in.data->work[2][1] * newg + as_in.data->work[2][2] * newb;
                 }
             }
         }
+    } else {
+        for (int y = 0; y < height; y++) {
+            step2Apply(rc + y * tile_width, gc + y * tile_width, bc + y * tile_width, width, data);
+        }
     }
 }
 
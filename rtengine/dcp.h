@@ -23,6 +23,7 @@
 #include <vector>
 #include <array>
 #include <memory>
+#include <tuple>
 
 #include <glibmm.h>
 
@@ -36,6 +37,8 @@
 namespace rtengine
 {
 
+class DCPStep2LUT;
+
 class DCPProfile final
 {
 public:
@@ -89,6 +92,10 @@ public:
         bool multithread
     ) const;
     void setStep2ApplyState(const Glib::ustring& working_space, bool use_tone_curve, bool apply_look_table, bool apply_baseline_exposure, ApplyState& as_out);
+    // approximates step 2 of a state set by setStep2ApplyState with a 3D LUT
+    // of dimension dim (exact computation if dim <= 1). Only for the
+    // pipelines that favour speed over accuracy (editor preview, thumbnails)
+    void setStep2LUT(const Glib::ustring& working_space, int dim, ApplyState& as);
     void step2ApplyTile(float* r, float* g, float* b, int width, int height, int tile_width, const ApplyState& as_in) const;
 
 private:
@@ -123,6 +130,8 @@ private:
     Matrix makeXyzCam(const ColorTemp& white_balance, const Triple& pre_mul, const Matrix& cam_wb_matrix, int preferred_illuminant, bool use_fwd_matrix) const;
     std::vector<HsbModify> makeHueSatMap(const ColorTemp& white_balance, int preferred_illuminant) const;
     void hsdApply(const HsdTableInfo& table_info, const std::vector<HsbModify>& table_base, float& h, float& s, float& v) const;
+    void step2Apply(float* r, float* g, float* b, int n, const ApplyState::Data& data) const;
+    std::shared_ptr<const DCPStep2LUT> getStep2LUT(const Glib::ustring& working_space, const ApplyState::Data& data, int dim);
 
     Matrix color_matrix_1;
     Matrix color_matrix_2;
@@ -148,6 +157,11 @@ private:
     short light_source_2;
 
     AdobeToneCurve tone_curve;
+
+    // baked step 2 transforms, by working space, tone curve and look table
+    // flags, exposure scale and LUT dimension
+    MyMutex step2_lut_mutex;
+    std::map<std::tuple<Glib::ustring, bool, bool, float, int>, std::shared_ptr<const DCPStep2LUT>> step2_luts;
 };
 
 class DCPStore final :
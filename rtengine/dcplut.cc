@@ -0,0 +1,183 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "dcplut.h"
+#include "settings.h"
+#include "cpudispatch.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// compile the kernels once for each ISA level, see cpudispatch_targets.h
+#define ART_DISPATCH_FILE "dcplut.cc"
+#include "cpudispatch_targets.h"
+
+namespace { namespace ART_ISA_NAMESPACE {
+
+using rtengine::DCPStep2LUT;
+
+// pixels processed at a time, in buffers on the stack
+constexpr int BLOCK = 256;
+
+
+int apply(const DCPStep2LUT::Data &d, float *r, float *g, float *b, int n, uint8_t *outside)
+{
+    alignas(64) int v0[BLOCK];
+    alignas(64) int v1[BLOCK];
+    alignas(64) int v2[BLOCK];
+    alignas(64) float w0[BLOCK];
+    alignas(64) float w1[BLOCK];
+    alignas(64) float w2[BLOCK];
+    alignas(64) float w3[BLOCK];
+
+    const float *lut = d.lut.data();
+    const int maxi = d.dim - 2;
+    const float scale = d.dim - 1;
+    constexpr float norm = 1.f / DCPStep2LUT::MAXVAL;
+    const int sr = 3 * d.dim * d.dim;
+    const int sg = 3 * d.dim;
+    constexpr int sb = 3;
+    const int s111 = sr + sg + sb;
+    int count = 0;
+
+    for (int start = 0; start < n; start += BLOCK) {
+        const int cnt = std::min(BLOCK, n - start);
+        float *rr = r + start;
+        float *gg = g + start;
+        float *bb = b + start;
+        uint8_t *out = outside + start;
+
+        // grid coordinates and weights of the enclosing tetrahedron. All
+        // branch-free, so that the compiler can vectorize it
+        for (int i = 0; i < cnt; ++i) {
+            const float x = rr[i], y = gg[i], z = bb[i];
+            const int o = !((x >= 0.f) & (x <= DCPStep2LUT::MAXVAL) & (y >= 0.f) & (y <= DCPStep2LUT::MAXVAL) & (z >= 0.f) & (z <= DCPStep2LUT::MAXVAL));
+            out[i] = o;
+            count += o;
+
+            // the clamping (which also maps NaNs to 0) keeps the indices of
+            // the flagged pixels valid
+            const float xr = std::sqrt(std::min(std::max(0.f, x * norm), 1.f)) * scale;
+            const float xg = std::sqrt(std::min(std::max(0.f, y * norm), 1.f)) * scale;
+            const float xb = std::sqrt(std::min(std::max(0.f, z * norm), 1.f)) * scale;
+            const int ir = std::min(int(xr), maxi);
+            const int ig = std::min(int(xg), maxi);
+            const int ib = std::min(int(xb), maxi);
+            const float fr = xr - ir, fg = xg - ig, fb = xb - ib;
+
+            // the tetrahedron is found by sorting the fractional parts: the
+            // path from the low to the high corner steps first along the
+            // axis with the largest one
+            const int crg = fr > fg, cgb = fg > fb, crb = fr > fb;
+            const int max_r = crg & crb;
+            const int max_g = (1 - crg) & cgb;
+            const int min_b = crb & cgb;
+            const int min_r = (1 - crg) & (1 - crb);
+            const int smax = max_r * sr + max_g * sg + (1 - max_r - max_g) * sb;
+            const int smin = min_r * sr + min_b * sb + (1 - min_r - min_b) * sg;
+            const int smid = s111 - smax - smin;
+            const float fmax = std::max(fr, std::max(fg, fb));
+            const float fmin = std::min(fr, std::min(fg, fb));
+            const float fmid = fr + fg + fb - fmax - fmin;
+
+            v0[i] = ir * sr + ig * sg + ib * sb;
+            v1[i] = smax;
+            v2[i] = smax + smid;
+            w0[i] = 1.f - fmax;
+            w1[i] = fmax - fmid;
+            w2[i] = fmid - fmin;
+            w3[i] = fmin;
+        }
+
+        for (int i = 0; i < cnt; ++i) {
+            const float *p0 = lut + v0[i];
+            const float *p1 = p0 + v1[i];
+            const float *p2 = p0 + v2[i];
+            const float *p3 = p0 + s111;
+            const float nr = w0[i] * p0[0] + w1[i] * p1[0] + w2[i] * p2[0] + w3[i] * p3[0];
+            const float ng = w0[i] * p0[1] + w1[i] * p1[1] + w2[i] * p2[1] + w3[i] * p3[1];
+            const float nb = w0[i] * p0[2] + w1[i] * p1[2] + w2[i] * p2[2] + w3[i] * p3[2];
+            rr[i] = out[i] ? rr[i] : nr;
+            gg[i] = out[i] ? gg[i] : ng;
+            bb[i] = out[i] ? bb[i] : nb;
+        }
+    }
+
+    return count;
+}
+
+}} // namespace ART_ISA_NAMESPACE
+
+#ifdef ART_DISPATCH_ONCE
+
+namespace rtengine {
+
+extern const Settings *settings;
+
+DCPStep2LUT::DCPStep2LUT(int dim, const Func &f)
+{
+    data_.dim = std::max(dim, 2);
+    const int d = data_.dim;
+    data_.lut.resize(size_t(3) * d * d * d);
+
+    std::vector<float> grid(d);
+    for (int i = 0; i < d; ++i) {
+        const float u = float(i) / float(d - 1);
+        grid[i] = u * u * MAXVAL;
+    }
+
+    // one slice of constant red at a time
+#ifdef _OPENMP
+#   pragma omp parallel
+#endif
+    {
+        std::vector<float> r(d * d), g(d * d), b(d * d);
+#ifdef _OPENMP
+#       pragma omp for
+#endif
+        for (int i = 0; i < d; ++i) {
+            for (int j = 0; j < d; ++j) {
+                for (int k = 0; k < d; ++k) {
+                    r[j * d + k] = grid[i];
+                    g[j * d + k] = grid[j];
+                    b[j * d + k] = grid[k];
+                }
+            }
+            f(r.data(), g.data(), b.data(), d * d);
+            float *dst = &data_.lut[size_t(3) * i * d * d];
+            for (int j = 0; j < d * d; ++j) {
+                dst[3*j] = r[j];
+                dst[3*j+1] = g[j];
+                dst[3*j+2] = b[j];
+            }
+        }
+    }
+
+    if (settings->verbose > 1) {
+        std::cout << "DCPStep2LUT: computed a LUT of dimension " << d << std::endl;
+    }
+}
+
+
+int DCPStep2LUT::operator()(float *r, float *g, float *b, int n, uint8_t *outside) const
+{
+    return ART_DISPATCH(apply)(data_, r, g, b, n, outside);
+}
+
+} // namespace rtengine
+
+#endif // ART_DISPATCH_ONCE
@@ -0,0 +1,64 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "noncopyable.h"
+
+namespace rtengine {
+
+/**
+ * Step 2 of the application of a DCP profile (baseline exposure, look table
+ * and tone curve, see DCPProfile::step2ApplyTile) baked into a 3D LUT over the
+ * working space RGB values in [0, MAXVAL]. The grid nodes are spaced
+ * uniformly on the square root of the input, so that the shadows (where the
+ * tone curves are steepest) get more of them. The lookup uses tetrahedral
+ * interpolation, with kernels compiled for each supported instruction set
+ * (see cpudispatch.h).
+ */
+class DCPStep2LUT: public NonCopyable {
+public:
+    static constexpr float MAXVAL = 65535.f;
+
+    // f must apply the exact transform in place to n pixels; it is called
+    // concurrently on the slices of the grid
+    using Func = std::function<void(float *r, float *g, float *b, int n)>;
+
+    DCPStep2LUT(int dim, const Func &f);
+
+    // applies the LUT in place to n pixels. The pixels outside the domain
+    // (negative, above MAXVAL or NaN) are left unchanged and flagged in
+    // outside, the return value is their number
+    int operator()(float *r, float *g, float *b, int n, uint8_t *outside) const;
+
+    int dimension() const { return data_.dim; }
+
+    // the state used by the kernels
+    struct Data {
+        int dim;
+        std::vector<float> lut; // interleaved RGB, node (i, j, k) at 3 * ((i * dim + j) * dim + k)
+    };
+
+private:
+    Data data_;
+};
+
+} // namespace rtengine
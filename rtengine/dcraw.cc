@@ -276,19 +276,35 @@ void CLASS merror (void *ptr, const char *where)
 
 void CLASS derror()
 {
-  if (!data_error) {
-    fprintf (stderr, "%s: ", ifname);
-    if (feof(ifp))
-      fprintf (stderr,_("Unexpected end of file\n"));
-    else
+  if (!data_error)
+    derror_message (feof(ifp), ftello(ifp));
+  data_error++;
+/*RT Issue 2467  longjmp (failure, 1);*/
+}
+
+void CLASS derror_message (bool eof, INT64 pos)
+{
+  fprintf (stderr, "%s: ", ifname);
+  if (eof)
+    fprintf (stderr,_("Unexpected end of file\n"));
+  else
 #ifdef WIN32
-      fprintf (stderr,_("Corrupt data near 0x%I64x\n"), (INT64) ftello(ifp));
+    fprintf (stderr,_("Corrupt data near 0x%I64x\n"), pos);
 #else
-      fprintf (stderr,_("Corrupt data near 0x%llx\n"), (INT64) ftello(ifp));
+    fprintf (stderr,_("Corrupt data near 0x%llx\n"), pos);
 #endif
+}
+
+void CLASS derror (ljpeg_errors *err, IMFILE *f)
+{
+  if (!err) {
+    derror();
+    return;
+  }
+  if (!err->count++) {
+    err->eof = feof(f);
+    err->pos = ftello(f);
   }
-  data_error++;
-/*RT Issue 2467  longjmp (failure, 1);*/
 }
 
 ushort CLASS sget2 (uchar *s)
@@ -673,7 +689,7 @@ inline unsigned CLASS nikbithuff_t::operator() (int nbits, ushort *huff)
 	1111110		0x0b
 	1111111		0xff
  */
-ushort * CLASS make_decoder_ref (const uchar **source)
+ushort * CLASS make_decoder_ref (const uchar **source, ljpeg_errors *err)
 {
   int max, len, h, i, j;
   const uchar *count;
@@ -682,6 +698,10 @@ ushort * CLASS make_decoder_ref (const uchar **source)
   count = (*source += 16) - 17;
   for (max=16; max && !count[max]; max--);
   huff = (ushort *) calloc (1 + (1 << max), sizeof *huff);
+  if (!huff && err) {
+    err->nomem = true;
+    return 0;
+  }
   merror (huff, "make_decoder()");
   huff[0] = max;
   for (h=len=1; len <= max; len++)
@@ -846,6 +866,15 @@ struct jhead {
 
 int CLASS ljpeg_start (struct jhead *jh, int info_only)
 {
+  ljpeg_input in = { ifp, zero_after_ff, getbithuff };
+  return ljpeg_start (jh, info_only, in);
+}
+
+int CLASS ljpeg_start (struct jhead *jh, int info_only, ljpeg_input &in)
+{
+  IMFILE *&ifp = in.ifp;
+  unsigned &zero_after_ff = in.zero_after_ff;
+  ljpeg_errors *err = in.getbithuff.errors();
   ushort c, tag, len;
   uchar data[0x10000];
   const uchar *dp;
@@ -873,8 +902,10 @@ int CLASS ljpeg_start (struct jhead *jh, int info_only)
 	break;
       case 0xffc4:
 	if (info_only) break;
-	for (dp = data; dp < data+len && !((c = *dp++) & -20); )
-	  jh->free[c] = jh->huff[c] = make_decoder_ref (&dp);
+	for (dp = data; dp < data+len && !((c = *dp++) & -20); ) {
+	  jh->free[c] = jh->huff[c] = make_decoder_ref (&dp, err);
+	  if (!jh->huff[c]) return 0;
+	}
 	break;
       case 0xffda:
 	jh->psv = data[1+data[0]*2];
@@ -897,6 +928,10 @@ int CLASS ljpeg_start (struct jhead *jh, int info_only)
     FORC(jh->sraw) jh->huff[1+c] = jh->huff[0];
   }
   jh->row = (ushort *) calloc (2 * jh->wide*jh->clrs, 4);
+  if (!jh->row && err) {
+    err->nomem = true;
+    return 0;
+  }
   merror (jh->row, "ljpeg_start()");
   return zero_after_ff = 1;
 }
@@ -910,6 +945,13 @@ void CLASS ljpeg_end (struct jhead *jh)
 
 inline int CLASS ljpeg_diff (ushort *huff)
 {
+  ljpeg_input in = { ifp, zero_after_ff, getbithuff };
+  return ljpeg_diff (huff, in);
+}
+
+inline int CLASS ljpeg_diff (ushort *huff, ljpeg_input &in)
+{
+  getbithuff_t &getbithuff = in.getbithuff;
   int len, diff;
 
   len = gethuff(huff);
@@ -923,6 +965,14 @@ inline int CLASS ljpeg_diff (ushort *huff)
 
 ushort * CLASS ljpeg_row (int jrow, struct jhead *jh)
 {
+  ljpeg_input in = { ifp, zero_after_ff, getbithuff };
+  return ljpeg_row (jrow, jh, in);
+}
+
+ushort * CLASS ljpeg_row (int jrow, struct jhead *jh, ljpeg_input &in)
+{
+  IMFILE *&ifp = in.ifp;
+  getbithuff_t &getbithuff = in.getbithuff;
   int col, c, diff, pred, spred=0;
   ushort mark=0, *row[3];
 
@@ -938,7 +988,7 @@ ushort * CLASS ljpeg_row (int jrow, struct jhead *jh)
   FORC3 row[c] = (jh->row + ((jrow & 1) + 1) * (jh->wide*jh->clrs*((jrow+c) & 1)));
   for (col=0; col < jh->wide; col++)
     FORC(jh->clrs) {
-      diff = ljpeg_diff (jh->huff[c]);
+      diff = ljpeg_diff (jh->huff[c], in);
       if (jh->sraw && c <= jh->sraw && (col | c))
 		    pred = spred;
       else if (col) pred = row[0][-jh->clrs];
@@ -952,7 +1002,7 @@ ushort * CLASS ljpeg_row (int jrow, struct jhead *jh)
 	case 7: pred = (pred + row[1][0]) >> 1;				break;
 	default: pred = 0;
       }
-      if (UNLIKELY((**row = pred + diff) >> jh->bits)) derror();
+      if (UNLIKELY((**row = pred + diff) >> jh->bits)) getbithuff.derror();
       if (c <= jh->sraw) spred = **row;
       row[0]++; row[1]++;
     }
@@ -1104,19 +1154,29 @@ void CLASS adobe_copy_pixel (unsigned row, unsigned col, ushort **rp)
 
 void CLASS ljpeg_idct (struct jhead *jh)
 {
+  ljpeg_input in = { ifp, zero_after_ff, getbithuff };
+  ljpeg_idct (jh, in);
+}
+
+void CLASS ljpeg_idct (struct jhead *jh, ljpeg_input &in)
+{
+  getbithuff_t &getbithuff = in.getbithuff;
   int c, i, j, len, skip, coef;
   float work[3][8][8];
-  static float cs[106] = { 0 };
+  // initialised once in a thread-safe way, tiles can be decoded concurrently
+  static const struct cs_table {
+    float v[106];
+    cs_table() { for (int k=0; k < 106; k++) v[k] = cos((k & 31)*rtengine::RT_PI/16)/2; }
+  } cs_init;
+  const float *cs = cs_init.v;
   static const uchar zigzag[80] =
   {  0, 1, 8,16, 9, 2, 3,10,17,24,32,25,18,11, 4, 5,12,19,26,33,
     40,48,41,34,27,20,13, 6, 7,14,21,28,35,42,49,56,57,50,43,36,
     29,22,15,23,30,37,44,51,58,59,52,45,38,31,39,46,53,60,61,54,
     47,55,62,63,63,63,63,63,63,63,63,63,63,63,63,63,63,63,63,63 };
 
-  if (!cs[0])
-    FORC(106) cs[c] = cos((c & 31)*rtengine::RT_PI/16)/2;
   memset (work, 0, sizeof work);
-  work[0][0][0] = jh->vpred[0] += ljpeg_diff (jh->huff[0]) * jh->quant[0];
+  work[0][0][0] = jh->vpred[0] += ljpeg_diff (jh->huff[0], in) * jh->quant[0];
   for (i=1; i < 64; i++ ) {
     len = gethuff (jh->huff[16]);
     i += skip = len >> 4;
@@ -1193,45 +1253,111 @@ void CLASS lossless_dnglj92_load_raw()
     }
 }
 
+void CLASS lossless_dng_decode_tile (struct jhead *jh, unsigned trow, unsigned tcol, ljpeg_input &in)
+{
+  getbithuff_t &getbithuff = in.getbithuff;
+  unsigned jwide, jrow, jcol, row, col, i, j;
+  ushort *rp;
+
+  jwide = jh->wide;
+  if (filters || (colors == 1 && jh->clrs > 1)) jwide *= jh->clrs;
+  jwide /= MIN (is_raw, tiff_samples);
+  switch (jh->algo) {
+    case 0xc1:
+      jh->vpred[0] = 16384;
+      getbits(-1);
+      for (jrow=0; jrow+7 < jh->high; jrow += 8) {
+	for (jcol=0; jcol+7 < jh->wide; jcol += 8) {
+	  ljpeg_idct (jh, in);
+	  rp = jh->idct;
+	  row = trow + jcol/tile_width + jrow*2;
+	  col = tcol + jcol%tile_width;
+	  for (i=0; i < 16; i+=2)
+	    for (j=0; j < 8; j++)
+	      adobe_copy_pixel (row+i, col+j, &rp);
+	}
+      }
+      break;
+    case 0xc3:
+      for (row=col=jrow=0; jrow < jh->high; jrow++) {
+	rp = ljpeg_row (jrow, jh, in);
+	for (jcol=0; jcol < jwide; jcol++) {
+	  adobe_copy_pixel (trow+row, tcol+col, &rp);
+	  if (++col >= tile_width || col >= raw_width)
+	    row += 1 + (col = 0);
+	}
+      }
+  }
+}
+
+#ifdef _OPENMP
+// tiled DNG: reads the offsets of all the tiles, and then decodes them in
+// parallel, each thread with a private cursor over the in-memory file. The
+// errors are recorded per tile and reported after the loop, in file order.
+// Returns false if out of memory
+bool CLASS lossless_dng_load_tiles()
+{
+  unsigned trow=0, tcol=0;
+  std::vector<unsigned> offsets, trows, tcols;
+  while (trow < raw_height) {
+    offsets.push_back(get4());
+    trows.push_back(trow);
+    tcols.push_back(tcol);
+    if ((tcol += tile_width) >= raw_width)
+      trow += tile_length + (tcol = 0);
+  }
+  const int ntiles = offsets.size();
+  const IMFILE *src = ifp;
+  std::vector<ljpeg_errors> errors(ntiles);
+
+#pragma omp parallel for schedule(dynamic)
+  for (int t = 0; t < ntiles; t++) {
+    IMFILE file = *src;
+    IMFILE *fp = &file;
+    file.plistener = nullptr;
+    unsigned zaff = 0;
+    getbithuff_t bits(this, fp, zaff, &errors[t]);
+    ljpeg_input in = { fp, zaff, bits };
+    struct jhead tjh;
+
+    fseek (fp, offsets[t], SEEK_SET);
+    if (ljpeg_start (&tjh, 0, in))
+      lossless_dng_decode_tile (&tjh, trows[t], tcols[t], in);
+    ljpeg_end (&tjh);
+  }
+
+  bool ok = true;
+  for (const auto &err : errors) {
+    ok = ok && !err.nomem;
+    if (err.count) {
+      if (!data_error)
+	derror_message (err.eof, err.pos);
+      data_error += err.count;
+    }
+  }
+  return ok;
+}
+#endif
+
 void CLASS lossless_dng_load_raw()
 {
-  unsigned save, trow=0, tcol=0, jwide, jrow, jcol, row, col, i, j;
+  unsigned save, trow=0, tcol=0;
   struct jhead jh;
-  ushort *rp;
 
+#ifdef _OPENMP
+  if (tile_length < INT_MAX) {
+    if (!lossless_dng_load_tiles()) merror (0, "lossless_dng_load_raw()");
+    return;
+  }
+#endif
+
+  ljpeg_input in = { ifp, zero_after_ff, getbithuff };
   while (trow < raw_height) {
     save = ftell(ifp);
     if (tile_length < INT_MAX)
       fseek (ifp, get4(), SEEK_SET);
     if (!ljpeg_start (&jh, 0)) break;
-    jwide = jh.wide;
-    if (filters || (colors == 1 && jh.clrs > 1)) jwide *= jh.clrs;
-    jwide /= MIN (is_raw, tiff_samples);
-    switch (jh.algo) {
-      case 0xc1:
-	jh.vpred[0] = 16384;
-	getbits(-1);
-	for (jrow=0; jrow+7 < jh.high; jrow += 8) {
-	  for (jcol=0; jcol+7 < jh.wide; jcol += 8) {
-	    ljpeg_idct (&jh);
-	    rp = jh.idct;
-	    row = trow + jcol/tile_width + jrow*2;
-	    col = tcol + jcol%tile_width;
-	    for (i=0; i < 16; i+=2)
-	      for (j=0; j < 8; j++)
-		adobe_copy_pixel (row+i, col+j, &rp);
-	  }
-	}
-	break;
-      case 0xc3:
-	for (row=col=jrow=0; jrow < jh.high; jrow++) {
-	  rp = ljpeg_row (jrow, &jh);
-	  for (jcol=0; jcol < jwide; jcol++) {
-	    adobe_copy_pixel (trow+row, tcol+col, &rp);
-	    if (++col >= tile_width || col >= raw_width)
-	      row += 1 + (col = 0);
-	  }
-	}    }
+    lossless_dng_decode_tile (&jh, trow, tcol, in);
     fseek (ifp, save+4, SEEK_SET);
     if ((tcol += tile_width) >= raw_width)
       trow += tile_length + (tcol = 0);
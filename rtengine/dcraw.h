@@ -291,6 +291,7 @@ protected:
 int fcol (int row, int col);
 void merror (void *ptr, const char *where);
 void derror();
+void derror_message (bool eof, INT64 pos);
 inline void derror(bool condition) {if(UNLIKELY(condition)) ++data_error;}
 ushort sget2 (uchar *s);
 ushort get2();
@@ -311,22 +312,34 @@ int canon_s2is();
 void redcine_load_raw();
 void parse_redcine();
 
+// the errors of a decoder running concurrently with others (e.g. on the
+// tiles of a DNG), which are reported by the caller once they all finished
+struct ljpeg_errors {
+    unsigned count = 0; // data errors
+    bool eof = false;   // at the first data error
+    INT64 pos = 0;      // idem
+    bool nomem = false;
+};
+void derror (ljpeg_errors *err, IMFILE *f);
+
 // getbithuff(int nbits, ushort *huff);
 class getbithuff_t
 {
 public:
-   getbithuff_t(DCraw *p,IMFILE *&i, unsigned &z):parent(p),bitbuf(0),vbits(0),reset(0),ifp(i),zero_after_ff(z){}
+   getbithuff_t(DCraw *p,IMFILE *&i, unsigned &z, ljpeg_errors *e=nullptr):parent(p),bitbuf(0),vbits(0),reset(0),ifp(i),zero_after_ff(z),errors_(e){}
    unsigned operator()(int nbits, ushort *huff);
-
-private:
    void derror(){
-	   parent->derror();
+	   parent->derror(errors_, ifp);
    }
+   ljpeg_errors *errors() const { return errors_; }
+
+private:
    DCraw *parent;
    unsigned bitbuf;
    int vbits, reset;
    IMFILE *&ifp;
    unsigned &zero_after_ff;
+   ljpeg_errors *errors_;
 };
 getbithuff_t getbithuff;
 
@@ -350,22 +363,37 @@ private:
 };
 nikbithuff_t nikbithuff;
 
-ushort * make_decoder_ref (const uchar **source);
+// the input state used by the LJPEG decoder. The overloads taking an
+// ljpeg_input allow to decode several tiles concurrently, each with its own
+// file cursor and bit reader
+struct ljpeg_input {
+    IMFILE *&ifp;
+    unsigned &zero_after_ff;
+    getbithuff_t &getbithuff;
+};
+
+ushort * make_decoder_ref (const uchar **source, ljpeg_errors *err=nullptr);
 ushort * make_decoder (const uchar *source);
 void crw_init_tables (unsigned table, ushort *huff[2]);
 int canon_has_lowbits();
 void canon_load_raw();
 int ljpeg_start (struct jhead *jh, int info_only);
+int ljpeg_start (struct jhead *jh, int info_only, ljpeg_input &in);
 void ljpeg_end (struct jhead *jh);
 int ljpeg_diff (ushort *huff);
+int ljpeg_diff (ushort *huff, ljpeg_input &in);
 ushort * ljpeg_row (int jrow, struct jhead *jh);
+ushort * ljpeg_row (int jrow, struct jhead *jh, ljpeg_input &in);
 void lossless_jpeg_load_raw();
 void ljpeg_idct (struct jhead *jh);
+void ljpeg_idct (struct jhead *jh, ljpeg_input &in);
 
 
 void canon_sraw_load_raw();
 void adobe_copy_pixel (unsigned row, unsigned col, ushort **rp);
 void lossless_dng_load_raw();
+bool lossless_dng_load_tiles();
+void lossless_dng_decode_tile (struct jhead *jh, unsigned trow, unsigned tcol, ljpeg_input &in);
 void lossless_dnglj92_load_raw();
 void packed_dng_load_raw();
 void deflate_dng_load_raw();
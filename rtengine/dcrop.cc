@@ -32,6 +32,40 @@ constexpr T skips(T a, T b)
     return a / b + static_cast<bool>(a % b);
 }
 
+
+// bilinear 2x upscaling of the half resolution crops rendered while the
+// parameters are changing (see Crop::update)
+rtengine::Image8 *upscale2x(const rtengine::Image8 *src)
+{
+    const int W = src->getWidth();
+    const int H = src->getHeight();
+    rtengine::Image8 *dst = new rtengine::Image8(2 * W, 2 * H);
+
+#ifdef _OPENMP
+#   pragma omp parallel for
+#endif
+    for (int y = 0; y < 2 * H; ++y) {
+        // the centre of the destination pixel in source coordinates
+        const float sy = rtengine::LIM(y * 0.5f - 0.25f, 0.f, float(H - 1));
+        const int y0 = sy;
+        const int y1 = std::min(y0 + 1, H - 1);
+        const float fy = sy - y0;
+        for (int x = 0; x < 2 * W; ++x) {
+            const float sx = rtengine::LIM(x * 0.5f - 0.25f, 0.f, float(W - 1));
+            const int x0 = sx;
+            const int x1 = std::min(x0 + 1, W - 1);
+            const float fx = sx - x0;
+            for (int c = 0; c < 3; ++c) {
+                const float top = src->data[3 * (y0 * W + x0) + c] * (1.f - fx) + src->data[3 * (y0 * W + x1) + c] * fx;
+                const float bottom = src->data[3 * (y1 * W + x0) + c] * (1.f - fx) + src->data[3 * (y1 * W + x1) + c] * fx;
+                dst->data[3 * (y * 2 * W + x) + c] = top * (1.f - fy) + bottom * fy + 0.5f;
+            }
+        }
+    }
+
+    return dst;
+}
+
 } // namespace
 
 namespace rtengine {
@@ -48,7 +82,9 @@ Crop::Crop(ImProcCoordinator* parent, EditDataProvider *editDataProvider, bool i
       rqcropx(0), rqcropy(0), rqcropw(-1), rqcroph(-1),
       borderRequested(32), upperBorder(0), leftBorder(0),
       cropAllocated(false),
-      cropImageListener(nullptr), parent(parent), isDetailWindow(isDetailWindow)
+      cropImageListener(nullptr), parent(parent), isDetailWindow(isDetailWindow),
+      ipf_(&parent->params, true), color_profiles_gen_(-1),
+      pending_todo_(0), coarse_(false), last_update_ms_(0), uncancellable_(false)
 {
     for (int i = 0; i < 3; ++i) {
         bufs_[i] = nullptr;
@@ -132,10 +168,13 @@ bool Crop::hasListener()
     return cropImageListener;
 }
 
-void Crop::update(int todo)
+bool Crop::update(int todo, bool coarse)
 {
     MyMutex::MyLock cropLock(cropMutex);
 
+    MyTime t1, t2;
+    t1.set();
+
     ProcParams& params = parent->params;
 //       CropGUIListener* cropgl;
 
@@ -147,35 +186,73 @@ void Crop::update(int todo)
     const bool overrideWindow = cropImageListener;
     bool spotsDone = false;
 
+    // the pipette buffers must match the displayed crop
+    coarse = coarse && overrideWindow && getCurrEditID() == EUID_None;
+
     if (overrideWindow) {
         cropImageListener->getWindow(wx, wy, ww, wh, ws);
+        if (coarse) {
+            ws *= 2;
+        }
     }
 
     // re-allocate sub-images and arrays if their dimensions changed
     bool needsinitupdate = false;
 
     if (!overrideWindow) {
-        needsinitupdate = setCropSizes(rqcropx, rqcropy, rqcropw, rqcroph, skip, true);
+        needsinitupdate = setCropSizes(rqcropx, rqcropy, rqcropw, rqcroph, coarse_ ? skip / 2 : skip, true);
     } else {
         needsinitupdate = setCropSizes(wx, wy, ww, wh, ws, true);     // this set skip=ws
     }
 
     // it something has been reallocated, all processing steps have to be performed
-    if (needsinitupdate || (todo & M_HIGHQUAL)) {
+    if (needsinitupdate || (todo & M_HIGHQUAL) || coarse != coarse_) {
         todo = ALL;
     }
 
+    // resume the work of an interrupted update
+    todo |= pending_todo_;
+    pending_todo_ = 0;
+    coarse_ = coarse;
+    const int view_skip = coarse ? skip / 2 : skip;
+
+    const auto interrupted =
+        [&]() -> bool
+        {
+            if (ipf_.cancelled()) {
+                pending_todo_ = todo;
+                if (!coarse) {
+                    // a lower bound of the duration, for deciding whether
+                    // to render at half resolution next time
+                    t2.set();
+                    last_update_ms_ = std::max(last_update_ms_, t2.etime(t1) / 1000.0);
+                }
+                return true;
+            }
+            return false;
+        };
+
+    // the monitor transform is computed by ImProcCoordinator::updatePreviewImage
+    if (color_profiles_gen_ != parent->color_profiles_gen_) {
+        ipf_.updateColorProfiles(parent->monitorProfile, parent->monitorIntent, parent->softProof, parent->gamutCheck);
+        color_profiles_gen_ = parent->color_profiles_gen_;
+    }
+    ipf_.inheritSetup(parent->ipf);
+    if (uncancellable_) {
+        ipf_.setCancelFlag(nullptr);
+    }
+
     // Tells to the ImProcFunctions' tool what is the preview scale, which may lead to some simplifications
-    parent->ipf.setScale(skip);
-    parent->ipf.setPipetteBuffer(this);
-    parent->ipf.setViewport(0, 0, -1, -1);
-    parent->ipf.setOutputHistograms(nullptr, nullptr, nullptr);
-    parent->ipf.setShowSharpeningMask(parent->sharpMask);
+    ipf_.setScale(skip);
+    ipf_.setPipetteBuffer(this);
+    ipf_.setViewport(0, 0, -1, -1);
+    ipf_.setOutputHistograms(nullptr, nullptr, nullptr);
+    ipf_.setShowSharpeningMask(parent->sharpMask);
 
     Imagefloat* baseCrop = origCrop;
 
-    bool needstransform  = parent->ipf.needsTransform();
-    bool show_denoise = params.denoise.enabled && (skip == 1 || options.denoiseZoomedOut);
+    bool needstransform  = ipf_.needsTransform();
+    bool show_denoise = params.denoise.enabled && (view_skip == 1 || options.denoiseZoomedOut);
 
     const auto invert_negative =
         [&](Imagefloat *img) -> bool
@@ -186,7 +263,7 @@ void Crop::update(int todo)
                     converted = true;
                     parent->imgsrc->convertColorSpace(img, params.icm, parent->currWB);
                 } 
-                parent->ipf.filmNegativeProcess(img, img, params.filmNegative, params.raw, parent->imgsrc, parent->currWB);
+                ipf_.filmNegativeProcess(img, img, params.filmNegative, params.raw, parent->imgsrc, parent->currWB);
             }
             return converted;
         };
@@ -219,17 +296,34 @@ void Crop::update(int todo)
         baseCrop = denoiseCrop;
         
         if (show_denoise) {
-            parent->ipf.denoiseComputeParams(parent->imgsrc, parent->currWB, parent->denoiseInfoStore, params.denoise);
-
-            if ((!isDetailWindow) && parent->adnListener) {
-                parent->adnListener->chromaChanged(params.denoise.chrominance, params.denoise.chrominanceRedGreen, params.denoise.chrominanceBlueYellow);
+            // the denoise info store is shared by all the crops and updated
+            // by the coordinator, so the crop works on its own copy
+            ImProcFunctions::DenoiseInfoStore dnstore;
+            {
+                MyMutex::MyLock lock(parent->minit);
+                ipf_.denoiseComputeParams(parent->imgsrc, parent->currWB, parent->denoiseInfoStore, params.denoise);
+                dnstore = parent->denoiseInfoStore;
+
+                if ((!isDetailWindow) && parent->adnListener) {
+                    parent->adnListener->chromaChanged(params.denoise.chrominance, params.denoise.chrominanceRedGreen, params.denoise.chrominanceBlueYellow);
+                }
             }
 
-            parent->ipf.denoise(parent->imgsrc, parent->currWB, denoiseCrop, parent->denoiseInfoStore, params.denoise);
+            // imgsrc is read without holding minit: it is modified only by
+            // the coordinator before the crops are updated, and denoise()
+            // just converts the colour space of its luminance guide, which
+            // only reads the image source (the lcms transform creation is
+            // serialized by lcmsMutex)
+            ipf_.denoise(parent->imgsrc, parent->currWB, denoiseCrop, dnstore, params.denoise);
 
             if (parent->adnListener && params.denoise.chrominanceMethod == DenoiseParams::ChrominanceMethod::AUTOMATIC) {
+                MyMutex::MyLock lock(parent->minit);
                 parent->adnListener->chromaChanged(params.denoise.chrominance, params.denoise.chrominanceRedGreen, params.denoise.chrominanceBlueYellow);
             }
+
+            if (interrupted()) {
+                return false;
+            }
         }
     } else if (denoiseCrop) {
         baseCrop = denoiseCrop;
@@ -242,7 +336,7 @@ void Crop::update(int todo)
     int offset_y = cropy / skip;
     int full_width = parent->getFullWidth() / skip;
     int full_height = parent->getFullHeight() / skip;
-    parent->ipf.setViewport(offset_x, offset_y, full_width, full_height);
+    ipf_.setViewport(offset_x, offset_y, full_width, full_height);
 
     // Apply Spot removal
     if ((todo & M_SPOT) && !spotsDone) {
@@ -254,7 +348,8 @@ void Crop::update(int todo)
             if (!params.spot.entries.empty()) {
                 PreviewProps pp(trafx, trafy, trafw * skip, trafh * skip, skip);
                 int tr = getCoarseBitMask(params.coarse);
-                parent->ipf.removeSpots(spotCrop, parent->imgsrc, params.spot.entries, pp, parent->currWB, &params.icm, tr, &parent->denoiseInfoStore);
+                MyMutex::MyLock lock(parent->minit);
+                ipf_.removeSpots(spotCrop, parent->imgsrc, params.spot.entries, pp, parent->currWB, &params.icm, tr, &parent->denoiseInfoStore);
             }
         } else {
             if (spotCrop) {
@@ -278,15 +373,42 @@ void Crop::update(int todo)
         int fh = skips(parent->fh, skip);
         bool need_cropping = false;
         bool need_drcomp = true;
+        bool use_cache = false;
+
+        // crop back to the size expected by the rest of the pipeline
+        const auto crop_back =
+            [&](const Imagefloat *src) -> void
+            {
+                int oy = trafy / skip;
+                int ox = trafx / skip;
+#ifdef _OPENMP
+#               pragma omp parallel for
+#endif
+                for (int y = 0; y < trafh; ++y) {
+                    int cy = y + oy;
+
+                    for (int x = 0; x < trafw; ++x) {
+                        int cx = x + ox;
+                        hdr_base_crop->r(y, x) = src->r(cy, cx);
+                        hdr_base_crop->g(y, x) = src->g(cy, cx);
+                        hdr_base_crop->b(y, x) = src->b(cy, cx);
+                    }
+                }
+            };
 
         if (trafx || trafy || trafw != fw || trafh != fh) {
             need_cropping = true;
             const bool copy_from_earlier_steps = params.denoise.enabled || params.spot.enabled;
+            use_cache = !copy_from_earlier_steps && skip == 1;
+
+            // the lock protects the image source and drcomp_11_dcrop_cache,
+            // shared with the other crops. It is not held while processing
+            MyMutex::MyLock lock(parent->minit);
 
             // fattal needs to work on the full image. So here we get the full
             // image from imgsrc, and replace the denoised crop in case
-            if (!copy_from_earlier_steps && skip == 1 && parent->drcomp_11_dcrop_cache) {
-                f = parent->drcomp_11_dcrop_cache;
+            if (use_cache && parent->drcomp_11_dcrop_cache) {
+                crop_back(parent->drcomp_11_dcrop_cache);
                 need_drcomp = false;
                 pipeline_stop_[0] = parent->pipeline_stop_[0];
             } else {
@@ -317,39 +439,33 @@ void Crop::update(int todo)
                             f->b(dy, dx) = baseCrop->b(y, x);
                         }
                     }
-                } else if (skip == 1) {
-                    parent->drcomp_11_dcrop_cache = f; // cache this globally
-                    drCompCrop.release();
                 }
             }
         }
 
         if (need_drcomp) {
-            pipeline_stop_[0] = parent->ipf.process(ImProcFunctions::Pipeline::PREVIEW, ImProcFunctions::Stage::STAGE_0, f);
-        }
-        stop = pipeline_stop_[0];
+            pipeline_stop_[0] = ipf_.process(ImProcFunctions::Pipeline::PREVIEW, ImProcFunctions::Stage::STAGE_0, f);
 
-        // crop back to the size expected by the rest of the pipeline
-        baseCrop = hdr_base_crop;
-        if (need_cropping) {
-            int oy = trafy / skip;
-            int ox = trafx / skip;
-#ifdef _OPENMP
-#           pragma omp parallel for
-#endif
-            for (int y = 0; y < trafh; ++y) {
-                int cy = y + oy;
-
-                for (int x = 0; x < trafw; ++x) {
-                    int cx = x + ox;
-                    baseCrop->r(y, x) = f->r(cy, cx);
-                    baseCrop->g(y, x) = f->g(cy, cx);
-                    baseCrop->b(y, x) = f->b(cy, cx);
+            if (interrupted()) {
+                return false;
+            }
+
+            if (need_cropping) {
+                crop_back(f);
+            } else {
+                f->copyTo(hdr_base_crop);
+            }
+
+            if (use_cache) {
+                // cache this globally, unless another crop did it meanwhile
+                MyMutex::MyLock lock(parent->minit);
+                if (!parent->drcomp_11_dcrop_cache) {
+                    parent->drcomp_11_dcrop_cache = drCompCrop.release();
                 }
             }
-        } else {
-            f->copyTo(baseCrop);
         }
+        stop = pipeline_stop_[0];
+        baseCrop = hdr_base_crop;
     }
 
     // transform
@@ -359,7 +475,7 @@ void Crop::update(int todo)
         }
 
         if (needstransform) {
-            parent->ipf.transform(baseCrop, transCrop, cropx / skip, cropy / skip, trafx / skip, trafy / skip, skips(parent->fw, skip), skips(parent->fh, skip), parent->getFullWidth(), parent->getFullHeight(),
+            ipf_.transform(baseCrop, transCrop, cropx / skip, cropy / skip, trafx / skip, trafy / skip, skips(parent->fw, skip), skips(parent->fh, skip), parent->getFullWidth(), parent->getFullHeight(),
                                   parent->imgsrc->getMetaData(),
                                   parent->imgsrc->getRotateDegree(), false);
         } else {
@@ -380,36 +496,48 @@ void Crop::update(int todo)
     if (todo & M_RGBCURVE) {
         Imagefloat *workingCrop = baseCrop;
         workingCrop->copyTo(bufs_[0]);
-        pipeline_stop_[1] = stop || parent->ipf.process(ImProcFunctions::Pipeline::PREVIEW, ImProcFunctions::Stage::STAGE_1, bufs_[0]);
+        pipeline_stop_[1] = stop || ipf_.process(ImProcFunctions::Pipeline::PREVIEW, ImProcFunctions::Stage::STAGE_1, bufs_[0]);
         
         if (workingCrop != baseCrop) {
             delete workingCrop;
         }
+
+        if (interrupted()) {
+            return false;
+        }
     }
     stop = stop || pipeline_stop_[1];
 
     if (todo & M_LUMACURVE) {
         bufs_[0]->copyTo(bufs_[1]);
         
-        pipeline_stop_[2] = stop || parent->ipf.process(ImProcFunctions::Pipeline::PREVIEW, ImProcFunctions::Stage::STAGE_2, bufs_[1]);
+        pipeline_stop_[2] = stop || ipf_.process(ImProcFunctions::Pipeline::PREVIEW, ImProcFunctions::Stage::STAGE_2, bufs_[1]);
+
+        if (interrupted()) {
+            return false;
+        }
     }
     stop = stop || pipeline_stop_[2];
     
     if (todo & (M_LUMINANCE | M_COLOR)) {
         bufs_[1]->copyTo(bufs_[2]);
 
-        pipeline_stop_[3] = stop || parent->ipf.process(ImProcFunctions::Pipeline::PREVIEW, ImProcFunctions::Stage::STAGE_3, bufs_[2]);
+        pipeline_stop_[3] = stop || ipf_.process(ImProcFunctions::Pipeline::PREVIEW, ImProcFunctions::Stage::STAGE_3, bufs_[2]);
+
+        if (interrupted()) {
+            return false;
+        }
     }
     stop = stop || pipeline_stop_[3];
 
     // all pipette buffer processing should be finished now
     PipetteBuffer::setReady();
 
-    parent->ipf.rgb2monitor(bufs_[2], cropImg);
+    ipf_.rgb2monitor(bufs_[2], cropImg);
 
     if (cropImageListener) {
         // internal image in output color space for analysis
-        Image8 *cropImgtrue = parent->ipf.rgb2out(bufs_[2], 0, 0, cropImg->getWidth(), cropImg->getHeight(), params.icm);
+        Image8 *cropImgtrue = ipf_.rgb2out(bufs_[2], 0, 0, cropImg->getWidth(), cropImg->getHeight(), params.icm);
 
         int finalW = rqcropw;
 
@@ -433,11 +561,27 @@ void Crop::update(int todo)
             memcpy(finaltrue->data + 3 * i * finalW, cropImgtrue->data + 3 * (i + upperBorder)*cW + 3 * leftBorder, 3 * finalW);
         }
 
-        cropImageListener->setDetailedCrop(final, finaltrue, params.icm, params.crop, rqcropx, rqcropy, rqcropw, rqcroph, skip);
+        if (coarse) {
+            Image8 *f = upscale2x(final);
+            delete final;
+            final = f;
+            f = upscale2x(finaltrue);
+            delete finaltrue;
+            finaltrue = f;
+        }
+
+        cropImageListener->setDetailedCrop(final, finaltrue, params.icm, params.crop, rqcropx, rqcropy, rqcropw, rqcroph, view_skip);
         delete final;
         delete finaltrue;
         delete cropImgtrue;
     }
+
+    if (!coarse) {
+        t2.set();
+        last_update_ms_ = t2.etime(t1) / 1000.0;
+    }
+
+    return true;
 }
 
 
@@ -553,7 +697,7 @@ bool Crop::setCropSizes(int rcx, int rcy, int rcw, int rch, int skip, bool inter
     orw = bw;
     orh = bh;
 
-    parent->ipf.transCoord(parent->fw, parent->fh, bx1, by1, bw, bh, orx, ory, orw, orh);
+    ipf_.transCoord(parent->fw, parent->fh, bx1, by1, bw, bh, orx, ory, orw, orh);
 
     double adjust = 0.f;
     if (check_need_larger_crop_for_transform(parent->fw, parent->fh, orx, ory, orw, orh, parent->params, adjust)) {
@@ -721,8 +865,12 @@ void Crop::fullUpdate()
 
     if (parent->plistener) {
         parent->plistener->setProgressState(true);
-        parent->ipf.setProgressListener(parent->plistener, 1);
     }
+    ipf_.setProgressListener(parent->plistener, 1);
+
+    // the crop window has been moved or resized: the current parameters
+    // must be rendered even if newer ones are waiting
+    uncancellable_ = true;
 
     // If there are more update request, the following WHILE will collect it
     newUpdatePending = true;
@@ -735,12 +883,17 @@ void Crop::fullUpdate()
         newUpdatePending = false;
         update(ALL);
     }
+    uncancellable_ = false;
     if (parent->tweakOperator) {
         parent->restoreParams();
     }
 
     updating = false;  // end of crop update
 
+    // the updates driven by ImProcCoordinator can run concurrently, and
+    // don't report their progress
+    ipf_.setProgressListener(nullptr, 1);
+
     if (parent->plistener) {
         parent->plistener->setProgressState(false);
     }
@@ -752,7 +905,21 @@ void Crop::fullUpdate()
 int Crop::get_skip()
 {
     MyMutex::MyLock lock(cropMutex);
-    return skip;
+    return coarse_ ? skip / 2 : skip;
+}
+
+
+bool Crop::is_coarse()
+{
+    MyMutex::MyLock lock(cropMutex);
+    return coarse_;
+}
+
+
+double Crop::get_update_time()
+{
+    MyMutex::MyLock lock(cropMutex);
+    return last_update_ms_;
 }
 
 int Crop::getLeftBorder()
@@ -65,12 +65,28 @@ protected:
     MyMutex cropMutex;
     ImProcCoordinator* const parent;
     const bool isDetailWindow;
+
+    ImProcFunctions ipf_;    /// own instance, so that the crops can be updated concurrently (see ImProcCoordinator::updatePreviewImage)
+    int color_profiles_gen_; /// value of ImProcCoordinator::color_profiles_gen_ when ipf_ got its monitor profile
+
+    int pending_todo_;       /// processing left to do by an update interrupted by ImProcCoordinator
+    bool coarse_;            /// the buffers hold a half resolution rendering (skip is twice the requested one)
+    double last_update_ms_;  /// duration of the last complete full resolution update
+    bool uncancellable_;     /// set by fullUpdate, which must render the current parameters even if newer ones are waiting
+
     EditUniqueID getCurrEditID();
     bool setCropSizes (int cropX, int cropY, int cropW, int cropH, int skip, bool internal);
     void freeAll ();
 
     friend class ImProcCoordinator;
-    void update(int todo);
+    /** @brief Processes the crop and sends it to the listener
+     * If coarse is true, the crop is rendered at half the resolution requested by the listener, and upscaled.
+     * @return false if the processing was interrupted (see ImProcFunctions::setCancelFlag); the remaining work
+     * is then done by the next update
+     */
+    bool update(int todo, bool coarse=false);
+    bool is_coarse();
+    double get_update_time();
 
 public:
     Crop(ImProcCoordinator* parent, EditDataProvider *editDataProvider, bool isDetailWindow);
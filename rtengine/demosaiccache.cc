@@ -0,0 +1,287 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "demosaiccache.h"
+#include "settings.h"
+#include "utils.h"
+#include "../rtgui/options.h"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <giomm.h>
+
+namespace rtengine {
+
+extern const Settings *settings;
+
+namespace {
+
+const char magic[8] = { 'A', 'R', 'T', 'D', 'M', 'C', '0', '2' };
+
+DemosaicDiskCache instance;
+
+
+Glib::ustring get_cache_dir()
+{
+    return Glib::build_filename(options.cacheBaseDir, "demosaic");
+}
+
+
+bool write_plane(FILE *out, array2D<float> &a)
+{
+    const int32_t dim[2] = { a.width(), a.height() };
+    if (fwrite(dim, sizeof(int32_t), 2, out) != 2) {
+        return false;
+    }
+    for (int y = 0; y < a.height(); ++y) {
+        if (fwrite(a[y], sizeof(float), a.width(), out) != size_t(a.width())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool read_plane(FILE *src, array2D<float> &a)
+{
+    int32_t dim[2];
+    if (fread(dim, sizeof(int32_t), 2, src) != 2) {
+        return false;
+    }
+    if (!a) {
+        a(dim[0], dim[1]);
+    } else if (dim[0] != a.width() || dim[1] != a.height()) {
+        return false;
+    }
+    for (int y = 0; y < a.height(); ++y) {
+        if (fread(a[y], sizeof(float), a.width(), src) != size_t(a.width())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+
+DemosaicDiskCache *DemosaicDiskCache::getInstance()
+{
+    return &instance;
+}
+
+
+bool DemosaicDiskCache::enabled() const
+{
+    return settings->demosaic_cache_size > 0;
+}
+
+
+std::string DemosaicDiskCache::getKey(const Glib::ustring &fname, unsigned int frame, const procparams::RAWParams &raw, const procparams::LensProfParams &lensProf, const procparams::CoarseTransformParams &coarse, const float ref_pre_mul[4], const std::vector<Glib::ustring> &files, const std::vector<badPix> *badpixels)
+{
+    // serialize only the tools that influence preprocess() and demosaic(),
+    // the other ones are left at their defaults. The serialized form also
+    // contains the ART version, so that entries are invalidated on updates
+    procparams::ProcParams pp;
+    pp.raw = raw;
+    pp.lensProf = lensProf;
+    pp.coarse = coarse;
+
+    auto md5 = getMD5(fname, true);
+    auto data = Glib::ustring::compose("%1\n%2\n%3\n", fname, md5, frame);
+    // the files actually used (e.g. the auto-selected dark frame), so that
+    // entries are invalidated when they are edited or replaced
+    for (const auto &ref : files) {
+        data += Glib::ustring::compose("%1\n%2\n", ref, ref.empty() ? "" : getMD5(ref, true));
+    }
+    if (badpixels) {
+        std::string bp;
+        bp.reserve(badpixels->size() * 12);
+        for (const auto &p : *badpixels) {
+            bp += std::to_string(p.x) + "," + std::to_string(p.y) + ";";
+        }
+        data += Glib::Checksum::compute_checksum(Glib::Checksum::CHECKSUM_SHA256, bp) + "\n";
+    } else {
+        data += "\n";
+    }
+    for (int i = 0; i < 4; ++i) {
+        data += Glib::ustring::format(std::setprecision(10), ref_pre_mul[i]) + "\n";
+    }
+    data += pp.to_data();
+    return Glib::Checksum::compute_checksum(Glib::Checksum::CHECKSUM_SHA256, data);
+}
+
+
+bool DemosaicDiskCache::load(const std::string &key, State &state, array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue)
+{
+    auto name = Glib::build_filename(get_cache_dir(), key);
+
+    MyMutex::MyLock lck(mutex_);
+
+    FILE *src = g_fopen(name.c_str(), "rb");
+    if (!src) {
+        if (settings->verbose > 1) {
+            std::cout << "demosaic cache miss: " << key << std::endl;
+        }
+        return false;
+    }
+
+    char buf[sizeof(magic)];
+    bool ok = fread(buf, 1, sizeof(magic), src) == sizeof(magic) && memcmp(buf, magic, sizeof(magic)) == 0;
+    ok = ok && fread(&state, sizeof(State), 1, src) == 1;
+    ok = ok && read_plane(src, rawData) && read_plane(src, red) && read_plane(src, green) && read_plane(src, blue);
+    fclose(src);
+
+    if (ok) {
+        // refresh the modification time, used by trim() to evict the
+        // least-recently used entries
+        g_utime(name.c_str(), nullptr);
+        if (settings->verbose > 1) {
+            std::cout << "demosaic cache hit: " << key << std::endl;
+        }
+    } else {
+        if (settings->verbose) {
+            std::cerr << "demosaic cache - invalid entry: " << key << std::endl;
+        }
+        g_remove(name.c_str());
+    }
+    return ok;
+}
+
+
+void DemosaicDiskCache::store(const std::string &key, const State &state, array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue)
+{
+    auto dir = get_cache_dir();
+    if (g_mkdir_with_parents(dir.c_str(), 0777) != 0) {
+        return;
+    }
+
+    {
+        MyMutex::MyLock lck(mutex_);
+
+        // write to a temporary file first, and then rename it, so that
+        // concurrent readers never see a partially-written entry
+        std::string templ = Glib::build_filename(dir, key + ".tmp-XXXXXX");
+        int fd = Glib::mkstemp(templ);
+        if (fd < 0) {
+            return;
+        }
+        FILE *out = fdopen(fd, "wb");
+        if (!out) {
+            close(fd);
+            g_remove(templ.c_str());
+            return;
+        }
+
+        bool ok = fwrite(magic, 1, sizeof(magic), out) == sizeof(magic);
+        ok = ok && fwrite(&state, sizeof(State), 1, out) == 1;
+        ok = ok && write_plane(out, rawData) && write_plane(out, red) && write_plane(out, green) && write_plane(out, blue);
+        ok = (fclose(out) == 0) && ok;
+
+        auto name = Glib::build_filename(dir, key);
+        if (!ok || g_rename(templ.c_str(), name.c_str()) != 0) {
+            g_remove(templ.c_str());
+            if (settings->verbose) {
+                std::cerr << "demosaic cache - error storing entry: " << key << std::endl;
+            }
+            return;
+        }
+
+        if (settings->verbose > 1) {
+            std::cout << "demosaic cache store: " << key << std::endl;
+        }
+    }
+
+    trim();
+}
+
+
+void DemosaicDiskCache::trim()
+{
+    MyMutex::MyLock lck(mutex_);
+
+    const goffset max_size = goffset(std::max(settings->demosaic_cache_size, 0)) * 1024 * 1024;
+    const auto dir_name = get_cache_dir();
+    const auto dir = Gio::File::create_for_path(dir_name);
+
+    struct Entry {
+        Glib::ustring name;
+        Glib::TimeVal mtime;
+        goffset size;
+    };
+    std::vector<Entry> files;
+    goffset total = 0;
+
+    try {
+        auto enumerator = dir->enumerate_children("standard::name,standard::size,time::modified");
+        while (auto file = enumerator->next_file()) {
+            files.push_back({file->get_name(), file->modification_time(), file->get_size()});
+            total += file->get_size();
+        }
+    } catch (Glib::Exception&) {}
+
+    if (total <= max_size) {
+        return;
+    }
+
+    std::sort(files.begin(), files.end(), [](const Entry &lhs, const Entry &rhs)
+    {
+        return lhs.mtime < rhs.mtime;
+    });
+
+    size_t num_removed = 0;
+    for (auto entry = files.begin(); entry != files.end() && total > max_size; ++entry) {
+        auto pth = Glib::build_filename(dir_name, entry->name);
+        if (g_remove(pth.c_str()) != 0) {
+            if (settings->verbose) {
+                std::cerr << "demosaic cache - error removing cache file: " << entry->name << std::endl;
+            }
+        } else {
+            total -= entry->size;
+            ++num_removed;
+        }
+    }
+
+    if (settings->verbose > 1) {
+        std::cout << "demosaic cache - removed " << num_removed << " cache files" << std::endl;
+    }
+}
+
+
+void DemosaicDiskCache::clear()
+{
+    MyMutex::MyLock lck(mutex_);
+
+    try {
+        auto dirname = get_cache_dir();
+        Glib::Dir dir(dirname);
+
+        for (auto entry = dir.begin(); entry != dir.end(); ++entry) {
+            auto name = Glib::build_filename(dirname, *entry);
+            if (g_remove(name.c_str()) != 0 && settings->verbose) {
+                std::cerr << "demosaic cache - error removing cache file: " << *entry << std::endl;
+            }
+        }
+    } catch (Glib::Error&) {}
+}
+
+} // namespace rtengine
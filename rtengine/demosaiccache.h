@@ -0,0 +1,83 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "noncopyable.h"
+#include "array2D.h"
+#include "procparams.h"
+#include "pixelsmap.h"
+#include "../rtgui/threadutils.h"
+#include <glibmm/ustring.h>
+#include <string>
+#include <vector>
+
+namespace rtengine {
+
+/**
+ * Persistent on-disk cache of the output of RawImageSource::preprocess and
+ * RawImageSource::demosaic. Entries are keyed on the identity of the raw file
+ * and of the other files read (dark frame, flat field, LCP profile: name,
+ * size and modification time), on the bad pixels corrected, and on the
+ * parameters that influence preprocessing and demosaicing. The cache is
+ * disabled when Settings::demosaic_cache_size is 0.
+ */
+class DemosaicDiskCache: public NonCopyable {
+public:
+    /** Scalar state computed by preprocess() and demosaic() that must be
+        restored along with the pixel data */
+    struct State {
+        float scale_mul[4];
+        float c_black[4];
+        float c_white[4];
+        float cblacksom[4];
+        float chmax[4];
+        float clmax[4];
+        float hlmax[4];
+        float psRedBrightness[4];
+        float psGreenBrightness[4];
+        float psBlueBrightness[4];
+        double initialGain;
+        double defGain;
+        int flatFieldAutoClipValue;
+        bool autoContrast;
+        double contrastThreshold;
+    };
+
+    static DemosaicDiskCache *getInstance();
+
+    bool enabled() const;
+
+    // files are the other files read by preprocess() (empty names for the
+    // ones not used), badpixels the pixels corrected from the .badpixels
+    // files (or nullptr)
+    std::string getKey(const Glib::ustring &fname, unsigned int frame, const procparams::RAWParams &raw, const procparams::LensProfParams &lensProf, const procparams::CoarseTransformParams &coarse, const float ref_pre_mul[4], const std::vector<Glib::ustring> &files, const std::vector<badPix> *badpixels);
+
+    bool load(const std::string &key, State &state, array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue);
+    void store(const std::string &key, const State &state, array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue);
+
+    void trim();
+    void clear();
+
+private:
+    DemosaicDiskCache() = default;
+
+    MyMutex mutex_;
+};
+
+} // namespace rtengine
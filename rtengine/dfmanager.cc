@@ -293,6 +293,8 @@ void DFManager::init(const Glib::ustring &pathname)
 
     } catch (Glib::Exception&) {}
 
+    MyMutex::MyLock lock(mutex);
+
     dfList.clear();
     bpList.clear();
 
@@ -479,6 +481,7 @@ DFInfo* DFManager::find( const std::string &mak, const std::string &mod, int iso
 
 RawImage* DFManager::searchDarkFrame( const std::string &mak, const std::string &mod, int iso, double shut, time_t t )
 {
+    MyMutex::MyLock lock(mutex);
     DFInfo *df = find( ((Glib::ustring)mak).uppercase(), ((Glib::ustring)mod).uppercase(), iso, shut, t );
 
     if( df ) {
@@ -490,6 +493,7 @@ RawImage* DFManager::searchDarkFrame( const std::string &mak, const std::string
 
 RawImage* DFManager::searchDarkFrame( const Glib::ustring filename )
 {
+    MyMutex::MyLock lock(mutex);
     for ( dfList_t::iterator iter = dfList.begin(); iter != dfList.end(); ++iter ) {
         if( iter->second.pathname.compare( filename ) == 0  ) {
             return iter->second.getRawImage();
@@ -506,6 +510,7 @@ RawImage* DFManager::searchDarkFrame( const Glib::ustring filename )
 }
 std::vector<badPix> *DFManager::getHotPixels ( const Glib::ustring filename )
 {
+    MyMutex::MyLock lock(mutex);
     for ( dfList_t::iterator iter = dfList.begin(); iter != dfList.end(); ++iter ) {
         if( iter->second.pathname.compare( filename ) == 0  ) {
             return &iter->second.getHotPixels();
@@ -516,6 +521,7 @@ std::vector<badPix> *DFManager::getHotPixels ( const Glib::ustring filename )
 }
 std::vector<badPix> *DFManager::getHotPixels ( const std::string &mak, const std::string &mod, int iso, double shut, time_t t )
 {
+    MyMutex::MyLock lock(mutex);
     DFInfo *df = find( ((Glib::ustring)mak).uppercase(), ((Glib::ustring)mod).uppercase(), iso, shut, t );
 
     if( df ) {
@@ -589,6 +595,7 @@ int DFManager::scanBadPixelsFile( Glib::ustring filename )
 
 std::vector<badPix> *DFManager::getBadPixels ( const std::string &mak, const std::string &mod, const std::string &serial)
 {
+    MyMutex::MyLock lock(mutex);
     bpList_t::iterator iter;
     bool found = false;
 
@@ -23,6 +23,7 @@
 #include <cmath>
 #include "pixelsmap.h"
 #include "rawimage.h"
+#include "../rtgui/threadutils.h"
 
 namespace rtengine {
 
@@ -99,6 +100,10 @@ protected:
     DFInfo *addFileInfo(const Glib::ustring &filename, bool pool = true );
     DFInfo *find( const std::string &mak, const std::string &mod, int isospeed, double shut, time_t t );
     int scanBadPixelsFile( Glib::ustring filename );
+
+    // dark frames are loaded lazily and can be requested by concurrent
+    // processing jobs
+    MyMutex mutex;
 };
 
 extern DFManager dfm;
@@ -258,6 +258,8 @@ void FFManager::init(const Glib::ustring &pathname)
 
     } catch (Glib::Exception&) {}
 
+    MyMutex::MyLock lock(mutex);
+
     ffList.clear();
 
     for (size_t i = 0; i < names.size(); i++) {
@@ -431,6 +433,7 @@ ffInfo* FFManager::find( const std::string &mak, const std::string &mod, const s
 
 RawImage* FFManager::searchFlatField( const std::string &mak, const std::string &mod, const std::string &len, double focal, double apert, time_t t )
 {
+    MyMutex::MyLock lock(mutex);
     ffInfo *ff = find( mak, mod, len, focal, apert, t );
 
     if( ff ) {
@@ -442,6 +445,7 @@ RawImage* FFManager::searchFlatField( const std::string &mak, const std::string
 
 RawImage* FFManager::searchFlatField( const Glib::ustring filename )
 {
+    MyMutex::MyLock lock(mutex);
     for ( ffList_t::iterator iter = ffList.begin(); iter != ffList.end(); ++iter ) {
         if( iter->second.pathname.compare( filename ) == 0  ) {
             return iter->second.getRawImage();
@@ -22,6 +22,7 @@
 #include <map>
 #include <cmath>
 #include "rawimage.h"
+#include "../rtgui/threadutils.h"
 
 namespace rtengine
 {
@@ -91,6 +92,10 @@ protected:
     Glib::ustring currentPath;
     ffInfo *addFileInfo(const Glib::ustring &filename, bool pool = true );
     ffInfo *find( const std::string &mak, const std::string &mod, const std::string &len, double focal, double apert, time_t t );
+
+    // flat fields are loaded lazily and can be requested by concurrent
+    // processing jobs
+    MyMutex mutex;
 };
 
 extern FFManager ffm;
@@ -40,6 +40,12 @@ GamutWarning::GamutWarning(cmsHPROFILE gamutprof, RenderingIntent intent, bool g
             lab2ref = cmsCreateTransform(iprof, TYPE_Lab_FLT, aces, TYPE_RGB_FLT, INTENT_ABSOLUTE_COLORIMETRIC, cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE);
             lab2softproof = cmsCreateTransform(iprof, TYPE_Lab_FLT, gamutprof, TYPE_RGB_FLT, INTENT_ABSOLUTE_COLORIMETRIC, cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE);
             softproof2ref = cmsCreateTransform(gamutprof, TYPE_RGB_FLT, aces, TYPE_RGB_FLT, INTENT_ABSOLUTE_COLORIMETRIC, cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE | (gamutbpc ? cmsFLAGS_BLACKPOINTCOMPENSATION : 0));
+
+            // exact evaluation of the curves (no LUTs), since the round trip
+            // is compared against lab2ref with a very small tolerance
+            lab2ref_ms = MatrixShaperTransform::create(iprof, TYPE_Lab_FLT, aces, TYPE_RGB_FLT, INTENT_ABSOLUTE_COLORIMETRIC, cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE, 0);
+            lab2softproof_ms = MatrixShaperTransform::create(iprof, TYPE_Lab_FLT, gamutprof, TYPE_RGB_FLT, INTENT_ABSOLUTE_COLORIMETRIC, cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE, 0);
+            softproof2ref_ms = MatrixShaperTransform::create(gamutprof, TYPE_RGB_FLT, aces, TYPE_RGB_FLT, INTENT_ABSOLUTE_COLORIMETRIC, cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE | (gamutbpc ? cmsFLAGS_BLACKPOINTCOMPENSATION : 0), 0);
         }
     } else {
         lab2ref = nullptr;
@@ -76,24 +82,34 @@ GamutWarning::~GamutWarning()
 }
 
 
+void GamutWarning::transform(cmsHTRANSFORM xform, const std::unique_ptr<MatrixShaperTransform> &ms, const float *src, float *dst, int n)
+{
+    if (ms) {
+        (*ms)(src, dst, n);
+    } else {
+        cmsDoTransform(xform, src, dst, n);
+    }
+}
+
+
 void GamutWarning::markLine(Image8 *image, int y, float *srcbuf, float *buf1, float *buf2)
 {
     if (softproof2ref) {
         const int width = image->getWidth();
         
         float delta_max = lab2ref ? 0.0001f : 4.9999f;
-        cmsDoTransform(lab2softproof, srcbuf, buf2, width);
+        transform(lab2softproof, lab2softproof_ms, srcbuf, buf2, width);
         // since we are checking for out-of-gamut, we do want to clamp here!
         for (int i = 0; i < width * 3; ++i) {
             buf2[i] = LIM01(buf2[i]);
         }
-        cmsDoTransform(softproof2ref, buf2, buf1, width);
+        transform(softproof2ref, softproof2ref_ms, buf2, buf1, width);
         
         float *proofdata = buf1;
         float *refdata = srcbuf;
         
         if (lab2ref) {
-            cmsDoTransform(lab2ref, srcbuf, buf2, width);
+            transform(lab2ref, lab2ref_ms, srcbuf, buf2, width);
             refdata = buf2;
 
             int iy = 0;
@@ -28,6 +28,7 @@
 #include "iccstore.h"
 #include "noncopyable.h"
 #include "image8.h"
+#include "matrixshaper.h"
 
 namespace rtengine {
 
@@ -40,9 +41,16 @@ public:
 private:
     void mark(Image8 *image, int i, int j);
     
+    void transform(cmsHTRANSFORM xform, const std::unique_ptr<MatrixShaperTransform> &ms, const float *src, float *dst, int n);
+    
     cmsHTRANSFORM lab2ref;
     cmsHTRANSFORM lab2softproof;
     cmsHTRANSFORM softproof2ref;
+
+    // built-in replacements of the above, when possible
+    std::unique_ptr<MatrixShaperTransform> lab2ref_ms;
+    std::unique_ptr<MatrixShaperTransform> lab2softproof_ms;
+    std::unique_ptr<MatrixShaperTransform> softproof2ref_ms;
 };
 
 } // namespace rtengine
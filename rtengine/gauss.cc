@@ -23,8 +23,13 @@
 #include "opthelper.h"
 #include "boxblur.h"
 #include "alignedbuffer.h"
+#include "cpudispatch.h"
 
-namespace {
+// compile the kernels once for each ISA level, see cpudispatch_targets.h
+#define ART_DISPATCH_FILE "gauss.cc"
+#include "cpudispatch_targets.h"
+
+namespace { namespace ART_ISA_NAMESPACE {
 
 template <class T>
 class AlignedMatrix {
@@ -1566,10 +1571,14 @@ template<class T> void gaussianBlurImpl(T** src, T** dst, const int W, const int
     }
 }
 
-} // namespace
+}} // namespace ART_ISA_NAMESPACE
+
+#ifdef ART_DISPATCH_ONCE
 
 void gaussianBlur(float** src, float** dst, const int W, const int H, const double sigma, float *buffer, eGaussType gausstype, float** buffer2)
 {
-    gaussianBlurImpl<float>(src, dst, W, H, sigma, buffer, gausstype, buffer2);
+    ART_DISPATCH(gaussianBlurImpl<float>)(src, dst, W, H, sigma, buffer, gausstype, buffer2);
 }
 
+#endif // ART_DISPATCH_ONCE
+
@@ -0,0 +1,216 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "geometrymesh.h"
+#include "imagefloat.h"
+#include "settings.h"
+#include "cpudispatch.h"
+#include <algorithm>
+#include <iostream>
+
+// compile the kernels once for each ISA level, see cpudispatch_targets.h
+#define ART_DISPATCH_FILE "geometrymesh.cc"
+#include "cpudispatch_targets.h"
+
+namespace { namespace ART_ISA_NAMESPACE {
+
+using rtengine::GeometryMesh;
+
+// pixels processed at a time, in buffers on the stack
+constexpr int BLOCK = 256;
+
+
+// resamples row y of the output. rx and ry must have room for grid_w values
+void resample_row(const GeometryMesh::Data &d, float **const *src, int sw, int sh, float **const *dst, float invalid, int y, float *rx, float *ry)
+{
+    alignas(64) int ix[BLOCK];
+    alignas(64) int iy[BLOCK];
+    alignas(64) float fx[BLOCK];
+    alignas(64) float fy[BLOCK];
+    alignas(64) float wx[4][BLOCK];
+    alignas(64) float wy[4][BLOCK];
+
+    // same kernel as interpolateTransformCubic in iptransform.cc
+    constexpr float A = -0.85f;
+
+    const int j = y / d.step;
+    const float t = float(y - j * d.step) / d.step;
+    const float inv_step = 1.f / d.step;
+    // coordinates outside of these bounds are all equally invalid. The
+    // clamping also maps NaNs to invalid coordinates
+    const float xlo = -2.f, xhi = sw + 2.f;
+    const float ylo = -2.f, yhi = sh + 2.f;
+
+    for (int m = 0; m < d.channels; ++m) {
+        // the nodes of the current row, interpolated between the two
+        // enclosing rows of the grid
+        const float *x0 = &d.sx[m][size_t(j) * d.grid_w];
+        const float *x1 = x0 + d.grid_w;
+        const float *y0 = &d.sy[m][size_t(j) * d.grid_w];
+        const float *y1 = y0 + d.grid_w;
+        for (int i = 0; i < d.grid_w; ++i) {
+            rx[i] = x0[i] + t * (x1[i] - x0[i]);
+            ry[i] = y0[i] + t * (y1[i] - y0[i]);
+        }
+
+        // with a single mesh channel, the coordinates and weights are shared
+        // by the three channels of the image
+        const int c0 = d.channels == 1 ? 0 : m;
+        const int c1 = d.channels == 1 ? 3 : m + 1;
+
+        for (int start = 0; start < d.width; start += BLOCK) {
+            const int cnt = std::min(BLOCK, d.width - start);
+
+            // source coordinates and interpolation weights. All branch-free,
+            // so that the compiler can vectorize it
+            for (int k = 0; k < cnt; ++k) {
+                const int x = start + k;
+                const int i = x / d.step;
+                const float u = (x - i * d.step) * inv_step;
+                const float X = std::min(std::max(xlo, rx[i] + u * (rx[i+1] - rx[i])), xhi);
+                const float Y = std::min(std::max(ylo, ry[i] + u * (ry[i+1] - ry[i])), yhi);
+                // truncation, as in the per-pixel code of iptransform.cc
+                const int xc = X;
+                const int yc = Y;
+                const float Dx = X - xc;
+                const float Dy = Y - yc;
+                ix[k] = xc;
+                iy[k] = yc;
+                fx[k] = Dx;
+                fy[k] = Dy;
+
+                const float t1h = A * (Dx - Dx * Dx);
+                const float t2h = (3.f - 2.f * Dx) * Dx * Dx;
+                wx[0][k] = t1h - t1h * Dx;
+                wx[1][k] = 1.f - t1h * Dx - t2h;
+                wx[2][k] = t1h * Dx - t1h + t2h;
+                wx[3][k] = t1h * Dx;
+
+                const float t1v = A * (Dy - Dy * Dy);
+                const float t2v = (3.f - 2.f * Dy) * Dy * Dy;
+                wy[0][k] = t1v - t1v * Dy;
+                wy[1][k] = 1.f - t1v * Dy - t2v;
+                wy[2][k] = t1v * Dy - t1v + t2v;
+                wy[3][k] = t1v * Dy;
+            }
+
+            for (int c = c0; c < c1; ++c) {
+                const float *const *s = src[c];
+                float *out = dst[c][y] + start;
+
+                for (int k = 0; k < cnt; ++k) {
+                    const int xc = ix[k], yc = iy[k];
+
+                    if (yc > 0 && yc < sh - 2 && xc > 0 && xc < sw - 2) {
+                        // all interpolation pixels inside the image
+                        const float *r0 = s[yc - 1] + xc - 1;
+                        const float *r1 = s[yc] + xc - 1;
+                        const float *r2 = s[yc + 1] + xc - 1;
+                        const float *r3 = s[yc + 2] + xc - 1;
+                        float v = 0.f;
+                        for (int n = 0; n < 4; ++n) {
+                            v += wx[n][k] * (wy[0][k] * r0[n] + wy[1][k] * r1[n] + wy[2][k] * r2[n] + wy[3][k] * r3[n]);
+                        }
+                        out[k] = v;
+                    } else if (yc >= 0 && yc < sh && xc >= 0 && xc < sw) {
+                        // edge pixels
+                        const int ya = yc;
+                        const int yb = std::min(yc + 1, sh - 1);
+                        const int xa = xc;
+                        const int xb = std::min(xc + 1, sw - 1);
+                        const float Dx = fx[k], Dy = fy[k];
+                        out[k] = s[ya][xa] * (1.f - Dx) * (1.f - Dy) + s[ya][xb] * Dx * (1.f - Dy) + s[yb][xa] * (1.f - Dx) * Dy + s[yb][xb] * Dx * Dy;
+                    } else {
+                        out[k] = invalid;
+                    }
+                }
+            }
+        }
+    }
+}
+
+}} // namespace ART_ISA_NAMESPACE
+
+#ifdef ART_DISPATCH_ONCE
+
+namespace rtengine {
+
+extern const Settings *settings;
+
+GeometryMesh::GeometryMesh(int width, int height, int step, int channels, const Func &f, bool multiThread)
+{
+    data_.width = width;
+    data_.height = height;
+    data_.step = std::max(step, 1);
+    data_.channels = channels == 1 ? 1 : 3;
+    // one more node past the last pixel, so that every pixel has a node on
+    // each side
+    data_.grid_w = (std::max(width, 1) - 1) / data_.step + 2;
+    data_.grid_h = (std::max(height, 1) - 1) / data_.step + 2;
+
+    const size_t n = size_t(data_.grid_w) * data_.grid_h;
+    for (int m = 0; m < data_.channels; ++m) {
+        data_.sx[m].resize(n);
+        data_.sy[m].resize(n);
+    }
+
+#ifdef _OPENMP
+#   pragma omp parallel for if (multiThread)
+#endif
+    for (int j = 0; j < data_.grid_h; ++j) {
+        for (int i = 0; i < data_.grid_w; ++i) {
+            const size_t idx = size_t(j) * data_.grid_w + i;
+            for (int m = 0; m < data_.channels; ++m) {
+                double x = 0, y = 0;
+                f(i * data_.step, j * data_.step, m, x, y);
+                data_.sx[m][idx] = x;
+                data_.sy[m][idx] = y;
+            }
+        }
+    }
+
+    if (settings->verbose > 1) {
+        std::cout << "GeometryMesh: sampled " << data_.grid_w << "x" << data_.grid_h << " nodes for " << data_.channels << " channel(s)" << std::endl;
+    }
+}
+
+
+void GeometryMesh::operator()(Imagefloat *src, Imagefloat *dst, float invalid, bool multiThread) const
+{
+    float **const s[3] = { src->r.ptrs, src->g.ptrs, src->b.ptrs };
+    float **const d[3] = { dst->r.ptrs, dst->g.ptrs, dst->b.ptrs };
+    const int sw = src->getWidth();
+    const int sh = src->getHeight();
+    const int h = std::min(data_.height, dst->getHeight());
+
+#ifdef _OPENMP
+#   pragma omp parallel if (multiThread)
+#endif
+    {
+        std::vector<float> rx(data_.grid_w), ry(data_.grid_w);
+#ifdef _OPENMP
+#       pragma omp for schedule(dynamic, 16)
+#endif
+        for (int y = 0; y < h; ++y) {
+            ART_DISPATCH(resample_row)(data_, s, sw, sh, d, invalid, y, rx.data(), ry.data());
+        }
+    }
+}
+
+} // namespace rtengine
+
+#endif // ART_DISPATCH_ONCE
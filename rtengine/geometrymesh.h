@@ -0,0 +1,76 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "noncopyable.h"
+
+namespace rtengine {
+
+class Imagefloat;
+
+/**
+ * A geometric transform (lens distortion and CA, rotation, perspective...)
+ * sampled on a sparse grid over the output image. Each node stores the
+ * source coordinates of the output pixel it sits on, separately for each
+ * channel when they differ (CA correction); in between, the coordinates are
+ * interpolated bilinearly. This way the whole chain of transforms is
+ * evaluated only once per node instead of once per pixel and per pass, and
+ * the image is resampled only once, with the kernels compiled for each
+ * supported instruction set (see cpudispatch.h).
+ */
+class GeometryMesh: public NonCopyable {
+public:
+    // f must compute the source coordinates (in pixels of the source image)
+    // of the output pixel (x, y) for the given channel (always 0 if the mesh
+    // has a single channel); it is called concurrently on the rows of the
+    // grid
+    using Func = std::function<void(int x, int y, int channel, double &sx, double &sy)>;
+
+    // a mesh for an output image of width x height pixels, with a node every
+    // step pixels. channels is 1 if the transform is the same for the three
+    // channels, 3 otherwise
+    GeometryMesh(int width, int height, int step, int channels, const Func &f, bool multiThread);
+
+    // resamples src into dst (whose size must be the one given to the
+    // constructor) with cubic interpolation, bilinear near the borders of
+    // src. The pixels mapped outside src are set to invalid
+    void operator()(Imagefloat *src, Imagefloat *dst, float invalid, bool multiThread) const;
+
+    int step() const { return data_.step; }
+    int channels() const { return data_.channels; }
+
+    // the state used by the kernels
+    struct Data {
+        int width;
+        int height;
+        int step;
+        int channels;
+        int grid_w; // number of nodes per row
+        int grid_h; // number of rows of nodes
+        std::vector<float> sx[3]; // node (i, j) at j * grid_w + i
+        std::vector<float> sy[3];
+    };
+
+private:
+    Data data_;
+};
+
+} // namespace rtengine
@@ -1304,6 +1304,33 @@ bool ICCStore::getProfileParametricTRC(cmsHPROFILE prof, float &out_gamma, float
 }
 
 
+bool ICCStore::isMatrixShaper(cmsHPROFILE prof, cmsUInt32Number intent, int direction)
+{
+    if (!prof || cmsGetColorSpace(prof) != cmsSigRgbData || cmsGetPCS(prof) != cmsSigXYZData || !cmsIsMatrixShaper(prof)) {
+        return false;
+    }
+
+    // LittleCMS falls back to the perceptual LUT when the one of the
+    // requested intent is missing, so any LUT in the given direction
+    // disqualifies the profile
+    static const cmsTagSignature input_tags[] = {
+        cmsSigAToB0Tag, cmsSigAToB1Tag, cmsSigAToB2Tag,
+        cmsSigDToB0Tag, cmsSigDToB1Tag, cmsSigDToB2Tag
+    };
+    static const cmsTagSignature output_tags[] = {
+        cmsSigBToA0Tag, cmsSigBToA1Tag, cmsSigBToA2Tag,
+        cmsSigBToD0Tag, cmsSigBToD1Tag, cmsSigBToD2Tag
+    };
+    const cmsTagSignature *tags = direction == LCMS_USED_AS_INPUT ? input_tags : output_tags;
+    for (size_t i = 0; i < sizeof(input_tags) / sizeof(input_tags[0]); ++i) {
+        if (cmsIsTag(prof, tags[i])) {
+            return false;
+        }
+    }
+    return !cmsIsCLUT(prof, intent, direction);
+}
+
+
 ICCStore::ICCStore() :
     implementation(new Implementation)
 {
@@ -107,6 +107,10 @@ public:
     bool getProfileMatrix(const Glib::ustring &name, Mat33<float> &out);
     static bool getProfileMatrix(cmsHPROFILE prof, Mat33<float> &out);
     static bool getProfileParametricTRC(cmsHPROFILE prof, float &out_gamma, float &out_slope);
+    // true if LittleCMS would use prof as a plain matrix/shaper RGB profile
+    // for the given intent and direction (LCMS_USED_AS_INPUT/OUTPUT), i.e.
+    // if it has no LUT-based tags that would take precedence
+    static bool isMatrixShaper(cmsHPROFILE prof, cmsUInt32Number intent, int direction);
 
 private:
     class Implementation;
@@ -24,6 +24,7 @@
 #include "rtengine.h"
 #include "mytime.h"
 #include "iccstore.h"
+#include "matrixshaper.h"
 #include "alignedbuffer.h"
 #include "rt_math.h"
 #include "color.h"
@@ -492,6 +493,19 @@ void Imagefloat::calcCroppedHistogram(const ProcParams &params, float scale, LUT
 
 // Parallelized transformation; create transform with cmsFLAGS_NOCACHE!
 void Imagefloat::ExecCMSTransform(cmsHTRANSFORM hTransform, bool multithread)
+{
+    exec_transform([hTransform](const float *src, float *dst, int n) { cmsDoTransform(hTransform, src, dst, n); }, multithread);
+}
+
+
+void Imagefloat::ExecCMSTransform(const MatrixShaperTransform &xform, bool multithread)
+{
+    exec_transform(xform, multithread);
+}
+
+
+template <class Xform>
+void Imagefloat::exec_transform(const Xform &xform, bool multithread)
 {
 
     // LittleCMS cannot parallelize planar setups -- Hombre: LCMS2.4 can! But it we use this new feature, memory allocation
@@ -516,7 +530,7 @@ void Imagefloat::ExecCMSTransform(cmsHTRANSFORM hTransform, bool multithread)
                 *(p++) = *(pB++);
             }
 
-            cmsDoTransform (hTransform, pBuf.data, pBuf.data, width);
+            xform(pBuf.data, pBuf.data, width);
 
             p = pBuf.data;
             pR = r(y);
@@ -534,6 +548,19 @@ void Imagefloat::ExecCMSTransform(cmsHTRANSFORM hTransform, bool multithread)
 
 // Parallelized transformation; create transform with cmsFLAGS_NOCACHE!
 void Imagefloat::ExecCMSTransform(cmsHTRANSFORM hTransform, const Imagefloat *src, bool multithread)
+{
+    exec_transform([hTransform](const float *in, float *out, int n) { cmsDoTransform(hTransform, in, out, n); }, src, multithread);
+}
+
+
+void Imagefloat::ExecCMSTransform(const MatrixShaperTransform &xform, const Imagefloat *src, bool multithread)
+{
+    exec_transform(xform, src, multithread);
+}
+
+
+template <class Xform>
+void Imagefloat::exec_transform(const Xform &xform, const Imagefloat *src, bool multithread)
 {
     mode_ = Mode::RGB;
     constexpr int cx = 0, cy = 0;
@@ -567,7 +594,7 @@ void Imagefloat::ExecCMSTransform(cmsHTRANSFORM hTransform, const Imagefloat *sr
                 *(pSrc++) = *(psB++) / 65535.f;
             }
 
-            cmsDoTransform(hTransform, bufferSrc.data, bufferRGB.data, width);
+            xform(bufferSrc.data, bufferRGB.data, width);
 
             pRGB = bufferRGB.data;
             pR = r(y - cy);
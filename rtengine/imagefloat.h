@@ -32,6 +32,7 @@ using namespace procparams;
 
 class Image8;
 class Image16;
+class MatrixShaperTransform;
 
 /*
  * Image type used by most tools; expected range: [0.0 ; 65535.0]
@@ -108,6 +109,9 @@ public:
     void calcCroppedHistogram(const ProcParams &params, float scale, LUTu & hist);
     void ExecCMSTransform(cmsHTRANSFORM hTransform, bool multithread);
     void ExecCMSTransform(cmsHTRANSFORM hTransform, const Imagefloat *img, bool multithread);
+    // same as the above, with the built-in transform for matrix/shaper profiles
+    void ExecCMSTransform(const MatrixShaperTransform &xform, bool multithread);
+    void ExecCMSTransform(const MatrixShaperTransform &xform, const Imagefloat *img, bool multithread);
 
     enum class Mode {
         RGB = 0, // r = red, g = green, b = blue
@@ -145,6 +149,8 @@ private:
     void xyz_to_lab(int y, int x, float &L, float &a, float &b);
     void yuv_to_lab(int y, int x, float &L, float &a, float &b);
     void get_ws();
+    template <class Xform> void exec_transform(const Xform &xform, bool multithread);
+    template <class Xform> void exec_transform(const Xform &xform, const Imagefloat *src, bool multithread);
     
     Glib::ustring color_space_;
     Mode mode_;
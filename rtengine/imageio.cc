@@ -79,8 +79,38 @@ FILE* g_fopen_withBinaryAndLock(const Glib::ustring& fname)
     return f;
 }
 
+
+// Selects the largest DCT scaling factor supported by libjpeg (1/2, 1/4 or
+// 1/8) for which the decoded image is still at least maxw_hint x maxh_hint,
+// so that the image can be brought to the requested size by a cheap resize
+// of a small buffer instead of decoding it at full resolution. A hint <= 0
+// leaves the corresponding dimension unconstrained
+void set_jpeg_scale(jpeg_decompress_struct &cinfo, int maxw_hint, int maxh_hint)
+{
+    if (maxw_hint <= 0 && maxh_hint <= 0) {
+        return;
+    }
+
+    int d = 8;
+    if (maxw_hint > 0) {
+        d = std::min(d, int(cinfo.image_width) / maxw_hint);
+    }
+    if (maxh_hint > 0) {
+        d = std::min(d, int(cinfo.image_height) / maxh_hint);
+    }
+
+    if (d > 1) {
+        int denom = 1;
+        while ((denom << 1) <= d) {
+            denom <<= 1;
+        }
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = denom;
+    }
 }
 
+} // namespace
+
 Glib::ustring ImageIO::errorMsg[6] = {"Success", "Cannot read file.", "Invalid header.", "Error while reading header.", "File reading error", "Image format not supported."};
 
 void ImageIO::setOutputProfile(const char* pdata, int plen)
@@ -370,7 +400,7 @@ int ImageIO::loadPNG(const Glib::ustring &fname)
 // }
 
 
-int ImageIO::loadJPEGFromMemory(const char* buffer, int bufsize)
+int ImageIO::loadJPEGFromMemory(const char* buffer, int bufsize, int maxw_hint, int maxh_hint)
 {
     jpeg_decompress_struct cinfo;
     jpeg_create_decompress(&cinfo);
@@ -413,6 +443,8 @@ int ImageIO::loadJPEGFromMemory(const char* buffer, int bufsize)
         setup_read_icc_profile (&cinfo);
 
         jpeg_read_header(&cinfo, TRUE);
+        set_jpeg_scale(cinfo, maxw_hint, maxh_hint);
+        decodeScale = cinfo.scale_denom / cinfo.scale_num;
 
         deleteLoadedProfileData();
         loadedProfileDataJpg = true;
@@ -504,19 +536,8 @@ int ImageIO::loadJPEG(const Glib::ustring &fname, int maxw_hint, int maxh_hint)
         }
 
         cinfo.out_color_space = JCS_RGB;
-        if (maxw_hint > 0 && maxh_hint > 0) {
-            int w = cinfo.image_width;
-            int h = cinfo.image_height;
-            int d1 = w / maxw_hint;
-            int d2 = h / maxh_hint;
-            int d = std::min(d1, d2);
-            if (d > 1) {
-                cinfo.scale_num = 1;
-                int l = std::min(d, 8);
-                for (d = 1; (d << 1) <= l; d = d << 1) {}
-                cinfo.scale_denom = d;
-            }
-        }
+        set_jpeg_scale(cinfo, maxw_hint, maxh_hint);
+        decodeScale = cinfo.scale_denom / cinfo.scale_num;
 
         deleteLoadedProfileData();
         loadedProfileDataJpg = true;
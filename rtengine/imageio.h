@@ -58,6 +58,7 @@ protected:
     IIOSampleFormat sampleFormat;
     IIOSampleArrangement sampleArrangement;
     Exiv2Metadata metadataInfo;
+    int decodeScale;
 
 private:
     void deleteLoadedProfileData( );
@@ -68,7 +69,8 @@ public:
     ImageIO () : pl (nullptr), embProfile(nullptr), profileData(nullptr), profileLength(0), loadedProfileData(nullptr), loadedProfileDataJpg(false),
         loadedProfileLength(0), //iptc(nullptr), exifRoot (nullptr),
         sampleFormat(IIOSF_UNKNOWN),
-        sampleArrangement(IIOSA_UNKNOWN) {}
+        sampleArrangement(IIOSA_UNKNOWN),
+        decodeScale(1) {}
 
     ~ImageIO () override;
 
@@ -77,6 +79,9 @@ public:
     IIOSampleFormat getSampleFormat() const;
     void setSampleArrangement(IIOSampleArrangement sArrangement);
     IIOSampleArrangement getSampleArrangement() const;
+    // the factor by which the image was downscaled while decoding it (see
+    // the maxw_hint/maxh_hint parameters of the load functions)
+    int getDecodeScale() const { return decodeScale; }
 
     virtual void getStdImage (const ColorTemp &ctemp, int tran, Imagefloat* image, PreviewProps pp) const = 0;
     virtual int getBPS () const = 0;
@@ -93,7 +98,7 @@ public:
     static int getPNGSampleFormat (const Glib::ustring &fname, IIOSampleFormat &sFormat, IIOSampleArrangement &sArrangement);
     static int getTIFFSampleFormat (const Glib::ustring &fname, IIOSampleFormat &sFormat, IIOSampleArrangement &sArrangement);
 
-    int loadJPEGFromMemory (const char* buffer, int bufsize);
+    int loadJPEGFromMemory (const char* buffer, int bufsize, int maxw_hint=0, int maxh_hint=0);
     int loadPPMFromMemory(const char* buffer, int width, int height, bool swap, int bps);
 
     int savePNG (const Glib::ustring &fname, int bps = -1, bool uncompressed=false) const;
@@ -31,6 +31,10 @@
 #include "metadata.h"
 #include "perspectivecorrection.h"
 #include "threadpool.h"
+#include "bufferpool.h"
+#include "pipelineprofiler.h"
+#include <algorithm>
+#include <chrono>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -41,7 +45,10 @@ using rtengine::procparams::WBParams;
 
 namespace {
 
-constexpr int VECTORSCOPE_SIZE = 128;
+// ms without parameter changes after which the detail crops rendered at half
+// resolution are refined. Changes closer than this are considered part of a
+// continuous interaction (e.g. dragging a slider)
+constexpr int PROGRESSIVE_REFINE_DELAY = 200;
 
 using rtengine::Coord2D;
 
@@ -89,8 +96,8 @@ ImProcCoordinator::ImProcCoordinator():
     vectorscopeScale(0),
     vectorscope_hc_dirty(false),
     vectorscope_hs_dirty(false),
-    vectorscope_hc(VECTORSCOPE_SIZE, VECTORSCOPE_SIZE),
-    vectorscope_hs(VECTORSCOPE_SIZE, VECTORSCOPE_SIZE),
+    vectorscope_hc(ScopeAccumulator::VECTORSCOPE_SIZE, ScopeAccumulator::VECTORSCOPE_SIZE),
+    vectorscope_hs(ScopeAccumulator::VECTORSCOPE_SIZE, ScopeAccumulator::VECTORSCOPE_SIZE),
     waveformScale(0),
     waveform_dirty(false),
     waveformRed(0, 0),
@@ -124,7 +131,13 @@ ImProcCoordinator::ImProcCoordinator():
     changeSinceLast(0),
     updaterRunning(false),
     destroying(false),
-    highQualityComputed(false)
+    highQualityComputed(false),
+    newer_params_(false),
+    redo_todo_(0),
+    color_profiles_gen_(0),
+    change_time_us_(0),
+    last_change_us_(0),
+    prev_change_us_(0)
 {
     for (int i = 0; i < 3; ++i) {
         bufs_[i] = nullptr;
@@ -142,7 +155,11 @@ void ImProcCoordinator::assign(ImageSource* imgsrc)
 
 ImProcCoordinator::~ImProcCoordinator()
 {
-    destroying = true;
+    {
+        std::lock_guard<std::mutex> lck(updater_mutex_);
+        destroying = true;
+    }
+    params_cond_.notify_all();
     // updaterThreadStart.lock();
 
     wait_not_running();
@@ -187,16 +204,38 @@ void ImProcCoordinator::restoreParams()
 
 // todo: bitmask containing desired actions, taken from changesSinceLast
 // cropCall: calling crop, used to prevent self-updates  ...doesn't seem to be used
-void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
+bool ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange, bool coarse)
 {
     MyMutex::MyLock processingLock(mProcessing);
     int numofphases = 14;
     int readyphase = 0;
 
+    ipf.setCancelFlag(settings->preview_cancellation ? &newer_params_ : nullptr);
+
+    const auto interrupted =
+        [&]() -> bool
+        {
+            if (!ipf.cancelled()) {
+                return false;
+            }
+            // the next pass must redo all the work of this one, except for
+            // the raw processing, which is complete at this point
+            redo_todo_ |= todo & ~(M_PREPROC | M_RAW);
+            if (orig_prev != oprevi && oprevi != spotprev) {
+                delete oprevi;
+                oprevi = nullptr;
+            }
+            return true;
+        };
+
     DCPProfile *dcpProf = imgsrc->getDCP(params.icm, dcpApplyState);
+    if (dcpProf) {
+        dcpProf->setStep2LUT(params.icm.workingProfile, settings->dcp_lut_size, dcpApplyState);
+    }
     ipf.setDCPProfile(dcpProf, dcpApplyState);
     ipf.setViewport(0, 0, -1, -1);
     ipf.setOutputHistograms(&histToneCurve, &histCCurve, &histLCurve);
+    ipf.setCheckpointCache(&checkpoints_);
 
     if (todo == CROP && ipf.needsPCVignetting()) {
         todo |= M_LUMINANCE; //TRANSFORM;    // Change about Crop does affect TRANSFORM
@@ -437,6 +476,10 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             // if (oprevi != orig_prev) {
             //     delete oprevi;
             // }
+
+            if (interrupted()) {
+                return false;
+            }
         }
         stop = pipeline_stop_[0];
     
@@ -498,6 +541,12 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         }
     
         progress("Exposure curve & CIELAB conversion...", 100 * readyphase / numofphases);
+
+        // the input of STAGE_1 has changed, the checkpoints of the following
+        // stages are no longer valid
+        if (todo & (M_SPOT | M_WHITEBALANCE | M_PREPROC | M_RAW | M_INIT | M_LINDENOISE | M_HDR | M_TRANSFORM | M_BLURMAP)) {
+            checkpoints_.clear();
+        }
     
         if ((todo & M_RGBCURVE) || (todo & M_CROP)) {
             // if it's just crop we just need the histogram, no image updates
@@ -505,6 +554,10 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
                 //initialize rrm bbm ggm different from zero to avoid black screen in some cases
                 oprevi->copyTo(bufs_[0]);
                 pipeline_stop_[1] = stop || ipf.process(ImProcFunctions::Pipeline::NAVIGATOR, ImProcFunctions::Stage::STAGE_1, bufs_[0]);
+
+                if (interrupted()) {
+                    return false;
+                }
             }
     
             // compute L channel histogram
@@ -518,12 +571,20 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         if (todo & M_LUMACURVE) {
             bufs_[0]->copyTo(bufs_[1]);
             pipeline_stop_[2] = stop || ipf.process(ImProcFunctions::Pipeline::NAVIGATOR, ImProcFunctions::Stage::STAGE_2, bufs_[1]);
+
+            if (interrupted()) {
+                return false;
+            }
         }
         stop = stop || pipeline_stop_[2];
 
         if (todo & (M_LUMINANCE | M_COLOR)) {
             bufs_[1]->copyTo(bufs_[2]);
             pipeline_stop_[3] = stop || ipf.process(ImProcFunctions::Pipeline::NAVIGATOR, ImProcFunctions::Stage::STAGE_3, bufs_[2]);
+
+            if (interrupted()) {
+                return false;
+            }
         }
         stop = stop || pipeline_stop_[3];
     
@@ -533,18 +594,33 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             lastOutputIntent = params.icm.outputIntent;
             lastOutputBPC = params.icm.outputBPC;
             ipf.updateColorProfiles(monitorProfile, monitorIntent, softProof, gamutCheck);
+            ++color_profiles_gen_;
         }
     }
 
-    // process crop, if needed
+    // process crop, if needed. An interrupted crop keeps track of its
+    // remaining work by itself, while the (cheap) conversion of the
+    // navigator image below is completed anyway
+    std::vector<std::pair<Crop *, bool>> to_update;
+    const int threshold = settings->progressive_preview_threshold;
     for (size_t i = 0; i < crops.size(); i++)
         if (crops[i]->hasListener() && (panningRelatedChange || (highDetailNeeded && options.prevdemo != PD_Sidecar) || (todo & (M_MONITOR | M_RGBCURVE | M_LUMACURVE)) || crops[i]->get_skip() == 1)) {
-            crops[i]->update(todo);     // may call ourselves
+            const bool c = coarse && threshold > 0 && crops[i]->get_update_time() > threshold;
+            to_update.emplace_back(crops[i], c);
         }
+    const bool complete = updateCrops(to_update, todo);
 
     if (panningRelatedChange || (todo & M_MONITOR)) {
         progress("Conversion to RGB...", 100 * readyphase / numofphases);
 
+        // the scopes currently shown are accumulated during the conversion
+        // to the output profile, the others are computed on demand
+        const bool scope_hist = hListener && hListener->updateHistogram();
+        const bool scope_hc = hListener && hListener->updateVectorscopeHC();
+        const bool scope_hs = hListener && hListener->updateVectorscopeHS();
+        const bool scope_waveform = hListener && hListener->updateWaveform();
+        bool scopes_done = false;
+
         if ((todo != CROP && todo != MINUPDATE) || (todo & M_MONITOR)) {
             MyMutex::MyLock prevImgLock(previmg->getMutex());
 
@@ -554,10 +630,12 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
                 // Computing the internal image for analysis, i.e. conversion from WCS->Output profile
                 delete workimg;
-                workimg = ipf.rgb2out(bufs_[2], 0, 0, pW, pH, params.icm);
+                const auto scopes = newScopeAccumulator(scope_hist, scope_hc, scope_hs, scope_waveform);
+                workimg = ipf.rgb2out(bufs_[2], 0, 0, pW, pH, params.icm, true, scopes.get());
+                scopes_done = true;
             } catch (char * str) {
                 progress("Error converting file...", 0);
-                return;
+                return complete;
             }
         }
 
@@ -577,18 +655,21 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
         readyphase++;
 
-        hist_lrgb_dirty = vectorscope_hc_dirty = vectorscope_hs_dirty = waveform_dirty = true;
+        hist_lrgb_dirty = !(scopes_done && scope_hist);
+        vectorscope_hc_dirty = !(scopes_done && scope_hc);
+        vectorscope_hs_dirty = !(scopes_done && scope_hs);
+        waveform_dirty = !(scopes_done && scope_waveform);
         if (hListener) {
-            if (hListener->updateHistogram()) {
+            if (scope_hist) {
                 updateLRGBHistograms();
             }
-            if (hListener->updateVectorscopeHC()) {
+            if (scope_hc) {
                 updateVectorscopeHC();
             }
-            if (hListener->updateVectorscopeHS()) {
+            if (scope_hs) {
                 updateVectorscopeHS();
             }
-            if (hListener->updateWaveform()) {
+            if (scope_waveform) {
                 updateWaveforms();
             }
             notifyHistogramChanged();
@@ -598,6 +679,94 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         delete oprevi;
         oprevi = nullptr;
     }
+
+    return complete;
+}
+
+
+bool ImProcCoordinator::updateCrops(const std::vector<std::pair<Crop *, bool>> &to_update, int todo)
+{
+    const size_t n = to_update.size();
+    if (n < 2 || !settings->concurrent_crop_updates) {
+        for (size_t i = 0; i < n; ++i) {
+            if (!to_update[i].first->update(todo, to_update[i].second)) {
+                // the interrupted crop keeps track of its remaining work,
+                // the ones not processed yet must get this pass' work too
+                for (size_t j = i + 1; j < n; ++j) {
+                    to_update[j].first->pending_todo_ |= todo;
+                }
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // each crop has its own ImProcFunctions and buffers, and the accesses
+    // to the shared state (image source, denoise info, drcomp cache) are
+    // serialized by minit, so they can be processed concurrently. The
+    // OpenMP threads are split among them
+#ifdef _OPENMP
+    const int num_threads = omp_get_max_threads();
+#else
+    const int num_threads = 1;
+#endif
+    std::vector<char> ok(n, true);
+    {
+        ThreadPool::TaskGroup group(ThreadPool::Priority::HIGHEST);
+        for (size_t i = 0; i < n; ++i) {
+            const int budget = std::max(num_threads / int(n) + (int(i) < num_threads % int(n) ? 1 : 0), 1);
+            group.run(
+                [&, i, budget]() -> void
+                {
+#ifdef _OPENMP
+                    const int prev = omp_get_max_threads();
+                    omp_set_num_threads(budget);
+#endif
+                    ok[i] = to_update[i].first->update(todo, to_update[i].second);
+#ifdef _OPENMP
+                    omp_set_num_threads(prev);
+#endif
+                });
+        }
+        // don't help running the other tasks of the pool: they could need
+        // mProcessing, which is held here
+        group.wait(false);
+    }
+
+    if (settings->verbose > 1) {
+        std::cout << "ImProcCoordinator: updated " << n << " crops concurrently, " << num_threads << " threads" << std::endl;
+    }
+
+    return std::find(ok.begin(), ok.end(), false) == ok.end();
+}
+
+
+bool ImProcCoordinator::refineCrops()
+{
+    MyMutex::MyLock processingLock(mProcessing);
+
+    ipf.setCancelFlag(settings->preview_cancellation ? &newer_params_ : nullptr);
+
+    std::vector<std::pair<Crop *, bool>> to_update;
+    for (auto c : crops) {
+        if (c->hasListener() && c->is_coarse()) {
+            to_update.emplace_back(c, false);
+        }
+    }
+    return updateCrops(to_update, 0);
+}
+
+
+bool ImProcCoordinator::hasCoarseCrops()
+{
+    MyMutex::MyLock processingLock(mProcessing);
+
+    for (auto c : crops) {
+        if (c->hasListener() && c->is_coarse()) {
+            return true;
+        }
+    }
+    return false;
 }
 
 
@@ -684,6 +853,9 @@ void ImProcCoordinator::freeAll()
     }
 
     allocated = false;
+    checkpoints_.clear();
+    // give back the memory of the idle temporaries to the system
+    BufferPool::getInstance()->clear();
 }
 
 void ImProcCoordinator::allocCache (Imagefloat* &imgfloat)
@@ -788,242 +960,23 @@ void ImProcCoordinator::notifyHistogramChanged()
 
 bool ImProcCoordinator::updateLRGBHistograms()
 {
-
-    if (!hist_lrgb_dirty) {
+    if (!workimg || !hist_lrgb_dirty) {
         return false;
     }
 
-    int x1, y1, x2, y2;
-    params.crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
-
-#ifdef _OPENMP
-    #pragma omp parallel sections
-#endif
-    {
-#ifdef _OPENMP
-        #pragma omp section
-#endif
-        {
-            histLuma.clear();
-            histChroma.clear();
-
-            for (int i = y1; i < y2; i++)
-                for (int j = x1; j < x2; j++)
-                {
-                    float L, a, b;
-                    bufs_[2]->getLab(i, j, L, a, b);
-                    histChroma[(int)(sqrtf(SQR(a) + SQR(b)) / 188.f)]++;      //188 = 48000/256
-                    histLuma[(int)(L / 128.f)]++;
-                }
-        }
-// #ifdef _OPENMP
-//         #pragma omp section
-// #endif
-//         {
-//             histLuma.clear();
-
-//             for (int i = y1; i < y2; i++)
-//                 for (int j = x1; j < x2; j++)
-//                 {
-//                     histLuma[(int)(nprevl->L[i][j] / 128.f)]++;
-//                 }
-//         }
-#ifdef _OPENMP
-        #pragma omp section
-#endif
-        {
-            histRed.clear();
-            histGreen.clear();
-            histBlue.clear();
-
-            for (int i = y1; i < y2; i++)
-            {
-                int ofs = (i * pW + x1) * 3;
-
-                for (int j = x1; j < x2; j++) {
-                    int r = workimg->data[ofs++];
-                    int g = workimg->data[ofs++];
-                    int b = workimg->data[ofs++];
-
-                    histRed[r]++;
-                    histGreen[g]++;
-                    histBlue[b]++;
-                }
-            }
-        }
-    }
-
+    newScopeAccumulator(true, false, false, false)->process(workimg, 0, 0, bufs_[2], true);
     hist_lrgb_dirty = false;
     return true;
-
 }
 
 
-namespace {
-
-void rgb2lab(const Image8 &src, int x, int y, int w, int h, float L[], float a[], float b[], const procparams::ColorManagementParams &icm)
-{ // Adapted from ImProcFunctions::lab2rgb
-    const int src_width = src.getWidth();
-    const int src_height = src.getHeight();
-
-    if (x < 0) {
-        x = 0;
-    }
-
-    if (y < 0) {
-        y = 0;
-    }
-
-    if (x + w > src_width) {
-        w = src_width - x;
-    }
-
-    if (y + h > src_height) {
-        h = src_height - y;
-    }
-
-    Glib::ustring profile;
-
-    cmsHPROFILE oprof = nullptr;
-
-    if (settings->HistogramWorking) {
-        profile = icm.workingProfile;
-    } else {
-        profile = icm.outputProfile;
-
-        if (icm.outputProfile.empty() || icm.outputProfile == ColorManagementParams::NoICMString) {
-            profile = "sRGB";
-        }
-        oprof = ICCStore::getInstance()->getProfile(profile);
-    }
-
-    if (oprof) {
-        cmsUInt32Number flags = cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE; // NOCACHE is important for thread safety
-
-        if (icm.outputBPC) {
-            flags |= cmsFLAGS_BLACKPOINTCOMPENSATION;
-        }
-
-        lcmsMutex->lock();
-        cmsHPROFILE LabIProf  = cmsCreateLab4Profile(nullptr);
-        cmsHTRANSFORM hTransform = cmsCreateTransform (oprof, TYPE_RGB_8, LabIProf, TYPE_Lab_FLT, icm.outputIntent, flags);
-        cmsCloseProfile(LabIProf);
-        lcmsMutex->unlock();
-
-        // cmsDoTransform is relatively expensive
-#ifdef _OPENMP
-        #pragma omp parallel
-#endif
-        {
-            AlignedBuffer<float> oBuf(3 * w);
-            float *outbuffer = oBuf.data;
-            int condition = y + h;
-
-#ifdef _OPENMP
-            #pragma omp for schedule(dynamic,16)
-#endif
-
-            for (int i = y; i < condition; i++) {
-                const int ix = 3 * (x + i * src_width);
-                int iy = 0;
-                float* rL = L + (i - y) * w;
-                float* ra = a + (i - y) * w;
-                float* rb = b + (i - y) * w;
-
-                cmsDoTransform (hTransform, src.data + ix, outbuffer, w);
-
-                for (int j = 0; j < w; j++) {
-                    rL[j] = outbuffer[iy++] * 327.68f;
-                    ra[j] = outbuffer[iy++] * 327.68f;
-                    rb[j] = outbuffer[iy++] * 327.68f;
-                }
-            }
-        } // End of parallelization
-
-        cmsDeleteTransform(hTransform);
-    } else {
-        TMatrix wprof = ICCStore::getInstance()->workingSpaceMatrix(profile);
-        const float wp[3][3] = {
-            {static_cast<float>(wprof[0][0]), static_cast<float>(wprof[0][1]), static_cast<float>(wprof[0][2])},
-            {static_cast<float>(wprof[1][0]), static_cast<float>(wprof[1][1]), static_cast<float>(wprof[1][2])},
-            {static_cast<float>(wprof[2][0]), static_cast<float>(wprof[2][1]), static_cast<float>(wprof[2][2])}
-        };
-
-        const int x2 = x + w;
-        const int y2 = y + h;
-        constexpr float rgb_factor = 65355.f / 255.f;
-
-#ifdef _OPENMP
-#       pragma omp parallel for schedule(dynamic,16) //if (multiThread)
-#endif
-        for (int i = y; i < y2; i++) {
-            int offset = (i - y) * w;
-            for (int j = x; j < x2; j++) {
-                float X, Y, Z;
-                // lab2rgb uses gamma2curve, which is gammatab_srgb.
-                const auto &igamma = Color::igammatab_srgb;
-                Color::rgbxyz(igamma[rgb_factor * src.r(i, j)], igamma[rgb_factor * src.g(i, j)], igamma[rgb_factor * src.b(i, j)], X, Y, Z, wp);
-                Color::XYZ2Lab(X, Y, Z, L[offset], a[offset], b[offset]);
-                offset++;
-            }
-        }
-    }
-}
-
-} // namespace
-
 bool ImProcCoordinator::updateVectorscopeHC()
 {
     if (!workimg || !vectorscope_hc_dirty) {
         return false;
     }
 
-    int x1, y1, x2, y2;
-    params.crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
-
-    constexpr int size = VECTORSCOPE_SIZE;
-    constexpr float norm_factor = size / (128.f * 655.36f);
-    vectorscope_hc.fill(0);
-
-    vectorscopeScale = (x2 - x1) * (y2 - y1);
-
-    const std::unique_ptr<float[]> a(new float[vectorscopeScale]);
-    const std::unique_ptr<float[]> b(new float[vectorscopeScale]);
-    const std::unique_ptr<float[]> L(new float[vectorscopeScale]);
-    rgb2lab(*workimg, x1, y1, x2 - x1, y2 - y1, L.get(), a.get(), b.get(), params.icm);
-    
-#ifdef _OPENMP
-    #pragma omp parallel
-#endif
-    {
-        array2D<int> vectorscopeThr(size, size, ARRAY2D_CLEAR_DATA);
-#ifdef _OPENMP
-        #pragma omp for nowait
-#endif
-        for (int i = y1; i < y2; ++i) {
-            for (int j = x1, ofs_lab = (i - y1) * (x2 - x1); j < x2; ++j, ++ofs_lab) {
-                const int col = norm_factor * a[ofs_lab] + size / 2 + 0.5f;
-                const int row = norm_factor * b[ofs_lab] + size / 2 + 0.5f;
-                if (col >= 0 && col < size && row >= 0 && row < size) {
-                    vectorscopeThr[row][col]++;
-                }
-            }
-        }
-#ifdef _OPENMP
-        #pragma omp critical
-#endif
-        {
-            for (int y = 0; y < vectorscope_hc.height(); ++y) {
-#ifdef _OPENMP
-#               pragma omp simd
-#endif
-                for (int x = 0; x < vectorscope_hc.width(); ++x) {
-                    vectorscope_hc[y][x] += vectorscopeThr[y][x];
-                }
-            }
-        }
-    }
-
+    newScopeAccumulator(false, true, false, false)->process(workimg, 0, 0, bufs_[2], true);
     vectorscope_hc_dirty = false;
     return true;
 }
@@ -1035,53 +988,7 @@ bool ImProcCoordinator::updateVectorscopeHS()
         return false;
     }
 
-    int x1, y1, x2, y2;
-    params.crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
-
-    constexpr int size = VECTORSCOPE_SIZE;
-    vectorscope_hs.fill(0);
-
-    vectorscopeScale = (x2 - x1) * (y2 - y1);
-
-#ifdef _OPENMP
-    #pragma omp parallel
-#endif
-    {
-        array2D<int> vectorscopeThr(size, size, ARRAY2D_CLEAR_DATA);
-#ifdef _OPENMP
-        #pragma omp for nowait
-#endif
-        for (int i = y1; i < y2; ++i) {
-            int ofs = (i * pW + x1) * 3;
-            for (int j = x1; j < x2; ++j) {
-                const float red = 257.f * workimg->data[ofs++];
-                const float green = 257.f * workimg->data[ofs++];
-                const float blue = 257.f * workimg->data[ofs++];
-                float h, s, l;
-                Color::rgb2hslfloat(red, green, blue, h, s, l);
-                const auto sincosval = xsincosf(2.f * RT_PI_F * h);
-                const int col = s * sincosval.y * (size / 2) + size / 2;
-                const int row = s * sincosval.x * (size / 2) + size / 2;
-                if (col >= 0 && col < size && row >= 0 && row < size) {
-                    vectorscopeThr[row][col]++;
-                }
-            }
-        }
-#ifdef _OPENMP
-        #pragma omp critical
-#endif
-        {
-            for (int y = 0; y < vectorscope_hs.height(); ++y) {
-#ifdef _OPENMP
-#               pragma omp simd
-#endif
-                for (int x = 0; x < vectorscope_hs.width(); ++x) {
-                    vectorscope_hs[y][x] += vectorscopeThr[y][x];
-                }
-            }
-        }
-    }
-
+    newScopeAccumulator(false, false, true, false)->process(workimg, 0, 0, bufs_[2], true);
     vectorscope_hs_dirty = false;
     return true;
 }
@@ -1102,43 +1009,47 @@ bool ImProcCoordinator::updateWaveforms()
         return false;
     }
 
+    newScopeAccumulator(false, false, false, true)->process(workimg, 0, 0, bufs_[2], true);
+    waveform_dirty = false;
+    return true;
+}
+
+
+std::unique_ptr<ScopeAccumulator> ImProcCoordinator::newScopeAccumulator(bool histograms, bool hc, bool hs, bool waveforms)
+{
+    if (!histograms && !hc && !hs && !waveforms) {
+        return nullptr;
+    }
+
     int x1, y1, x2, y2;
     params.crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
-    int waveform_width = waveformRed.width();
-
-    if (waveform_width != x2 - x1) {
-        // Resize waveform arrays.
-        waveform_width = x2 - x1;
-        waveformRed(waveform_width, 256);
-        waveformGreen(waveform_width, 256);
-        waveformBlue(waveform_width, 256);
-        waveformLuma(waveform_width, 256);
-    }
-
-    // Start with zero.
-    waveformRed.fill(0);
-    waveformGreen.fill(0);
-    waveformBlue.fill(0);
-    waveformLuma.fill(0);
-
-    constexpr float luma_factor = 255.f / 32768.f;
-    for (int i = y1; i < y2; i++) {
-        int ofs = (i * pW + x1) * 3;
-        //float* L_row = nprevl->L[i] + x1;
-
-        for (int j = 0; j < waveform_width; j++) {
-            waveformRed[workimg->data[ofs++]][j]++;
-            waveformGreen[workimg->data[ofs++]][j]++;
-            waveformBlue[workimg->data[ofs++]][j]++;
-            float L, a, b;
-            bufs_[2]->getLab(i, j, L, a, b);
-            waveformLuma[LIM<int>(L * luma_factor + 0.5, 0, 255)][j]++;
-        }
+
+    ScopeAccumulator::Output out;
+    if (histograms) {
+        out.hist_red = &histRed;
+        out.hist_green = &histGreen;
+        out.hist_blue = &histBlue;
+        out.hist_luma = &histLuma;
+        out.hist_chroma = &histChroma;
+    }
+    if (hc) {
+        out.vectorscope_hc = &vectorscope_hc;
+    }
+    if (hs) {
+        out.vectorscope_hs = &vectorscope_hs;
+    }
+    if (hc || hs) {
+        vectorscopeScale = (x2 - x1) * (y2 - y1);
+    }
+    if (waveforms) {
+        out.waveform_red = &waveformRed;
+        out.waveform_green = &waveformGreen;
+        out.waveform_blue = &waveformBlue;
+        out.waveform_luma = &waveformLuma;
+        waveformScale = y2 - y1;
     }
 
-    waveformScale = y2 - y1;
-    waveform_dirty = false;
-    return true;
+    return std::unique_ptr<ScopeAccumulator>(new ScopeAccumulator(params.icm, out, x1, y1, x2, y2));
 }
 
 
@@ -1454,7 +1365,7 @@ void ImProcCoordinator::startProcessing()
 void ImProcCoordinator::startProcessing(int changeCode)
 {
     paramsUpdateMutex.lock();
-    changeSinceLast |= update_change_flags(nextParams, changeCode);
+    params_changed(changeCode);
     paramsUpdateMutex.unlock();
 
     startProcessing();
@@ -1464,17 +1375,36 @@ void ImProcCoordinator::process()
 {
     if (plistener) {
         plistener->setProgressState(true);
-        ipf.setProgressListener(plistener, crops.size() + 1);
+        ipf.setProgressListener(plistener, 1);
     }
 
+    const auto report_latency =
+        [this](int64_t t0, const char *what) -> void
+        {
+            if (!t0) {
+                return;
+            }
+            if (settings->verbose) {
+                std::cout << "ImProcCoordinator: " << what << " latency: " << (PipelineProfiler::now_us() - t0) / 1000 << " ms" << std::endl;
+            }
+            PipelineProfiler::getInstance()->record("latency", what, pW, pH, t0);
+        };
+
     paramsUpdateMutex.lock();
 
     bool changed = false;
     while (changeSinceLast) {
         const bool panningRelatedChange = true;
         params = nextParams;
-        int change = changeSinceLast;
+        int change = changeSinceLast | redo_todo_;
         changeSinceLast = 0;
+        redo_todo_ = 0;
+        newer_params_ = false;
+        const int64_t t0 = change_time_us_;
+        change_time_us_ = 0;
+        // render the slow crops at half resolution while the parameters
+        // keep changing
+        const bool coarse = settings->progressive_preview_threshold > 0 && last_change_us_ - prev_change_us_ < PROGRESSIVE_REFINE_DELAY * 1000;
         if (tweakOperator) {
             // TWEAKING THE PROCPARAMS FOR THE SPOT ADJUSTMENT MODE
             backupParams();
@@ -1488,13 +1418,38 @@ void ImProcCoordinator::process()
         paramsUpdateMutex.unlock();
 
         // M_VOID means no update, and is a bit higher that the rest
+        bool complete = true;
         if (change & (M_VOID - 1)) {
-            updatePreviewImage(change, panningRelatedChange);
+            complete = updatePreviewImage(change, panningRelatedChange, coarse);
             changed = true;
         }
 
+        if (complete && hasCoarseCrops()) {
+            report_latency(t0, "preview-coarse");
+
+            // refine once the input goes idle
+            bool busy = false;
+            {
+                std::unique_lock<std::mutex> lck(updater_mutex_);
+                busy = params_cond_.wait_for(lck, std::chrono::milliseconds(PROGRESSIVE_REFINE_DELAY), [this]() -> bool { return newer_params_ || destroying; });
+            }
+            if (!busy) {
+                complete = refineCrops();
+                if (complete) {
+                    report_latency(t0, "preview-refined");
+                }
+            }
+        } else if (complete) {
+            report_latency(t0, "preview");
+        }
+
         paramsUpdateMutex.lock();
 
+        if (!complete && t0) {
+            // still not displayed
+            change_time_us_ = change_time_us_ ? std::min(change_time_us_, t0) : t0;
+        }
+
         if (tweakOperator) {
             restoreParams();
         }
@@ -1526,6 +1481,30 @@ void ImProcCoordinator::endUpdateParams(ProcEvent change)
 }
 
 
+// must be called with paramsUpdateMutex locked
+void ImProcCoordinator::params_changed(int changeFlags)
+{
+    changeSinceLast |= update_change_flags(nextParams, changeFlags);
+
+    if (!(changeFlags & (M_VOID - 1))) {
+        return; // no update of the preview
+    }
+
+    const int64_t now = PipelineProfiler::now_us();
+    if (!change_time_us_) {
+        change_time_us_ = now;
+    }
+    prev_change_us_ = last_change_us_;
+    last_change_us_ = now;
+
+    {
+        std::lock_guard<std::mutex> lck(updater_mutex_);
+        newer_params_ = true;
+    }
+    params_cond_.notify_all();
+}
+
+
 int ImProcCoordinator::update_change_flags(const ProcParams &pp, int flags)
 {
     if (flags & (LINKEDMASK & ~LINKEDMASK_FIRST)) {
@@ -1545,7 +1524,7 @@ int ImProcCoordinator::update_change_flags(const ProcParams &pp, int flags)
 
 void ImProcCoordinator::endUpdateParams(int changeFlags)
 {
-    changeSinceLast |= update_change_flags(nextParams, changeFlags);
+    params_changed(changeFlags);
 
     paramsUpdateMutex.unlock();
     startProcessing();
@@ -27,8 +27,11 @@
 #include "procevents.h"
 #include "dcrop.h"
 #include "LUT.h"
+#include "scopes.h"
 #include "../rtgui/threadutils.h"
 
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 
@@ -58,6 +61,7 @@ protected:
     Imagefloat *oprevi;
     Imagefloat *spotprev;
     Imagefloat *bufs_[3];
+    PipelineCheckpointCache checkpoints_;
     std::array<bool, 4> pipeline_stop_;
     
     Imagefloat *drcomp_11_dcrop_cache; // global cache for dynamicRangeCompression used in 1:1 detail windows (except when denoise is active)
@@ -142,7 +146,16 @@ protected:
     void reallocAll ();
     void allocCache (Imagefloat* &imgfloat);
     void setScale (int prevscale);
-    void updatePreviewImage (int todo, bool panningRelatedChange);
+    // returns false if the processing was interrupted by newer parameters.
+    // If coarse is true, the slow detail crops are rendered at half resolution
+    bool updatePreviewImage (int todo, bool panningRelatedChange, bool coarse);
+    // renders at full resolution the detail crops left at half resolution by
+    // the previous pass. Returns false if interrupted
+    bool refineCrops();
+    // updates the given crops (with their coarse flag), concurrently if
+    // possible. Returns false if interrupted
+    bool updateCrops(const std::vector<std::pair<Crop *, bool>> &to_update, int todo);
+    bool hasCoarseCrops();
     void updateWB();
 
     void notifyHistogramChanged();
@@ -154,6 +167,9 @@ protected:
     bool updateVectorscopeHS();
     /// Updates all waveforms. Returns true unless not updated.
     bool updateWaveforms();
+    /// Returns an accumulator for the given scopes on the cropped area of
+    /// the preview, or nullptr if none is requested.
+    std::unique_ptr<ScopeAccumulator> newScopeAccumulator(bool histograms, bool hc, bool hs, bool waveforms);
     
     MyMutex mProcessing;
     ProcParams params;
@@ -181,6 +197,20 @@ protected:
     void process ();
     bool highQualityComputed;
 
+    // set when new parameters arrive, reset when process() takes them. It
+    // interrupts the running pass (see ImProcFunctions::setCancelFlag) when
+    // Settings::preview_cancellation is on
+    std::atomic<bool> newer_params_;
+    std::condition_variable params_cond_; // signals newer_params_, with updater_mutex_
+    int redo_todo_; // work of an interrupted pass of the navigator pipeline
+    int color_profiles_gen_; // incremented at each ipf.updateColorProfiles() call, see Crop::update
+    // for measuring the latency between a parameter change and its display
+    // (PipelineProfiler clock, 0 if none)
+    int64_t change_time_us_; // the oldest change not displayed yet
+    int64_t last_change_us_;
+    int64_t prev_change_us_;
+    void params_changed(int changeFlags);
+
     void wait_not_running();
     void set_updater_running(bool val);
     int update_change_flags(const ProcParams &pp, int flags);
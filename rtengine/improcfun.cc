@@ -42,6 +42,7 @@
 #include "../rtgui/ppversion.h"
 #include "../rtgui/guiutils.h"
 #include "refreshmap.h"
+#include "pipelineprofiler.h"
 
 namespace rtengine {
 
@@ -70,7 +71,9 @@ ImProcFunctions::ImProcFunctions(const ProcParams* iparams, bool imultiThread):
     show_sharpening_mask(false),
     plistener(nullptr),
     progress_step(0),
-    progress_end(1)
+    progress_end(1),
+    checkpoints(nullptr),
+    cancel_flag_(nullptr)
 {
 }
 
@@ -95,6 +98,7 @@ void ImProcFunctions::updateColorProfiles (const Glib::ustring& monitorProfile,
         cmsDeleteTransform (monitorTransform);
     }
     gamutWarning.reset(nullptr);
+    monitorMatrixShaper.reset();
 
     monitorTransform = nullptr;
     monitor = nullptr;
@@ -231,6 +235,7 @@ void ImProcFunctions::updateColorProfiles (const Glib::ustring& monitorProfile,
 
             monitorTransform = cmsCreateTransform (iprof, TYPE_RGB_FLT, 
                                                    monitor, TYPE_RGB_FLT, monitorIntent, flags);
+            monitorMatrixShaper = MatrixShaperTransform::create(iprof, TYPE_RGB_FLT, monitor, TYPE_RGB_FLT, monitorIntent, flags);
         }
 
         if (gamutCheck && gamutprof) {
@@ -553,94 +558,275 @@ void ImProcFunctions::setProgressListener(ProgressListener *pl, int num_previews
 }
 
 
+const char *ImProcFunctions::pipeline_name() const
+{
+    switch (cur_pipeline) {
+    case Pipeline::THUMBNAIL: return "thumbnail";
+    case Pipeline::NAVIGATOR: return "navigator";
+    case Pipeline::PREVIEW: return "preview";
+    default: return "output";
+    }
+}
+
+
 template <class Ret, class Method>
-Ret ImProcFunctions::apply(Method op, Imagefloat *img)
+Ret ImProcFunctions::apply(const char *name, Method op, Imagefloat *img)
 {
     if (plistener) {
         float percent = float(++progress_step) / float(progress_end);
         plistener->setProgress(percent);
     }
+    PipelineProfiler::Scope prof(name, pipeline_name(), img->getWidth(), img->getHeight());
     return (this->*op)(img);
 }
 
 
-bool ImProcFunctions::process(Pipeline pipeline, Stage stage, Imagefloat *img)
+std::vector<ImProcFunctions::PipelineStep> ImProcFunctions::get_pipeline_steps(Pipeline pipeline, Stage stage)
 {
-    bool stop = false;
-    cur_pipeline = pipeline;
+    std::vector<PipelineStep> steps;
+
+#define DEPS_(...) \
+    PipelineStep::depends_on(__VA_ARGS__)
+#define STEP_(op, checkpoint, p) \
+    steps.emplace_back(#op, [this](Imagefloat *img) -> bool { apply<void>(#op, &ImProcFunctions::op, img); return false; }, checkpoint, DEPS_(&ProcParams::p))
+#define STEP_s_(op, checkpoint, p) \
+    steps.emplace_back(#op, [this](Imagefloat *img) -> bool { return apply<bool>(#op, &ImProcFunctions::op, img); }, checkpoint, DEPS_(&ProcParams::p))
 
-#define STEP_(op) apply<void>(&ImProcFunctions::op, img)
-#define STEP_s_(op) apply<bool>(&ImProcFunctions::op, img)
+    // steps whose output depends only on the parameters shared by the whole
+    // pipeline (see process_checkpointed())
+    const auto no_deps = DEPS_();
+
+    const auto dcp_step =
+        [this](Imagefloat *img) -> bool
+        {
+            PipelineProfiler::Scope prof("dcpProfile", pipeline_name(), img->getWidth(), img->getHeight());
+            dcpProfile(img, dcpProf, dcpApplyState, multiThread);
+            return false;
+        };
         
     switch (stage) {
     case Stage::STAGE_0:
-        STEP_(dehaze);
-        STEP_(dynamicRangeCompression);
+        STEP_(dehaze, params->dehaze.enabled, dehaze);
+        STEP_(dynamicRangeCompression, params->fattal.enabled, fattal);
         break;
     case Stage::STAGE_1:
-        STEP_(channelMixer);
-        STEP_(exposure);
-        STEP_(hslEqualizer);
-        stop = STEP_s_(toneEqualizer);
+        STEP_(channelMixer, false, chmixer);
+        STEP_(exposure, false, exposure);
+        // the guided filter used for smoothing works on a subsampled copy of
+        // the whole image
+        STEP_(hslEqualizer, params->hsl.enabled && params->hsl.smoothing > 0, hsl);
+        STEP_s_(toneEqualizer, params->toneEqualizer.enabled, toneEqualizer);
         if (params->icm.workingProfile == "ProPhoto") {
-            proPhotoBlue(img, multiThread);
+            steps.emplace_back("proPhotoBlue", [this](Imagefloat *img) -> bool { proPhotoBlue(img, multiThread); return false; }, false, no_deps, true);
         }
         break;
     case Stage::STAGE_2:
         if (params->icm.dcp_look_early) {
-            dcpProfile(img, dcpProf, dcpApplyState, multiThread);
+            steps.emplace_back("dcpProfile", dcp_step, false, no_deps);
         }
-        linked_mask_mgr_.init(*params);
+        steps.emplace_back("linkedMasks", [this](Imagefloat *) -> bool { linked_mask_mgr_.init(*params); return false; }, true, no_deps);
         if (pipeline == Pipeline::OUTPUT || pipeline == Pipeline::PREVIEW) {
-            stop = STEP_s_(sharpening);
-            if (!stop) {
-                STEP_(impulsedenoise);
-                STEP_(defringe);
-            }
+            STEP_s_(sharpening, params->sharpening.enabled, sharpening);
+            STEP_(impulsedenoise, params->impulseDenoise.enabled, impulseDenoise);
+            STEP_(defringe, params->defringe.enabled, defringe);
         }
-        stop = stop || STEP_s_(colorCorrection);
-        stop = stop || STEP_s_(guidedSmoothing);
+        STEP_s_(colorCorrection, params->colorcorrection.enabled, colorcorrection);
+        steps.emplace_back(
+            "guidedSmoothing", [this](Imagefloat *img) -> bool { return apply<bool>("guidedSmoothing", &ImProcFunctions::guidedSmoothing, img); }, params->smoothing.enabled,
+            DEPS_(&ProcParams::smoothing, &ProcParams::denoise));
         break;
     case Stage::STAGE_3:
-        STEP_(creativeGradients);
-        stop = stop || STEP_s_(textureBoost);
-        if (!stop) { 
-            STEP_(filmGrain);
-            STEP_(logEncoding);
-            STEP_(saturationVibrance);
-            if (!params->icm.dcp_look_early) {
-                dcpProfile(img, dcpProf, dcpApplyState, multiThread);
-            }
-            if (!params->filmSimulation.after_tone_curve) {
-                STEP_(filmSimulation);
-            }
-            STEP_(toneCurve);
-            if (params->filmSimulation.after_tone_curve) {
-                STEP_(filmSimulation);
-            }
-            STEP_(rgbCurves);
-            STEP_(labAdjustments);
-            STEP_(softLight);
+        // gradients and vignetting depend on the pixel position, which is
+        // taken into account by the viewport (see setViewport())
+        steps.emplace_back(
+            "creativeGradients", [this](Imagefloat *img) -> bool { apply<void>("creativeGradients", &ImProcFunctions::creativeGradients, img); return false; }, false,
+            DEPS_(&ProcParams::gradient, &ProcParams::pcvignette, &ProcParams::crop));
+        STEP_s_(textureBoost, params->textureBoost.enabled, textureBoost);
+        STEP_(filmGrain, params->grain.enabled, grain);
+        STEP_(logEncoding, params->logenc.enabled && params->logenc.regularization > 0, logenc);
+        STEP_(saturationVibrance, false, saturation);
+        if (!params->icm.dcp_look_early) {
+            steps.emplace_back("dcpProfile", dcp_step, false, no_deps);
         }
-        stop = stop || STEP_s_(localContrast);
-        if (!stop) {
-            STEP_(blackAndWhite);
+        if (!params->filmSimulation.after_tone_curve) {
+            STEP_(filmSimulation, false, filmSimulation);
         }
+        steps.emplace_back(
+            "toneCurve", [this](Imagefloat *img) -> bool { apply<void>("toneCurve", &ImProcFunctions::toneCurve, img); return false; }, params->toneCurve.enabled && params->toneCurve.contrastLegacyMode && params->toneCurve.contrast,
+            DEPS_(&ProcParams::toneCurve, &ProcParams::logenc));
+        if (params->filmSimulation.after_tone_curve) {
+            STEP_(filmSimulation, false, filmSimulation);
+        }
+        STEP_(rgbCurves, false, rgbCurves);
+        STEP_(labAdjustments, params->labCurve.enabled && params->labCurve.contrast, labCurve);
+        STEP_(softLight, false, softlight);
+        STEP_s_(localContrast, params->localContrast.enabled, localContrast);
+        STEP_(blackAndWhite, false, blackwhite);
         if (pipeline == Pipeline::PREVIEW && params->prsharpening.enabled) {
-            double s = scale;
-            int fw = full_width * s, fh = full_height * s;
-            int imw, imh;
-            double s2 = resizeScale(params, fw, fh, imw, imh);
-            scale = std::max(s * s2, 1.0);
-            STEP_s_(prsharpening);
-            scale = s;
+            steps.emplace_back(
+                "prsharpening", [this](Imagefloat *img) -> bool
+                {
+                    double s = scale;
+                    int fw = full_width * s, fh = full_height * s;
+                    int imw, imh;
+                    double s2 = resizeScale(params, fw, fh, imw, imh);
+                    scale = std::max(s * s2, 1.0);
+                    apply<bool>("prsharpening", &ImProcFunctions::prsharpening, img);
+                    scale = s;
+                    return false;
+                }, true,
+                DEPS_(&ProcParams::prsharpening, &ProcParams::resize), true);
         }
         break;
     }
+
+#undef STEP_
+#undef STEP_s_
+#undef DEPS_
+
+    return steps;
+}
+
+
+bool ImProcFunctions::process(Pipeline pipeline, Stage stage, Imagefloat *img)
+{
+    bool stop = false;
+    cur_pipeline = pipeline;
+
+    // the checkpoints are taken on the navigator image only (detail crops
+    // share the same ImProcFunctions instance)
+    if (checkpoints && checkpoints->enabled() && pipeline == Pipeline::NAVIGATOR && stage != Stage::STAGE_0) {
+        return process_checkpointed(pipeline, stage, img);
+    }
+
+    for (auto &step : get_pipeline_steps(pipeline, stage)) {
+        if (cancelled()) {
+            break;
+        }
+        if (!stop || step.always) {
+            stop = step.op(img) || stop;
+        }
+    }
     return stop;
 }
 
 
+bool ImProcFunctions::process_checkpointed(Pipeline pipeline, Stage stage, Imagefloat *img)
+{
+    const auto steps = get_pipeline_steps(pipeline, stage);
+
+    // steps of the previous stages, which determine the input of this one
+    std::vector<PipelineStep> prev;
+    for (int s = int(Stage::STAGE_1); s < int(stage); ++s) {
+        for (auto &step : get_pipeline_steps(pipeline, Stage(s))) {
+            prev.push_back(step);
+        }
+    }
+
+    // parameters that affect all the steps, or the structure of the step
+    // lists (which is also recorded in the layout)
+    const auto global = PipelineStep::depends_on(&ProcParams::icm, &ProcParams::wb);
+
+    std::string layout;
+    for (auto &step : prev) {
+        layout += std::string(step.name) + ",";
+    }
+    layout += "|";
+    for (auto &step : steps) {
+        layout += std::string(step.name) + ",";
+    }
+
+    // copies of the parameters of global, prev and steps (in this order),
+    // taken only up to the last checkpoint stored. The checkpoints share
+    // them
+    std::vector<PipelineStep::Snapshot> deps;
+    const auto snapshot =
+        [&](size_t step) -> std::vector<PipelineStep::Snapshot>
+        {
+            if (deps.empty()) {
+                deps.push_back(global.snapshot(*params));
+                for (auto &s : prev) {
+                    deps.push_back(s.deps.snapshot(*params));
+                }
+            }
+            const size_t n = 1 + prev.size() + step + 1;
+            while (deps.size() < n) {
+                deps.push_back(steps[deps.size() - 1 - prev.size()].deps.snapshot(*params));
+            }
+            return std::vector<PipelineStep::Snapshot>(deps.begin(), deps.begin() + n);
+        };
+
+    const auto run =
+        [&](size_t first, bool store) -> bool
+        {
+            bool stop = false;
+            for (size_t i = first; i < steps.size() && !cancelled(); ++i) {
+                auto &step = steps[i];
+                if (!stop || step.always) {
+                    stop = step.op(img) || stop;
+                }
+                // pointwise steps are cheaper to replay than to snapshot.
+                // The output of an interrupted step must never be stored
+                if (store && !stop && step.checkpoint && !cancelled()) {
+                    checkpoints->store(int(stage), i, scale, layout, snapshot(i), img, histToneCurve, histLCurve);
+                }
+            }
+            return stop;
+        };
+
+    // pipettes, delta E pickers and linked masks are side outputs that
+    // can't be restored from a checkpoint
+    bool linked_masks = false;
+    for (auto p : params->get_maskable()) {
+        for (auto &m : p->get_masks()) {
+            linked_masks = linked_masks || (m.enabled && m.linkedMask.enabled);
+        }
+    }
+    if (pipetteBuffer || deltaE.x >= 0 || linked_masks) {
+        return run(0, false);
+    }
+
+    const auto valid =
+        [&](const PipelineCheckpointCache::Checkpoint &cp) -> bool
+        {
+            // with the same layout, the copies in cp.params have the types
+            // expected by the deps of the current steps
+            if (cp.layout != layout || cp.scale != scale || cp.img.getWidth() != img->getWidth() || cp.img.getHeight() != img->getHeight()) {
+                return false;
+            }
+            const auto &d = cp.params;
+            if (!global.same(d[0], *params)) {
+                return false;
+            }
+            for (size_t i = 0; i < prev.size(); ++i) {
+                if (!prev[i].deps.same(d[1 + i], *params)) {
+                    return false;
+                }
+            }
+            for (int i = 0; i <= cp.step; ++i) {
+                if (!steps[i].deps.same(d[1 + prev.size() + i], *params)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+    auto cp = checkpoints->find(int(stage), valid);
+    size_t first = 0;
+    if (cp) {
+        cp->img.copyTo(img);
+        if (histToneCurve && cp->hist_tone_curve) {
+            *histToneCurve = cp->hist_tone_curve;
+        }
+        if (histLCurve && cp->hist_l_curve) {
+            *histLCurve = cp->hist_l_curve;
+        }
+        first = cp->step + 1;
+    }
+    return run(first, true);
+}
+
+
 int ImProcFunctions::setDeltaEData(EditUniqueID id, double x, double y)
 {
     deltaE.ok = false;
@@ -34,7 +34,14 @@
 #include "cplx_wavelet_dec.h"
 #include "pipettebuffer.h"
 #include "gamutwarning.h"
+#include "matrixshaper.h"
 #include "masks.h"
+#include "pipelinecheckpoints.h"
+#include "scopes.h"
+#include <atomic>
+#include <functional>
+#include <tuple>
+#include <vector>
 
 namespace rtengine {
 
@@ -44,9 +51,12 @@ struct ImProcData {
     const ProcParams *params;
     double scale;
     bool multiThread;
+    const std::atomic<bool> *cancel; // see ImProcFunctions::setCancelFlag
 
-    explicit ImProcData(const ProcParams *p=nullptr, double s=1.0, bool m=true):
-        params(p), scale(s), multiThread(m) {}
+    explicit ImProcData(const ProcParams *p=nullptr, double s=1.0, bool m=true, const std::atomic<bool> *c=nullptr):
+        params(p), scale(s), multiThread(m), cancel(c) {}
+
+    bool cancelled() const { return cancel && cancel->load(std::memory_order_relaxed); }
 };
 
 
@@ -61,7 +71,7 @@ public:
     void setScale(double iscale);
 
     void updateColorProfiles(const Glib::ustring& monitorProfile, RenderingIntent monitorIntent, bool softProof, GamutCheck gamutCheck);
-    void setMonitorTransform(cmsHTRANSFORM xform) { monitorTransform = xform; }
+    void setMonitorTransform(cmsHTRANSFORM xform) { monitorTransform = xform; monitorMatrixShaper.reset(); }
 
     void setDCPProfile(DCPProfile *dcp, const DCPProfile::ApplyState &as)
     {
@@ -96,6 +106,25 @@ public:
 
     void setViewport(int ox, int oy, int fw, int fh);
     void setOutputHistograms(LUTu *histToneCurve, LUTu *histCCurve, LUTu *histLCurve);
+    // if set, process() restarts STAGE_1..STAGE_3 of the NAVIGATOR pipeline
+    // from the latest valid checkpoint, and stores new checkpoints after the
+    // non-pointwise steps
+    void setCheckpointCache(PipelineCheckpointCache *cache) { checkpoints = cache; }
+    // if set, process() gives up as soon as *flag becomes true, between
+    // the steps and inside the most expensive ones. The output image is
+    // then garbage, and the caller must check cancelled() and discard it
+    void setCancelFlag(const std::atomic<bool> *flag) { cancel_flag_ = flag; }
+    bool cancelled() const { return cancel_flag_ && cancel_flag_->load(std::memory_order_relaxed); }
+    // copies the setup that doesn't depend on the image being processed
+    // (DCP profile and cancel flag) from another instance. Used by the
+    // detail crops, which have their own instance so that they can be
+    // processed concurrently
+    void inheritSetup(const ImProcFunctions &other)
+    {
+        dcpProf = other.dcpProf;
+        dcpApplyState = other.dcpApplyState;
+        cancel_flag_ = other.cancel_flag_;
+    }
     void setShowSharpeningMask(bool yes);
     //----------------------------------------------------------------------
     
@@ -158,7 +187,9 @@ public:
     //----------------------------------------------------------------------
     void rgb2monitor(Imagefloat *img, Image8* image, bool bypass_out=false);
     
-    Image8 *rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch, const procparams::ColorManagementParams &icm, bool consider_histogram_settings = true);
+    // if scopes is not nullptr, the scopes are accumulated during the
+    // conversion (see ScopeAccumulator)
+    Image8 *rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch, const procparams::ColorManagementParams &icm, bool consider_histogram_settings = true, ScopeAccumulator *scopes = nullptr);
 
     Imagefloat *rgb2out(Imagefloat *img, const procparams::ColorManagementParams &icm);
 
@@ -210,6 +241,14 @@ public:
 private:
     cmsHPROFILE monitor;
     cmsHTRANSFORM monitorTransform;
+    // built-in replacement of monitorTransform, when possible
+    std::unique_ptr<MatrixShaperTransform> monitorMatrixShaper;
+    // built-in transform to the output profile used by rgb2out(), kept
+    // across calls. The key identifies the working space, output profile
+    // (by content), intent and BPC it was built for (also when the output profile is not
+    // a matrix/shaper one, in which case outputMatrixShaper is null)
+    std::unique_ptr<MatrixShaperTransform> outputMatrixShaper;
+    Glib::ustring outputMatrixShaperKey;
     std::unique_ptr<GamutWarning> gamutWarning;
 
     const ProcParams* params;
@@ -240,11 +279,14 @@ private:
     int progress_end;
 
     LinkedMaskManager linked_mask_mgr_;
+    PipelineCheckpointCache *checkpoints;
+    const std::atomic<bool> *cancel_flag_;
     
 private:
     void transformLuminanceOnly(Imagefloat* original, Imagefloat* transformed, int cx, int cy, int oW, int oH, int fW, int fH, bool creative);
     void transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap);
     void transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, const LensCorrection *pLCPMap);
+    void transformMesh(Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const FramesMetaData *metadata, const LensCorrection *pLCPMap, bool needs_general, bool needs_lcp_ca, bool needs_perspective);
 
     void expcomp(Imagefloat *rgb, const procparams::ExposureParams *expparams);
     
@@ -257,8 +299,56 @@ private:
     bool needsLCP();
     bool needsLensfun();
 
+    // runs a step, updating the progress and recording it (under the given
+    // name) in the PipelineProfiler
     template <class Ret, class Method>
-    Ret apply(Method op, Imagefloat *img);
+    Ret apply(const char *name, Method op, Imagefloat *img);
+    const char *pipeline_name() const;
+
+    // a single step of ImProcFunctions::process(). checkpoint tells whether
+    // the output of the step is worth a checkpoint (see
+    // process_checkpointed()): pointwise operations are cheaper to replay.
+    // deps are the parameters the output of the step depends on
+    struct PipelineStep {
+        using Snapshot = PipelineCheckpointCache::Snapshot;
+
+        // snapshot() copies the parameters, same() tells whether a copy is
+        // equal to the current ones
+        struct Deps {
+            std::function<Snapshot(const ProcParams &)> snapshot;
+            std::function<bool(const Snapshot &, const ProcParams &)> same;
+        };
+
+        template <class... T>
+        static Deps depends_on(T ProcParams::*... members)
+        {
+            using Tuple = std::tuple<T...>;
+            Deps ret;
+            ret.snapshot =
+                [=](const ProcParams &p) -> Snapshot
+                {
+                    return std::make_shared<Tuple>((p.*members)...);
+                };
+            ret.same =
+                [=](const Snapshot &s, const ProcParams &p) -> bool
+                {
+                    return *static_cast<const Tuple *>(s.get()) == std::tie((p.*members)...);
+                };
+            return ret;
+        }
+
+        const char *name;
+        std::function<bool(Imagefloat *)> op;
+        bool checkpoint;
+        Deps deps;
+        bool always; // run even if a previous step requested to stop
+
+        PipelineStep(const char *n, std::function<bool(Imagefloat *)> o, bool c, Deps d, bool a=false):
+            name(n), op(o), checkpoint(c), deps(d), always(a) {}
+    };
+
+    std::vector<PipelineStep> get_pipeline_steps(Pipeline pipeline, Stage stage);
+    bool process_checkpointed(Pipeline pipeline, Stage stage, Imagefloat *img);
 };
 
 
@@ -17,6 +17,7 @@
  *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <fftw3.h>
+#include <iostream>
 #include "../rtgui/profilestorecombobox.h"
 #include "rtengine.h"
 #include "iccstore.h"
@@ -36,6 +37,9 @@
 #include "imgiomanager.h"
 #include "threadpool.h"
 #include "masks.h"
+#include "pipelineprofiler.h"
+#include "bufferpool.h"
+#include "cpudispatch.h"
 
 #ifdef ART_USE_OCIO
 # include "extclut.h"
@@ -59,6 +63,10 @@ MyMutex *librawMutex = nullptr;
 int init (const Settings* s, Glib::ustring baseDir, Glib::ustring userSettingsDir, bool loadAll)
 {
     settings = s;
+    cpu::init(settings->cpu_isa);
+    if (settings->verbose) {
+        std::cout << "instruction set: " << cpu::isa_name(cpu::get_isa()) << std::endl;
+    }
     ProcParams::init();
     PerceptualToneCurve::init();
     RawImageSource::init();
@@ -72,6 +80,10 @@ int init (const Settings* s, Glib::ustring baseDir, Glib::ustring userSettingsDi
     }
     ThreadPool::init(num_threads);
 
+    if (!settings->pipeline_profile_file.empty()) {
+        PipelineProfiler::getInstance()->set_enabled(true);
+    }
+
 #ifdef _OPENMP
 #pragma omp parallel sections if (!settings->verbose)
 #endif
@@ -137,6 +149,7 @@ int init (const Settings* s, Glib::ustring baseDir, Glib::ustring userSettingsDi
     ExternalLUT3D::init();
 #endif
     ExternalMaskManager::init();
+    MaskCache::init();
     
     delete lcmsMutex;
     lcmsMutex = new MyMutex;
@@ -148,10 +161,38 @@ int init (const Settings* s, Glib::ustring baseDir, Glib::ustring userSettingsDi
     return 0;
 }
 
+bool savePipelineProfile()
+{
+    auto prof = PipelineProfiler::getInstance();
+    if (!settings || settings->pipeline_profile_file.empty() || !prof->enabled()) {
+        return true;
+    }
+    prof->set_enabled(false);
+    if (!prof->save(settings->pipeline_profile_file, settings->pipeline_profile_format == 1 ? PipelineProfiler::Format::CHROME_TRACE : PipelineProfiler::Format::JSON)) {
+        std::cerr << "error writing the pipeline profile to " << settings->pipeline_profile_file << std::endl;
+        return false;
+    }
+    return true;
+}
+
 void cleanup ()
 {
+    if (settings && settings->verbose) {
+        auto st = ThreadPool::get_stats();
+        std::cout << "thread pool: " << st.num_workers << " workers, "
+                  << st.executed << " tasks executed, " << st.steals
+                  << " stolen, " << st.queue_depth << " pending" << std::endl;
+        auto bp = BufferPool::getInstance()->get_stats();
+        std::cout << "buffer pool: " << bp.hits << " allocations avoided ("
+                  << (bp.bytes_reused >> 20) << " MB reused), " << bp.misses
+                  << " allocated, " << bp.evictions << " evicted" << std::endl;
+    }
+    
+    savePipelineProfile();
+
     Exiv2Metadata::cleanup();
     ProcParams::cleanup ();
+    BufferPool::getInstance()->clear();
     Color::cleanup ();
     RawImageSource::cleanup ();
 
@@ -165,6 +206,7 @@ void cleanup ()
     ExternalLUT3D::cleanup();
 #endif
     ExternalMaskManager::cleanup();
+    MaskCache::cleanup();
 }
 
 StagedImageProcessor* StagedImageProcessor::create (InitialImage* initialImage)
@@ -196,7 +238,21 @@ Settings::Settings():
     thread_pool_size(0),
     ctl_scripts_fast_preview(false),
     os_monitor_profile(StdMonitorProfile::SRGB),
-    imgio_raw_cache_size(10)
+    imgio_raw_cache_size(10),
+    demosaic_cache_size(0),
+    preview_checkpoint_cache_size(256),
+    buffer_pool_size(512),
+    clut_cache_size(256),
+    cpu_isa("auto"),
+    dcp_lut_size(65),
+    exiftool_workers(4),
+    pipeline_profile_file(""),
+    pipeline_profile_format(0),
+    preview_cancellation(true),
+    concurrent_crop_updates(true),
+    progressive_preview_threshold(250),
+    mask_cache_size(256),
+    geometry_mesh_step(16)
 {
 }
 
@@ -233,7 +233,7 @@ bool ImProcFunctions::colorCorrection(Imagefloat *rgb)
     std::vector<array2D<float>> abmask(n);
     std::vector<array2D<float>> Lmask(n);
 
-    if (!generateMasks(rgb, "colorcorrection", linked_mask_mgr_, params->colorcorrection.masks, offset_x, offset_y, full_width, full_height, scale, multiThread, show_mask_idx, &Lmask, &abmask, cur_pipeline == Pipeline::NAVIGATOR ? plistener : nullptr)) {
+    if (!generateMasks(rgb, "colorcorrection", linked_mask_mgr_, params->colorcorrection.masks, offset_x, offset_y, full_width, full_height, scale, multiThread, show_mask_idx, &Lmask, &abmask, cur_pipeline == Pipeline::NAVIGATOR ? plistener : nullptr, cur_pipeline == Pipeline::PREVIEW || cur_pipeline == Pipeline::NAVIGATOR)) {
         return true; // show mask is active, nothing more to do
     }
     
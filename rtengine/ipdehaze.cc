@@ -404,6 +404,10 @@ void ImProcFunctions::dehaze(Imagefloat *img)
         get_dark_channel(R, G, B, dark, patchsize, ambient, true, multiThread);
     }
 
+    if (cancelled()) {
+        return; // the result is going to be discarded anyway
+    }
+
     // if (min(ambient[0], ambient[1], ambient[2]) < 0.01f) {
     //     if (options.rtSettings.verbose) {
     //         std::cout << "dehaze: no haze detected" << std::endl;
@@ -443,6 +447,10 @@ void ImProcFunctions::dehaze(Imagefloat *img)
         array2D<float> guideB(W, H, img->b.ptrs, ARRAY2D_BYREFERENCE);
         rtengine::guidedFilter(guideB, t_tilde, t, radius, epsilon, multiThread);
     }
+
+    if (cancelled()) {
+        return;
+    }
         
     DEBUG_DUMP(t);
 
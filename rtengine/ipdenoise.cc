@@ -1152,7 +1152,7 @@ void ImProcFunctions::denoise(ImageSource *imgsrc, const ColorTemp &currWB, Imag
         plistener->setProgress(0.1);
     }
 
-    ImProcData im(params, scale, multiThread);
+    ImProcData im(params, scale, multiThread, cancel_flag_);
     double ecomp = params->exposure.enabled ? params->exposure.expcomp : 0.0;
     ExposureParams expparams;
     expparams.enabled = true;
@@ -451,7 +451,7 @@ bool ImProcFunctions::localContrast(Imagefloat *rgb)
             show_mask_idx = -1;
         }
         std::vector<array2D<float>> mask(n);
-        if (!generateMasks(rgb, "localcontrast", linked_mask_mgr_, params->localContrast.masks, offset_x, offset_y, full_width, full_height, scale, multiThread, show_mask_idx, &mask, nullptr, cur_pipeline == Pipeline::NAVIGATOR ? plistener : nullptr)) {
+        if (!generateMasks(rgb, "localcontrast", linked_mask_mgr_, params->localContrast.masks, offset_x, offset_y, full_width, full_height, scale, multiThread, show_mask_idx, &mask, nullptr, cur_pipeline == Pipeline::NAVIGATOR ? plistener : nullptr, cur_pipeline == Pipeline::PREVIEW || cur_pipeline == Pipeline::NAVIGATOR)) {
             return true; // show mask is active, nothing more to do
         }
 
@@ -460,7 +460,7 @@ bool ImProcFunctions::localContrast(Imagefloat *rgb)
         
         array2D<float> L(W, H, rgb->g.ptrs);
 
-        for (int i = 0; i < n; ++i) {
+        for (int i = 0; i < n && !cancelled(); ++i) {
             if (!params->localContrast.masks[i].enabled) {
                 continue;
             }
@@ -26,6 +26,7 @@
 #include "curves.h"
 #include "alignedbuffer.h"
 #include "color.h"
+#include "matrixshaper.h"
 
 #define BENCHMARK
 #include "StopWatch.h"
@@ -50,7 +51,7 @@ inline void copyAndClampLine(const float *src, unsigned char *dst, const int W,
 }
 
 
-inline void copyAndClamp(Imagefloat *src, unsigned char *dst, const float rgb_xyz[3][3], bool multiThread)
+inline void copyAndClamp(Imagefloat *src, unsigned char *dst, const float rgb_xyz[3][3], bool multiThread, ScopeAccumulator *scopes=nullptr)
 {
     src->setMode(Imagefloat::Mode::XYZ, multiThread);
     
@@ -58,27 +59,36 @@ inline void copyAndClamp(Imagefloat *src, unsigned char *dst, const float rgb_xy
     const int H = src->getHeight();
 
 #ifdef _OPENMP
-        #pragma omp parallel for schedule(dynamic,16) if (multiThread)
+    #pragma omp parallel if (multiThread)
 #endif
-    for (int i = 0; i < H; ++i) {
-        float *rx = src->r.ptrs[i];
-        float *ry = src->g.ptrs[i];
-        float *rz = src->b.ptrs[i];
+    {
+        ScopeAccumulator::Thread scopes_thread(scopes);
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic,16)
+#endif
+        for (int i = 0; i < H; ++i) {
+            float *rx = src->r.ptrs[i];
+            float *ry = src->g.ptrs[i];
+            float *rz = src->b.ptrs[i];
         
-        int ix = i * 3 * W;
+            int ix = i * 3 * W;
 
-        float R, G, B;
-        float x_, y_, z_;
+            float R, G, B;
+            float x_, y_, z_;
 
-        for (int j = 0; j < W; ++j) {
-            x_ = rx[j];
-            y_ = ry[j];
-            z_ = rz[j];
-            Color::xyz2rgb(x_, y_, z_, R, G, B, rgb_xyz);
+            for (int j = 0; j < W; ++j) {
+                x_ = rx[j];
+                y_ = ry[j];
+                z_ = rz[j];
+                Color::xyz2rgb(x_, y_, z_, R, G, B, rgb_xyz);
 
-            dst[ix++] = uint16ToUint8Rounded(Color::gamma2curve[CLIP(R)]);
-            dst[ix++] = uint16ToUint8Rounded(Color::gamma2curve[CLIP(G)]);
-            dst[ix++] = uint16ToUint8Rounded(Color::gamma2curve[CLIP(B)]);
+                dst[ix++] = uint16ToUint8Rounded(Color::gamma2curve[CLIP(R)]);
+                dst[ix++] = uint16ToUint8Rounded(Color::gamma2curve[CLIP(G)]);
+                dst[ix++] = uint16ToUint8Rounded(Color::gamma2curve[CLIP(B)]);
+            }
+
+            scopes_thread.add_row(i, dst + i * 3 * W, 0, src);
         }
     }
 }
@@ -315,7 +325,11 @@ void ImProcFunctions::rgb2monitor(Imagefloat *img, Image8* image, bool bypass_ou
                     }
                 }
                 
-                cmsDoTransform(monitorTransform, buffer, outbuffer, W);
+                if (monitorMatrixShaper && !bypass_out) {
+                    (*monitorMatrixShaper)(buffer, outbuffer, W);
+                } else {
+                    cmsDoTransform(monitorTransform, buffer, outbuffer, W);
+                }
                 copyAndClampLine(outbuffer, data + ix, W);
 
                 if (gamutWarning) {
@@ -329,7 +343,7 @@ void ImProcFunctions::rgb2monitor(Imagefloat *img, Image8* image, bool bypass_ou
     }
 }
 
-Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch, const procparams::ColorManagementParams &icm, bool consider_histogram_settings)
+Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch, const procparams::ColorManagementParams &icm, bool consider_histogram_settings, ScopeAccumulator *scopes)
 {
     if (cx < 0) {
         cx = 0;
@@ -371,6 +385,7 @@ Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch
         img->setMode(Imagefloat::Mode::RGB, true);
 
         cmsHTRANSFORM hTransform = nullptr;
+        const MatrixShaperTransform *ms = nullptr;
 
         ARTOutputProfile op(oprof, icm, img->colorSpace(), 256);
 
@@ -381,10 +396,20 @@ Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch
                 flags |= cmsFLAGS_BLACKPOINTCOMPENSATION;
             }
 
-        
             lcmsMutex->lock();
+            // the output profile is identified by its contents, as a
+            // profile reloaded under the same name may differ
+            const auto phash = Glib::Checksum::compute_checksum(Glib::Checksum::CHECKSUM_MD5, ProfileContent(oprof).getData());
+            const Glib::ustring key = Glib::ustring::compose("%1|%2|%3|%4", img->colorSpace(), phash, int(icm.outputIntent), icm.outputBPC);
             auto iprof = ICCStore::getInstance()->workingSpace(img->colorSpace());
-            hTransform = cmsCreateTransform(iprof, TYPE_RGB_FLT, oprof, TYPE_RGB_FLT, icm.outputIntent, flags);  // NOCACHE is important for thread safety
+            if (key != outputMatrixShaperKey) {
+                outputMatrixShaper = MatrixShaperTransform::create(iprof, TYPE_RGB_FLT, oprof, TYPE_RGB_FLT, icm.outputIntent, flags, 4096);
+                outputMatrixShaperKey = key;
+            }
+            ms = outputMatrixShaper.get();
+            if (!ms) {
+                hTransform = cmsCreateTransform(iprof, TYPE_RGB_FLT, oprof, TYPE_RGB_FLT, icm.outputIntent, flags);  // NOCACHE is important for thread safety
+            }
             lcmsMutex->unlock();
         }
 
@@ -400,6 +425,7 @@ Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch
             float *buffer = pBuf.data;
             float *outbuffer = oBuf.data;
             int condition = cy + ch;
+            ScopeAccumulator::Thread scopes_thread(scopes);
 
 #ifdef _OPENMP
 #           pragma omp for firstprivate(img) schedule(dynamic,16)
@@ -420,10 +446,13 @@ Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch
 
                 if (op) {
                     op(buffer, outbuffer, cw);
+                } else if (ms) {
+                    (*ms)(buffer, outbuffer, cw);
                 } else {
                     cmsDoTransform(hTransform, buffer, outbuffer, cw);
                 }
                 copyAndClampLine(outbuffer, data + ix, cw);
+                scopes_thread.add_row(i, data + ix, cx, img);
             }
         } // End of parallelization
 
@@ -432,7 +461,11 @@ Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch
         }
     } else {
         const auto xyz_rgb = ICCStore::getInstance()->workingSpaceInverseMatrix(profile);
-        copyAndClamp(img, image->data, xyz_rgb, multiThread);
+        copyAndClamp(img, image->data, xyz_rgb, multiThread, scopes);
+    }
+
+    if (scopes) {
+        scopes->finish(image, cx, cy, multiThread);
     }
 
     return image;
@@ -454,7 +487,8 @@ Imagefloat* ImProcFunctions::rgb2out(Imagefloat *img, const procparams::ColorMan
     if (oprof) {
         img->setMode(Imagefloat::Mode::RGB, multiThread);
 
-        ARTOutputProfile op(oprof, icm, img->colorSpace(), cur_pipeline == Pipeline::OUTPUT ? -1 : (cur_pipeline == Pipeline::PREVIEW && scale == 1 ? 65536 : (cur_pipeline == Pipeline::THUMBNAIL ? 256 : 1024)));
+        const int lutsz = cur_pipeline == Pipeline::OUTPUT ? -1 : (cur_pipeline == Pipeline::PREVIEW && scale == 1 ? 65536 : (cur_pipeline == Pipeline::THUMBNAIL ? 256 : 1024));
+        ARTOutputProfile op(oprof, icm, img->colorSpace(), lutsz);
         if (op) {
             // if (settings->verbose) {
             //     std::cout << "rgb2out: converting using fast path" << std::endl;
@@ -469,11 +503,16 @@ Imagefloat* ImProcFunctions::rgb2out(Imagefloat *img, const procparams::ColorMan
 
             lcmsMutex->lock();
             cmsHPROFILE iprof = ICCStore::getInstance()->workingSpace(img->colorSpace());
-            cmsHTRANSFORM hTransform = cmsCreateTransform(iprof, TYPE_RGB_FLT, oprof, TYPE_RGB_FLT, icm.outputIntent, flags);
+            auto ms = MatrixShaperTransform::create(iprof, TYPE_RGB_FLT, oprof, TYPE_RGB_FLT, icm.outputIntent, flags, lutsz);
+            cmsHTRANSFORM hTransform = ms ? nullptr : cmsCreateTransform(iprof, TYPE_RGB_FLT, oprof, TYPE_RGB_FLT, icm.outputIntent, flags);
             lcmsMutex->unlock();
 
-            image->ExecCMSTransform(hTransform, img, multiThread);
-            cmsDeleteTransform(hTransform);
+            if (ms) {
+                image->ExecCMSTransform(*ms, img, multiThread);
+            } else {
+                image->ExecCMSTransform(hTransform, img, multiThread);
+                cmsDeleteTransform(hTransform);
+            }
         }
     } else if (icm.outputProfile != procparams::ColorManagementParams::NoProfileString) {
         img->setMode(Imagefloat::Mode::XYZ, multiThread);
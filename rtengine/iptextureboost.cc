@@ -207,7 +207,7 @@ bool ImProcFunctions::textureBoost(Imagefloat *rgb)
             show_mask_idx = -1;
         }
         std::vector<array2D<float>> mask(n);
-        if (!generateMasks(rgb, "textureboost", linked_mask_mgr_, params->textureBoost.masks, offset_x, offset_y, full_width, full_height, scale, multiThread, show_mask_idx, &mask, nullptr, cur_pipeline == Pipeline::NAVIGATOR ? plistener : nullptr)) {
+        if (!generateMasks(rgb, "textureboost", linked_mask_mgr_, params->textureBoost.masks, offset_x, offset_y, full_width, full_height, scale, multiThread, show_mask_idx, &mask, nullptr, cur_pipeline == Pipeline::NAVIGATOR ? plistener : nullptr, cur_pipeline == Pipeline::PREVIEW || cur_pipeline == Pipeline::NAVIGATOR)) {
             return true; // show mask is active, nothing more to do
         }
 
@@ -27,10 +27,14 @@
 #include "rtlensfun.h"
 #include "perspectivecorrection.h"
 #include "lensexif.h"
+#include "geometrymesh.h"
+#include "settings.h"
 #include "../rtgui/multilangmgr.h"
 
 namespace rtengine {
 
+extern const Settings *settings;
+
 namespace {
 
 float pow3 (float x)
@@ -598,42 +602,47 @@ void ImProcFunctions::transform(Imagefloat* original, Imagefloat* transformed, i
             encode(original, logimg.get(), multiThread);
             original = logimg.get();
         }
-        
-        std::unique_ptr<Imagefloat> tmpimg;
-        Imagefloat *dest = transformed;
-        int dest_x = cx, dest_y = cy;
-        
-        if (needs_lcp_ca || needs_perspective) {
-            tmpimg.reset(new Imagefloat(original->getWidth(), original->getHeight()));
-            dest = tmpimg.get();
-            dest_x = sx;
-            dest_y = sy;
-        }
-        
-        if (needs_transform_general) {
-            transformGeneral(highQuality, original, dest, dest_x, dest_y, sx, sy, oW, oH, fW, fH, pLCPMap.get());
+
+        if (do_encode && settings->geometry_mesh_step > 0) {
+            // all the geometric transforms in a single resampling pass
+            transformMesh(original, transformed, cx, cy, sx, sy, oW, oH, fW, fH, metadata, pLCPMap.get(), needs_transform_general, needs_lcp_ca, needsPerspective());
         } else {
-            dest = original;
-        }
+            std::unique_ptr<Imagefloat> tmpimg;
+            Imagefloat *dest = transformed;
+            int dest_x = cx, dest_y = cy;
         
-        if (needs_lcp_ca) {
-            Imagefloat *out = transformed;
-            dest_x = cx;
-            dest_y = cy;
-            if (needs_perspective) {
-                out = new Imagefloat(dest->getWidth(), dest->getHeight());
+            if (needs_lcp_ca || needs_perspective) {
+                tmpimg.reset(new Imagefloat(original->getWidth(), original->getHeight()));
+                dest = tmpimg.get();
                 dest_x = sx;
                 dest_y = sy;
             }
-            transformLCPCAOnly(dest, out, dest_x, dest_y, pLCPMap.get());
+        
+            if (needs_transform_general) {
+                transformGeneral(highQuality, original, dest, dest_x, dest_y, sx, sy, oW, oH, fW, fH, pLCPMap.get());
+            } else {
+                dest = original;
+            }
+        
+            if (needs_lcp_ca) {
+                Imagefloat *out = transformed;
+                dest_x = cx;
+                dest_y = cy;
+                if (needs_perspective) {
+                    out = new Imagefloat(dest->getWidth(), dest->getHeight());
+                    dest_x = sx;
+                    dest_y = sy;
+                }
+                transformLCPCAOnly(dest, out, dest_x, dest_y, pLCPMap.get());
+                if (needs_perspective) {
+                    tmpimg.reset(out);
+                    dest = out;
+                }
+            }
             if (needs_perspective) {
-                tmpimg.reset(out);
-                dest = out;
+                transform_perspective(params, metadata, dest, transformed, cx, cy, sx, sy, oW, oH, fW, fH, multiThread);
             }
         }
-        if (needs_perspective) {
-            transform_perspective(params, metadata, dest, transformed, cx, cy, sx, sy, oW, oH, fW, fH, multiThread);
-        }
 
         if (do_encode) {
             decode(transformed, multiThread);
@@ -1307,6 +1316,98 @@ void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *trans
 }
 
 
+void ImProcFunctions::transformMesh(Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const FramesMetaData *metadata, const LensCorrection *pLCPMap, bool needs_general, bool needs_lcp_ca, bool needs_perspective)
+{
+    // the mappings of transform_perspective, transformLCPCAOnly and
+    // transformGeneral (the high quality path), composed in reverse order of
+    // application and sampled on a GeometryMesh
+    PerspectiveCorrection pc;
+    if (needs_perspective) {
+        pc.init(fW, fH, params->perspective, params->commonTrans.autofill, metadata);
+    }
+    const double s = double(fW) / double(oW);
+
+    const bool enableLCPDist = pLCPMap && params->lensProf.useDist;
+    const bool enableCA = needsCA();
+    const bool enableDistortion = needsDistortion();
+
+    const double w2 = (double) oW  / 2.0 - 0.5;
+    const double h2 = (double) oH  / 2.0 - 0.5;
+
+    double vig_w2, vig_h2, maxRadius, v, b, mul;
+    calcVignettingParams (oW, oH, params->vignetting, vig_w2, vig_h2, maxRadius, v, b, mul);
+
+    const double chDist[3] = {
+        enableCA ? params->cacorrection.red : 0.0,
+        0.0,
+        enableCA ? params->cacorrection.blue : 0.0
+    };
+    const double distAmount = params->distortion.amount;
+
+    double cost, sint;
+    get_rotation(params, cost, sint);
+
+    const double ascale = params->commonTrans.autofill ? getTransformAutoFill (oW, oH, pLCPMap) : 1.0;
+
+    const int channels = (needs_general && enableCA) || needs_lcp_ca ? 3 : 1;
+
+    // from the coordinates of the output pixel to the ones of the source
+    // pixel. The intermediate results are relative to (sx, sy), as the
+    // temporary images of the multi-pass code
+    const auto f =
+        [&](int x, int y, int c, double &Dx, double &Dy) -> void
+        {
+            if (needs_perspective) {
+                Dx = (x + cx) * s;
+                Dy = (y + cy) * s;
+                pc(Dx, Dy);
+                Dx = Dx / s - sx;
+                Dy = Dy / s - sy;
+            } else {
+                Dx = x + cx - sx;
+                Dy = y + cy - sy;
+            }
+
+            if (needs_lcp_ca) {
+                pLCPMap->correctCA(Dx, Dy, sx, sy, c);
+            }
+
+            if (needs_general) {
+                double x_d = Dx, y_d = Dy;
+
+                if (enableLCPDist) {
+                    pLCPMap->correctDistortion(x_d, y_d, sx, sy, ascale); // must be first transform
+                } else {
+                    x_d *= ascale;
+                    y_d *= ascale;
+                }
+
+                x_d += ascale * (sx - w2);     // centering x coord & scale
+                y_d += ascale * (sy - h2);     // centering y coord & scale
+
+                // rotate
+                const double Dxc = x_d * cost - y_d * sint;
+                const double Dyc = x_d * sint + y_d * cost;
+
+                // distortion correction
+                double sc = 1;
+
+                if (enableDistortion) {
+                    double r = sqrt (Dxc * Dxc + Dyc * Dyc) / maxRadius;
+                    sc = 1.0 - distAmount + distAmount * r ;
+                }
+
+                // de-center
+                Dx = Dxc * (sc + chDist[c]) + w2 - sx;
+                Dy = Dyc * (sc + chDist[c]) + h2 - sy;
+            }
+        };
+
+    GeometryMesh mesh(transformed->getWidth(), transformed->getHeight(), settings->geometry_mesh_step, channels, f, multiThread);
+    mesh(original, transformed, 0.f, multiThread);
+}
+
+
 double ImProcFunctions::getTransformAutoFill (int oW, int oH, const LensCorrection *pLCPMap)
 {
     if (!needsCA() && !needsDistortion() && !needsRotation() && !needsPerspective() && (!params->lensProf.useDist || pLCPMap == nullptr)) {
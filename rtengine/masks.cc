@@ -36,10 +36,15 @@
 #include "rescale.h"
 #include "halffloat.h"
 #include "stdimagesource.h"
+#include "settings.h"
 #include "../rtgui/multilangmgr.h"
+#include <cstring>
+#include <iostream>
 
 namespace rtengine {
 
+extern const Settings *settings;
+
 using procparams::AreaMask;
 using procparams::Mask;
 using procparams::DrawnMask;
@@ -802,6 +807,61 @@ bool mask_postprocess(int width, int height, float scale, const array2D<float> &
 }
 
 
+// hash of the pixel data of img. Each row is hashed with 4 interleaved FNV-1a
+// lanes, so that the multiplications are not all serialized
+uint64_t image_hash(const Imagefloat *img, bool multithread)
+{
+    constexpr uint64_t prime = 0x100000001b3ULL;
+    constexpr uint64_t basis = 0xcbf29ce484222325ULL;
+
+    const int W = img->getWidth();
+    const int H = img->getHeight();
+    std::vector<uint64_t> rows(H);
+
+#ifdef _OPENMP
+#   pragma omp parallel for if (multithread)
+#endif
+    for (int y = 0; y < H; ++y) {
+        uint64_t h[4] = { basis, basis ^ 1, basis ^ 2, basis ^ 3 };
+        for (const float *row : { img->r(y), img->g(y), img->b(y) }) {
+            int x = 0;
+            for (; x < W - 3; x += 4) {
+                uint32_t v[4];
+                std::memcpy(v, row + x, sizeof(v));
+                for (int k = 0; k < 4; ++k) {
+                    h[k] = (h[k] ^ v[k]) * prime;
+                }
+            }
+            for (; x < W; ++x) {
+                uint32_t v;
+                std::memcpy(&v, row + x, sizeof(v));
+                h[0] = (h[0] ^ v) * prime;
+            }
+        }
+        rows[y] = ((h[0] * prime ^ h[1]) * prime ^ h[2]) * prime ^ h[3];
+    }
+
+    uint64_t ret = basis ^ (uint64_t(W) << 32) ^ uint64_t(H);
+    for (auto r : rows) {
+        ret = (ret ^ r) * prime;
+    }
+    return ret;
+}
+
+
+void copy_mask(const array2D<float> &src, array2D<float> &dst, bool multithread)
+{
+    const int W = src.width();
+    const int H = src.height();
+    dst(W, H);
+#ifdef _OPENMP
+#   pragma omp parallel for if (multithread)
+#endif
+    for (int y = 0; y < H; ++y) {
+        std::copy(src[y], src[y] + W, dst[y]);
+    }
+}
+
 } // namespace
 
 
@@ -1032,9 +1092,185 @@ bool ExternalMaskManager::apply_mask(const Glib::ustring &filename, bool inverte
     return true;
 }
 
+//-----------------------------------------------------------------------------
+// MaskCache
+//-----------------------------------------------------------------------------
+
+std::unique_ptr<MaskCache> MaskCache::instance_;
+
+bool MaskCache::Key::operator==(const Key &other) const
+{
+    return image_hash == other.image_hash
+        && offset_x == other.offset_x
+        && offset_y == other.offset_y
+        && full_width == other.full_width
+        && full_height == other.full_height
+        && scale == other.scale
+        && width == other.width
+        && height == other.height
+        && mode == other.mode
+        && has_L == other.has_L
+        && has_ab == other.has_ab
+        && toolname == other.toolname
+        && color_space == other.color_space
+        && needed == other.needed
+        && external_md5 == other.external_md5
+        && masks == other.masks;
+}
+
+
+MaskCache::MaskCache():
+    size_(0),
+    clock_(0),
+    hits_(0),
+    misses_(0)
+{
+}
+
+
+MaskCache *MaskCache::getInstance()
+{
+    return instance_.get();
+}
+
+
+void MaskCache::init()
+{
+    instance_.reset(new MaskCache());
+}
+
+
+void MaskCache::cleanup()
+{
+    instance_.reset(nullptr);
+}
+
+
+bool MaskCache::enabled() const
+{
+    return settings->mask_cache_size > 0;
+}
+
+
+void MaskCache::clear()
+{
+    MyMutex::MyLock lock(mutex_);
+    entries_.clear();
+    size_ = 0;
+}
+
+
+bool MaskCache::get(const Key &key, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask, bool multithread)
+{
+    std::shared_ptr<const Entry> e;
+    {
+        MyMutex::MyLock lock(mutex_);
+
+        for (auto &p : entries_) {
+            if (p->key == key) {
+                p->last_use = ++clock_;
+                e = p;
+                break;
+            }
+        }
+
+        if (e) {
+            ++hits_;
+        } else {
+            ++misses_;
+        }
+
+        if (settings->verbose > 1) {
+            std::cout << "MaskCache: " << (e ? "hit" : "miss") << " for " << key.toolname
+                      << ", hit rate " << (100 * hits_ / (hits_ + misses_)) << "% of "
+                      << (hits_ + misses_) << " lookups" << std::endl;
+        }
+    }
+
+    if (!e) {
+        return false;
+    }
+
+    // the masks are never modified once stored, they can be copied
+    // without holding the lock
+    for (size_t i = 0; i < key.needed.size(); ++i) {
+        if (!key.needed[i]) {
+            continue;
+        }
+        if (Lmask) {
+            copy_mask(e->Lmask[i], (*Lmask)[i], multithread);
+        }
+        if (abmask) {
+            copy_mask(e->abmask[i], (*abmask)[i], multithread);
+        }
+    }
+    return true;
+}
+
+
+void MaskCache::store(const Key &key, const std::vector<array2D<float>> *Lmask, const std::vector<array2D<float>> *abmask, bool multithread)
+{
+    const size_t budget = size_t(std::max(settings->mask_cache_size, 0)) * 1024 * 1024;
+    size_t sz = 0;
+    for (size_t i = 0; i < key.needed.size(); ++i) {
+        if (key.needed[i]) {
+            sz += size_t(key.width) * key.height * sizeof(float) * ((Lmask ? 1 : 0) + (abmask ? 1 : 0));
+        }
+    }
+    if (sz > budget) {
+        return;
+    }
+
+    std::shared_ptr<Entry> e = std::make_shared<Entry>();
+    e->key = key;
+    e->Lmask.resize(key.needed.size());
+    e->abmask.resize(key.needed.size());
+    for (size_t i = 0; i < key.needed.size(); ++i) {
+        if (!key.needed[i]) {
+            continue;
+        }
+        if (Lmask) {
+            copy_mask((*Lmask)[i], e->Lmask[i], multithread);
+        }
+        if (abmask) {
+            copy_mask((*abmask)[i], e->abmask[i], multithread);
+        }
+    }
+    e->size = sz;
+    e->last_use = 0;
+
+    MyMutex::MyLock lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if ((*it)->key == key) {
+            size_ -= (*it)->size;
+            entries_.erase(it);
+            break;
+        }
+    }
+    evict(budget - sz);
+    e->last_use = ++clock_;
+    size_ += sz;
+    entries_.emplace_back(std::move(e));
+}
+
+
+void MaskCache::evict(size_t budget)
+{
+    while (size_ > budget && !entries_.empty()) {
+        auto lru = entries_.begin();
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if ((*it)->last_use < (*lru)->last_use) {
+                lru = it;
+            }
+        }
+        size_ -= (*lru)->size;
+        entries_.erase(lru);
+    }
+}
+
 //-----------------------------------------------------------------------------
 
-bool generateMasks(Imagefloat *rgb, const Glib::ustring &toolname, LinkedMaskManager &mmgr, const std::vector<Mask> &masks, int offset_x, int offset_y, int full_width, int full_height, double scale, bool multithread, int show_mask_idx, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask, ProgressListener *plistener)
+bool generateMasks(Imagefloat *rgb, const Glib::ustring &toolname, LinkedMaskManager &mmgr, const std::vector<Mask> &masks, int offset_x, int offset_y, int full_width, int full_height, double scale, bool multithread, int show_mask_idx, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask, ProgressListener *plistener, bool use_cache)
 {
     int n = masks.size();
     if (show_mask_idx < 0 || show_mask_idx >= n || !masks[show_mask_idx].enabled) {
@@ -1086,6 +1322,68 @@ bool generateMasks(Imagefloat *rgb, const Glib::ustring &toolname, LinkedMaskMan
     assert(!abmask || abmask->size() == size_t(n));
     assert(!Lmask || Lmask->size() == size_t(n));
 
+    const auto store_linked =
+        [&](int i) -> void
+        {
+            const array2D<float> *m1 = nullptr;
+            const array2D<float> *m2 = nullptr;
+            if (Lmask && abmask) {
+                m1 = &((*abmask)[i]);
+                m2 = &((*Lmask)[i]);
+            } else if (Lmask) {
+                m1 = &((*Lmask)[i]);
+            } else {
+                m1 = &((*abmask)[i]);
+            }
+            mmgr.store_mask(toolname, masks[i].name, m1, m2, multithread);
+        };
+
+    MaskCache *mcache = MaskCache::getInstance();
+    MaskCache::Key cache_key;
+    if (use_cache && show_mask_idx < 0 && (Lmask || abmask) && mcache && mcache->enabled()) {
+        for (int i = 0; i < end_idx; ++i) {
+            // the linked masks depend on the masks of other tools
+            if (needed[i] && masks[i].linkedMask.enabled) {
+                use_cache = false;
+            }
+        }
+    } else {
+        use_cache = false;
+    }
+
+    if (use_cache) {
+        cache_key.toolname = toolname;
+        cache_key.masks = masks;
+        cache_key.needed = needed;
+        cache_key.offset_x = offset_x;
+        cache_key.offset_y = offset_y;
+        cache_key.full_width = full_width;
+        cache_key.full_height = full_height;
+        cache_key.scale = scale;
+        cache_key.width = W;
+        cache_key.height = H;
+        cache_key.mode = int(mode);
+        cache_key.color_space = rgb->colorSpace();
+        cache_key.image_hash = image_hash(rgb, multithread);
+        cache_key.has_L = Lmask;
+        cache_key.has_ab = abmask;
+        for (int i = 0; i < end_idx; ++i) {
+            auto &em = masks[i].externalMask;
+            if (needed[i] && em.enabled) {
+                cache_key.external_md5.push_back(getMD5(em.filename, true));
+            }
+        }
+
+        if (mcache->get(cache_key, Lmask, abmask, multithread)) {
+            for (int i = 0; i < end_idx; ++i) {
+                if (needed[i]) {
+                    store_linked(i);
+                }
+            }
+            return true;
+        }
+    }
+
     bool has_lmask = false;
     for (int i = 0; i < end_idx; ++i) {
         if (!needed[i]) {
@@ -1468,20 +1766,14 @@ bool generateMasks(Imagefloat *rgb, const Glib::ustring &toolname, LinkedMaskMan
         }
 
         if (Lmask || abmask) {
-            const array2D<float> *m1 = nullptr;
-            const array2D<float> *m2 = nullptr;
-            if (Lmask && abmask) {
-                m1 = &((*abmask)[i]);
-                m2 = &((*Lmask)[i]);
-            } else if (Lmask) {
-                m1 = &((*Lmask)[i]);
-            } else {
-                m1 = &((*abmask)[i]);
-            }
-            mmgr.store_mask(toolname, masks[i].name, m1, m2, multithread);
+            store_linked(i);
         }
     }
 
+    if (use_cache) {
+        mcache->store(cache_key, Lmask, abmask, multithread);
+    }
+
     if (show_mask_idx >= 0) {
         TMatrix iws = ICCStore::getInstance()->workingSpaceInverseMatrix(rgb->colorSpace());
         float iwp[3][3];
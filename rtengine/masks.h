@@ -25,6 +25,9 @@
 #include "labimage.h"
 #include "imagefloat.h"
 #include "cache.h"
+#include "../rtgui/threadutils.h"
+#include <cstdint>
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -62,7 +65,77 @@ private:
 };
 
 
-bool generateMasks(Imagefloat *rgb, const Glib::ustring &toolname, LinkedMaskManager &mmgr, const std::vector<procparams::Mask> &masks, int offset_x, int offset_y, int full_width, int full_height, double scale, bool multithread, int show_mask_idx, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask, ProgressListener *pl);
+/**
+ * The masks computed by generateMasks for the interactive pipelines, keyed by
+ * the definitions of the masks, the position and scale of the processed area
+ * and a hash of the input image. This way, changing the parameters of a
+ * masked tool (but not its masks) doesn't regenerate them. The total memory
+ * used is bounded by Settings::mask_cache_size (in MB).
+ */
+class MaskCache: public NonCopyable {
+public:
+    static MaskCache *getInstance();
+    static void init();
+    static void cleanup();
+
+    struct Key {
+        Glib::ustring toolname;
+        std::vector<procparams::Mask> masks;
+        std::vector<bool> needed;
+        std::vector<std::string> external_md5;
+        int offset_x;
+        int offset_y;
+        int full_width;
+        int full_height;
+        double scale;
+        int width;
+        int height;
+        int mode;
+        Glib::ustring color_space;
+        uint64_t image_hash;
+        bool has_L;
+        bool has_ab;
+
+        bool operator==(const Key &other) const;
+    };
+
+    bool enabled() const;
+    void clear();
+
+    // on a hit, copies the needed masks into Lmask/abmask
+    bool get(const Key &key, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask, bool multithread);
+    void store(const Key &key, const std::vector<array2D<float>> *Lmask, const std::vector<array2D<float>> *abmask, bool multithread);
+
+    unsigned long hits() const { return hits_; }
+    unsigned long misses() const { return misses_; }
+
+private:
+    struct Entry {
+        Key key;
+        std::vector<array2D<float>> Lmask;
+        std::vector<array2D<float>> abmask;
+        size_t size;
+        unsigned long last_use;
+    };
+
+    MaskCache();
+    void evict(size_t budget);
+
+    MyMutex mutex_;
+    std::vector<std::shared_ptr<Entry>> entries_;
+    size_t size_;
+    unsigned long clock_;
+    unsigned long hits_;
+    unsigned long misses_;
+
+    static std::unique_ptr<MaskCache> instance_;
+};
+
+
+// if use_cache is true, the masks are looked up in (and stored to) the
+// MaskCache. Not used when show_mask_idx is active or when the masks depend
+// on masks of other tools
+bool generateMasks(Imagefloat *rgb, const Glib::ustring &toolname, LinkedMaskManager &mmgr, const std::vector<procparams::Mask> &masks, int offset_x, int offset_y, int full_width, int full_height, double scale, bool multithread, int show_mask_idx, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask, ProgressListener *pl, bool use_cache=false);
 
 enum class MasksEditID { H = 0, C, L };
 void fillPipetteMasks(Imagefloat *rgb, PlanarWhateverData<float> *editWhatever, MasksEditID id, bool multithread);
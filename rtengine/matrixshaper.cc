@@ -0,0 +1,327 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "matrixshaper.h"
+#include "iccstore.h"
+#include "linalgebra.h"
+#include "settings.h"
+#include "cpudispatch.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// compile the kernels once for each ISA level, see cpudispatch_targets.h
+#define ART_DISPATCH_FILE "matrixshaper.cc"
+#include "cpudispatch_targets.h"
+
+namespace { namespace ART_ISA_NAMESPACE {
+
+using rtengine::MatrixShaperTransform;
+
+// pixels processed at a time, in planar buffers on the stack
+constexpr int BLOCK = 256;
+
+
+void apply_curve(const MatrixShaperTransform::Curve &c, const float *src, float *dst, int n)
+{
+    if (!c.curve) {
+        std::copy(src, src + n, dst);
+    } else if (c.lut.empty()) {
+        for (int i = 0; i < n; ++i) {
+            dst[i] = cmsEvalToneCurveFloat(c.curve, src[i]);
+        }
+    } else {
+        const float *lut = c.lut.data();
+        const int maxi = int(c.lut.size()) - 2;
+        const float scale = float(c.lut.size() - 1);
+        bool outside = false;
+
+        for (int i = 0; i < n; ++i) {
+            const float x = src[i];
+            outside |= !(x >= 0.f && x <= 1.f);
+            const float v = std::min(std::max(x, 0.f), 1.f) * scale;
+            const int j = std::min(int(v), maxi);
+            const float d = v - j;
+            dst[i] = lut[j] + d * (lut[j+1] - lut[j]);
+        }
+
+        // the LUT covers only [0, 1], out-of-range values (rare in
+        // practice) are evaluated exactly, as LittleCMS does
+        if (outside) {
+            for (int i = 0; i < n; ++i) {
+                const float x = src[i];
+                if (!(x >= 0.f && x <= 1.f)) {
+                    dst[i] = cmsEvalToneCurveFloat(c.curve, x);
+                }
+            }
+        }
+    }
+}
+
+
+void apply_matrix(const float m[3][3], const float *r, const float *g, const float *b, float *x, float *y, float *z, int n)
+{
+    const float m00 = m[0][0], m01 = m[0][1], m02 = m[0][2];
+    const float m10 = m[1][0], m11 = m[1][1], m12 = m[1][2];
+    const float m20 = m[2][0], m21 = m[2][1], m22 = m[2][2];
+
+    for (int i = 0; i < n; ++i) {
+        const float rr = r[i], gg = g[i], bb = b[i];
+        x[i] = m00 * rr + m01 * gg + m02 * bb;
+        y[i] = m10 * rr + m11 * gg + m12 * bb;
+        z[i] = m20 * rr + m21 * gg + m22 * bb;
+    }
+}
+
+
+// same as cmsLab2XYZ with a D50 white point
+void lab2xyz(const float *L, const float *a, const float *b, float *x, float *y, float *z, int n)
+{
+    constexpr float limit = 24.f / 116.f;
+    constexpr float k = 108.f / 841.f;
+    constexpr float off = 16.f / 116.f;
+    const float wx = cmsD50X, wy = cmsD50Y, wz = cmsD50Z;
+
+    for (int i = 0; i < n; ++i) {
+        const float fy = (L[i] + 16.f) / 116.f;
+        const float fx = fy + 0.002f * a[i];
+        const float fz = fy - 0.005f * b[i];
+        x[i] = wx * (fx <= limit ? k * (fx - off) : fx * fx * fx);
+        y[i] = wy * (fy <= limit ? k * (fy - off) : fy * fy * fy);
+        z[i] = wz * (fz <= limit ? k * (fz - off) : fz * fz * fz);
+    }
+}
+
+
+void transform(const MatrixShaperTransform::Data &d, const float *src, float *dst, int n)
+{
+    alignas(64) float a[3][BLOCK];
+    alignas(64) float b[3][BLOCK];
+
+    for (int start = 0; start < n; start += BLOCK) {
+        const int cnt = std::min(BLOCK, n - start);
+        const float *s = src + 3 * start;
+        float *o = dst + 3 * start;
+
+        for (int i = 0; i < cnt; ++i) {
+            a[0][i] = s[3*i];
+            a[1][i] = s[3*i+1];
+            a[2][i] = s[3*i+2];
+        }
+
+        if (d.lab_input) {
+            lab2xyz(a[0], a[1], a[2], b[0], b[1], b[2], cnt);
+        } else {
+            for (int c = 0; c < 3; ++c) {
+                apply_curve(d.in[c], a[c], b[c], cnt);
+            }
+        }
+
+        apply_matrix(d.matrix, b[0], b[1], b[2], a[0], a[1], a[2], cnt);
+
+        for (int c = 0; c < 3; ++c) {
+            apply_curve(d.out[c], a[c], b[c], cnt);
+        }
+
+        for (int i = 0; i < cnt; ++i) {
+            o[3*i] = b[0][i];
+            o[3*i+1] = b[1][i];
+            o[3*i+2] = b[2][i];
+        }
+    }
+}
+
+}} // namespace ART_ISA_NAMESPACE
+
+#ifdef ART_DISPATCH_ONCE
+
+namespace rtengine {
+
+extern const Settings *settings;
+
+namespace {
+
+// same as _cmsReadMediaWhitePoint of LittleCMS
+cmsCIEXYZ media_white_point(cmsHPROFILE prof)
+{
+    cmsCIEXYZ ret = *cmsD50_XYZ();
+    const cmsCIEXYZ *wp = static_cast<const cmsCIEXYZ *>(cmsReadTag(prof, cmsSigMediaWhitePointTag));
+    if (wp && !(cmsGetEncodedICCversion(prof) < 0x4000000 && cmsGetDeviceClass(prof) == cmsSigDisplayClass)) {
+        ret = *wp;
+    }
+    return ret;
+}
+
+
+bool is_lab_identity(cmsHPROFILE prof)
+{
+    // the profiles created by cmsCreateLab4Profile/cmsCreateLab2Profile
+    char buf[64];
+    return cmsGetColorSpace(prof) == cmsSigLabData && cmsGetPCS(prof) == cmsSigLabData
+        && cmsGetProfileInfoASCII(prof, cmsInfoDescription, "en", "US", buf, sizeof(buf)) > 0
+        && strcmp(buf, "Lab identity built-in") == 0;
+}
+
+
+// true if black point compensation would be a no-op, i.e. if LittleCMS
+// would detect the same black point for both profiles
+bool bpc_is_noop(cmsHPROFILE iprof, cmsHPROFILE oprof, cmsUInt32Number intent)
+{
+    cmsCIEXYZ bpi, bpo;
+    if (!cmsDetectBlackPoint(&bpi, iprof, intent, 0)) {
+        bpi.X = bpi.Y = bpi.Z = 0;
+    }
+    if (!cmsDetectDestinationBlackPoint(&bpo, oprof, intent, 0)) {
+        bpo.X = bpo.Y = bpo.Z = 0;
+    }
+    return bpi.X == bpo.X && bpi.Y == bpo.Y && bpi.Z == bpo.Z;
+}
+
+
+bool init_curve(cmsToneCurve *tc, bool reverse, int lutsz, MatrixShaperTransform::Curve &out)
+{
+    if (!tc) {
+        return false;
+    }
+    if (cmsIsToneCurveLinear(tc)) {
+        return true;
+    }
+
+    // LittleCMS uses cmsReverseToneCurve for the output shapers as well
+    out.curve = reverse ? cmsReverseToneCurve(tc) : cmsDupToneCurve(tc);
+    if (!out.curve) {
+        return false;
+    }
+
+    if (lutsz > 1) {
+        out.lut.resize(lutsz);
+        for (int i = 0; i < lutsz; ++i) {
+            out.lut[i] = cmsEvalToneCurveFloat(out.curve, float(i) / float(lutsz - 1));
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+
+MatrixShaperTransform::MatrixShaperTransform()
+{
+    data_.lab_input = false;
+    for (int i = 0; i < 3; ++i) {
+        data_.in[i].curve = nullptr;
+        data_.out[i].curve = nullptr;
+    }
+}
+
+
+MatrixShaperTransform::~MatrixShaperTransform()
+{
+    for (int i = 0; i < 3; ++i) {
+        if (data_.in[i].curve) {
+            cmsFreeToneCurve(data_.in[i].curve);
+        }
+        if (data_.out[i].curve) {
+            cmsFreeToneCurve(data_.out[i].curve);
+        }
+    }
+}
+
+
+std::unique_ptr<MatrixShaperTransform> MatrixShaperTransform::create(cmsHPROFILE iprof, cmsUInt32Number iformat, cmsHPROFILE oprof, cmsUInt32Number oformat, cmsUInt32Number intent, cmsUInt32Number flags, int lutsz)
+{
+    if (!iprof || !oprof || oformat != TYPE_RGB_FLT || intent > INTENT_ABSOLUTE_COLORIMETRIC) {
+        return nullptr;
+    }
+    if (flags & (cmsFLAGS_SOFTPROOFING | cmsFLAGS_GAMUTCHECK | cmsFLAGS_NULLTRANSFORM)) {
+        return nullptr;
+    }
+
+    const bool lab_input = (iformat == TYPE_Lab_FLT);
+    if (lab_input) {
+        if (!is_lab_identity(iprof)) {
+            return nullptr;
+        }
+    } else if (iformat != TYPE_RGB_FLT || !ICCStore::isMatrixShaper(iprof, intent, LCMS_USED_AS_INPUT)) {
+        return nullptr;
+    }
+    if (!ICCStore::isMatrixShaper(oprof, intent, LCMS_USED_AS_OUTPUT)) {
+        return nullptr;
+    }
+
+    // LittleCMS forces black point compensation for V4 profiles with the
+    // perceptual and saturation intents, and ignores it for absolute
+    // colorimetric
+    bool bpc = (flags & cmsFLAGS_BLACKPOINTCOMPENSATION);
+    if ((intent == INTENT_PERCEPTUAL || intent == INTENT_SATURATION) && (cmsGetEncodedICCversion(iprof) >= 0x4000000 || cmsGetEncodedICCversion(oprof) >= 0x4000000)) {
+        bpc = true;
+    }
+    if (bpc && intent != INTENT_ABSOLUTE_COLORIMETRIC && !bpc_is_noop(iprof, oprof, intent)) {
+        return nullptr;
+    }
+
+    Mat33<float> mi, mo, imo;
+    if ((!lab_input && !ICCStore::getProfileMatrix(iprof, mi)) || !ICCStore::getProfileMatrix(oprof, mo) || !inverse(mo, imo)) {
+        return nullptr;
+    }
+
+    // chromatic adaptation of LittleCMS for absolute colorimetric, with the
+    // default adaptation state of 1
+    Mat33<float> scale = identity<float>();
+    if (intent == INTENT_ABSOLUTE_COLORIMETRIC) {
+        const cmsCIEXYZ wi = media_white_point(iprof);
+        const cmsCIEXYZ wo = media_white_point(oprof);
+        scale = diagonal<float>(wi.X / wo.X, wi.Y / wo.Y, wi.Z / wo.Z);
+    }
+
+    std::unique_ptr<MatrixShaperTransform> ret(new MatrixShaperTransform());
+    auto &d = ret->data_;
+    d.lab_input = lab_input;
+
+    const cmsTagSignature trc[3] = { cmsSigRedTRCTag, cmsSigGreenTRCTag, cmsSigBlueTRCTag };
+    for (int i = 0; i < 3; ++i) {
+        if (!lab_input && !init_curve(static_cast<cmsToneCurve *>(cmsReadTag(iprof, trc[i])), false, lutsz, d.in[i])) {
+            return nullptr;
+        }
+        if (!init_curve(static_cast<cmsToneCurve *>(cmsReadTag(oprof, trc[i])), true, lutsz, d.out[i])) {
+            return nullptr;
+        }
+    }
+
+    const Mat33<float> m = lab_input ? dot_product(imo, scale) : dot_product(imo, dot_product(scale, mi));
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            d.matrix[i][j] = m[i][j];
+        }
+    }
+
+    if (settings->verbose > 1) {
+        std::cout << "MatrixShaperTransform: using the built-in matrix/shaper transform" << std::endl;
+    }
+
+    return ret;
+}
+
+
+void MatrixShaperTransform::operator()(const float *src, float *dst, int n) const
+{
+    ART_DISPATCH(transform)(data_, src, dst, n);
+}
+
+} // namespace rtengine
+
+#endif // ART_DISPATCH_ONCE
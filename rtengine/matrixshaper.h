@@ -0,0 +1,73 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <lcms2.h>
+
+#include "noncopyable.h"
+
+namespace rtengine {
+
+/**
+ * Built-in replacement of cmsDoTransform for the conversions between
+ * matrix/shaper RGB profiles (sRGB, AdobeRGB, Rec2020, ProPhoto, most of the
+ * monitor profiles...) and from Lab to such profiles, on float data. The
+ * transform is linearization curves, 3x3 matrix, inverse curves, computed
+ * on blocks of pixels with kernels compiled for each supported instruction
+ * set (see cpudispatch.h).
+ *
+ * create() returns nullptr for the profile pairs that LittleCMS would not
+ * process as plain matrix/shaper ones (LUT-based profiles, black point
+ * compensation with a non-zero black point, soft-proofing...), in which case
+ * the caller must fall back to LittleCMS.
+ */
+class MatrixShaperTransform: public NonCopyable {
+public:
+    // iformat is TYPE_RGB_FLT or TYPE_Lab_FLT, oformat must be TYPE_RGB_FLT.
+    // The tone curves are sampled in LUTs of lutsz entries, or evaluated
+    // exactly if lutsz <= 0
+    static std::unique_ptr<MatrixShaperTransform> create(cmsHPROFILE iprof, cmsUInt32Number iformat, cmsHPROFILE oprof, cmsUInt32Number oformat, cmsUInt32Number intent, cmsUInt32Number flags, int lutsz=65536);
+
+    ~MatrixShaperTransform();
+
+    // same as cmsDoTransform(xform, src, dst, n); src and dst can be the same
+    // buffer. Thread-safe
+    void operator()(const float *src, float *dst, int n) const;
+
+    // the state used by the kernels
+    struct Curve {
+        cmsToneCurve *curve; // nullptr if linear
+        std::vector<float> lut; // empty for exact evaluation
+    };
+
+    struct Data {
+        bool lab_input;
+        Curve in[3];
+        float matrix[3][3];
+        Curve out[3];
+    };
+
+private:
+    MatrixShaperTransform();
+
+    Data data_;
+};
+
+} // namespace rtengine
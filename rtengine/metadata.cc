@@ -25,6 +25,10 @@
 #include <giomm.h>
 #include <set>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+#include <cctype>
 
 #include "metadata.h"
 #include "settings.h"
@@ -32,6 +36,7 @@
 #include "../rtgui/version.h"
 #include "../rtgui/pathutils.h"
 #include "../rtgui/multilangmgr.h"
+#include "../rtgui/options.h"
 #include "subprocess.h"
 #include "cJSON.h"
 
@@ -42,7 +47,7 @@ extern const Settings *settings;
 
 std::unique_ptr<Exiv2Metadata::ImageCache> Exiv2Metadata::cache_(nullptr);
 std::unique_ptr<Exiv2Metadata::JSONCache> Exiv2Metadata::jsoncache_(nullptr);
-std::unique_ptr<Exiftool> Exiv2Metadata::exiftool_(nullptr);
+std::unique_ptr<ExiftoolPool> Exiv2Metadata::exiftool_(nullptr);
 
 namespace {
 
@@ -138,6 +143,21 @@ const char *exiftool_xmp_config =
  ");\n";
 
 
+// the XMP toolkit used by Exiv2 is not thread-safe by itself, and the
+// metadata of different images can be read and written concurrently (e.g.
+// the batch queue and the editor, or the jobs of art-cli)
+std::recursive_mutex xmp_mutex;
+
+void xmp_lock(void *data, bool lock)
+{
+    if (lock) {
+        xmp_mutex.lock();
+    } else {
+        xmp_mutex.unlock();
+    }
+}
+
+
 } // namespace
 
 
@@ -387,6 +407,501 @@ private:
 };
 
 
+/**
+ * Pool of exiftool processes, started on demand up to
+ * settings->exiftool_workers, so that threads reading metadata in parallel
+ * do not all queue behind a single pipe
+ */
+class ExiftoolPool {
+public:
+    class Handle {
+    public:
+        Handle(ExiftoolPool *pool, Exiftool *e): pool_(pool), e_(e) {}
+        Handle(Handle &&other): pool_(other.pool_), e_(other.e_) { other.e_ = nullptr; }
+        ~Handle() { release(); }
+
+        Exiftool *operator->() { return e_; }
+
+        void release()
+        {
+            if (e_) {
+                pool_->release(e_);
+                e_ = nullptr;
+            }
+        }
+
+    private:
+        ExiftoolPool *pool_;
+        Exiftool *e_;
+    };
+
+    Handle acquire()
+    {
+        std::unique_lock<std::mutex> lck(mutex_);
+        while (idle_.empty()) {
+            if (workers_.size() < size_t(std::max(settings->exiftool_workers, 1))) {
+                workers_.emplace_back(new Exiftool());
+                return Handle(this, workers_.back().get());
+            }
+            cond_.wait(lck);
+        }
+        Exiftool *e = idle_.back();
+        idle_.pop_back();
+        return Handle(this, e);
+    }
+
+    void shutdown()
+    {
+        std::unique_lock<std::mutex> lck(mutex_);
+        for (auto &w : workers_) {
+            w->shutdown();
+        }
+    }
+
+private:
+    void release(Exiftool *e)
+    {
+        {
+            std::unique_lock<std::mutex> lck(mutex_);
+            idle_.push_back(e);
+        }
+        cond_.notify_one();
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<std::unique_ptr<Exiftool>> workers_;
+    std::vector<Exiftool *> idle_;
+};
+
+
+namespace {
+
+typedef std::unordered_map<std::string, std::string> Makernotes;
+
+// max number of files queried with a single -execute
+constexpr size_t MAKERNOTES_BATCH_SIZE = 16;
+
+
+Makernotes makernotes_from_json(cJSON *obj)
+{
+    const auto tostr =
+        [](double d) -> std::string
+        {
+            if (d == int(d)) {
+                return std::to_string(int(d));
+            } else {
+                auto s = std::to_string(d);
+                auto p = s.rfind('.');
+                if (p != std::string::npos) {
+                    while (s.back() == '0') {
+                        s.pop_back();
+                    }
+                    if (s.back() == '.') {
+                        s.pop_back();
+                    }
+                }
+                return s;
+            }
+        };
+
+    Makernotes ret;
+    for (cJSON *e = obj->child; e != nullptr; e = e->next) {
+        if (e->type & cJSON_String) {
+            ret[e->string] = e->valuestring;
+        } else if (e->type & cJSON_Number) {
+            ret[e->string] = tostr(e->valuedouble);
+        } else if (e->type & cJSON_True) {
+            ret[e->string] = "true";
+        } else if (e->type & cJSON_False) {
+            ret[e->string] = "false";
+        }
+    }
+    return ret;
+}
+
+
+// exiftool reports the SourceFile with forward slashes also on Windows
+std::string normalize_source_file(const std::string &fname)
+{
+    std::string ret = fname;
+    std::replace(ret.begin(), ret.end(), '\\', '/');
+    return ret;
+}
+
+
+//-----------------------------------------------------------------------------
+// on-disk cache of the makernotes, one file per image:
+//
+// magic "ARTMKN01"
+// modification time of the image (int64 seconds, int64 microseconds)
+// number of tags (uint32)
+// for each tag: key size (uint32), key, value size (uint32), value
+//-----------------------------------------------------------------------------
+
+const char makernotes_cache_magic[8] = { 'A', 'R', 'T', 'M', 'K', 'N', '0', '1' };
+
+
+Glib::ustring get_makernotes_cache_dir()
+{
+    return Glib::build_filename(options.cacheBaseDir, "makernotes");
+}
+
+
+bool use_makernotes_cache()
+{
+    return !options.cacheBaseDir.empty() && options.maxCacheEntries > 0;
+}
+
+
+Glib::ustring get_makernotes_cache_name(const Glib::ustring &fname)
+{
+    return Glib::build_filename(get_makernotes_cache_dir(), Glib::Checksum::compute_checksum(Glib::Checksum::CHECKSUM_SHA256, fname));
+}
+
+
+bool load_makernotes_cache(const Glib::ustring &fname, const Glib::TimeVal &mtime, Makernotes &out)
+{
+    const auto name = get_makernotes_cache_name(fname);
+    gchar *contents = nullptr;
+    gsize length = 0;
+    if (!g_file_get_contents(name.c_str(), &contents, &length, nullptr)) {
+        return false;
+    }
+
+    const char *pos = contents;
+    const char *end = contents + length;
+    const auto get =
+        [&](void *dst, size_t n) -> bool
+        {
+            if (pos + n > end) {
+                return false;
+            }
+            memcpy(dst, pos, n);
+            pos += n;
+            return true;
+        };
+    const auto get_str =
+        [&](std::string &dst) -> bool
+        {
+            uint32_t n = 0;
+            if (!get(&n, sizeof(n)) || pos + n > end) {
+                return false;
+            }
+            dst.assign(pos, n);
+            pos += n;
+            return true;
+        };
+
+    char magic[sizeof(makernotes_cache_magic)];
+    int64_t sec = 0, usec = 0;
+    uint32_t count = 0;
+    bool ok = get(magic, sizeof(magic)) && memcmp(magic, makernotes_cache_magic, sizeof(magic)) == 0
+        && get(&sec, sizeof(sec)) && get(&usec, sizeof(usec)) && get(&count, sizeof(count))
+        && sec == mtime.tv_sec && usec == mtime.tv_usec;
+
+    Makernotes ret;
+    for (uint32_t i = 0; ok && i < count; ++i) {
+        std::string k, v;
+        ok = get_str(k) && get_str(v);
+        ret[k] = std::move(v);
+    }
+    ok = ok && pos == end;
+    g_free(contents);
+
+    if (!ok) {
+        g_remove(name.c_str());
+        return false;
+    }
+
+    // refresh the modification time, used by trim_makernotes_cache() to
+    // evict the least-recently used entries
+    g_utime(name.c_str(), nullptr);
+    out = std::move(ret);
+    return true;
+}
+
+
+void store_makernotes_cache(const Glib::ustring &fname, const Glib::TimeVal &mtime, const Makernotes &data)
+{
+    const auto dir = get_makernotes_cache_dir();
+    if (g_mkdir_with_parents(dir.c_str(), 0777) != 0) {
+        return;
+    }
+
+    std::string buf(makernotes_cache_magic, sizeof(makernotes_cache_magic));
+    const auto put =
+        [&](const void *src, size_t n) -> void
+        {
+            buf.append(static_cast<const char *>(src), n);
+        };
+    const auto put_str =
+        [&](const std::string &s) -> void
+        {
+            const uint32_t n = s.size();
+            put(&n, sizeof(n));
+            buf += s;
+        };
+
+    const int64_t sec = mtime.tv_sec, usec = mtime.tv_usec;
+    const uint32_t count = data.size();
+    put(&sec, sizeof(sec));
+    put(&usec, sizeof(usec));
+    put(&count, sizeof(count));
+    for (auto &p : data) {
+        put_str(p.first);
+        put_str(p.second);
+    }
+
+    // write to a temporary file first, and then rename it, so that
+    // concurrent readers never see a partially-written entry
+    const auto name = get_makernotes_cache_name(fname);
+    std::string templ = name + ".tmp-XXXXXX";
+    int fd = Glib::mkstemp(templ);
+    if (fd < 0) {
+        return;
+    }
+    const bool ok = write(fd, buf.data(), buf.size()) == ssize_t(buf.size());
+    if (close(fd) != 0 || !ok || g_rename(templ.c_str(), name.c_str()) != 0) {
+        g_remove(templ.c_str());
+        if (settings->verbose) {
+            std::cout << "makernotes cache - error storing entry for " << fname << std::endl;
+        }
+    }
+}
+
+
+void trim_makernotes_cache()
+{
+    const auto dir_name = get_makernotes_cache_dir();
+    std::vector<std::pair<Glib::TimeVal, std::string>> files;
+
+    try {
+        auto enumerator = Gio::File::create_for_path(dir_name)->enumerate_children("standard::name,time::modified");
+        while (auto file = enumerator->next_file()) {
+            files.emplace_back(file->modification_time(), file->get_name());
+        }
+    } catch (Glib::Exception &) {}
+
+    if (files.size() <= options.maxCacheEntries) {
+        return;
+    }
+
+    std::sort(files.begin(), files.end(),
+              [](const std::pair<Glib::TimeVal, std::string> &lhs, const std::pair<Glib::TimeVal, std::string> &rhs)
+              {
+                  return lhs.first < rhs.first;
+              });
+    for (size_t i = 0, n = files.size() - options.maxCacheEntries; i < n; ++i) {
+        g_remove(Glib::build_filename(dir_name, files[i].second).c_str());
+    }
+}
+
+
+/**
+ * Collects the makernote requests of concurrent threads: the thread that
+ * gets an exiftool worker first queries also the files requested by the
+ * others in the meantime, with a single -execute. The files missing from the
+ * output of a batch (or all of them, if exiftool fails) are queried again one
+ * by one, so that a single bad file doesn't affect the others
+ */
+class MakernotesBatcher {
+public:
+    // false if exiftool produced no data for fname (because it could not be
+    // run or it could not read the file)
+    bool get(ExiftoolPool &pool, const Glib::ustring &fname, Makernotes &out)
+    {
+        auto req = std::make_shared<Request>(fname);
+        {
+            std::unique_lock<std::mutex> lck(mutex_);
+            pending_.push_back(req);
+        }
+
+        auto worker = pool.acquire();
+        std::vector<std::shared_ptr<Request>> batch;
+        {
+            std::unique_lock<std::mutex> lck(mutex_);
+            if (req->taken) {
+                // someone else is querying it already
+                worker.release();
+                cond_.wait(lck, [&]() { return req->done; });
+                out = req->result;
+                return req->ok;
+            }
+            req->taken = true;
+            batch.push_back(req);
+            for (auto it = pending_.begin(); it != pending_.end(); ) {
+                if (*it == req) {
+                    it = pending_.erase(it);
+                } else if (batch.size() < MAKERNOTES_BATCH_SIZE) {
+                    (*it)->taken = true;
+                    batch.push_back(*it);
+                    it = pending_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        std::vector<Glib::ustring> fnames;
+        for (auto &r : batch) {
+            fnames.push_back(r->fname);
+        }
+        std::vector<Makernotes> results(fnames.size());
+        std::vector<uint8_t> found(fnames.size());
+        query(worker, fnames, results, found);
+        if (fnames.size() > 1) {
+            for (size_t i = 0; i < fnames.size(); ++i) {
+                if (!found[i]) {
+                    std::vector<Makernotes> r(1);
+                    std::vector<uint8_t> f(1);
+                    query(worker, { fnames[i] }, r, f);
+                    results[i] = std::move(r[0]);
+                    found[i] = f[0];
+                }
+            }
+        }
+        worker.release();
+
+        bool ok = false;
+        {
+            std::unique_lock<std::mutex> lck(mutex_);
+            for (size_t i = 0; i < batch.size(); ++i) {
+                batch[i]->result = std::move(results[i]);
+                batch[i]->ok = found[i];
+                batch[i]->done = true;
+            }
+            out = req->result;
+            ok = req->ok;
+        }
+        cond_.notify_all();
+
+        return ok;
+    }
+
+private:
+    struct Request {
+        explicit Request(const Glib::ustring &f): fname(f), taken(false), done(false), ok(false) {}
+        Glib::ustring fname;
+        Makernotes result;
+        bool taken;
+        bool done;
+        bool ok;
+    };
+
+    // found[i] is set to 1 if the output contains an entry for fnames[i]
+    bool query(ExiftoolPool::Handle &exiftool, const std::vector<Glib::ustring> &fnames, std::vector<Makernotes> &ret, std::vector<uint8_t> &found)
+    {
+        auto p = exiftool->mktemp(fnames[0], "json");
+        auto &templ = p.first;
+        int fd = p.second;
+        if (fd < 0) {
+            if (settings->verbose) {
+                std::cout << "ERROR generating temporary file: " << Glib::path_get_basename(fnames[0]) << std::endl;
+            }
+            return false;
+        }
+        Glib::ustring outname = fname_to_utf8(templ);
+
+        // the JSON output of each file is appended to outname
+        std::vector<Glib::ustring> argv = {
+            "-json",
+            "-MakerNotes:all",
+            "-RAF:all",
+            "-PanasonicRaw:all",
+            "-w+", "%0f" + outname
+        };
+        argv.insert(argv.end(), fnames.begin(), fnames.end());
+
+        std::string out, err;
+        if (!exiftool->exec(argv, &out, &err)) {
+            if (settings->verbose) {
+                std::cout << "ERROR executing exiftool with args:";
+                for (auto &a : argv) {
+                    std::cout << " " << a;
+                }
+                std::cout << std::endl;
+                std::cout << "output:\n" << out << "\nerror:\n" << err << std::endl;
+            }
+            close(fd);
+            if (Glib::file_test(outname, Glib::FILE_TEST_EXISTS)) {
+                g_remove(outname.c_str());
+            }
+            return false;
+        } else if (settings->verbose > 1) {
+            std::cout << "exiftool exec with args:";
+            for (auto &a : argv) {
+                std::cout << " " << a;
+            }
+            std::cout << std::endl;
+            std::cout << "output:\n" << out << "\nerror:\n" << err << std::endl;
+        }
+
+        close(fd);
+
+        std::string data;
+        {
+            gchar *contents = nullptr;
+            gsize length = 0;
+            if (g_file_get_contents(outname.c_str(), &contents, &length, nullptr)) {
+                data.assign(contents, length);
+                g_free(contents);
+            }
+        }
+        if (Glib::file_test(outname, Glib::FILE_TEST_EXISTS)) {
+            g_remove(outname.c_str());
+        }
+
+        std::unordered_map<std::string, size_t> index;
+        for (size_t i = 0; i < fnames.size(); ++i) {
+            index[normalize_source_file(fnames[i])] = i;
+        }
+
+        // one JSON array per file
+        const char *pos = data.c_str();
+        while (*pos) {
+            const char *end = nullptr;
+            cJSON *root = cJSON_ParseWithOpts(pos, &end, false);
+            if (!root) {
+                break;
+            }
+            if (cJSON_IsArray(root)) {
+                for (cJSON *obj = root->child; obj != nullptr; obj = obj->next) {
+                    if (!cJSON_IsObject(obj)) {
+                        continue;
+                    }
+                    auto m = makernotes_from_json(obj);
+                    auto it = index.find(normalize_source_file(m["SourceFile"]));
+                    if (it == index.end() && fnames.size() == 1) {
+                        it = index.begin();
+                    }
+                    if (it != index.end()) {
+                        m.erase("SourceFile");
+                        ret[it->second] = std::move(m);
+                        found[it->second] = 1;
+                    }
+                }
+            }
+            cJSON_Delete(root);
+            pos = end;
+            while (*pos && std::isspace(static_cast<unsigned char>(*pos))) {
+                ++pos;
+            }
+        }
+
+        return true;
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::shared_ptr<Request>> pending_;
+};
+
+MakernotesBatcher makernotes_batcher;
+
+} // namespace
+
+
 //-----------------------------------------------------------------------------
 // Exiv2Metadata
 //-----------------------------------------------------------------------------
@@ -442,7 +957,7 @@ void Exiv2Metadata::load() const
                 auto img = open_exiv2(src_, true);
                 image_.reset(img.release());
             } catch (std::exception &exc) {
-                auto img = exiftool_->import(src_, exc);
+                auto img = exiftool_->acquire()->import(src_, exc);
                 image_.reset(img.release());
             }
             if (merge_xmp_) {
@@ -829,9 +1344,9 @@ void Exiv2Metadata::init(const Glib::ustring &base_dir, const Glib::ustring &use
         exiftool_base_dir = base_dir;
     }
     exiftool_config_dir = user_dir;
-    exiftool_.reset(new Exiftool());
+    exiftool_.reset(new ExiftoolPool());
     
-    Exiv2::XmpParser::initialize();
+    Exiv2::XmpParser::initialize(xmp_lock, nullptr);
     Exiv2::XmpProperties::registerNs("us/pixls/ART/", "ART");
 #ifdef EXV_ENABLE_BMFF
     Exiv2::enableBMFF(true);
@@ -845,6 +1360,9 @@ void Exiv2Metadata::cleanup()
     if (exiftool_) {
         exiftool_->shutdown();
     }
+    if (use_makernotes_cache()) {
+        trim_makernotes_cache();
+    }
 }
 
 
@@ -855,7 +1373,7 @@ void Exiv2Metadata::embedProcParamsData(const Glib::ustring &fname, const std::s
         img->xmpData()["Xmp.ART.arp"] = data;
         img->writeMetadata();
     } catch (std::exception &exc) {
-        if (!exiftool_->embed_procparams(fname, data)) {
+        if (!exiftool_->acquire()->embed_procparams(fname, data)) {
             throw exc;
         }
     }
@@ -886,116 +1404,19 @@ std::unordered_map<std::string, std::string> Exiv2Metadata::getExiftoolMakernote
     }
 
     std::unordered_map<std::string, std::string> ret;
-    
-    auto p = exiftool_->mktemp(fname, "json");
-    auto &templ = p.first;
-    int fd = p.second;
-    if (fd < 0) {
-        if (settings->verbose) {
-            std::cout << "ERROR generating temporary file: " << Glib::path_get_basename(fname) << std::endl;
-        }
-        return ret;
-    }
-    Glib::ustring outname = fname_to_utf8(templ);
-    
-    std::vector<Glib::ustring> argv = {
-        "-json",
-        "-MakerNotes:all",
-        "-RAF:all",
-        "-PanasonicRaw:all",
-        "-w+", "%0f" + outname,
-        fname
-    };
-    std::string out, err;
-    if (!exiftool_->exec(argv, &out, &err)) {
-        if (settings->verbose) {
-            std::cout << "ERROR executing exiftool with args:";
-            for (auto &a : argv) {
-                std::cout << " " << a;
-            }
-            std::cout << std::endl;
-            std::cout << "output:\n" << out << "\nerror:\n" << err << std::endl;
-        }
-        if (Glib::file_test(outname, Glib::FILE_TEST_EXISTS)) {
-            g_remove(outname.c_str());
-        }
-        return ret;
-    } else if (settings->verbose > 1) {
-        std::cout << "exiftool exec with args:";
-        for (auto &a : argv) {
-            std::cout << " " << a;
-        }
-        std::cout << std::endl;
-        std::cout << "output:\n" << out << "\nerror:\n" << err << std::endl;
-    }
+    const bool use_disk_cache = finfo && use_makernotes_cache();
 
-    cJSON *root = nullptr;
-    close(fd);
-
-    FILE *src = g_fopen(outname.c_str(), "rb");
-    if (src) {
-        std::ostringstream data;
-        int c;
-        while (true) {
-            c = fgetc(src);
-            if (c != EOF) {
-                data << static_cast<unsigned char>(c);
-            } else {
-                break;
-            }
-        }
-        fclose(src);
-        std::string s = data.str();
-        root = cJSON_Parse(s.c_str());
-    }
-    if (Glib::file_test(outname, Glib::FILE_TEST_EXISTS)) {
-        g_remove(outname.c_str());
-    }
-    
-    if (!root) {
-        return ret;
-    }
-
-    const auto tostr =
-        [](double d) -> std::string
-        {
-            if (d == int(d)) {
-                return std::to_string(int(d));
-            } else {
-                auto s = std::to_string(d);
-                auto p = s.rfind('.');
-                if (p != std::string::npos) {
-                    while (s.back() == '0') {
-                        s.pop_back();
-                    }
-                    if (s.back() == '.') {
-                        s.pop_back();
-                    }
-                }
-                return s;
-            }
-        };
-
-    if (cJSON_IsArray(root) && cJSON_GetArraySize(root) == 1) {
-        cJSON *obj = cJSON_GetArrayItem(root, 0);
-        if (obj && cJSON_IsObject(obj)) {
-            for (cJSON *e = obj->child; e != nullptr; e = e->next) {
-                if (e->type & cJSON_String) {
-                    ret[e->string] = e->valuestring;
-                } else if (e->type & cJSON_Number) {
-                    ret[e->string] = tostr(e->valuedouble);
-                } else if (e->type & cJSON_True) {
-                    ret[e->string] = "true";
-                } else if (e->type & cJSON_False) {
-                    ret[e->string] = "false";
-                }
-            }
+    if (use_disk_cache && load_makernotes_cache(fname, finfo->modification_time(), ret)) {
+        if (settings->verbose > 1) {
+            std::cout << "retrieving exiftool makernotes from disk cache for: " << fname << std::endl;
         }
+    } else if (makernotes_batcher.get(*exiftool_, fname, ret) && use_disk_cache) {
+        // also when there are no makernotes, so that exiftool is not run
+        // again for this file. Failures are not stored, so that they are
+        // retried the next time
+        store_makernotes_cache(fname, finfo->modification_time(), ret);
     }
 
-    cJSON_Delete(root);
-    ret.erase("SourceFile");
-
     if (jsoncache_ && finfo) {
         jsoncache_->set(fname, JSONCacheVal(ret, finfo->modification_time()));
     }
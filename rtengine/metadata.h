@@ -30,7 +30,7 @@
 namespace rtengine {
 
 class ProgressListener;
-class Exiftool;
+class ExiftoolPool;
 
 long exiv2_to_long(const Exiv2::Metadatum &d);
 
@@ -110,7 +110,7 @@ private:
     typedef Cache<Glib::ustring, JSONCacheVal> JSONCache;
     static std::unique_ptr<JSONCache> jsoncache_;
 
-    static std::unique_ptr<Exiftool> exiftool_;
+    static std::unique_ptr<ExiftoolPool> exiftool_;
 };
 
 } // namespace rtengine
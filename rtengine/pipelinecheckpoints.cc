@@ -0,0 +1,119 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pipelinecheckpoints.h"
+#include "settings.h"
+#include <iostream>
+#include <algorithm>
+
+namespace rtengine {
+
+extern const Settings *settings;
+
+PipelineCheckpointCache::PipelineCheckpointCache():
+    size_(0),
+    clock_(0)
+{
+}
+
+
+bool PipelineCheckpointCache::enabled() const
+{
+    return settings->preview_checkpoint_cache_size > 0;
+}
+
+
+void PipelineCheckpointCache::clear()
+{
+    entries_.clear();
+    size_ = 0;
+}
+
+
+const PipelineCheckpointCache::Checkpoint *PipelineCheckpointCache::find(int stage, const std::function<bool(const Checkpoint &)> &valid)
+{
+    Checkpoint *ret = nullptr;
+    for (auto &e : entries_) {
+        if (e->stage == stage && (!ret || e->step > ret->step) && valid(*e)) {
+            ret = e.get();
+        }
+    }
+    if (ret) {
+        ret->last_use = ++clock_;
+        if (settings->verbose > 1) {
+            std::cout << "pipeline checkpoint hit: stage " << stage << ", step " << ret->step << std::endl;
+        }
+    }
+    return ret;
+}
+
+
+void PipelineCheckpointCache::store(int stage, int step, double scale, const std::string &layout, std::vector<Snapshot> params, const Imagefloat *img, const LUTu *hist_tone_curve, const LUTu *hist_l_curve)
+{
+    const size_t budget = size_t(std::max(settings->preview_checkpoint_cache_size, 0)) * 1024 * 1024;
+    const size_t sz = size_t(img->getWidth()) * img->getHeight() * 3 * sizeof(float);
+    if (sz > budget) {
+        return;
+    }
+
+    // keep only the most recent snapshot for each position in the pipeline
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if ((*it)->stage == stage && (*it)->step == step) {
+            size_ -= (*it)->size;
+            entries_.erase(it);
+            break;
+        }
+    }
+    evict(budget - sz);
+
+    std::unique_ptr<Checkpoint> cp(new Checkpoint());
+    cp->stage = stage;
+    cp->step = step;
+    cp->scale = scale;
+    cp->layout = layout;
+    cp->params = std::move(params);
+    img->copyTo(&cp->img);
+    if (hist_tone_curve && *hist_tone_curve) {
+        cp->hist_tone_curve = *hist_tone_curve;
+    }
+    if (hist_l_curve && *hist_l_curve) {
+        cp->hist_l_curve = *hist_l_curve;
+    }
+    cp->size = sz;
+    cp->last_use = ++clock_;
+
+    size_ += sz;
+    entries_.emplace_back(std::move(cp));
+}
+
+
+void PipelineCheckpointCache::evict(size_t budget)
+{
+    while (size_ > budget && !entries_.empty()) {
+        auto lru = entries_.begin();
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if ((*it)->last_use < (*lru)->last_use) {
+                lru = it;
+            }
+        }
+        size_ -= (*lru)->size;
+        entries_.erase(lru);
+    }
+}
+
+} // namespace rtengine
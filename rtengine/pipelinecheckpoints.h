@@ -0,0 +1,79 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "noncopyable.h"
+#include "imagefloat.h"
+#include "LUT.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace rtengine {
+
+/**
+ * Snapshots of the intermediate results of ImProcFunctions::process, taken
+ * after the steps of STAGE_1..STAGE_3. Each checkpoint records the layout
+ * of the steps and a copy of the parameters each step up to it depends on:
+ * ImProcFunctions decides which checkpoints are still valid by comparing
+ * them with the current ones, and restarts the stage from the latest valid
+ * one. The owner must call
+ * clear() whenever the input of STAGE_1 changes. The total memory used is
+ * bounded by Settings::preview_checkpoint_cache_size (in MB).
+ */
+class PipelineCheckpointCache: public NonCopyable {
+public:
+    // a copy of the parameters a step depends on (type-erased, see
+    // ImProcFunctions::PipelineStep)
+    using Snapshot = std::shared_ptr<const void>;
+
+    struct Checkpoint {
+        int stage;
+        int step; // index of the last step applied
+        double scale;
+        std::string layout; // names of the steps of this and the previous stages
+        std::vector<Snapshot> params; // one per step, in the order of layout
+        Imagefloat img;
+        // side outputs of the steps (see ImProcFunctions::setOutputHistograms)
+        LUTu hist_tone_curve;
+        LUTu hist_l_curve;
+        size_t size;
+        unsigned long last_use;
+    };
+
+    PipelineCheckpointCache();
+
+    bool enabled() const;
+    void clear();
+
+    // returns the valid checkpoint of the given stage with the highest step
+    // index, or nullptr if there is none
+    const Checkpoint *find(int stage, const std::function<bool(const Checkpoint &)> &valid);
+    void store(int stage, int step, double scale, const std::string &layout, std::vector<Snapshot> params, const Imagefloat *img, const LUTu *hist_tone_curve, const LUTu *hist_l_curve);
+
+private:
+    void evict(size_t budget);
+
+    std::vector<std::unique_ptr<Checkpoint>> entries_;
+    size_t size_;
+    unsigned long clock_;
+};
+
+} // namespace rtengine
@@ -0,0 +1,404 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pipelineprofiler.h"
+#include "cJSON.h"
+#include <chrono>
+#include <map>
+#include <functional>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib/gstdio.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef WIN32
+#  include <windows.h>
+#  include <psapi.h>
+#elif defined __APPLE__
+#  include <mach/mach.h>
+#  include <sys/resource.h>
+#else
+#  include <unistd.h>
+#  include <sys/resource.h>
+#endif
+
+namespace rtengine {
+
+namespace {
+
+int64_t wall_time_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+int64_t cpu_time_us()
+{
+#ifdef WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    const auto to_us =
+        [](const FILETIME &t) -> int64_t
+        {
+            return ((int64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime) / 10;
+        };
+    return to_us(kernel) + to_us(user);
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        return 0;
+    }
+    return int64_t(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#endif
+}
+
+
+int64_t resident_set_size()
+{
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return pmc.WorkingSetSize;
+    }
+    return 0;
+#elif defined __APPLE__
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS) {
+        return info.resident_size;
+    }
+    return 0;
+#else
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return int64_t(resident) * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+
+int num_threads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+
+// interval between two samples of the resident set size
+constexpr auto SAMPLING_INTERVAL = std::chrono::milliseconds(2);
+
+} // namespace
+
+
+//-----------------------------------------------------------------------------
+// PipelineProfiler::Scope
+//-----------------------------------------------------------------------------
+
+PipelineProfiler::Scope::Scope(const char *name, const char *pipeline, int width, int height):
+    active_(PipelineProfiler::getInstance()->enabled()),
+    mem0_(0),
+    mem_peak_(0)
+{
+    if (active_) {
+        event_.name = name;
+        event_.pipeline = pipeline;
+        event_.width = width;
+        event_.height = height;
+        event_.threads = num_threads();
+        event_.tid = std::hash<std::thread::id>()(std::this_thread::get_id());
+        mem0_ = resident_set_size();
+        mem_peak_ = mem0_;
+        PipelineProfiler::getInstance()->add(this);
+        event_.cpu_us = cpu_time_us();
+        event_.start_us = wall_time_us();
+    }
+}
+
+
+PipelineProfiler::Scope::~Scope()
+{
+    if (active_) {
+        event_.wall_us = wall_time_us() - event_.start_us;
+        event_.cpu_us = cpu_time_us() - event_.cpu_us;
+        PipelineProfiler::getInstance()->remove(this);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+// PipelineProfiler
+//-----------------------------------------------------------------------------
+
+PipelineProfiler *PipelineProfiler::getInstance()
+{
+    static PipelineProfiler instance;
+    return &instance;
+}
+
+
+PipelineProfiler::PipelineProfiler():
+    enabled_(false),
+    next_event_(0),
+    stop_sampler_(false),
+    origin_us_(wall_time_us())
+{
+}
+
+
+PipelineProfiler::~PipelineProfiler()
+{
+    set_enabled(false);
+}
+
+
+void PipelineProfiler::set_enabled(bool yes)
+{
+    std::unique_lock<std::mutex> lck(mutex_);
+    if (yes == enabled_) {
+        return;
+    }
+    enabled_ = yes;
+    if (yes) {
+        stop_sampler_ = false;
+        sampler_ = std::thread(&PipelineProfiler::sampler, this);
+    } else {
+        stop_sampler_ = true;
+        cond_.notify_all();
+        lck.unlock();
+        sampler_.join();
+    }
+}
+
+
+void PipelineProfiler::clear()
+{
+    std::lock_guard<std::mutex> lck(mutex_);
+    events_.clear();
+    next_event_ = 0;
+    origin_us_ = wall_time_us();
+}
+
+
+std::vector<PipelineProfiler::Event> PipelineProfiler::get_events() const
+{
+    std::lock_guard<std::mutex> lck(mutex_);
+    return ordered_events();
+}
+
+
+int64_t PipelineProfiler::now_us()
+{
+    return wall_time_us();
+}
+
+
+void PipelineProfiler::record(const char *name, const char *pipeline, int width, int height, int64_t start_us)
+{
+    if (!enabled_) {
+        return;
+    }
+    Event e;
+    e.name = name;
+    e.pipeline = pipeline;
+    e.width = width;
+    e.height = height;
+    e.start_us = start_us;
+    e.wall_us = wall_time_us() - start_us;
+    e.cpu_us = 0;
+    e.peak_mem = 0;
+    e.threads = 1;
+    e.tid = std::hash<std::thread::id>()(std::this_thread::get_id());
+    std::lock_guard<std::mutex> lck(mutex_);
+    push(e);
+}
+
+
+void PipelineProfiler::add(Scope *s)
+{
+    std::lock_guard<std::mutex> lck(mutex_);
+    active_.push_back(s);
+}
+
+
+void PipelineProfiler::remove(Scope *s)
+{
+    std::lock_guard<std::mutex> lck(mutex_);
+    active_.erase(std::find(active_.begin(), active_.end(), s));
+    auto &e = s->event_;
+    e.peak_mem = std::max(std::max(s->mem_peak_.load(), resident_set_size()) - s->mem0_, int64_t(0));
+    push(e);
+}
+
+
+void PipelineProfiler::push(const Event &e)
+{
+    if (events_.size() < MAX_EVENTS) {
+        events_.push_back(e);
+    } else {
+        events_[next_event_] = e;
+        next_event_ = (next_event_ + 1) % MAX_EVENTS;
+    }
+}
+
+
+std::vector<PipelineProfiler::Event> PipelineProfiler::ordered_events() const
+{
+    std::vector<Event> ret;
+    ret.reserve(events_.size());
+    ret.insert(ret.end(), events_.begin() + next_event_, events_.end());
+    ret.insert(ret.end(), events_.begin(), events_.begin() + next_event_);
+    return ret;
+}
+
+
+void PipelineProfiler::sampler()
+{
+    std::unique_lock<std::mutex> lck(mutex_);
+    while (!stop_sampler_) {
+        if (!active_.empty()) {
+            const int64_t rss = resident_set_size();
+            for (auto s : active_) {
+                if (rss > s->mem_peak_) {
+                    s->mem_peak_ = rss;
+                }
+            }
+        }
+        cond_.wait_for(lck, SAMPLING_INTERVAL);
+    }
+}
+
+
+bool PipelineProfiler::save(const Glib::ustring &fname, Format fmt) const
+{
+    std::vector<Event> events;
+    int64_t origin = 0;
+    {
+        std::lock_guard<std::mutex> lck(mutex_);
+        events = ordered_events();
+        origin = origin_us_;
+    }
+
+    cJSON *root = nullptr;
+
+    const auto utilisation =
+        [](int64_t cpu, int64_t wall, int threads) -> double
+        {
+            return wall > 0 ? double(cpu) / (double(wall) * std::max(threads, 1)) : 0.0;
+        };
+
+    if (fmt == Format::CHROME_TRACE) {
+        root = cJSON_CreateObject();
+        cJSON *trace = cJSON_CreateArray();
+        cJSON_AddItemToObject(root, "traceEvents", trace);
+        cJSON_AddStringToObject(root, "displayTimeUnit", "ms");
+        for (auto &e : events) {
+            cJSON *ev = cJSON_CreateObject();
+            cJSON_AddStringToObject(ev, "name", e.name.c_str());
+            cJSON_AddStringToObject(ev, "cat", e.pipeline);
+            cJSON_AddStringToObject(ev, "ph", "X");
+            cJSON_AddNumberToObject(ev, "ts", e.start_us - origin);
+            cJSON_AddNumberToObject(ev, "dur", e.wall_us);
+            cJSON_AddNumberToObject(ev, "pid", 1);
+            cJSON_AddNumberToObject(ev, "tid", double(e.tid % 1000000));
+            cJSON *args = cJSON_CreateObject();
+            cJSON_AddNumberToObject(args, "width", e.width);
+            cJSON_AddNumberToObject(args, "height", e.height);
+            cJSON_AddNumberToObject(args, "cpu_ms", e.cpu_us / 1000.0);
+            cJSON_AddNumberToObject(args, "peak_mem_mb", e.peak_mem / (1024.0 * 1024.0));
+            cJSON_AddNumberToObject(args, "threads", e.threads);
+            cJSON_AddNumberToObject(args, "utilisation", utilisation(e.cpu_us, e.wall_us, e.threads));
+            cJSON_AddItemToObject(ev, "args", args);
+            cJSON_AddItemToArray(trace, ev);
+        }
+    } else {
+        struct Summary {
+            int calls = 0;
+            double megapixels = 0;
+            int64_t wall_us = 0;
+            int64_t cpu_us = 0;
+            int64_t peak_mem = 0;
+            int64_t thread_us = 0;
+        };
+        // keep the steps in order of first appearance
+        std::vector<std::pair<std::string, std::string>> order;
+        std::map<std::pair<std::string, std::string>, Summary> summary;
+        for (auto &e : events) {
+            auto key = std::make_pair(std::string(e.pipeline), e.name);
+            auto it = summary.find(key);
+            if (it == summary.end()) {
+                order.push_back(key);
+                it = summary.emplace(key, Summary()).first;
+            }
+            auto &s = it->second;
+            ++s.calls;
+            s.megapixels += double(e.width) * e.height / 1e6;
+            s.wall_us += e.wall_us;
+            s.cpu_us += e.cpu_us;
+            s.peak_mem = std::max(s.peak_mem, e.peak_mem);
+            s.thread_us += e.wall_us * std::max(e.threads, 1);
+        }
+
+        root = cJSON_CreateObject();
+        cJSON *steps = cJSON_CreateArray();
+        cJSON_AddItemToObject(root, "steps", steps);
+        for (auto &key : order) {
+            auto &s = summary[key];
+            cJSON *st = cJSON_CreateObject();
+            cJSON_AddStringToObject(st, "pipeline", key.first.c_str());
+            cJSON_AddStringToObject(st, "step", key.second.c_str());
+            cJSON_AddNumberToObject(st, "calls", s.calls);
+            cJSON_AddNumberToObject(st, "wall_ms", s.wall_us / 1000.0);
+            cJSON_AddNumberToObject(st, "cpu_ms", s.cpu_us / 1000.0);
+            cJSON_AddNumberToObject(st, "peak_mem_mb", s.peak_mem / (1024.0 * 1024.0));
+            cJSON_AddNumberToObject(st, "utilisation", s.thread_us > 0 ? double(s.cpu_us) / s.thread_us : 0.0);
+            cJSON_AddNumberToObject(st, "mpix_per_s", s.wall_us > 0 ? s.megapixels / (s.wall_us / 1e6) : 0.0);
+            cJSON_AddItemToArray(steps, st);
+        }
+    }
+
+    char *data = cJSON_Print(root);
+    cJSON_Delete(root);
+    if (!data) {
+        return false;
+    }
+
+    bool ok = false;
+    FILE *out = g_fopen(fname.c_str(), "wb");
+    if (out) {
+        ok = fputs(data, out) >= 0;
+        ok = (fclose(out) == 0) && ok;
+    }
+    free(data);
+    return ok;
+}
+
+} // namespace rtengine
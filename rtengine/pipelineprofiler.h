@@ -0,0 +1,113 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "noncopyable.h"
+#include <glibmm/ustring.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+namespace rtengine {
+
+/**
+ * Runtime-switchable profiler for the steps of ImProcFunctions::process.
+ * For each step it records wall time, process CPU time, peak growth of the
+ * resident set size (sampled by a background thread) and thread
+ * utilisation, i.e. CPU time / (wall time * number of OpenMP threads).
+ * CPU time and memory are process-wide, so they are only meaningful when a
+ * single pipeline runs at a time.
+ */
+class PipelineProfiler: public NonCopyable {
+public:
+    enum class Format {
+        JSON,         // per-step summary
+        CHROME_TRACE  // one event per step invocation, for chrome://tracing
+    };
+
+    struct Event {
+        std::string name;
+        const char *pipeline;
+        int width;
+        int height;
+        int64_t start_us;
+        int64_t wall_us;
+        int64_t cpu_us;
+        int64_t peak_mem; // bytes
+        int threads;
+        size_t tid;
+    };
+
+    class Scope: public NonCopyable {
+    public:
+        Scope(const char *name, const char *pipeline, int width, int height);
+        ~Scope();
+
+    private:
+        friend class PipelineProfiler;
+        bool active_;
+        Event event_;
+        int64_t mem0_;
+        std::atomic<int64_t> mem_peak_;
+    };
+
+    static constexpr size_t MAX_EVENTS = 100000;
+
+    static PipelineProfiler *getInstance();
+    ~PipelineProfiler();
+
+    bool enabled() const { return enabled_; }
+    void set_enabled(bool yes);
+    void clear();
+    // the steps recorded since the last call to clear(), in order of
+    // completion. Only the last MAX_EVENTS are kept
+    std::vector<Event> get_events() const;
+    bool save(const Glib::ustring &fname, Format fmt) const;
+
+    // the clock of Event::start_us
+    static int64_t now_us();
+    // records an interval measured by the caller, from start_us to now
+    // (e.g. the latency between a parameter change and the preview update)
+    void record(const char *name, const char *pipeline, int width, int height, int64_t start_us);
+
+private:
+    PipelineProfiler();
+
+    void sampler();
+    void add(Scope *s);
+    void remove(Scope *s);
+    void push(const Event &e);
+    std::vector<Event> ordered_events() const;
+
+    std::atomic<bool> enabled_;
+    mutable std::mutex mutex_;
+    std::vector<Event> events_; // ring buffer of at most MAX_EVENTS
+    size_t next_event_; // the oldest event once events_ is full
+    std::vector<Scope *> active_;
+    std::thread sampler_;
+    std::condition_variable cond_;
+    bool stop_sampler_;
+    int64_t origin_us_;
+};
+
+} // namespace rtengine
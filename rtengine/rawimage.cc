@@ -1312,6 +1312,44 @@ bool RawImage::is_ppmThumb() const
              !thumb_load_raw );
 }
 
+void RawImage::init_synthetic(int w, int h, bool is_xtrans)
+{
+    static const int xtrans_pattern[6][6] = {
+        {1, 1, 0, 1, 1, 2},
+        {1, 1, 2, 1, 1, 0},
+        {2, 0, 1, 0, 2, 1},
+        {1, 1, 2, 1, 1, 0},
+        {1, 1, 0, 1, 1, 2},
+        {0, 2, 1, 2, 0, 1}
+    };
+
+    width = raw_width = iwidth = w;
+    height = raw_height = iheight = h;
+    top_margin = left_margin = 0;
+    fuji_width = 0;
+    shrink = 0;
+    colors = 3;
+    filters = is_xtrans ? 9 : 0x94949494;
+    prefilters = filters;
+    for (int row = 0; row < 6; ++row) {
+        for (int col = 0; col < 6; ++col) {
+            xtrans[row][col] = xtrans_abs[row][col] = xtrans_pattern[row][col];
+        }
+    }
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            rgb_cam[i][j] = (i == j);
+        }
+    }
+    for (int c = 0; c < 4; ++c) {
+        pre_mul[c] = cam_mul[c] = 1.f;
+        cblack[c] = 0;
+    }
+    black = 0;
+    maximum = 65535;
+}
+
+
 void RawImage::getXtransMatrix(int XtransMatrix[6][6])
 {
     for(int row = 0; row < 6; row++)
@@ -1384,7 +1422,7 @@ float RawImage::get_optical_black(int row, int col) const
 }
 
 
-Image8 *RawImage::getThumbnail()
+Image8 *RawImage::getThumbnail(int maxw_hint, int maxh_hint)
 {
     if (use_internal_decoder_) {
         if (!checkThumbOk()) {
@@ -1399,7 +1437,7 @@ Image8 *RawImage::getThumbnail()
 
         int err = 1;
         if ((unsigned char)data[1] == 0xd8) {
-            err = img->loadJPEGFromMemory(data, get_thumbLength());
+            err = img->loadJPEGFromMemory(data, get_thumbLength(), maxw_hint, maxh_hint);
         } else if (is_ppmThumb()) {
             err = img->loadPPMFromMemory(data, get_thumbWidth(), get_thumbHeight(), get_thumbSwap(), get_thumbBPS());
         }
@@ -1430,7 +1468,7 @@ Image8 *RawImage::getThumbnail()
             img->setSampleFormat(IIOSF_UNSIGNED_CHAR);
             img->setSampleArrangement(IIOSA_CHUNKY);
             if (t.tformat == LIBRAW_THUMBNAIL_JPEG) {
-                err = img->loadJPEGFromMemory(t.thumb, t.tlength);
+                err = img->loadJPEGFromMemory(t.thumb, t.tlength, maxw_hint, maxh_hint);
             } else {
                 err = img->loadPPMFromMemory(t.thumb, t.twidth, t.theight, false, 8);
             }
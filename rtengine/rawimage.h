@@ -162,6 +162,9 @@ public:
     bool isFloat() const { return float_raw_image; }
 
     void set_filters(unsigned f) { filters = f; }
+    // sets up an in-memory sensor of the given size, with a RGGB Bayer or
+    // X-Trans CFA and identity color matrices (used for benchmarking)
+    void init_synthetic(int w, int h, bool is_xtrans);
 
 public:
     // dcraw functions
@@ -212,7 +215,9 @@ public:
 
 public:
     bool thumbNeedsRotation() const;
-    Image8 *getThumbnail();
+    // the hints, when > 0, allow the embedded JPEG to be decoded at a reduced
+    // size (see ImageIO::loadJPEGFromMemory)
+    Image8 *getThumbnail(int maxw_hint=0, int maxh_hint=0);
 
     float get_optical_black(int row, int col) const;
 
@@ -46,6 +46,7 @@
 #include "opthelper.h"
 #include "linalgebra.h"
 #include "clutstore.h"
+#include "demosaiccache.h"
 
 #undef CLIPD
 #define CLIPD(a) ((a)>0.0f?((a)<1.0f?(a):1.0f):0.0f)
@@ -623,6 +624,7 @@ RawImageSource::RawImageSource ()
     , red(0, 0)
     , blue(0, 0)
     , rawDirty(true)
+    , dmcacheHit(false)
 {
     camProfile = nullptr;
     embProfile = nullptr;
@@ -1534,20 +1536,6 @@ void RawImageSource::preprocess(const RAWParams &raw, const LensProfParams &lens
         printf( "Subtracting Darkframe:%s\n", rid->get_filename().c_str());
     }
 
-    std::unique_ptr<PixelsMap> bitmapBads;
-
-    int totBP = 0; // Hold count of bad pixels to correct
-
-    if(ri->zeroIsBad()) { // mark all pixels with value zero as bad, has to be called before FF and DF. dcraw sets this flag only for some cameras (mainly Panasonic and Leica)
-        bitmapBads.reset(new PixelsMap(W, H));
-        totBP = findZeroPixels(*(bitmapBads.get()));
-
-        if( settings->verbose) {
-            printf( "%d pixels with value zero marked as bad pixels\n", totBP);
-        }
-    }
-
-    //FLATFIELD start
     RawImage *rif = nullptr;
 
     if (raw.enable_flatfield) {
@@ -1570,6 +1558,44 @@ void RawImageSource::preprocess(const RAWParams &raw, const LensProfParams &lens
         printf( "Flat Field Correction:%s\n", rif->get_filename().c_str());
     }
 
+    // camera bad pixels from the .badpixels files
+    std::vector<badPix> *badpixels = dfm.getBadPixels(ri->get_maker(), ri->get_model(), idata->getSerialNumber());
+
+    dmcacheKey.clear();
+    dmcacheHit = false;
+
+    if (DemosaicDiskCache::getInstance()->enabled() && numFrames != 4 && !(numFrames == 2 && currFrame == 2)) {
+        // the hot pixels are found on the dark frame, which is part of the
+        // key. The LCP profile is read only for the vignetting correction
+        const bool use_lcp = !hasFlatField && lensProf.useVign && lensProf.useLcp();
+        const std::vector<Glib::ustring> files = {
+            rid ? rid->get_filename() : "",
+            rif ? rif->get_filename() : "",
+            use_lcp ? lensProf.lcpFile : ""
+        };
+        dmcacheKey = DemosaicDiskCache::getInstance()->getKey(fileName, currFrame, raw, lensProf, coarse, ref_pre_mul, files, badpixels);
+        dmcacheRaw = raw;
+        if (dmcacheLoad()) {
+            dmcacheHit = true;
+            rawDirty = true;
+            return;
+        }
+    }
+
+    std::unique_ptr<PixelsMap> bitmapBads;
+
+    int totBP = 0; // Hold count of bad pixels to correct
+
+    if(ri->zeroIsBad()) { // mark all pixels with value zero as bad, has to be called before FF and DF. dcraw sets this flag only for some cameras (mainly Panasonic and Leica)
+        bitmapBads.reset(new PixelsMap(W, H));
+        totBP = findZeroPixels(*(bitmapBads.get()));
+
+        if( settings->verbose) {
+            printf( "%d pixels with value zero marked as bad pixels\n", totBP);
+        }
+    }
+
+    //FLATFIELD start
     if(numFrames == 4) {
         int bufferNumber = 0;
         for(unsigned int i=0; i<4; ++i) {
@@ -1605,7 +1631,7 @@ void RawImageSource::preprocess(const RAWParams &raw, const LensProfParams &lens
 
 
     // Always correct camera badpixels from .badpixels file
-    std::vector<badPix> *bp = dfm.getBadPixels( ri->get_maker(), ri->get_model(), idata->getSerialNumber() );
+    std::vector<badPix> *bp = badpixels;
 
     if( bp ) {
         if(!bitmapBads) {
@@ -1858,6 +1884,23 @@ void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &c
 
     double raw_expos = raw.enable_whitepoint ? raw.expos : 1.0;
 
+    // the cached data is valid only if the demosaic parameters are the same
+    // as the ones seen by preprocess(). If preprocess() didn't find an entry,
+    // there's no point in looking for it again
+    bool use_dmcache = !dmcacheKey.empty() && raw == dmcacheRaw;
+    if (use_dmcache && dmcacheHit) {
+        dmcacheHit = false;
+        if (dmcacheState.autoContrast == autoContrast) {
+            if (autoContrast) {
+                contrastThreshold = dmcacheState.contrastThreshold;
+            }
+            rgbSourceModified = false;
+            return;
+        }
+        // don't replace the existing entry
+        use_dmcache = false;
+    }
+
     if (ri->getSensorType() == ST_BAYER) {
         switch (raw.bayersensor.method) {
         case RAWParams::BayerSensor::Method::HPHD:
@@ -1951,6 +1994,12 @@ void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &c
 
     rgbSourceModified = false;
 
+    if (use_dmcache) {
+        dmcacheStore(autoContrast, contrastThreshold);
+        // store the entry only once
+        dmcacheKey.clear();
+    }
+
 
     if( settings->verbose ) {
         if (getSensorType() == ST_BAYER) {
@@ -1962,6 +2011,119 @@ void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &c
 }
 
 
+void RawImageSource::setSyntheticData(const Imagefloat *scene, bool xtrans)
+{
+    if (numFrames) {
+        return; // only for sources that have not been loaded
+    }
+
+    W = scene->getWidth();
+    H = scene->getHeight();
+
+    ri = new RawImage("");
+    ri->init_synthetic(W, H, xtrans);
+    riFrames[0] = ri;
+    numFrames = 1;
+    currFrame = 0;
+
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            imatrices.rgb_cam[i][j] = imatrices.cam_rgb[i][j] = rgb_cam[i][j] = cam_rgb[i][j] = (i == j);
+        }
+    }
+    for (int c = 0; c < 4; ++c) {
+        scale_mul[c] = 1.f;
+        c_black[c] = cblacksom[c] = 0.f;
+        c_white[c] = 65535.f;
+        chmax[c] = hlmax[c] = clmax[c] = 65535.f;
+    }
+    initialGain = camInitialGain = defGain = 1.0;
+    border = 4;
+
+    rawData(W, H);
+#ifdef _OPENMP
+#   pragma omp parallel for
+#endif
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            const unsigned c = xtrans ? ri->XTRANSFC(y, x) : ri->FC(y, x);
+            rawData[y][x] = c == 0 ? scene->r(y, x) : (c == 2 ? scene->b(y, x) : scene->g(y, x));
+        }
+    }
+    red(W, H);
+    green(W, H);
+    blue(W, H);
+    rawDirty = false;
+    rgbSourceModified = false;
+}
+
+
+bool RawImageSource::dmcacheLoad()
+{
+    // load into temporaries, so that the current data is left untouched if
+    // the entry is missing or invalid
+    const bool rgb = !(ri->getSensorType() == ST_BAYER || ri->getSensorType() == ST_FUJI_XTRANS || ri->get_colors() == 1);
+    array2D<float> r(rgb ? 3 * W : W, H);
+    array2D<float> rr(W, H);
+    array2D<float> gg(W, H);
+    array2D<float> bb(W, H);
+
+    DemosaicDiskCache::State st;
+    if (!DemosaicDiskCache::getInstance()->load(dmcacheKey, st, r, rr, gg, bb)) {
+        return false;
+    }
+
+    dmcacheState = st;
+    rawData.swap(r);
+    red.swap(rr);
+    green.swap(gg);
+    blue.swap(bb);
+
+    for (int i = 0; i < 4; ++i) {
+        scale_mul[i] = st.scale_mul[i];
+        c_black[i] = st.c_black[i];
+        c_white[i] = st.c_white[i];
+        cblacksom[i] = st.cblacksom[i];
+        chmax[i] = st.chmax[i];
+        clmax[i] = st.clmax[i];
+        hlmax[i] = st.hlmax[i];
+        psRedBrightness[i] = st.psRedBrightness[i];
+        psGreenBrightness[i] = st.psGreenBrightness[i];
+        psBlueBrightness[i] = st.psBlueBrightness[i];
+    }
+    initialGain = st.initialGain;
+    defGain = st.defGain;
+    flatFieldAutoClipValue = st.flatFieldAutoClipValue;
+
+    return true;
+}
+
+
+void RawImageSource::dmcacheStore(bool autoContrast, double contrastThreshold)
+{
+    auto &st = dmcacheState;
+    for (int i = 0; i < 4; ++i) {
+        st.scale_mul[i] = scale_mul[i];
+        st.c_black[i] = c_black[i];
+        st.c_white[i] = c_white[i];
+        st.cblacksom[i] = cblacksom[i];
+        st.chmax[i] = chmax[i];
+        st.clmax[i] = clmax[i];
+        st.hlmax[i] = hlmax[i];
+        st.psRedBrightness[i] = psRedBrightness[i];
+        st.psGreenBrightness[i] = psGreenBrightness[i];
+        st.psBlueBrightness[i] = psBlueBrightness[i];
+    }
+    st.initialGain = initialGain;
+    st.defGain = defGain;
+    st.flatFieldAutoClipValue = flatFieldAutoClipValue;
+    st.autoContrast = autoContrast;
+    st.contrastThreshold = contrastThreshold;
+
+    DemosaicDiskCache::getInstance()->store(dmcacheKey, st, rawData, red, green, blue);
+}
+
+
 void RawImageSource::flushRawData()
 {
     if (rawData) {
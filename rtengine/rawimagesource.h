@@ -27,6 +27,7 @@
 #include "iimage.h"
 #include <iostream>
 #include "pixelsmap.h"
+#include "demosaiccache.h"
 #define HR_SCALE 2
 
 namespace rtengine {
@@ -91,6 +92,12 @@ protected:
     float psGreenBrightness[4];
     float psBlueBrightness[4];
 
+    // key and state of the on-disk demosaic cache (see demosaiccache.h)
+    std::string dmcacheKey;
+    RAWParams dmcacheRaw;
+    bool dmcacheHit;
+    DemosaicDiskCache::State dmcacheState;
+
     std::vector<double> histMatchingCache;
     std::vector<double> histMatchingCache2;
     ColorManagementParams histMatchingParams;
@@ -110,6 +117,9 @@ protected:
     void HLRecovery_inpaint(int blur);
     void highlight_recovery_opposed(float scale_mul[3], const ColorTemp &wb);
 
+    bool dmcacheLoad();
+    void dmcacheStore(bool autoContrast, double contrastThreshold);
+
 public:
     RawImageSource ();
     ~RawImageSource () override;
@@ -118,6 +128,10 @@ public:
     int load(const Glib::ustring &fname, bool firstFrameOnly);
     void preprocess(const RAWParams &raw, const LensProfParams &lensProf, const CoarseTransformParams& coarse, bool prepareDenoise=true, const ColorTemp &wb=ColorTemp()) override;
     void demosaic(const RAWParams &raw, bool autoContrast, double &contrastThreshold) override;
+    // replaces the raw data of a source that has not been loaded with a
+    // mosaic sampled from the given image through a RGGB Bayer or X-Trans
+    // CFA, so that demosaic() can be run on synthetic input (for benchmarks)
+    void setSyntheticData(const Imagefloat *scene, bool xtrans);
     void flushRawData() override;
     void flushRGB() override;
     void HLRecovery_Global(const ExposureParams &hrp) override;
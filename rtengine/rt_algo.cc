@@ -42,7 +42,13 @@
 #define BENCHMARK
 #include "StopWatch.h"
 
-namespace {
+#include "cpudispatch.h"
+
+// compile the kernels once for each ISA level, see cpudispatch_targets.h
+#define ART_DISPATCH_FILE "rt_algo.cc"
+#include "cpudispatch_targets.h"
+
+namespace rtengine { namespace { namespace ART_ISA_NAMESPACE {
 
 float calcBlendFactor(float val, float threshold) {
     // sigmoid function
@@ -169,150 +175,7 @@ float calcContrastThreshold(float** luminance, int tileY, int tileX, int tilesiz
     return c / 100.f;
 }
 
-} // namespace
-
-namespace rtengine {
-
-extern MyMutex *fftwMutex;
-
-
-void findMinMaxPercentile(const float* data, size_t size, float minPrct, float& minOut, float maxPrct, float& maxOut, bool multithread)
-{
-    // Copyright (c) 2017 Ingo Weyrich <heckflosse67@gmx.de>
-    // We need to find the (minPrct*size) smallest value and the (maxPrct*size) smallest value in data.
-    // We use a histogram based search for speed and to reduce memory usage.
-    // Memory usage of this method is histoSize * sizeof(uint32_t) * (t + 1) byte,
-    // where t is the number of threads and histoSize is in [1;65536].
-    // Processing time is O(n) where n is size of the input array.
-    // It scales well with multiple threads if the size of the input array is large.
-    // The current implementation is not guaranteed to work correctly if size > 2^32 (4294967296).
-
-    assert(minPrct <= maxPrct);
-
-    if (size == 0) {
-        return;
-    }
-
-    size_t numThreads = 1;
-#ifdef _OPENMP
-    // Because we have an overhead in the critical region of the main loop for each thread
-    // we make a rough calculation to reduce the number of threads for small data size.
-    // This also works fine for the minmax loop.
-    if (multithread) {
-        const size_t maxThreads = omp_get_num_procs();
-        while (size > numThreads * numThreads * 16384 && numThreads < maxThreads) {
-            ++numThreads;
-        }
-    }
-#endif
-
-    // We need min and max value of data to calculate the scale factor for the histogram
-    float minVal = data[0];
-    float maxVal = data[0];
-#ifdef _OPENMP
-    #pragma omp parallel for reduction(min:minVal) reduction(max:maxVal) num_threads(numThreads)
-#endif
-    for (size_t i = 1; i < size; ++i) {
-        minVal = std::min(minVal, data[i]);
-        maxVal = std::max(maxVal, data[i]);
-    }
-
-    if (std::fabs(maxVal - minVal) == 0.f) { // fast exit, also avoids division by zero in calculation of scale factor
-        minOut = maxOut = minVal;
-        return;
-    }
-
-    // Caution: Currently this works correctly only for histoSize in range[1;65536].
-    // For small data size (i.e. thumbnails) we reduce the size of the histogram to the size of data.
-    const unsigned int histoSize = std::min<size_t>(65536, size);
-
-    // calculate scale factor to use full range of histogram
-    const float scale = (histoSize - 1) / (maxVal - minVal);
-
-    // We need one main histogram
-    std::vector<uint32_t> histo(histoSize, 0);
-
-    if (numThreads == 1) {
-        // just one thread => use main histogram
-        for (size_t i = 0; i < size; ++i) {
-            // we have to subtract minVal and multiply with scale to get the data in [0;histosize] range
-            histo[static_cast<uint16_t>(scale * (data[i] - minVal))]++;
-        }
-    } else {
-#ifdef _OPENMP
-    #pragma omp parallel num_threads(numThreads)
-#endif
-        {
-            // We need one histogram per thread
-            std::vector<uint32_t> histothr(histoSize, 0);
-
-#ifdef _OPENMP
-            #pragma omp for nowait
-#endif
-            for (size_t i = 0; i < size; ++i) {
-                // we have to subtract minVal and multiply with scale to get the data in [0;histosize] range
-                histothr[static_cast<uint16_t>(scale * (data[i] - minVal))]++;
-            }
-
-#ifdef _OPENMP
-            #pragma omp critical
-#endif
-            {
-                // add per thread histogram to main histogram
-#ifdef _OPENMP
-                #pragma omp simd
-#endif
-
-                for (size_t i = 0; i < histoSize; ++i) {
-                    histo[i] += histothr[i];
-                }
-            }
-        }
-    }
-
-    size_t k = 0;
-    size_t count = 0;
-
-    // find (minPrct*size) smallest value
-    const float threshmin = minPrct * size;
-    while (count < threshmin) {
-        count += histo[k++];
-    }
-
-    if (k > 0) { // interpolate
-        const size_t count_ = count - histo[k - 1];
-        const float c0 = count - threshmin;
-        const float c1 = threshmin - count_;
-        minOut = (c1 * k + c0 * (k - 1)) / (c0 + c1);
-    } else {
-        minOut = k;
-    }
-    // go back to original range
-    minOut /= scale;
-    minOut += minVal;
-    minOut = rtengine::LIM(minOut, minVal, maxVal);
-
-    // find (maxPrct*size) smallest value
-    const float threshmax = maxPrct * size;
-    while (count < threshmax) {
-        count += histo[k++];
-    }
-
-    if (k > 0) { // interpolate
-        const size_t count_ = count - histo[k - 1];
-        const float c0 = count - threshmax;
-        const float c1 = threshmax - count_;
-        maxOut = (c1 * k + c0 * (k - 1)) / (c0 + c1);
-    } else {
-        maxOut = k;
-    }
-    // go back to original range
-    maxOut /= scale;
-    maxOut += minVal;
-    maxOut = rtengine::LIM(maxOut, minVal, maxVal);
-}
-
-void buildBlendMask(float** luminance, float **blend, int W, int H, float &contrastThreshold, float amount, bool autoContrast, float blur_radius, float luminance_factor)
+void buildBlendMaskImpl(float** luminance, float **blend, int W, int H, float &contrastThreshold, float amount, bool autoContrast, float blur_radius, float luminance_factor)
 {
     if (autoContrast) {
         const float minLuminance = 2000.f / luminance_factor;
@@ -494,7 +357,7 @@ void buildBlendMask(float** luminance, float **blend, int W, int H, float &contr
 }
 
 
-void markImpulse(int width, int height, float **const src, char **impulse, float thresh)
+void markImpulseImpl(int width, int height, float **const src, char **impulse, float thresh)
 {
     // buffer for the lowpass image
     float * lpf[height] ALIGNED16;
@@ -595,6 +458,162 @@ void markImpulse(int width, int height, float **const src, char **impulse, float
     delete [] lpf[0];
 }
 
+}}} // namespace rtengine::ART_ISA_NAMESPACE
+
+#ifdef ART_DISPATCH_ONCE
+
+namespace rtengine {
+
+extern MyMutex *fftwMutex;
+
+
+void findMinMaxPercentile(const float* data, size_t size, float minPrct, float& minOut, float maxPrct, float& maxOut, bool multithread)
+{
+    // Copyright (c) 2017 Ingo Weyrich <heckflosse67@gmx.de>
+    // We need to find the (minPrct*size) smallest value and the (maxPrct*size) smallest value in data.
+    // We use a histogram based search for speed and to reduce memory usage.
+    // Memory usage of this method is histoSize * sizeof(uint32_t) * (t + 1) byte,
+    // where t is the number of threads and histoSize is in [1;65536].
+    // Processing time is O(n) where n is size of the input array.
+    // It scales well with multiple threads if the size of the input array is large.
+    // The current implementation is not guaranteed to work correctly if size > 2^32 (4294967296).
+
+    assert(minPrct <= maxPrct);
+
+    if (size == 0) {
+        return;
+    }
+
+    size_t numThreads = 1;
+#ifdef _OPENMP
+    // Because we have an overhead in the critical region of the main loop for each thread
+    // we make a rough calculation to reduce the number of threads for small data size.
+    // This also works fine for the minmax loop.
+    if (multithread) {
+        const size_t maxThreads = omp_get_num_procs();
+        while (size > numThreads * numThreads * 16384 && numThreads < maxThreads) {
+            ++numThreads;
+        }
+    }
+#endif
+
+    // We need min and max value of data to calculate the scale factor for the histogram
+    float minVal = data[0];
+    float maxVal = data[0];
+#ifdef _OPENMP
+    #pragma omp parallel for reduction(min:minVal) reduction(max:maxVal) num_threads(numThreads)
+#endif
+    for (size_t i = 1; i < size; ++i) {
+        minVal = std::min(minVal, data[i]);
+        maxVal = std::max(maxVal, data[i]);
+    }
+
+    if (std::fabs(maxVal - minVal) == 0.f) { // fast exit, also avoids division by zero in calculation of scale factor
+        minOut = maxOut = minVal;
+        return;
+    }
+
+    // Caution: Currently this works correctly only for histoSize in range[1;65536].
+    // For small data size (i.e. thumbnails) we reduce the size of the histogram to the size of data.
+    const unsigned int histoSize = std::min<size_t>(65536, size);
+
+    // calculate scale factor to use full range of histogram
+    const float scale = (histoSize - 1) / (maxVal - minVal);
+
+    // We need one main histogram
+    std::vector<uint32_t> histo(histoSize, 0);
+
+    if (numThreads == 1) {
+        // just one thread => use main histogram
+        for (size_t i = 0; i < size; ++i) {
+            // we have to subtract minVal and multiply with scale to get the data in [0;histosize] range
+            histo[static_cast<uint16_t>(scale * (data[i] - minVal))]++;
+        }
+    } else {
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(numThreads)
+#endif
+        {
+            // We need one histogram per thread
+            std::vector<uint32_t> histothr(histoSize, 0);
+
+#ifdef _OPENMP
+            #pragma omp for nowait
+#endif
+            for (size_t i = 0; i < size; ++i) {
+                // we have to subtract minVal and multiply with scale to get the data in [0;histosize] range
+                histothr[static_cast<uint16_t>(scale * (data[i] - minVal))]++;
+            }
+
+#ifdef _OPENMP
+            #pragma omp critical
+#endif
+            {
+                // add per thread histogram to main histogram
+#ifdef _OPENMP
+                #pragma omp simd
+#endif
+
+                for (size_t i = 0; i < histoSize; ++i) {
+                    histo[i] += histothr[i];
+                }
+            }
+        }
+    }
+
+    size_t k = 0;
+    size_t count = 0;
+
+    // find (minPrct*size) smallest value
+    const float threshmin = minPrct * size;
+    while (count < threshmin) {
+        count += histo[k++];
+    }
+
+    if (k > 0) { // interpolate
+        const size_t count_ = count - histo[k - 1];
+        const float c0 = count - threshmin;
+        const float c1 = threshmin - count_;
+        minOut = (c1 * k + c0 * (k - 1)) / (c0 + c1);
+    } else {
+        minOut = k;
+    }
+    // go back to original range
+    minOut /= scale;
+    minOut += minVal;
+    minOut = rtengine::LIM(minOut, minVal, maxVal);
+
+    // find (maxPrct*size) smallest value
+    const float threshmax = maxPrct * size;
+    while (count < threshmax) {
+        count += histo[k++];
+    }
+
+    if (k > 0) { // interpolate
+        const size_t count_ = count - histo[k - 1];
+        const float c0 = count - threshmax;
+        const float c1 = threshmax - count_;
+        maxOut = (c1 * k + c0 * (k - 1)) / (c0 + c1);
+    } else {
+        maxOut = k;
+    }
+    // go back to original range
+    maxOut /= scale;
+    maxOut += minVal;
+    maxOut = rtengine::LIM(maxOut, minVal, maxVal);
+}
+
+void buildBlendMask(float** luminance, float **blend, int W, int H, float &contrastThreshold, float amount, bool autoContrast, float blur_radius, float luminance_factor)
+{
+    ART_DISPATCH(buildBlendMaskImpl)(luminance, blend, W, H, contrastThreshold, amount, autoContrast, blur_radius, luminance_factor);
+}
+
+
+void markImpulse(int width, int height, float **const src, char **impulse, float thresh)
+{
+    ART_DISPATCH(markImpulseImpl)(width, height, src, impulse, thresh);
+}
+
 // Code adapted from Blender's project
 // https://developer.blender.org/diffusion/B/browse/master/source/blender/blenlib/intern/math_geom.c;3b4a8f1cfa7339f3db9ddd4a7974b8cc30d7ff0b$2411
 float polyFill(float **buffer, int width, int height, const std::vector<CoordD> &poly, const float color)
@@ -1518,3 +1537,5 @@ void inpaint(Imagefloat *img, const array2D<float> &mask, float threshold, int r
 }
 
 } // namespace rtengine
+
+#endif // ART_DISPATCH_ONCE
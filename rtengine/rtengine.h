@@ -563,6 +563,11 @@ int init (const Settings* s, Glib::ustring baseDir, Glib::ustring userSettingsDi
 /** Cleanup the RT engine (static variables) */
 void cleanup ();
 
+/** Stops the pipeline profiler and writes what it recorded to
+  * settings->pipeline_profile_file, if set. Only the first call writes the
+  * file (cleanup() calls it too). Returns false on write errors */
+bool savePipelineProfile();
+
 /** This class  holds all the necessary information to accomplish the full processing of the image */
 class ProcessingJob
 {
@@ -226,6 +226,8 @@ Thumbnail* Thumbnail::loadFromImage (const Glib::ustring& fname, int &w, int &h,
         h = w * img->getHeight() / img->getWidth();
         tpp->scale = (double)img->getWidth() / w;
     }
+    // relative to the full size image, also if it was decoded at a reduced size
+    tpp->scale *= img->getDecodeScale();
 
     h = std::max(h, 1);
     w = std::max(w, 1);
@@ -284,7 +286,16 @@ Thumbnail* Thumbnail::loadQuickFromRaw (const Glib::ustring& fname, eSensorType
 
     sensorType = ri->getSensorType();
 
-    Image8 *img = ri->getThumbnail();
+    // let libjpeg downscale the embedded preview in the DCT domain to just
+    // above the size of the thumbnail, instead of decoding it at full size
+    Image8 *img = nullptr;
+    if (forHistogramMatching) {
+        img = ri->getThumbnail();
+    } else if (fixwh == 1) {
+        img = ri->getThumbnail(0, h);
+    } else {
+        img = ri->getThumbnail(w, 0);
+    }
 
     // did we succeed?
     if (!img) {
@@ -310,6 +321,7 @@ Thumbnail* Thumbnail::loadQuickFromRaw (const Glib::ustring& fname, eSensorType
             h = w * img->getHeight() / img->getWidth();
             tpp->scale = (double)img->getWidth() / w;
         }
+        tpp->scale *= img->getDecodeScale();
     }
 
     if (tpp->thumbImg) {
@@ -320,7 +332,9 @@ Thumbnail* Thumbnail::loadQuickFromRaw (const Glib::ustring& fname, eSensorType
     if (forHistogramMatching) {
         tpp->thumbImg = img;
     } else {
-        tpp->thumbImg = resizeTo<Image8> (w, h, TI_Nearest, img);
+        // the decoded preview is already close to the target size, so
+        // bilinear interpolation is cheap here
+        tpp->thumbImg = resizeTo<Image8> (w, h, TI_Bilinear, img);
         delete img;
     }
 
@@ -1062,6 +1076,7 @@ IImage8* Thumbnail::processImage (const procparams::ProcParams& params, eSensorT
 
         if (dcpProf) {
             dcpProf->setStep2ApplyState (params.icm.workingProfile, params.icm.toneCurve, params.icm.applyLookTable, params.icm.applyBaselineExposureOffset, as);
+            dcpProf->setStep2LUT(params.icm.workingProfile, settings->dcp_lut_size, as);
         }
     }
     ipf.setDCPProfile(dcpProf, as);
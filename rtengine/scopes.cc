@@ -0,0 +1,500 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "scopes.h"
+#include "imagefloat.h"
+#include "image8.h"
+#include "iccstore.h"
+#include "color.h"
+#include "settings.h"
+#include "rtengine.h"
+#include "opthelper.h"
+#include "sleef.h"
+#include "cpudispatch.h"
+#include <algorithm>
+#include <cmath>
+
+// compile the kernels once for each ISA level, see cpudispatch_targets.h
+#define ART_DISPATCH_FILE "scopes.cc"
+#include "cpudispatch_targets.h"
+
+namespace { namespace ART_ISA_NAMESPACE {
+
+using rtengine::ScopeAccumulator;
+
+constexpr int VS_SIZE = ScopeAccumulator::VECTORSCOPE_SIZE;
+
+// the bins of the luma and chroma histograms and of the luma waveform (if
+// wbin is not nullptr) of n pixels. The clamping also maps NaNs to 0
+void lab_bins(const float *L, const float *a, const float *b, int n, uint8_t *lbin, uint8_t *cbin, uint8_t *wbin)
+{
+    for (int i = 0; i < n; ++i) {
+        lbin[i] = std::min(std::max(0.f, L[i] / 128.f), 255.f);
+        cbin[i] = std::min(std::max(0.f, std::sqrt(a[i] * a[i] + b[i] * b[i]) / 188.f), 255.f); // 188 = 48000/256
+    }
+
+    if (wbin) {
+        constexpr float luma_factor = 255.f / 32768.f;
+        for (int i = 0; i < n; ++i) {
+            wbin[i] = std::min(std::max(0.f, L[i] * luma_factor + 0.5f), 255.f);
+        }
+    }
+}
+
+
+// the vectorscope bins of n points, given their (float) column and row.
+// Points outside of the scope go to the trash bin VS_SIZE * VS_SIZE
+void vectorscope_bins(const float *col, const float *row, int n, int *bin)
+{
+    for (int i = 0; i < n; ++i) {
+        // truncation, as in the previous per-pixel code
+        const int c = int(std::min(std::max(-1.f, col[i]), float(VS_SIZE)));
+        const int r = int(std::min(std::max(-1.f, row[i]), float(VS_SIZE)));
+        const bool inside = (c >= 0) & (c < VS_SIZE) & (r >= 0) & (r < VS_SIZE);
+        bin[i] = inside ? r * VS_SIZE + c : VS_SIZE * VS_SIZE;
+    }
+}
+
+
+void hc_bins(float *a, float *b, int n, int *bin)
+{
+    constexpr float norm_factor = VS_SIZE / (128.f * 655.36f);
+    for (int i = 0; i < n; ++i) {
+        a[i] = norm_factor * a[i] + VS_SIZE / 2 + 0.5f;
+        b[i] = norm_factor * b[i] + VS_SIZE / 2 + 0.5f;
+    }
+    vectorscope_bins(a, b, n, bin);
+}
+
+
+// R, G, B, col and row are buffers of n floats
+void hs_bins(const uint8_t *rgb8, int n, float *R, float *G, float *B, float *col, float *row, int *bin)
+{
+    for (int i = 0; i < n; ++i) {
+        R[i] = 257.f * rgb8[3*i];
+        G[i] = 257.f * rgb8[3*i+1];
+        B[i] = 257.f * rgb8[3*i+2];
+    }
+
+    constexpr float half = VS_SIZE / 2;
+    int i = 0;
+#ifdef __SSE2__
+    const vfloat halfv = F2V(half);
+    const vfloat twopiv = F2V(2.f * rtengine::RT_PI_F);
+    for (; i < n - 3; i += 4) {
+        vfloat h, s, l;
+        rtengine::Color::rgb2hsl(LVFU(R[i]), LVFU(G[i]), LVFU(B[i]), h, s, l);
+        const vfloat2 sincosval = xsincosf(twopiv * h);
+        STVFU(col[i], s * sincosval.y * halfv + halfv);
+        STVFU(row[i], s * sincosval.x * halfv + halfv);
+    }
+#endif
+    for (; i < n; ++i) {
+        float h, s, l;
+        rtengine::Color::rgb2hslfloat(R[i], G[i], B[i], h, s, l);
+        const auto sincosval = xsincosf(2.f * rtengine::RT_PI_F * h);
+        col[i] = s * sincosval.y * half + half;
+        row[i] = s * sincosval.x * half + half;
+    }
+
+    vectorscope_bins(col, row, n, bin);
+}
+
+}} // namespace ART_ISA_NAMESPACE
+
+#ifdef ART_DISPATCH_ONCE
+
+namespace rtengine {
+
+extern const Settings *settings;
+
+ScopeAccumulator::ScopeAccumulator(const procparams::ColorManagementParams &icm, const Output &out, int x1, int y1, int x2, int y2):
+    out_(out),
+    x1_(x1),
+    y1_(y1),
+    x2_(std::max(x1, x2)),
+    y2_(std::max(y1, y2)),
+    need_lab_(out.hist_luma || out.waveform_luma),
+    hc_transform_(nullptr)
+{
+    if (out_.hist_red) {
+        out_.hist_red->clear();
+        out_.hist_green->clear();
+        out_.hist_blue->clear();
+        out_.hist_luma->clear();
+        out_.hist_chroma->clear();
+    }
+    if (out_.vectorscope_hc) {
+        out_.vectorscope_hc->fill(0);
+    }
+    if (out_.vectorscope_hs) {
+        out_.vectorscope_hs->fill(0);
+    }
+    if (out_.waveform_red) {
+        const int W = x2_ - x1_;
+        for (auto w : { out_.waveform_red, out_.waveform_green, out_.waveform_blue, out_.waveform_luma }) {
+            if (w->width() != W || w->height() != 256) {
+                (*w)(W, 256);
+            }
+            w->fill(0);
+        }
+        waveform_luma_.assign(size_t(W) * (y2_ - y1_), 0);
+    }
+
+    if (!out_.vectorscope_hc) {
+        return;
+    }
+
+    // the H-C vectorscope shows the Lab values of the output image
+    Glib::ustring profile;
+    cmsHPROFILE oprof = nullptr;
+
+    if (settings->HistogramWorking) {
+        profile = icm.workingProfile;
+    } else {
+        profile = icm.outputProfile;
+
+        if (icm.outputProfile.empty() || icm.outputProfile == procparams::ColorManagementParams::NoICMString) {
+            profile = "sRGB";
+        }
+        oprof = ICCStore::getInstance()->getProfile(profile);
+    }
+
+    if (!oprof) {
+        // the inverse of the conversion in ImProcFunctions::rgb2out, which
+        // uses gamma2curve, i.e. the sRGB gamma
+        const TMatrix wprof = ICCStore::getInstance()->workingSpaceMatrix(profile);
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                hc_matrix_[i][j] = wprof[i][j];
+            }
+        }
+        for (int v = 0; v < 256; ++v) {
+            hc_lin_[0][v] = hc_lin_[1][v] = hc_lin_[2][v] = Color::igammatab_srgb[v * (65535.f / 255.f)];
+        }
+        return;
+    }
+
+    MyMutex::MyLock lock(*lcmsMutex);
+
+    // for matrix-shaper profiles, the conversion to Lab is the same as
+    // linearizing the 256 possible values of each channel and converting to
+    // XYZ with the matrix of the profile. Profiles with LUTs, absolute
+    // colorimetric and black point compensation with a non-zero black point
+    // go through lcms
+    Mat33<float> m;
+    cmsToneCurve *trc[3] = {
+        static_cast<cmsToneCurve *>(cmsReadTag(oprof, cmsSigRedTRCTag)),
+        static_cast<cmsToneCurve *>(cmsReadTag(oprof, cmsSigGreenTRCTag)),
+        static_cast<cmsToneCurve *>(cmsReadTag(oprof, cmsSigBlueTRCTag))
+    };
+    cmsCIEXYZ bp;
+
+    if (icm.outputIntent != RI_ABSOLUTE && ICCStore::getProfileMatrix(oprof, m) && !cmsIsCLUT(oprof, icm.outputIntent, LCMS_USED_AS_INPUT) && trc[0] && trc[1] && trc[2] && (!icm.outputBPC || !cmsDetectBlackPoint(&bp, oprof, icm.outputIntent, 0) || (bp.X == 0 && bp.Y == 0 && bp.Z == 0))) {
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                hc_matrix_[i][j] = m[i][j];
+            }
+        }
+        for (int c = 0; c < 3; ++c) {
+            for (int v = 0; v < 256; ++v) {
+                hc_lin_[c][v] = cmsEvalToneCurveFloat(trc[c], v / 255.f) * 65535.f;
+            }
+        }
+    } else {
+        cmsUInt32Number flags = cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE; // NOCACHE is important for thread safety
+
+        if (icm.outputBPC) {
+            flags |= cmsFLAGS_BLACKPOINTCOMPENSATION;
+        }
+
+        cmsHPROFILE LabIProf = cmsCreateLab4Profile(nullptr);
+        hc_transform_ = cmsCreateTransform(oprof, TYPE_RGB_8, LabIProf, TYPE_Lab_FLT, icm.outputIntent, flags);
+        cmsCloseProfile(LabIProf);
+    }
+}
+
+
+ScopeAccumulator::~ScopeAccumulator()
+{
+    if (hc_transform_) {
+        cmsDeleteTransform(hc_transform_);
+    }
+}
+
+
+void ScopeAccumulator::finish(const Image8 *img, int x0, int y0, bool multiThread)
+{
+    if (!out_.waveform_red) {
+        return;
+    }
+
+    // the waveforms are binned by bands of columns, so that each thread
+    // works on its own part of the outputs
+    constexpr int BAND = 32;
+    const int W = x2_ - x1_;
+    const int H = y2_ - y1_;
+    const int img_width = img->getWidth();
+    array2D<int> &wr = *out_.waveform_red;
+    array2D<int> &wg = *out_.waveform_green;
+    array2D<int> &wb = *out_.waveform_blue;
+    array2D<int> &wl = *out_.waveform_luma;
+
+#ifdef _OPENMP
+#   pragma omp parallel for schedule(dynamic) if (multiThread)
+#endif
+    for (int start = 0; start < W; start += BAND) {
+        const int end = std::min(start + BAND, W);
+        for (int i = 0; i < H; ++i) {
+            const uint8_t *rgb = img->data + (size_t(y1_ + i - y0) * img_width + (x1_ - x0)) * 3;
+            const uint8_t *luma = &waveform_luma_[size_t(i) * W];
+            for (int j = start; j < end; ++j) {
+                wr[rgb[3*j]][j]++;
+                wg[rgb[3*j+1]][j]++;
+                wb[rgb[3*j+2]][j]++;
+                wl[luma[j]][j]++;
+            }
+        }
+    }
+}
+
+
+void ScopeAccumulator::process(const Image8 *img, int x0, int y0, Imagefloat *work, bool multiThread)
+{
+    const int img_width = img->getWidth();
+
+#ifdef _OPENMP
+#   pragma omp parallel if (multiThread)
+#endif
+    {
+        Thread t(this);
+#ifdef _OPENMP
+#       pragma omp for schedule(dynamic,16)
+#endif
+        for (int y = y1_; y < y2_; ++y) {
+            t.add_row(y, img->data + size_t(y - y0) * img_width * 3, x0, work);
+        }
+    }
+
+    finish(img, x0, y0, multiThread);
+}
+
+
+ScopeAccumulator::Thread::Thread(ScopeAccumulator *parent):
+    parent_(parent),
+    width_(parent ? parent->x2_ - parent->x1_ : 0),
+    ws_ok_(false)
+{
+    if (width_ <= 0) {
+        parent_ = nullptr;
+        return;
+    }
+
+    const Output &out = parent_->out_;
+    const bool hc = out.vectorscope_hc, hs = out.vectorscope_hs;
+
+    if (parent_->need_lab_ || hc || hs) {
+        L_.resize(width_);
+        a_.resize(width_);
+        b_.resize(width_);
+    }
+    if (parent_->need_lab_) {
+        lbin_.resize(width_);
+        cbin_.resize(width_);
+    }
+    if (hc || hs) {
+        buf_.resize(3 * width_);
+        vbin_.resize(width_);
+    }
+    if (out.hist_red) {
+        hist_.assign(5 * 256, 0);
+    }
+    if (hc) {
+        vs_hc_.assign(VECTORSCOPE_SIZE * VECTORSCOPE_SIZE + 1, 0);
+    }
+    if (hs) {
+        vs_hs_.assign(VECTORSCOPE_SIZE * VECTORSCOPE_SIZE + 1, 0);
+    }
+}
+
+
+ScopeAccumulator::Thread::~Thread()
+{
+    if (!parent_) {
+        return;
+    }
+
+    const Output &out = parent_->out_;
+    MyMutex::MyLock lock(parent_->mutex_);
+
+    if (out.hist_red) {
+        LUTu *hist[5] = { out.hist_red, out.hist_green, out.hist_blue, out.hist_luma, out.hist_chroma };
+        for (int c = 0; c < 5; ++c) {
+            for (int i = 0; i < 256; ++i) {
+                (*hist[c])[i] += hist_[c * 256 + i];
+            }
+        }
+    }
+
+    const auto merge =
+        [](array2D<int> &dst, const std::vector<uint32_t> &src) -> void
+        {
+            for (int y = 0; y < VECTORSCOPE_SIZE; ++y) {
+                const uint32_t *s = &src[y * VECTORSCOPE_SIZE];
+#ifdef _OPENMP
+#               pragma omp simd
+#endif
+                for (int x = 0; x < VECTORSCOPE_SIZE; ++x) {
+                    dst[y][x] += s[x];
+                }
+            }
+        };
+
+    if (out.vectorscope_hc) {
+        merge(*out.vectorscope_hc, vs_hc_);
+    }
+    if (out.vectorscope_hs) {
+        merge(*out.vectorscope_hs, vs_hs_);
+    }
+}
+
+
+void ScopeAccumulator::Thread::lab_row(int y, Imagefloat *work)
+{
+    const int x1 = parent_->x1_;
+    float *L = L_.data();
+    float *a = a_.data();
+    float *b = b_.data();
+
+    switch (work->mode()) {
+    case Imagefloat::Mode::RGB:
+    case Imagefloat::Mode::XYZ:
+        if (!ws_ok_) {
+            if (work->mode() == Imagefloat::Mode::RGB) {
+                const TMatrix ws = ICCStore::getInstance()->workingSpaceMatrix(work->colorSpace());
+                for (int i = 0; i < 3; ++i) {
+                    for (int j = 0; j < 3; ++j) {
+                        ws_[i][j] = ws[i][j];
+                    }
+                }
+            } else {
+                for (int i = 0; i < 3; ++i) {
+                    for (int j = 0; j < 3; ++j) {
+                        ws_[i][j] = i == j ? 1.f : 0.f;
+                    }
+                }
+            }
+            ws_ok_ = true;
+        }
+        Color::RGB2Lab(work->r(y) + x1, work->g(y) + x1, work->b(y) + x1, L, a, b, ws_, width_);
+        break;
+    case Imagefloat::Mode::LAB:
+        std::copy(work->g(y) + x1, work->g(y) + x1 + width_, L);
+        std::copy(work->r(y) + x1, work->r(y) + x1 + width_, a);
+        std::copy(work->b(y) + x1, work->b(y) + x1 + width_, b);
+        break;
+    default:
+        for (int j = 0; j < width_; ++j) {
+            work->getLab(y, x1 + j, L[j], a[j], b[j]);
+        }
+        break;
+    }
+}
+
+
+void ScopeAccumulator::Thread::hc_lab_row(const uint8_t *rgb8)
+{
+    float *buf = buf_.data();
+
+    if (parent_->hc_transform_) {
+        cmsDoTransform(parent_->hc_transform_, rgb8, buf, width_);
+        for (int j = 0; j < width_; ++j) {
+            L_[j] = buf[3*j] * 327.68f;
+            a_[j] = buf[3*j+1] * 327.68f;
+            b_[j] = buf[3*j+2] * 327.68f;
+        }
+    } else {
+        const auto &lin = parent_->hc_lin_;
+        float *R = buf;
+        float *G = R + width_;
+        float *B = G + width_;
+        for (int j = 0; j < width_; ++j) {
+            R[j] = lin[0][rgb8[3*j]];
+            G[j] = lin[1][rgb8[3*j+1]];
+            B[j] = lin[2][rgb8[3*j+2]];
+        }
+        Color::RGB2Lab(R, G, B, L_.data(), a_.data(), b_.data(), parent_->hc_matrix_, width_);
+    }
+}
+
+
+void ScopeAccumulator::Thread::add_row(int y, const uint8_t *rgb8, int x0, Imagefloat *work)
+{
+    if (!parent_ || y < parent_->y1_ || y >= parent_->y2_) {
+        return;
+    }
+
+    const Output &out = parent_->out_;
+    const int n = width_;
+    rgb8 += 3 * (parent_->x1_ - x0);
+
+    if (out.hist_red) {
+        uint32_t *hr = &hist_[0];
+        uint32_t *hg = &hist_[256];
+        uint32_t *hb = &hist_[512];
+        for (int j = 0; j < n; ++j) {
+            hr[rgb8[3*j]]++;
+            hg[rgb8[3*j+1]]++;
+            hb[rgb8[3*j+2]]++;
+        }
+    }
+
+    if (parent_->need_lab_) {
+        lab_row(y, work);
+        uint8_t *wbin = out.waveform_luma ? &parent_->waveform_luma_[size_t(y - parent_->y1_) * n] : nullptr;
+        ART_DISPATCH(lab_bins)(L_.data(), a_.data(), b_.data(), n, lbin_.data(), cbin_.data(), wbin);
+
+        if (out.hist_luma) {
+            uint32_t *hl = &hist_[768];
+            uint32_t *hc = &hist_[1024];
+            for (int j = 0; j < n; ++j) {
+                hl[lbin_[j]]++;
+                hc[cbin_[j]]++;
+            }
+        }
+    }
+
+    if (out.vectorscope_hc) {
+        hc_lab_row(rgb8);
+        ART_DISPATCH(hc_bins)(a_.data(), b_.data(), n, vbin_.data());
+        for (int j = 0; j < n; ++j) {
+            vs_hc_[vbin_[j]]++;
+        }
+    }
+
+    if (out.vectorscope_hs) {
+        float *R = buf_.data();
+        ART_DISPATCH(hs_bins)(rgb8, n, R, R + n, R + 2 * n, a_.data(), b_.data(), vbin_.data());
+        for (int j = 0; j < n; ++j) {
+            vs_hs_[vbin_[j]]++;
+        }
+    }
+}
+
+} // namespace rtengine
+
+#endif // ART_DISPATCH_ONCE
@@ -0,0 +1,128 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <lcms2.h>
+
+#include "noncopyable.h"
+#include "procparams.h"
+#include "array2D.h"
+#include "LUT.h"
+#include "../rtgui/threadutils.h"
+
+namespace rtengine {
+
+class Imagefloat;
+class Image8;
+
+/**
+ * Accumulation of the histograms, waveforms and vectorscopes of the editor
+ * from the rows of the preview converted to the output (or histogram)
+ * profile, so that the scopes are computed in the same pass as the
+ * conversion (see ImProcFunctions::rgb2out) instead of in passes of their
+ * own. The bin indices are computed a row at a time in branch-free loops,
+ * with kernels compiled for each supported instruction set (see
+ * cpudispatch.h); each thread bins into private copies of the histograms and
+ * vectorscopes, merged at the end. The waveforms are binned by finish(), one
+ * band of columns per thread, so that they need no private copies.
+ */
+class ScopeAccumulator: public NonCopyable {
+public:
+    static constexpr int VECTORSCOPE_SIZE = 128;
+
+    // the scopes to compute, nullptr for the ones not needed. The five
+    // histograms and the four waveforms are computed all or none
+    struct Output {
+        LUTu *hist_red = nullptr;
+        LUTu *hist_green = nullptr;
+        LUTu *hist_blue = nullptr;
+        LUTu *hist_luma = nullptr;
+        LUTu *hist_chroma = nullptr;
+        array2D<int> *vectorscope_hc = nullptr;
+        array2D<int> *vectorscope_hs = nullptr;
+        array2D<int> *waveform_red = nullptr;
+        array2D<int> *waveform_green = nullptr;
+        array2D<int> *waveform_blue = nullptr;
+        array2D<int> *waveform_luma = nullptr;
+    };
+
+    // the scopes are computed on the area [x1, x2) x [y1, y2) of the working
+    // image. The requested outputs are cleared (and the waveforms resized)
+    // here
+    ScopeAccumulator(const procparams::ColorManagementParams &icm, const Output &out, int x1, int y1, int x2, int y2);
+    ~ScopeAccumulator();
+
+    // the per-thread state. The destructor merges the bins into the outputs
+    class Thread: public NonCopyable {
+    public:
+        // parent can be nullptr, in which case add_row does nothing
+        explicit Thread(ScopeAccumulator *parent);
+        ~Thread();
+
+        // adds row y of the working image work: rgb8 points to the pixels of
+        // the row converted to the output profile (3 bytes each), starting
+        // from column x0
+        void add_row(int y, const uint8_t *rgb8, int x0, Imagefloat *work);
+
+    private:
+        void lab_row(int y, Imagefloat *work);
+        void hc_lab_row(const uint8_t *rgb8);
+
+        ScopeAccumulator *parent_;
+        int width_;
+        std::vector<float> L_, a_, b_;
+        std::vector<float> buf_;
+        std::vector<uint8_t> lbin_, cbin_;
+        std::vector<int> vbin_;
+        std::vector<uint32_t> hist_; // red, green, blue, luma, chroma
+        std::vector<uint32_t> vs_hc_; // with a trash bin at the end
+        std::vector<uint32_t> vs_hs_;
+        bool ws_ok_;
+        float ws_[3][3];
+    };
+
+    // completes the scopes after all the rows have been added (and all the
+    // Thread objects destroyed). img is the converted image, whose top left
+    // corner is at (x0, y0) in the working image
+    void finish(const Image8 *img, int x0, int y0, bool multiThread);
+
+    // computes the scopes in a pass of their own over an already converted
+    // image
+    void process(const Image8 *img, int x0, int y0, Imagefloat *work, bool multiThread);
+
+private:
+    Output out_;
+    int x1_;
+    int y1_;
+    int x2_;
+    int y2_;
+    bool need_lab_;
+    // the luma bins of the waveform, filled by the threads for finish()
+    std::vector<uint8_t> waveform_luma_;
+    // conversion of the output values to Lab for the H-C vectorscope: either
+    // linearization curves and a matrix to XYZ, or (for LUT profiles) a cms
+    // transform
+    cmsHTRANSFORM hc_transform_;
+    float hc_lin_[3][256];
+    float hc_matrix_[3][3];
+    MyMutex mutex_;
+};
+
+} // namespace rtengine
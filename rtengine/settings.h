@@ -93,6 +93,21 @@ public:
     static ColorManagementMode color_mgmt_mode;
 
     int imgio_raw_cache_size;
+
+    int demosaic_cache_size; ///< max size (in MB) of the on-disk cache of demosaiced raw data, 0 to disable it
+    int preview_checkpoint_cache_size; ///< max memory (in MB) used for the checkpoints of the preview pipeline, 0 to disable them
+    int buffer_pool_size; ///< max memory (in MB) kept for reuse by the pool of large image buffers, 0 to disable it
+    int clut_cache_size; ///< max size (in MB) of the on-disk cache of decoded HaldCLUTs, shared across processes, 0 to disable it
+    Glib::ustring cpu_isa; ///< instruction set of the multi-ISA kernels: "auto", "sse2", "avx2" or "avx512" (see cpu::init)
+    int dcp_lut_size; ///< grid size of the 3D LUT used to apply the DCP look table and tone curve in the editor preview and thumbnails (exports are always exact), 0 for the exact per-pixel computation
+    int exiftool_workers; ///< max number of exiftool processes used concurrently for reading metadata
+    Glib::ustring pipeline_profile_file; ///< if not empty, profile the processing steps and write the report to this file at exit
+    int pipeline_profile_format; ///< 0: JSON summary, 1: Chrome trace (see PipelineProfiler::Format)
+    bool preview_cancellation; ///< abort the processing of the preview as soon as newer parameters arrive
+    bool concurrent_crop_updates; ///< process the detail crops of the editor concurrently, splitting the threads among them
+    int progressive_preview_threshold; ///< ms; while the parameters keep changing, detail crops slower than this are rendered at half resolution first, and refined when the input goes idle. 0 to disable
+    int mask_cache_size; ///< max memory (in MB) used for caching the masks of the tools in the editor, 0 to disable it
+    int geometry_mesh_step; ///< spacing (in pixels) of the nodes of the mesh used to apply the lens/rotation/perspective corrections in a single resampling pass, 0 for the exact per-pixel computation in separate passes
 };
 
 } // namespace rtengine
@@ -19,6 +19,7 @@
 #include "stdimagesource.h"
 #include "mytime.h"
 #include "iccstore.h"
+#include "matrixshaper.h"
 #include "imageio.h"
 #include "curves.h"
 #include "color.h"
@@ -430,9 +431,13 @@ void StdImageSource::colorSpaceConversion (Imagefloat* im, const ColorManagement
         lcmsMutex->lock();
         ARTInputProfile artprof(in, cmp);
         cmsHTRANSFORM hTransform = nullptr;
+        std::unique_ptr<MatrixShaperTransform> ms;
         if (!artprof) {
-            hTransform = cmsCreateTransform (in, TYPE_RGB_FLT, out, TYPE_RGB_FLT, INTENT_RELATIVE_COLORIMETRIC,
-                                                       cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE);
+            ms = MatrixShaperTransform::create(in, TYPE_RGB_FLT, out, TYPE_RGB_FLT, INTENT_RELATIVE_COLORIMETRIC, cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE);
+            if (!ms) {
+                hTransform = cmsCreateTransform (in, TYPE_RGB_FLT, out, TYPE_RGB_FLT, INTENT_RELATIVE_COLORIMETRIC,
+                                                 cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE);
+            }
         }
         lcmsMutex->unlock();
 
@@ -441,6 +446,10 @@ void StdImageSource::colorSpaceConversion (Imagefloat* im, const ColorManagement
                 printf("stdimagesource: ART ICC profile detected, using built-in color space conversion\n");
             }
             artprof(im, im, multithread);
+        } else if (ms) {
+            im->normalizeFloatTo1();
+            im->ExecCMSTransform(*ms, multithread);
+            im->normalizeFloatTo65535();
         } else if (hTransform) {
             // Convert to the [0.0 ; 1.0] range
             im->normalizeFloatTo1();
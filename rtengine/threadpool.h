@@ -27,7 +27,7 @@ freely, subject to the following restrictions:
 #pragma once
 
 #include <vector>
-#include <queue>
+#include <deque>
 #include <memory>
 #include <thread>
 #include <mutex>
@@ -36,11 +36,18 @@ freely, subject to the following restrictions:
 #include <functional>
 #include <stdexcept>
 #include <limits>
+#include <atomic>
 
 #include "noncopyable.h"
 
 namespace rtengine {
 
+// Work-stealing thread pool. Every worker owns a set of deques (one per
+// priority level): tasks added from a worker thread go to the back of its
+// own deque and are popped LIFO by the owner, while idle workers steal from
+// the front of the deques of the others. Tasks added from non-worker threads
+// go to a shared FIFO queue. Higher priority tasks are always picked first,
+// regardless of the queue they are in.
 class ThreadPool: public NonCopyable {
 public: 
     enum class Priority {
@@ -57,6 +64,47 @@ public:
 
     static void init(size_t num_workers);
     static void cleanup();
+
+    struct Stats {
+        size_t num_workers;
+        size_t queue_depth; // tasks waiting to be executed
+        size_t executed;    // tasks executed so far
+        size_t steals;      // tasks taken from the deque of another worker
+    };
+    static Stats get_stats();
+
+    // A set of tasks that can be waited for. The tasks not started yet are
+    // executed by wait() itself. When wait() is called from a worker thread
+    // with help set, the worker also executes the other pending tasks of the
+    // pool instead of blocking, so that groups can be nested without
+    // exhausting the pool. Callers holding locks must not help, since the
+    // tasks of others might need them. Tasks of a group must not throw.
+    class TaskGroup: public NonCopyable {
+    public:
+        explicit TaskGroup(Priority p=Priority::NORMAL): p_(p), state_(std::make_shared<State>()) {}
+        ~TaskGroup() { wait(); }
+
+        template <class F>
+        void run(F &&f);
+        void wait(bool help=true);
+
+    private:
+        // shared with the tasks pushed to the pool, which can outlive the
+        // group once all its tasks have been executed by wait()
+        struct State {
+            State(): pending(0) {}
+            std::atomic<size_t> pending;
+            std::deque<std::function<void()>> tasks;
+            std::mutex mutex;
+            std::condition_variable condition;
+        };
+
+        // executes the next task of the group not started yet, if any
+        static bool run_one(State &s);
+
+        Priority p_;
+        std::shared_ptr<State> state_;
+    };
     
 private:
     ThreadPool(size_t);
@@ -75,30 +123,42 @@ public:
     ~ThreadPool();
 
 private:
+    typedef std::function<void()> Task;
+    static constexpr size_t NUM_PRIORITIES = size_t(Priority::HIGHEST) + 1;
+    
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks[NUM_PRIORITIES];
+    };
+
+    void push(Priority p, Task task);
+    bool pop(int worker, Task &task);
+    bool run_pending(int worker);
+    void worker_loop(int worker);
+
+    // index of the worker running on the calling thread, -1 if the calling
+    // thread does not belong to the pool
+    static int &current_worker()
+    {
+        static thread_local int idx = -1;
+        return idx;
+    }
+
     // need to keep track of threads so we can join them
     std::vector<std::thread> workers_;
-    // the task queue
-    class Task: public std::function<void()> {
-    public:
-        template <class Fn>
-        explicit Task(Priority p, size_t i, Fn func):
-            std::function<void()>(func), p_(p), i_(i) {}
-
-        bool operator<(const Task &other) const
-        {
-            return p_ == other.p_ ? i_ > other.i_ : p_ < other.p_;
-        }
-    private:
-        Priority p_;
-        size_t i_;
-    };
-    std::priority_queue<Task> tasks_;
+    // one queue per worker, plus the shared one (the last) for tasks coming
+    // from the outside
+    std::vector<std::unique_ptr<Queue>> queues_;
     
     // synchronization
-    std::mutex queue_mutex_;
+    std::mutex mutex_;
     std::condition_variable condition_;
     bool stop_;
-    size_t idx_;
+    // this can transiently become negative, when a task is popped before its
+    // insertion has been accounted for
+    std::atomic<long> pending_;
+    std::atomic<size_t> executed_;
+    std::atomic<size_t> steals_;
 
     static std::unique_ptr<ThreadPool> instance_;
 };
@@ -107,31 +167,107 @@ private:
 // the constructor just launches some amount of workers
 inline ThreadPool::ThreadPool(size_t threads):
     stop_(false),
-    idx_(0)
+    pending_(0),
+    executed_(0),
+    steals_(0)
 {
+    threads = std::max(threads, size_t(1));
+    for (size_t i = 0; i <= threads; ++i) {
+        queues_.emplace_back(new Queue());
+    }
     for (size_t i = 0; i < threads; ++i) {
-        workers_.emplace_back(
-            [this]
-            {
-                while (true) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(this->queue_mutex_);
-                        this->condition_.wait(
-                            lock,
-                            [this]{ return this->stop_ ||
-                                    !this->tasks_.empty(); });
-                        if (this->stop_ && this->tasks_.empty()) {
-                            return;
-                        }
-                        task = std::move(this->tasks_.top());
-                        this->tasks_.pop();
-                    }
-
-                    task();
-                }
+        workers_.emplace_back([this, i]() { worker_loop(i); });
+    }
+}
+
+
+inline void ThreadPool::push(Priority p, Task task)
+{
+    int w = current_worker();
+    Queue &q = w >= 0 ? *queues_[w] : *queues_.back();
+    {
+        std::unique_lock<std::mutex> lock(q.mutex);
+        q.tasks[size_t(p)].emplace_back(std::move(task));
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++pending_;
+    }
+    condition_.notify_one();
+}
+
+
+inline bool ThreadPool::pop(int worker, Task &task)
+{
+    const int n = workers_.size();
+    
+    for (int p = NUM_PRIORITIES-1; p >= 0; --p) {
+        if (worker >= 0) {
+            Queue &q = *queues_[worker];
+            std::unique_lock<std::mutex> lock(q.mutex);
+            if (!q.tasks[p].empty()) {
+                task = std::move(q.tasks[p].back());
+                q.tasks[p].pop_back();
+                return true;
             }
-        );
+        }
+        {
+            Queue &q = *queues_.back();
+            std::unique_lock<std::mutex> lock(q.mutex);
+            if (!q.tasks[p].empty()) {
+                task = std::move(q.tasks[p].front());
+                q.tasks[p].pop_front();
+                return true;
+            }
+        }
+        for (int i = 1; i <= n; ++i) {
+            int victim = (std::max(worker, 0) + i) % n;
+            if (victim == worker) {
+                continue;
+            }
+            Queue &q = *queues_[victim];
+            std::unique_lock<std::mutex> lock(q.mutex);
+            if (!q.tasks[p].empty()) {
+                task = std::move(q.tasks[p].front());
+                q.tasks[p].pop_front();
+                ++steals_;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+inline bool ThreadPool::run_pending(int worker)
+{
+    Task task;
+    if (pop(worker, task)) {
+        --pending_;
+        task();
+        ++executed_;
+        return true;
+    }
+    return false;
+}
+
+
+inline void ThreadPool::worker_loop(int worker)
+{
+    current_worker() = worker;
+    
+    while (true) {
+        if (run_pending(worker)) {
+            continue;
+        }
+        
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(
+            lock,
+            [this]{ return stop_ || pending_ > 0; });
+        if (stop_ && pending_ <= 0) {
+            return;
+        }
     }
 }
 
@@ -149,16 +285,15 @@ auto ThreadPool::enqueue(Priority p, F&& f, Args&&... args)
         
     std::future<return_type> res = task->get_future();
     {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
+        std::unique_lock<std::mutex> lock(mutex_);
 
         // don't allow enqueueing after stopping the pool
         if (stop_) {
             throw std::runtime_error("enqueue on stopped ThreadPool");
         }
-
-        tasks_.emplace(p, idx_++, [task](){ (*task)(); });
     }
-    condition_.notify_one();
+
+    push(p, [task](){ (*task)(); });
     return res;
 }
 
@@ -167,7 +302,7 @@ auto ThreadPool::enqueue(Priority p, F&& f, Args&&... args)
 inline ThreadPool::~ThreadPool()
 {
     {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
+        std::unique_lock<std::mutex> lock(mutex_);
         stop_ = true;
     }
     condition_.notify_all();
@@ -189,6 +324,19 @@ inline void ThreadPool::cleanup()
 }
 
 
+inline ThreadPool::Stats ThreadPool::get_stats()
+{
+    Stats ret = { 0, 0, 0, 0 };
+    if (instance_) {
+        ret.num_workers = instance_->workers_.size();
+        ret.queue_depth = std::max(instance_->pending_.load(), 0L);
+        ret.executed = instance_->executed_;
+        ret.steals = instance_->steals_;
+    }
+    return ret;
+}
+
+
 template<class F, class... Args>
 auto ThreadPool::add_task(Priority p, F &&f, Args &&... args) 
     -> std::future<typename std::result_of<F(Args...)>::type>
@@ -196,5 +344,56 @@ auto ThreadPool::add_task(Priority p, F &&f, Args &&... args)
     return instance_->enqueue(p, f, args...);
 }
 
-} // namespace rtengine
 
+template <class F>
+void ThreadPool::TaskGroup::run(F &&f)
+{
+    {
+        std::unique_lock<std::mutex> lock(state_->mutex);
+        ++state_->pending;
+        state_->tasks.emplace_back(std::forward<F>(f));
+    }
+    std::shared_ptr<State> s = state_;
+    instance_->push(p_, [s]() { run_one(*s); });
+}
+
+
+inline bool ThreadPool::TaskGroup::run_one(State &s)
+{
+    std::function<void()> task;
+    {
+        std::unique_lock<std::mutex> lock(s.mutex);
+        if (s.tasks.empty()) {
+            return false;
+        }
+        task = std::move(s.tasks.front());
+        s.tasks.pop_front();
+    }
+    task();
+    std::unique_lock<std::mutex> lock(s.mutex);
+    if (--s.pending == 0) {
+        s.condition.notify_all();
+    }
+    return true;
+}
+
+
+inline void ThreadPool::TaskGroup::wait(bool help)
+{
+    State &s = *state_;
+    while (run_one(s)) {
+    }
+    int w = current_worker();
+    if (help && w >= 0) {
+        // help the pool instead of blocking a worker
+        while (s.pending > 0) {
+            if (!instance_->run_pending(w)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    std::unique_lock<std::mutex> lock(s.mutex);
+    s.condition.wait(lock, [&s]{ return s.pending == 0; });
+}
+
+} // namespace rtengine
@@ -0,0 +1,339 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "browserfilterindex.h"
+#include <glibmm/regex.h>
+#include <giomm.h>
+#include <limits>
+
+namespace {
+
+constexpr double tol = 0.01;
+constexpr double tol2 = 1e-8;
+
+} // namespace
+
+
+//-----------------------------------------------------------------------------
+// BrowserFilterIndex::StringColumn
+//-----------------------------------------------------------------------------
+
+BrowserFilterIndex::StringColumn::StringColumn():
+    enabled_(false)
+{
+}
+
+
+void BrowserFilterIndex::StringColumn::clear()
+{
+    ids_.clear();
+    values_.clear();
+    allowed_.clear();
+}
+
+
+uint32_t BrowserFilterIndex::StringColumn::intern(const std::string &value)
+{
+    auto it = ids_.find(value);
+    if (it != ids_.end()) {
+        return it->second;
+    }
+    const uint32_t id = values_.size();
+    ids_.emplace(value, id);
+    values_.push_back(value);
+    allowed_.push_back(filter_.count(value) > 0);
+    return id;
+}
+
+
+void BrowserFilterIndex::StringColumn::compile(bool enabled, const std::set<std::string> &allowed)
+{
+    enabled_ = enabled;
+    filter_ = allowed;
+    for (size_t i = 0; i < values_.size(); ++i) {
+        allowed_[i] = filter_.count(values_[i]) > 0;
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+// BrowserFilterIndex
+//-----------------------------------------------------------------------------
+
+BrowserFilterIndex::BrowserFilterIndex():
+    query_match_equal_(true),
+    exif_enabled_(false),
+    date_from_(0),
+    date_to_(std::numeric_limits<uint32_t>::max())
+{
+}
+
+
+void BrowserFilterIndex::clear()
+{
+    rows_.clear();
+    entries_.clear();
+    stamp_.clear();
+    name_.clear();
+    exif_valid_.clear();
+    date_.clear();
+    timestamp_.clear();
+    shutter_.clear();
+    fnumber_.clear();
+    focal_len_.clear();
+    iso_.clear();
+    camera_.clear();
+    lens_.clear();
+    orientation_.clear();
+    filetype_.clear();
+    expcomp_.clear();
+    cameras_.clear();
+    lenses_.clear();
+    orientations_.clear();
+    filetypes_.clear();
+    expcomps_.clear();
+}
+
+
+size_t BrowserFilterIndex::add(const ThumbBrowserEntryBase *entry, const CacheImageData *cfs, const Glib::ustring &fname, unsigned int stamp)
+{
+    const size_t row = entries_.size();
+    rows_[entry] = row;
+    entries_.push_back(entry);
+
+    const size_t n = row + 1;
+    stamp_.resize(n);
+    name_.resize(n);
+    exif_valid_.resize(n);
+    date_.resize(n);
+    timestamp_.resize(n);
+    shutter_.resize(n);
+    fnumber_.resize(n);
+    focal_len_.resize(n);
+    iso_.resize(n);
+    camera_.resize(n);
+    lens_.resize(n);
+    orientation_.resize(n);
+    filetype_.resize(n);
+    expcomp_.resize(n);
+
+    update(row, cfs, fname, stamp);
+    return row;
+}
+
+
+void BrowserFilterIndex::update(size_t row, const CacheImageData *cfs, const Glib::ustring &fname, unsigned int stamp)
+{
+    stamp_[row] = stamp;
+    name_[row] = Glib::path_get_basename(fname).uppercase();
+    exif_valid_[row] = cfs->exifValid;
+    date_[row] = g_date_valid_dmy(cfs->day, GDateMonth(cfs->month), cfs->year) ? Glib::Date(cfs->day, Glib::Date::Month(cfs->month), cfs->year).get_julian() : 0;
+    timestamp_[row] = cfs->getDateTimeAsTS();
+    // normalised in the same way as the values shown in the filter panel
+    shutter_[row] = rtengine::FramesMetaData::shutterFromString(rtengine::FramesMetaData::shutterToString(cfs->shutter));
+    fnumber_[row] = rtengine::FramesMetaData::apertureFromString(rtengine::FramesMetaData::apertureToString(cfs->fnumber));
+    focal_len_[row] = cfs->focalLen;
+    iso_[row] = cfs->iso;
+    camera_[row] = cameras_.intern(cfs->getCamera());
+    lens_[row] = lenses_.intern(cfs->lens);
+    orientation_[row] = orientations_.intern(cfs->getOrientationFilter());
+    filetype_[row] = filetypes_.intern(cfs->filetype);
+    expcomp_[row] = expcomps_.intern(cfs->expcomp);
+}
+
+
+void BrowserFilterIndex::remove(const ThumbBrowserEntryBase *entry)
+{
+    auto it = rows_.find(entry);
+    if (it == rows_.end()) {
+        return;
+    }
+
+    // move the last row in place of the removed one
+    const size_t row = it->second;
+    const size_t last = entries_.size() - 1;
+    rows_.erase(it);
+    if (row != last) {
+        entries_[row] = entries_[last];
+        rows_[entries_[row]] = row;
+        stamp_[row] = stamp_[last];
+        name_[row] = std::move(name_[last]);
+        exif_valid_[row] = exif_valid_[last];
+        date_[row] = date_[last];
+        timestamp_[row] = timestamp_[last];
+        shutter_[row] = shutter_[last];
+        fnumber_[row] = fnumber_[last];
+        focal_len_[row] = focal_len_[last];
+        iso_[row] = iso_[last];
+        camera_[row] = camera_[last];
+        lens_[row] = lens_[last];
+        orientation_[row] = orientation_[last];
+        filetype_[row] = filetype_[last];
+        expcomp_[row] = expcomp_[last];
+    }
+    entries_.pop_back();
+    stamp_.pop_back();
+    name_.pop_back();
+    exif_valid_.pop_back();
+    date_.pop_back();
+    timestamp_.pop_back();
+    shutter_.pop_back();
+    fnumber_.pop_back();
+    focal_len_.pop_back();
+    iso_.pop_back();
+    camera_.pop_back();
+    lens_.pop_back();
+    orientation_.pop_back();
+    filetype_.pop_back();
+    expcomp_.pop_back();
+}
+
+
+void BrowserFilterIndex::setFilter(const BrowserFilter &filter)
+{
+    query_.clear();
+    query_match_equal_ = true;
+
+    if (!filter.queryFileName.empty()) {
+        // Determine the match mode - check if the first 2 characters are equal to "!="
+        Glib::ustring q = filter.queryFileName;
+        if (q.find("!=") == 0) {
+            q = q.substr(2, q.length() - 2);
+            query_match_equal_ = false;
+        }
+        // comma separated values, the query matches if ANY of them is
+        // contained in the file name. Empty values are ignored, otherwise
+        // the filter would always match when the query ends with a ","
+        for (auto &s : Glib::Regex::split_simple(",", q.uppercase())) {
+            if (!s.empty()) {
+                query_.push_back(s);
+            }
+        }
+        if (query_.empty()) {
+            // only empty values: nothing can match, as in the original
+            // linear check
+            query_.push_back(Glib::ustring());
+        }
+    }
+
+    exif_enabled_ = filter.exifFilterEnabled;
+    exif_ = filter.exifFilter;
+
+    cameras_.compile(exif_.filterCamera, exif_.cameras);
+    lenses_.compile(exif_.filterLens, exif_.lenses);
+    orientations_.compile(exif_.filterOrientation, exif_.orientations);
+    filetypes_.compile(exif_.filterFiletype, exif_.filetypes);
+    expcomps_.compile(exif_.filterExpComp, exif_.expcomp);
+
+    date_from_ = exif_.dateFrom.valid() ? exif_.dateFrom.get_julian() : 0;
+    date_to_ = exif_.dateTo.valid() ? exif_.dateTo.get_julian() : std::numeric_limits<uint32_t>::max();
+}
+
+
+size_t BrowserFilterIndex::getRow(const ThumbBrowserEntryBase *entry, const CacheImageData *cfs, const Glib::ustring &fname, unsigned int stamp)
+{
+    auto it = rows_.find(entry);
+    if (it == rows_.end()) {
+        return add(entry, cfs, fname, stamp);
+    }
+    const size_t row = it->second;
+    if (stamp_[row] != stamp) {
+        update(row, cfs, fname, stamp);
+    }
+    return row;
+}
+
+
+bool BrowserFilterIndex::matches(const ThumbBrowserEntryBase *entry, const CacheImageData *cfs, const Glib::ustring &fname, unsigned int stamp)
+{
+    const size_t row = getRow(entry, cfs, fname, stamp);
+
+    if (!query_.empty()) {
+        const Glib::ustring &name = name_[row];
+        bool found = false;
+        for (auto &s : query_) {
+            if (!s.empty() && name.find(s) != Glib::ustring::npos) {
+                found = true;
+                break;
+            }
+        }
+        if (found != query_match_equal_) {
+            return false;
+        }
+    }
+
+    if (!exif_enabled_) {
+        return true;
+    }
+
+    if (!cameras_.accepts(camera_[row]) || !lenses_.accepts(lens_[row]) || !orientations_.accepts(orientation_[row]) || !filetypes_.accepts(filetype_[row]) || !expcomps_.accepts(expcomp_[row])) {
+        return false;
+    }
+
+    if (!exif_valid_[row]) {
+        return true;
+    }
+
+    if (exif_.filterDate && date_[row] && (date_[row] < date_from_ || date_[row] > date_to_)) {
+        return false;
+    }
+
+    return
+        (!exif_.filterShutter || (shutter_[row] >= exif_.shutterFrom - tol2 && shutter_[row] <= exif_.shutterTo + tol2))
+        && (!exif_.filterFNumber || (fnumber_[row] >= exif_.fnumberFrom - tol2 && fnumber_[row] <= exif_.fnumberTo + tol2))
+        && (!exif_.filterFocalLen || (focal_len_[row] >= exif_.focalFrom - tol && focal_len_[row] <= exif_.focalTo + tol))
+        && (!exif_.filterISO || (iso_[row] >= exif_.isoFrom && iso_[row] <= exif_.isoTo));
+}
+
+
+int64_t BrowserFilterIndex::sortKey(Options::ThumbnailOrder order, const ThumbBrowserEntryBase *entry, const CacheImageData *cfs, const Glib::ustring &fname, unsigned int stamp)
+{
+    switch (order) {
+    case Options::ThumbnailOrder::DATE:
+    case Options::ThumbnailOrder::DATE_REV:
+        return timestamp_[getRow(entry, cfs, fname, stamp)];
+    case Options::ThumbnailOrder::MODTIME:
+    case Options::ThumbnailOrder::MODTIME_REV:
+        return modTimeKey(fname);
+    case Options::ThumbnailOrder::PROCTIME:
+    case Options::ThumbnailOrder::PROCTIME_REV:
+        return procTimeKey(fname);
+    default:
+        return 0;
+    }
+}
+
+
+int64_t BrowserFilterIndex::modTimeKey(const Glib::ustring &fname)
+{
+    try {
+        auto t = Gio::File::create_for_path(fname)->query_info(G_FILE_ATTRIBUTE_TIME_MODIFIED)->modification_time();
+        return int64_t(t.tv_sec) * 1000000 + t.tv_usec;
+    } catch (Glib::Exception &) {
+        return std::numeric_limits<int64_t>::min();
+    }
+}
+
+
+int64_t BrowserFilterIndex::procTimeKey(const Glib::ustring &fname)
+{
+    auto pp = options.getParamFile(fname);
+    if (!Glib::file_test(pp, Glib::FILE_TEST_EXISTS)) {
+        return std::numeric_limits<int64_t>::min();
+    }
+    return modTimeKey(pp);
+}
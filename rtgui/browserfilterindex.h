@@ -0,0 +1,124 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <set>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <glibmm/ustring.h>
+
+#include "browserfilter.h"
+#include "cacheimagedata.h"
+#include "options.h"
+
+class ThumbBrowserEntryBase;
+
+/**
+ * Columnar index of the cached fields checked by the file name query and
+ * by the EXIF filter of the file browser, and of the shot time used to sort
+ * the thumbnails by date. The values of each entry are
+ * extracted (and normalised) only once, string fields are interned so that
+ * the set lookups of the filter become a table lookup per entry, and the
+ * query is parsed once in setFilter() instead of once per entry. The row of
+ * an entry is refreshed when the stamp of its cached data changes (see
+ * Thumbnail::getCacheImageDataStamp).
+ *
+ * The rank, color label, trash and edited flags are not indexed, since they
+ * change often and they are cheap to check. Neither are the modification
+ * times of the files and of their sidecars: sortKey() reads them when asked.
+ */
+class BrowserFilterIndex {
+public:
+    BrowserFilterIndex();
+
+    void clear();
+    void remove(const ThumbBrowserEntryBase *entry);
+    void setFilter(const BrowserFilter &filter);
+
+    // true if the entry satisfies the file name query and the EXIF filter.
+    // The entry is added to the index the first time it is checked, and
+    // updated when stamp differs from the one it was indexed with
+    bool matches(const ThumbBrowserEntryBase *entry, const CacheImageData *cfs, const Glib::ustring &fname, unsigned int stamp);
+
+    // the key by which the entry is sorted for the given order (files with
+    // the same key are sorted by name, and so are all of them for the
+    // FILENAME orders). The shot time comes from the index, the
+    // modification times are read from the file system
+    int64_t sortKey(Options::ThumbnailOrder order, const ThumbBrowserEntryBase *entry, const CacheImageData *cfs, const Glib::ustring &fname, unsigned int stamp);
+
+    // the keys of the orders by modification time and by processing time
+    // (time of the last change of the sidecar, files without one first)
+    static int64_t modTimeKey(const Glib::ustring &fname);
+    static int64_t procTimeKey(const Glib::ustring &fname);
+
+private:
+    class StringColumn {
+    public:
+        StringColumn();
+        void clear();
+        uint32_t intern(const std::string &value);
+        void compile(bool enabled, const std::set<std::string> &allowed);
+        bool accepts(uint32_t id) const { return !enabled_ || allowed_[id]; }
+
+    private:
+        std::unordered_map<std::string, uint32_t> ids_;
+        std::vector<std::string> values_;
+        bool enabled_;
+        std::set<std::string> filter_;
+        std::vector<uint8_t> allowed_;
+    };
+
+    size_t getRow(const ThumbBrowserEntryBase *entry, const CacheImageData *cfs, const Glib::ustring &fname, unsigned int stamp);
+    size_t add(const ThumbBrowserEntryBase *entry, const CacheImageData *cfs, const Glib::ustring &fname, unsigned int stamp);
+    void update(size_t row, const CacheImageData *cfs, const Glib::ustring &fname, unsigned int stamp);
+
+    std::unordered_map<const ThumbBrowserEntryBase *, size_t> rows_;
+    std::vector<const ThumbBrowserEntryBase *> entries_;
+
+    // columns
+    std::vector<unsigned int> stamp_;
+    std::vector<Glib::ustring> name_;
+    std::vector<uint8_t> exif_valid_;
+    std::vector<uint32_t> date_;
+    std::vector<int64_t> timestamp_;
+    std::vector<double> shutter_;
+    std::vector<double> fnumber_;
+    std::vector<double> focal_len_;
+    std::vector<unsigned> iso_;
+    std::vector<uint32_t> camera_;
+    std::vector<uint32_t> lens_;
+    std::vector<uint32_t> orientation_;
+    std::vector<uint32_t> filetype_;
+    std::vector<uint32_t> expcomp_;
+
+    StringColumn cameras_;
+    StringColumn lenses_;
+    StringColumn orientations_;
+    StringColumn filetypes_;
+    StringColumn expcomps_;
+
+    // compiled filter
+    std::vector<Glib::ustring> query_;
+    bool query_match_equal_;
+    bool exif_enabled_;
+    ExifFilterSettings exif_;
+    uint32_t date_from_;
+    uint32_t date_to_;
+};
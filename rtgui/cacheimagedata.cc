@@ -23,6 +23,68 @@
 #include "version.h"
 #include <locale.h>
 #include <unordered_map>
+#include <cstring>
+#include <cstdint>
+
+namespace {
+
+class Writer {
+public:
+    explicit Writer(std::string &out): out_(out) {}
+
+    template <class T>
+    void put(T v)
+    {
+        out_.append(reinterpret_cast<const char *>(&v), sizeof(T));
+    }
+
+    void put(const Glib::ustring &s)
+    {
+        put(uint32_t(s.bytes()));
+        out_.append(s.data(), s.bytes());
+    }
+
+private:
+    std::string &out_;
+};
+
+
+class Reader {
+public:
+    explicit Reader(const std::string &in): in_(in), pos_(0), ok_(true) {}
+
+    template <class T>
+    void get(T &v)
+    {
+        if (pos_ + sizeof(T) > in_.size()) {
+            ok_ = false;
+            return;
+        }
+        memcpy(&v, in_.data() + pos_, sizeof(T));
+        pos_ += sizeof(T);
+    }
+
+    void get(Glib::ustring &s)
+    {
+        uint32_t n = 0;
+        get(n);
+        if (!ok_ || pos_ + n > in_.size()) {
+            ok_ = false;
+            return;
+        }
+        s = std::string(in_.data() + pos_, n);
+        pos_ += n;
+    }
+
+    bool ok() const { return ok_ && pos_ == in_.size(); }
+
+private:
+    const std::string &in_;
+    size_t pos_;
+    bool ok_;
+};
+
+} // namespace
 
 CacheImageData::CacheImageData ()
     : md5(""), supported(false), format(FT_Invalid), recentlySaved(false),
@@ -328,6 +390,128 @@ int CacheImageData::save (const Glib::ustring& fname)
 }
 
 
+/*
+ * Binary counterparts of load()/save(), the layout is private to the cache
+ * index and it must be kept in sync with CacheIndex::VERSION
+ */
+std::string CacheImageData::serialize() const
+{
+    std::string ret;
+    Writer w(ret);
+
+    w.put(md5);
+    w.put(version);
+    w.put(supported);
+    w.put(int32_t(format));
+    w.put(recentlySaved);
+
+    w.put(timeValid);
+    w.put(year);
+    w.put(month);
+    w.put(day);
+    w.put(hour);
+    w.put(min);
+    w.put(sec);
+    w.put(int64_t(timestamp));
+
+    w.put(exifValid);
+    w.put(frameCount);
+    w.put(fnumber);
+    w.put(shutter);
+    w.put(focalLen);
+    w.put(focalLen35mm);
+    w.put(focusDist);
+    w.put(iso);
+    w.put(isHDR);
+    w.put(isPixelShift);
+    w.put(int32_t(sensortype));
+    w.put(int32_t(sampleFormat));
+    w.put(lens);
+    w.put(orientation);
+    w.put(camMake);
+    w.put(camModel);
+    w.put(filetype);
+    w.put(expcomp);
+    w.put(int32_t(rating));
+    w.put(int32_t(colorLabel));
+
+    w.put(int32_t(rotate));
+    w.put(int32_t(thumbImgType));
+    w.put(int32_t(width));
+    w.put(int32_t(height));
+
+    return ret;
+}
+
+
+bool CacheImageData::deserialize(const std::string &data)
+{
+    Reader r(data);
+    int32_t i_format = 0, i_sensortype = 0, i_sampleformat = 0;
+    int32_t i_rating = 0, i_colorlabel = 0, i_rotate = 0, i_thumbimgtype = 0;
+    int32_t i_width = 0, i_height = 0;
+    int64_t i_timestamp = 0;
+
+    r.get(md5);
+    r.get(version);
+    r.get(supported);
+    r.get(i_format);
+    r.get(recentlySaved);
+
+    r.get(timeValid);
+    r.get(year);
+    r.get(month);
+    r.get(day);
+    r.get(hour);
+    r.get(min);
+    r.get(sec);
+    r.get(i_timestamp);
+
+    r.get(exifValid);
+    r.get(frameCount);
+    r.get(fnumber);
+    r.get(shutter);
+    r.get(focalLen);
+    r.get(focalLen35mm);
+    r.get(focusDist);
+    r.get(iso);
+    r.get(isHDR);
+    r.get(isPixelShift);
+    r.get(i_sensortype);
+    r.get(i_sampleformat);
+    r.get(lens);
+    r.get(orientation);
+    r.get(camMake);
+    r.get(camModel);
+    r.get(filetype);
+    r.get(expcomp);
+    r.get(i_rating);
+    r.get(i_colorlabel);
+
+    r.get(i_rotate);
+    r.get(i_thumbimgtype);
+    r.get(i_width);
+    r.get(i_height);
+
+    if (!r.ok()) {
+        return false;
+    }
+
+    format = ThFileType(i_format);
+    timestamp = i_timestamp;
+    sensortype = i_sensortype;
+    sampleFormat = rtengine::IIO_Sample_Format(i_sampleformat);
+    rating = i_rating;
+    colorLabel = i_colorlabel;
+    rotate = i_rotate;
+    thumbImgType = i_thumbimgtype;
+    width = i_width;
+    height = i_height;
+
+    return true;
+}
+
+
 std::string CacheImageData::getOrientationFilter() const
 {
     static const std::unordered_map<std::string, std::string> ormap = {
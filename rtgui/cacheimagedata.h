@@ -86,6 +86,10 @@ public:
     int load (const Glib::ustring& fname);
     int save (const Glib::ustring& fname);
 
+    // compact binary form of the fields stored by save(), used by CacheIndex
+    std::string serialize() const;
+    bool deserialize(const std::string &data);
+
     //-------------------------------------------------------------------------
     // FramesMetaData interface
     //-------------------------------------------------------------------------
@@ -0,0 +1,330 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cacheindex.h"
+#include "options.h"
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+#include <glib/gstdio.h>
+
+namespace {
+
+constexpr char MAGIC[] = "ARTIDX";
+constexpr size_t MAGIC_SIZE = sizeof(MAGIC) - 1;
+constexpr size_t HEADER_SIZE = MAGIC_SIZE + sizeof(uint16_t);
+
+enum RecordType : uint8_t {
+    RECORD_ERASE = 0,
+    RECORD_UPDATE = 1
+};
+
+
+bool get_file_info(const Glib::ustring &fname, int64_t &mtime, int64_t &size)
+{
+    GStatBuf st;
+    if (g_stat(fname.c_str(), &st) != 0) {
+        return false;
+    }
+    mtime = st.st_mtime;
+    size = st.st_size;
+    return true;
+}
+
+
+template <class T>
+void put(std::string &out, T v)
+{
+    out.append(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+
+template <class T>
+bool get(const char *&pos, const char *end, T &v)
+{
+    if (pos + sizeof(T) > end) {
+        return false;
+    }
+    memcpy(&v, pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+
+std::string make_header(uint16_t version)
+{
+    std::string ret(MAGIC, MAGIC_SIZE);
+    put(ret, version);
+    return ret;
+}
+
+} // namespace
+
+
+CacheIndex::CacheIndex():
+    loaded_(false),
+    stamp_(0),
+    records_(0)
+{
+}
+
+
+void CacheIndex::init(const Glib::ustring &index_fname)
+{
+    MyMutex::MyLock lock(mutex_);
+
+    fname_ = index_fname;
+    loaded_ = false;
+    stamp_ = 0;
+    records_ = 0;
+    entries_.clear();
+}
+
+
+void CacheIndex::load()
+{
+    if (loaded_) {
+        return;
+    }
+    loaded_ = true;
+
+    gchar *contents = nullptr;
+    gsize length = 0;
+    if (!g_file_get_contents(fname_.c_str(), &contents, &length, nullptr)) {
+        return;
+    }
+
+    const char *pos = contents + MAGIC_SIZE;
+    const char *end = contents + length;
+    uint16_t version = 0;
+
+    if (length < HEADER_SIZE || memcmp(contents, MAGIC, MAGIC_SIZE) != 0 || !get(pos, end, version) || version != VERSION) {
+        g_free(contents);
+        if (options.rtSettings.verbose) {
+            std::cout << "CacheIndex: discarding invalid index " << fname_ << std::endl;
+        }
+        g_remove(fname_.c_str());
+        return;
+    }
+
+    // a truncated record at the end (e.g. after a crash) is ignored
+    while (pos < end) {
+        uint32_t sz = 0;
+        if (!get(pos, end, sz) || pos + sz > end) {
+            break;
+        }
+        const char *rec = pos;
+        const char *rec_end = pos + sz;
+        pos = rec_end;
+
+        uint8_t type = 0;
+        uint32_t path_sz = 0;
+        if (!get(rec, rec_end, type) || !get(rec, rec_end, path_sz) || rec + path_sz > rec_end) {
+            continue;
+        }
+        std::string path(rec, path_sz);
+        rec += path_sz;
+        ++records_;
+
+        if (type == RECORD_UPDATE) {
+            Entry e;
+            if (get(rec, rec_end, e.mtime) && get(rec, rec_end, e.size)) {
+                e.stamp = ++stamp_;
+                e.data.assign(rec, rec_end);
+                entries_[path] = std::move(e);
+            }
+        } else {
+            entries_.erase(path);
+        }
+    }
+
+    g_free(contents);
+
+    if (options.rtSettings.verbose > 1) {
+        std::cout << "CacheIndex: loaded " << entries_.size() << " entries from " << records_ << " records" << std::endl;
+    }
+}
+
+
+std::string CacheIndex::make_record(const std::string &path, const Entry *e) const
+{
+    std::string body;
+    put(body, uint8_t(e ? RECORD_UPDATE : RECORD_ERASE));
+    put(body, uint32_t(path.size()));
+    body += path;
+    if (e) {
+        put(body, e->mtime);
+        put(body, e->size);
+        body += e->data;
+    }
+
+    std::string ret;
+    put(ret, uint32_t(body.size()));
+    ret += body;
+    return ret;
+}
+
+
+bool CacheIndex::append(const std::string &record)
+{
+    FILE *f = g_fopen(fname_.c_str(), "ab");
+    if (!f) {
+        return false;
+    }
+
+    bool ok = true;
+    if (ftell(f) == 0) {
+        const std::string header = make_header(VERSION);
+        ok = fwrite(header.data(), 1, header.size(), f) == header.size();
+    }
+    ok = ok && fwrite(record.data(), 1, record.size(), f) == record.size();
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok && options.rtSettings.verbose) {
+        std::cerr << "CacheIndex: error writing to " << fname_ << std::endl;
+    }
+    return ok;
+}
+
+
+bool CacheIndex::find(const Glib::ustring &fname, CacheImageData &out)
+{
+    int64_t mtime = 0, size = 0;
+    if (!get_file_info(fname, mtime, size)) {
+        return false;
+    }
+
+    MyMutex::MyLock lock(mutex_);
+    load();
+
+    auto it = entries_.find(fname.raw());
+    if (it == entries_.end()) {
+        return false;
+    }
+
+    auto &e = it->second;
+    if (e.mtime != mtime || e.size != size || !out.deserialize(e.data)) {
+        return false;
+    }
+    e.stamp = ++stamp_;
+    return true;
+}
+
+
+void CacheIndex::update(const Glib::ustring &fname, const CacheImageData &data)
+{
+    Entry e;
+    if (!get_file_info(fname, e.mtime, e.size)) {
+        return;
+    }
+    e.data = data.serialize();
+
+    MyMutex::MyLock lock(mutex_);
+    load();
+
+    auto it = entries_.find(fname.raw());
+    if (it != entries_.end() && it->second.mtime == e.mtime && it->second.size == e.size && it->second.data == e.data) {
+        it->second.stamp = ++stamp_;
+        return;
+    }
+
+    e.stamp = ++stamp_;
+    if (append(make_record(fname.raw(), &e))) {
+        ++records_;
+        entries_[fname.raw()] = std::move(e);
+    }
+}
+
+
+void CacheIndex::erase(const Glib::ustring &fname)
+{
+    MyMutex::MyLock lock(mutex_);
+    load();
+
+    auto it = entries_.find(fname.raw());
+    if (it != entries_.end()) {
+        entries_.erase(it);
+        if (append(make_record(fname.raw(), nullptr))) {
+            ++records_;
+        }
+    }
+}
+
+
+void CacheIndex::clear()
+{
+    MyMutex::MyLock lock(mutex_);
+
+    entries_.clear();
+    records_ = 0;
+    loaded_ = true;
+    g_remove(fname_.c_str());
+}
+
+
+void CacheIndex::compact(size_t max_entries)
+{
+    MyMutex::MyLock lock(mutex_);
+    load();
+
+    if (records_ == entries_.size() && entries_.size() <= max_entries) {
+        return;
+    }
+
+    // least recently used first, so that the order of the records in the
+    // file preserves the usage history across sessions
+    std::vector<std::pair<uint64_t, const std::string *>> order;
+    order.reserve(entries_.size());
+    for (auto &p : entries_) {
+        order.emplace_back(p.second.stamp, &p.first);
+    }
+    std::sort(order.begin(), order.end());
+
+    const size_t skip = order.size() > max_entries ? order.size() - max_entries : 0;
+    std::string data = make_header(VERSION);
+    for (size_t i = skip; i < order.size(); ++i) {
+        data += make_record(*order[i].second, &entries_[*order[i].second]);
+    }
+
+    const Glib::ustring tmpname = fname_ + ".tmp";
+    if (!g_file_set_contents(tmpname.c_str(), data.data(), data.size(), nullptr)) {
+        if (options.rtSettings.verbose) {
+            std::cerr << "CacheIndex: error writing " << tmpname << std::endl;
+        }
+        return;
+    }
+    if (g_rename(tmpname.c_str(), fname_.c_str()) != 0) {
+        g_remove(fname_.c_str());
+        if (g_rename(tmpname.c_str(), fname_.c_str()) != 0) {
+            g_remove(tmpname.c_str());
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < skip; ++i) {
+        const std::string key = *order[i].second;
+        entries_.erase(key);
+    }
+    records_ = entries_.size();
+
+    if (options.rtSettings.verbose > 1) {
+        std::cout << "CacheIndex: compacted to " << records_ << " entries" << std::endl;
+    }
+}
@@ -0,0 +1,86 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+#include <glibmm/ustring.h>
+
+#include "../rtengine/noncopyable.h"
+#include "threadutils.h"
+#include "cacheimagedata.h"
+
+/**
+ * Single-file index of the CacheImageData of all the images in the cache,
+ * keyed by file path, modification time and size. The index is an
+ * append-only log of records which is read in one go the first time it is
+ * accessed; updates and deletions are appended at the end, and compact()
+ * rewrites it keeping only the most recently used entries.
+ *
+ * The per-image keyfiles in the "data" cache dir are still written, since
+ * they also hold the data of rtengine::Thumbnail, and they are used as a
+ * fallback when an image is not in the index.
+ *
+ * file format:
+ *
+ * "ARTIDX" magic, format version (uint16)
+ * list of records:
+ *   size of the rest of the record (uint32)
+ *   type (uint8, 1 = update, 0 = erase)
+ *   path size (uint32), path
+ *   modification time (int64), file size (int64)  [update only]
+ *   CacheImageData::serialize()                   [update only]
+ */
+class CacheIndex: public rtengine::NonCopyable {
+public:
+    CacheIndex();
+
+    void init(const Glib::ustring &index_fname);
+
+    bool find(const Glib::ustring &fname, CacheImageData &out);
+    void update(const Glib::ustring &fname, const CacheImageData &data);
+    void erase(const Glib::ustring &fname);
+    void clear();
+
+    // rewrites the index dropping stale records, keeping at most max_entries
+    // of the most recently used images
+    void compact(size_t max_entries);
+
+private:
+    static constexpr uint16_t VERSION = 1;
+
+    struct Entry {
+        int64_t mtime;
+        int64_t size;
+        uint64_t stamp;
+        std::string data;
+    };
+
+    void load();
+    bool append(const std::string &record);
+    std::string make_record(const std::string &path, const Entry *e) const;
+
+    MyMutex mutex_;
+    Glib::ustring fname_;
+    bool loaded_;
+    uint64_t stamp_;
+    size_t records_;
+    std::unordered_map<std::string, Entry> entries_;
+};
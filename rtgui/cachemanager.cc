@@ -33,6 +33,7 @@
 #include "procparamchangers.h"
 #include "thumbnail.h"
 #include "../rtengine/utils.h"
+#include "../rtengine/demosaiccache.h"
 #ifdef ART_USE_OCIO
 # include "../rtengine/extclut.h"
 #endif
@@ -78,6 +79,8 @@ void CacheManager::init()
     if (error != 0 && options.rtSettings.verbose) {
         std::cerr << "Failed to create all cache directories: " << g_strerror(errno) << std::endl;
     }
+
+    index.init(Glib::build_filename(baseDir, "data.idx"));
 }
 
 
@@ -102,26 +105,32 @@ Thumbnail* CacheManager::getEntry(const Glib::ustring& fname)
         }
     }
 
+    // let's see if we have it in the cache: first look in the index, which
+    // needs neither the md5 nor the per-image data file
+    CacheImageData imageData;
+    bool cached = index.find(fname, imageData) && imageData.supported && !imageData.md5.empty();
+
     // build path name
-    const auto md5 = getMD5(fname);
+    const std::string md5 = cached ? std::string(imageData.md5) : getMD5(fname);
 
     if (md5.empty()) {
         return nullptr;
     }
 
-    const auto cacheName = getCacheFileName("data", fname, ".txt", md5);
-
-    // let's see if we have it in the cache
-    {
-        CacheImageData imageData;
+    if (!cached) {
+        const auto cacheName = getCacheFileName("data", fname, ".txt", md5);
 
         const auto error = imageData.load(cacheName);
-        if (error == 0 && imageData.supported) {
+        cached = error == 0 && imageData.supported;
+        if (cached) {
+            index.update(fname, imageData);
+        }
+    }
 
-            thumbnail.reset(new Thumbnail(this, fname, &imageData));
-            if (!thumbnail->isSupported()) {
-                thumbnail.reset();
-            }
+    if (cached) {
+        thumbnail.reset(new Thumbnail(this, fname, &imageData));
+        if (!thumbnail->isSupported()) {
+            thumbnail.reset();
         }
     }
 
@@ -199,6 +208,8 @@ void CacheManager::renameEntry(const std::string& oldfilename, const std::string
 
     const auto newmd5 = getMD5(newfilename);
 
+    index.erase(oldfilename);
+
     auto error = g_rename(getCacheFileName("profiles", oldfilename, paramFileExtension, oldmd5).c_str(), getCacheFileName("profiles", newfilename, paramFileExtension, newmd5).c_str());
     error |= g_rename(getCacheFileName("images", oldfilename, ".rtti", oldmd5).c_str(), getCacheFileName("images", newfilename, ".rtti", newmd5).c_str());
     error |= g_rename(getCacheFileName("embprofiles", oldfilename, ".icc", oldmd5).c_str(), getCacheFileName("embprofiles", newfilename, ".icc", newmd5).c_str());
@@ -240,6 +251,7 @@ void CacheManager::closeCache() const
     MyMutex::MyLock lock(mutex);
 
     applyCacheSizeLimitation();
+    index.compact(options.maxCacheEntries);
 #ifdef ART_USE_OCIO
     rtengine::ExternalLUT3D::trim_cache();
 #endif
@@ -253,6 +265,9 @@ void CacheManager::clearAll() const
     for (const auto& cacheDir : cacheDirs) {
         deleteDir(cacheDir);
     }
+    index.clear();
+
+    rtengine::DemosaicDiskCache::getInstance()->clear();
 
 #ifdef ART_USE_OCIO
     rtengine::ExternalLUT3D::clear_cache();
@@ -265,6 +280,7 @@ void CacheManager::clearImages() const
     MyMutex::MyLock lock(mutex);
 
     deleteDir("data");
+    index.clear();
     deleteDir("images");
     deleteDir("aehistograms");
 }
@@ -309,6 +325,7 @@ void CacheManager::deleteFiles(const Glib::ustring& fname, const std::string& md
 
     if (purgeData) {
         error |= g_remove(getCacheFileName("data", fname, ".txt", md5).c_str());
+        index.erase(fname);
     }
 
     if (purgeProfile) {
@@ -407,6 +424,10 @@ void CacheManager::applyCacheSizeLimitation() const
 
 bool CacheManager::getImageData(const Glib::ustring &fname, CacheImageData &out)
 {
+    if (index.find(fname, out)) {
+        return true;
+    }
+
     const auto md5 = getMD5(fname);
 
     if (!md5.empty()) {
@@ -416,9 +437,18 @@ bool CacheManager::getImageData(const Glib::ustring &fname, CacheImageData &out)
         if (error != 0) {
             return false;
         }
+        index.update(fname, out);
     } else {
         return false;
     }
 
     return true;
 }
+
+
+void CacheManager::saveImageData(const Glib::ustring &fname, CacheImageData &data)
+{
+    if (data.save(getCacheFileName("data", fname, ".txt", data.md5)) == 0) {
+        index.update(fname, data);
+    }
+}
@@ -28,6 +28,7 @@
 #include "../rtengine/rtengine.h"
 #include "threadutils.h"
 #include "cacheimagedata.h"
+#include "cacheindex.h"
 
 class Thumbnail;
 
@@ -37,6 +38,7 @@ private:
     Entries openEntries;
     Glib::ustring    baseDir;
     mutable MyMutex  mutex;
+    mutable CacheIndex index;
     rtengine::ProgressListener *pl_;
 
     void deleteDir   (const Glib::ustring& dirName) const;
@@ -72,6 +74,7 @@ public:
                                    const Glib::ustring& md5) const;
 
     bool getImageData(const Glib::ustring &fn, CacheImageData &out);
+    void saveImageData(const Glib::ustring &fn, CacheImageData &data);
 };
 
 #define cacheMgr CacheManager::getInstance()
@@ -20,6 +20,8 @@
  */
 #include "filebrowser.h"
 #include <map>
+#include <unordered_map>
+#include <functional>
 #include <glibmm.h>
 #include "options.h"
 #include "multilangmgr.h"
@@ -124,87 +126,50 @@ void findOriginalEntries (const std::vector<ThumbBrowserEntryBase*>& entries)
 }
 
 
+// the sort keys of the entries are extracted once per sort (or insertion),
+// instead of twice per comparison. Pass it to the std algorithms with
+// std::ref(), as they copy the comparator
 class ThumbnailSorter {
 public:
-    ThumbnailSorter(Options::ThumbnailOrder order): order_(order) {}
+    ThumbnailSorter(Options::ThumbnailOrder order, BrowserFilterIndex &index):
+        order_(order),
+        reverse_(order == Options::ThumbnailOrder::DATE_REV || order == Options::ThumbnailOrder::MODTIME_REV || order == Options::ThumbnailOrder::PROCTIME_REV),
+        index_(index)
+    {}
 
     bool operator()(const ThumbBrowserEntryBase *a, const ThumbBrowserEntryBase *b) const
     {
         switch (order_) {
-        case Options::ThumbnailOrder::DATE:
-        case Options::ThumbnailOrder::DATE_REV:
-            return lt_date(*a, *b, order_ == Options::ThumbnailOrder::DATE_REV);
-            break;
-        case Options::ThumbnailOrder::MODTIME:
-        case Options::ThumbnailOrder::MODTIME_REV:
-            return lt_modtime(*a, *b, order_ == Options::ThumbnailOrder::MODTIME_REV);
-            break;
-        case Options::ThumbnailOrder::PROCTIME:
-        case Options::ThumbnailOrder::PROCTIME_REV:
-            return lt_proctime(*a, *b, order_ == Options::ThumbnailOrder::PROCTIME_REV);
-            break;
         case Options::ThumbnailOrder::FILENAME_REV:
             return *b < *a;
-            break;
         case Options::ThumbnailOrder::FILENAME:
-        default:
             return *a < *b;
+        default: {
+            const int64_t ka = key(a);
+            const int64_t kb = key(b);
+            if (ka == kb) {
+                return *a < *b;
+            }
+            return reverse_ ? kb < ka : ka < kb;
+        }
         }
     }
 
 private:
-    bool lt_date(const ThumbBrowserEntryBase &a, const ThumbBrowserEntryBase &b, bool reverse) const
+    int64_t key(const ThumbBrowserEntryBase *e) const
     {
-        auto ca = a.thumbnail->getCacheImageData();
-        auto cb = b.thumbnail->getCacheImageData();
-        auto ta = ca->getDateTimeAsTS();
-        auto tb = cb->getDateTimeAsTS();
-        if (ta == tb) {
-            return a < b;
-        }
-        return (ta < tb) == !reverse;
-    }
-
-    bool lt_modtime(const ThumbBrowserEntryBase &a, const ThumbBrowserEntryBase &b, bool reverse) const
-    {
-        auto fa = a.thumbnail->getFileName();
-        auto fb = b.thumbnail->getFileName();
-
-        auto ia = Gio::File::create_for_path(fa)->query_info(G_FILE_ATTRIBUTE_TIME_MODIFIED);
-        auto ib = Gio::File::create_for_path(fb)->query_info(G_FILE_ATTRIBUTE_TIME_MODIFIED);
-        auto ta = ia->modification_time();
-        auto tb = ib->modification_time();
-        if (ta == tb) {
-            return a < b;
-        }
-        return (ta < tb) == !reverse;
-    }
-
-    bool lt_proctime(const ThumbBrowserEntryBase &a, const ThumbBrowserEntryBase &b, bool reverse) const
-    {
-        auto fa = options.getParamFile(a.thumbnail->getFileName());
-        auto fb = options.getParamFile(b.thumbnail->getFileName());
-
-        bool has_a = Glib::file_test(fa, Glib::FILE_TEST_EXISTS);
-        bool has_b = Glib::file_test(fb, Glib::FILE_TEST_EXISTS);
-
-        if (has_a != has_b) {
-            return reverse ? has_a : has_b;
-        } else if (has_a) {
-            auto ia = Gio::File::create_for_path(fa)->query_info(G_FILE_ATTRIBUTE_TIME_MODIFIED);
-            auto ib = Gio::File::create_for_path(fb)->query_info(G_FILE_ATTRIBUTE_TIME_MODIFIED);
-            auto ta = ia->modification_time();
-            auto tb = ib->modification_time();
-            if (ta == tb) {
-                return a < b;
-            }
-            return (ta < tb) == !reverse;
-        } else {
-            return a < b;
+        auto it = keys_.find(e);
+        if (it == keys_.end()) {
+            auto t = e->thumbnail;
+            it = keys_.emplace(e, index_.sortKey(order_, e, t->getCacheImageData(), t->getFileName(), t->getCacheImageDataStamp())).first;
         }
+        return it->second;
     }
 
     Options::ThumbnailOrder order_;
+    bool reverse_;
+    BrowserFilterIndex &index_;
+    mutable std::unordered_map<const ThumbBrowserEntryBase *, int64_t> keys_;
 };
 
 } // namespace
@@ -703,18 +668,14 @@ void FileBrowser::addEntry_ (FileBrowserEntry* entry)
     {
         MYWRITERLOCK(l, entryRW);
 
-        ThumbnailSorter order(options.thumbnailOrder);
+        ThumbnailSorter order(options.thumbnailOrder, filterIndex);
 
         fd.insert(
             std::lower_bound(
                 fd.begin(),
                 fd.end(),
                 entry,
-                // [](const ThumbBrowserEntryBase* a, const ThumbBrowserEntryBase* b)
-                // {
-                //     return *a < *b;
-                // }
-                order
+                std::ref(order)
             ),
             entry
         );
@@ -734,11 +695,15 @@ FileBrowserEntry* FileBrowser::delEntry (const Glib::ustring& fname)
             entry->selected = false;
             fd.erase (i);
             std::vector<ThumbBrowserEntryBase*>::iterator j = std::find (selected.begin(), selected.end(), entry);
+            // checkFilter would add the entry back to the index, so it
+            // must be called before removing it
+            const bool shown = j != selected.end() && checkFilter(*j);
+            filterIndex.remove(entry);
 
             MYWRITERLOCK_RELEASE(l);
 
             if (j != selected.end()) {
-                if (checkFilter (*j)) {
+                if (shown) {
                     numFiltered--;
                 }
 
@@ -780,6 +745,7 @@ void FileBrowser::close ()
         }
 
         fd.clear ();
+        filterIndex.clear();
     }
 
     lastClicked = nullptr;
@@ -1363,6 +1329,7 @@ void FileBrowser::applyFilter (const BrowserFilter& filter)
     }
 
     this->filter = filter;
+    filterIndex.setFilter(filter);
 
     // remove items not complying the filter from the selection
     bool selchanged = false;
@@ -1375,7 +1342,8 @@ void FileBrowser::applyFilter (const BrowserFilter& filter)
         }
 
         for (size_t i = 0; i < fd.size(); i++) {
-            if (checkFilter(fd[i])) {
+            fd[i]->filtered = !checkFilter(fd[i]);
+            if (!fd[i]->filtered) {
                 numFiltered++;
             } else if (fd[i]->selected) {
                 fd[i]->selected = false;
@@ -1420,7 +1388,8 @@ void FileBrowser::applyFilter (const BrowserFilter& filter)
     }
 
     tbl->filterApplied();
-    redraw();
+    // the filter has already been checked above
+    redraw(false);
 }
 
 bool FileBrowser::checkFilter (ThumbBrowserEntryBase* entryb)   // true -> entry complies filter
@@ -1447,93 +1416,8 @@ bool FileBrowser::checkFilter (ThumbBrowserEntryBase* entryb)   // true -> entry
         return false;
     }
 
-    // return false is query is not satisfied
-    if (!filter.queryFileName.empty()) {
-        // check if image's FileName contains queryFileName (case insensitive)
-        // TODO should we provide case-sensitive search option via preferences?
-        Glib::ustring FileName;
-        FileName = Glib::path_get_basename (entry->thumbnail->getFileName());
-        FileName = FileName.uppercase();
-        //printf("FileBrowser::checkFilter FileName = '%s'; find() result= %i \n",FileName.c_str(), FileName.find(filter.queryFileName.uppercase()));
-
-        Glib::ustring decodedQueryFileName;
-        bool MatchEqual;
-
-        // Determine the match mode - check if the first 2 characters are equal to "!="
-        if (filter.queryFileName.find("!=") == 0) {
-            decodedQueryFileName = filter.queryFileName.substr (2, filter.queryFileName.length() - 2);
-            MatchEqual = false;
-        } else {
-            decodedQueryFileName = filter.queryFileName;
-            MatchEqual = true;
-        }
-
-        // Consider that queryFileName consist of comma separated values (FilterString)
-        // Evaluate if ANY of these FilterString are contained in the filename
-        // This will construct OR filter within the filter.queryFileName
-        int iFilenameMatch = 0;
-        std::vector<Glib::ustring> vFilterStrings = Glib::Regex::split_simple(",", decodedQueryFileName.uppercase());
-
-        for(size_t i = 0; i < vFilterStrings.size(); i++) {
-            // ignore empty vFilterStrings. Otherwise filter will always return true if
-            // e.g. filter.queryFileName ends on "," and will stop being a filter
-            if (!vFilterStrings.at(i).empty()) {
-                if (FileName.find(vFilterStrings.at(i)) != Glib::ustring::npos) {
-                    iFilenameMatch++;
-                }
-            }
-        }
-
-        if (MatchEqual) {
-            if (iFilenameMatch == 0) { //none of the vFilterStrings found in FileName
-                return false;
-            }
-        } else {
-            if (iFilenameMatch > 0) { // match is found for at least one of vFilterStrings in FileName
-                return false;
-            }
-        }
-
-        /*experimental Regex support, this is unlikely to be useful to photographers*/
-        //bool matchfound=Glib::Regex::match_simple(filter.queryFileName.uppercase(),FileName);
-        //if (!matchfound) return false;
-    }
-
-    // check exif filter
-    const CacheImageData* cfs = entry->thumbnail->getCacheImageData();
-    double tol = 0.01;
-    double tol2 = 1e-8;
-
-    if (!filter.exifFilterEnabled) {
-        return true;
-    }
-
-    Glib::ustring camera(cfs->getCamera());
-
-    if (!cfs->exifValid)
-        return (!filter.exifFilter.filterCamera || filter.exifFilter.cameras.count(camera) > 0)
-               && (!filter.exifFilter.filterLens || filter.exifFilter.lenses.count(cfs->lens) > 0)
-               && (!filter.exifFilter.filterOrientation || filter.exifFilter.orientations.count(cfs->getOrientationFilter()) > 0)
-               && (!filter.exifFilter.filterFiletype || filter.exifFilter.filetypes.count(cfs->filetype) > 0)
-               && (!filter.exifFilter.filterExpComp || filter.exifFilter.expcomp.count(cfs->expcomp) > 0);
-
-    if (filter.exifFilter.filterDate) {
-        Glib::Date d(cfs->day, Glib::Date::Month(cfs->month), cfs->year);
-        if (d < filter.exifFilter.dateFrom || d > filter.exifFilter.dateTo) {
-            return false;
-        }
-    }
-
-    return
-        (!filter.exifFilter.filterShutter || (rtengine::FramesMetaData::shutterFromString(rtengine::FramesMetaData::shutterToString(cfs->shutter)) >= filter.exifFilter.shutterFrom - tol2 && rtengine::FramesMetaData::shutterFromString(rtengine::FramesMetaData::shutterToString(cfs->shutter)) <= filter.exifFilter.shutterTo + tol2))
-        && (!filter.exifFilter.filterFNumber || (rtengine::FramesMetaData::apertureFromString(rtengine::FramesMetaData::apertureToString(cfs->fnumber)) >= filter.exifFilter.fnumberFrom - tol2 && rtengine::FramesMetaData::apertureFromString(rtengine::FramesMetaData::apertureToString(cfs->fnumber)) <= filter.exifFilter.fnumberTo + tol2))
-        && (!filter.exifFilter.filterFocalLen || (cfs->focalLen >= filter.exifFilter.focalFrom - tol && cfs->focalLen <= filter.exifFilter.focalTo + tol))
-        && (!filter.exifFilter.filterISO     || (cfs->iso >= filter.exifFilter.isoFrom && cfs->iso <= filter.exifFilter.isoTo))
-        && (!filter.exifFilter.filterExpComp || filter.exifFilter.expcomp.count(cfs->expcomp) > 0)
-        && (!filter.exifFilter.filterCamera  || filter.exifFilter.cameras.count(camera) > 0)
-        && (!filter.exifFilter.filterLens    || filter.exifFilter.lenses.count(cfs->lens) > 0)
-        && (!filter.exifFilter.filterOrientation    || filter.exifFilter.orientations.count(cfs->getOrientationFilter()) > 0)
-        && (!filter.exifFilter.filterFiletype  || filter.exifFilter.filetypes.count(cfs->filetype) > 0);
+    // file name query and exif filter
+    return filterIndex.matches(entry, entry->thumbnail->getCacheImageData(), entry->thumbnail->getFileName(), entry->thumbnail->getCacheImageDataStamp());
 }
 
 void FileBrowser::toTrashRequested (std::vector<FileBrowserEntry*> tbe)
@@ -2118,8 +2002,11 @@ bool FileBrowser::isSelected(const Glib::ustring &fname) const
 
 void FileBrowser::sortThumbnails()
 {
-    ThumbnailSorter order(options.thumbnailOrder);
-    std::sort(fd.begin(), fd.end(), order);
+    {
+        MYWRITERLOCK(l, entryRW);
+        ThumbnailSorter order(options.thumbnailOrder, filterIndex);
+        std::sort(fd.begin(), fd.end(), std::ref(order));
+    }
     redraw(false);
 }
 
@@ -25,6 +25,7 @@
 #include "exiffiltersettings.h"
 #include "filebrowserentry.h"
 #include "browserfilter.h"
+#include "browserfilterindex.h"
 #include "pparamschangelistener.h"
 #include "partialpastedlg.h"
 #include "extprog.h"
@@ -118,6 +119,7 @@ protected:
 
     FileBrowserListener* tbl;
     BrowserFilter filter;
+    BrowserFilterIndex filterIndex;
     int numFiltered;
     Glib::ustring last_selected_fname_;
 
@@ -22,6 +22,7 @@
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <functional>
 
 #include <glib/gstdio.h>
 
@@ -39,6 +40,7 @@
 #include "fastexport.h"
 #include "../rtengine/imagedata.h"
 #include "session.h"
+#include "browserfilterindex.h"
 #include "rtwindow.h"
 
 namespace {
@@ -764,105 +766,65 @@ void FileCatalog::closeDir ()
 
 namespace {
 
-class FileSorter {
-public:
-    FileSorter(Options::ThumbnailOrder order): order_(order) {}
-
-    bool operator()(const Glib::ustring &a, const Glib::ustring &b) const
-    {
-        switch (order_) {
-        case Options::ThumbnailOrder::DATE:
-        case Options::ThumbnailOrder::DATE_REV:
-            return lt_date(a, b, order_ == Options::ThumbnailOrder::DATE_REV);
-            break;
-        case Options::ThumbnailOrder::MODTIME:
-        case Options::ThumbnailOrder::MODTIME_REV:
-            return lt_modtime(a, b, order_ == Options::ThumbnailOrder::MODTIME_REV);
-            break;
-        case Options::ThumbnailOrder::PROCTIME:
-        case Options::ThumbnailOrder::PROCTIME_REV:
-            return lt_proctime(a, b, order_ == Options::ThumbnailOrder::PROCTIME_REV);
-            break;
-        case Options::ThumbnailOrder::FILENAME_REV:
-            return b < a;
-            break;
-        case Options::ThumbnailOrder::FILENAME:
-        default:
-            return a < b;
-        }
-    }
-
-private:
-    bool lt_date(const Glib::ustring &a, const Glib::ustring &b, bool reverse) const
-    {
-        try {
-            // rtengine::FramesData ma(a);
-            // rtengine::FramesData mb(b);
-            // auto ta = ma.getDateTimeAsTS();
-            // auto tb = mb.getDateTimeAsTS();
-            auto ta = get_date(a);
-            auto tb = get_date(b);
-            if (ta == tb) {
-                return a < b;
+// sorts the file names by the keys of BrowserFilterIndex, extracted once
+// per file instead of twice per comparison (the shot time is read from the
+// cache)
+void sort_files(std::vector<Glib::ustring> &names, Options::ThumbnailOrder order)
+{
+    const auto get_date =
+        [](const Glib::ustring &us) -> int64_t
+        {
+            CacheImageData d;
+            try {
+                if (cacheMgr->getImageData(us, d) && d.supported) {
+                    return d.getDateTimeAsTS();
+                }
+            } catch (std::exception &) {
             }
-            return (ta < tb) == !reverse;
-        } catch (std::exception &) {
-            return a < b;
-        }
-    }
+            return -1;
+        };
 
-    bool lt_modtime(const Glib::ustring &a, const Glib::ustring &b, bool reverse) const
-    {
-        auto ia = Gio::File::create_for_path(a)->query_info(G_FILE_ATTRIBUTE_TIME_MODIFIED);
-        auto ib = Gio::File::create_for_path(b)->query_info(G_FILE_ATTRIBUTE_TIME_MODIFIED);
-        auto ta = ia->modification_time();
-        auto tb = ib->modification_time();
-        if (ta == tb) {
-            return a < b;
-        }
-        return (ta < tb) == !reverse;
+    const bool reverse = order == Options::ThumbnailOrder::DATE_REV || order == Options::ThumbnailOrder::MODTIME_REV || order == Options::ThumbnailOrder::PROCTIME_REV;
+    std::function<int64_t(const Glib::ustring &)> key;
+    switch (order) {
+    case Options::ThumbnailOrder::DATE:
+    case Options::ThumbnailOrder::DATE_REV:
+        key = get_date;
+        break;
+    case Options::ThumbnailOrder::MODTIME:
+    case Options::ThumbnailOrder::MODTIME_REV:
+        key = &BrowserFilterIndex::modTimeKey;
+        break;
+    case Options::ThumbnailOrder::PROCTIME:
+    case Options::ThumbnailOrder::PROCTIME_REV:
+        key = &BrowserFilterIndex::procTimeKey;
+        break;
+    case Options::ThumbnailOrder::FILENAME_REV:
+        std::sort(names.rbegin(), names.rend());
+        return;
+    case Options::ThumbnailOrder::FILENAME:
+    default:
+        std::sort(names.begin(), names.end());
+        return;
     }
 
-    bool lt_proctime(const Glib::ustring &a, const Glib::ustring &b, bool reverse) const
-    {
-        auto fa = options.getParamFile(a);
-        auto fb = options.getParamFile(b);
-
-        bool has_a = Glib::file_test(fa, Glib::FILE_TEST_EXISTS);
-        bool has_b = Glib::file_test(fb, Glib::FILE_TEST_EXISTS);
-
-        if (has_a != has_b) {
-            return reverse ? has_a : has_b;
-        } else if (has_a) {
-            auto ia = Gio::File::create_for_path(fa)->query_info(G_FILE_ATTRIBUTE_TIME_MODIFIED);
-            auto ib = Gio::File::create_for_path(fb)->query_info(G_FILE_ATTRIBUTE_TIME_MODIFIED);
-            auto ta = ia->modification_time();
-            auto tb = ib->modification_time();
-            if (ta == tb) {
-                return a < b;
-            }
-            return (ta < tb) == !reverse;
-        } else {
-            return a < b;
-        }
+    std::vector<std::pair<int64_t, Glib::ustring>> keyed;
+    keyed.reserve(names.size());
+    for (auto &n : names) {
+        keyed.emplace_back(key(n), std::move(n));
     }
-
-    time_t get_date(const Glib::ustring &us) const
-    {
-        CacheImageData d;
-        if (cacheMgr->getImageData(us, d)) {
-            if (!d.supported) {
-                return time_t(-1);
-            } else {
-                return d.getDateTimeAsTS();
-            }
-        } else {
-            return time_t(-1);
-        }
+    std::sort(keyed.begin(), keyed.end(),
+              [reverse](const std::pair<int64_t, Glib::ustring> &a, const std::pair<int64_t, Glib::ustring> &b) -> bool
+              {
+                  if (a.first == b.first) {
+                      return a.second < b.second;
+                  }
+                  return reverse ? b.first < a.first : a.first < b.first;
+              });
+    for (size_t i = 0; i < names.size(); ++i) {
+        names[i] = std::move(keyed[i].second);
     }
-
-    Options::ThumbnailOrder order_;
-};
+}
 
 
 } // namespace
@@ -944,7 +906,7 @@ std::vector<Glib::ustring> FileCatalog::getFileList(bool recursive)
 
     }
 
-    std::sort(names.begin(), names.end(), FileSorter(options.thumbnailOrder));
+    sort_files(names, options.thumbnailOrder);
     return names;
 }
 
@@ -0,0 +1,1242 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// art-bench: throughput benchmark of the demosaicing methods and of the
+// steps of ImProcFunctions::process, on synthetic and reference images.
+// The results are printed as a table on stderr and as JSON on stdout (or in
+// the file given with --output), tagged with the ART version so that they
+// can be compared across commits.
+
+#ifdef __GNUC__
+#if defined(__FAST_MATH__)
+#error Using the -ffast-math CFLAG is known to lead to problems. Disable it to compile ART.
+#endif
+#endif
+
+#include "config.h"
+#include <giomm.h>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <locale.h>
+#include <glib/gstdio.h>
+#include "options.h"
+#include "version.h"
+#include "pathutils.h"
+#include "../rtengine/rawimagesource.h"
+#include "../rtengine/rawimage.h"
+#include "../rtengine/improcfun.h"
+#include "../rtengine/imagefloat.h"
+#include "../rtengine/imgiomanager.h"
+#include "../rtengine/pipelineprofiler.h"
+#include "../rtengine/bufferpool.h"
+#include "../rtengine/clutstore.h"
+#include "../rtengine/iccstore.h"
+#include "../rtengine/matrixshaper.h"
+#include "../rtengine/dcp.h"
+#include "../rtengine/imagedata.h"
+#include "../rtengine/cpudispatch.h"
+#include "../rtengine/scopes.h"
+#include "../rtengine/rt_math.h"
+#include "../rtengine/cJSON.h"
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+#ifdef WITH_MIMALLOC
+#  include <mimalloc.h>
+#endif
+
+extern Options options;
+
+using namespace rtengine;
+using namespace rtengine::procparams;
+
+namespace {
+
+struct Config {
+    std::vector<double> megapixels = { 2, 8, 24 };
+    std::vector<int> threads;
+    int repeat = 3;
+    bool demosaic = true;
+    bool pipeline = true;
+    bool clut = true;
+    bool decode = true;
+    bool icc = true;
+    bool geometry = true;
+    bool scopes = true;
+    bool checkpoints = true;
+    Glib::ustring profile;
+    Glib::ustring dcp;
+    Glib::ustring output;
+    std::vector<Glib::ustring> inputs;
+};
+
+
+struct Result {
+    std::string benchmark; // "decode", "demosaic", "pipeline", "clut", "icc", "dcp", "geometry", "scopes" or "checkpoints"
+    std::string name;
+    std::string input;
+    int width;
+    int height;
+    int threads;
+    double time_ms;
+
+    double mpix_per_s() const
+    {
+        return time_ms > 0 ? (double(width) * height / 1e6) / (time_ms / 1000.0) : 0.0;
+    }
+};
+
+
+void print_help(const char *argv0)
+{
+    std::cout << "Usage: " << Glib::path_get_basename(argv0) << " [options] [reference images...]\n\n"
+              << "Measures the throughput (in MP/s) of each demosaicing method and of each\n"
+              << "processing step, on synthetic Bayer/X-Trans mosaics and RGB images and on\n"
+              << "the given reference images (raw or not).\n\n"
+              << "Options:\n"
+              << "  --sizes=<MP,...>     Sizes of the synthetic images, in megapixels (default: 2,8,24).\n"
+              << "  --threads=<n,...>    Thread counts to test (default: 1 and the number of CPUs).\n"
+              << "  --repeat=<n>         Runs per measurement, the fastest is reported (default: 3).\n"
+              << "  --profile=<file>     Processing profile for the pipeline benchmark\n"
+              << "                       (default: all the tools enabled with neutral-ish settings).\n"
+              << "  --dcp=<file>         Benchmark the application of the look table and tone curve\n"
+              << "                       of this DCP profile (exact vs baked 3D LUT).\n"
+              << "  --output=<file>      Write the JSON report to <file> instead of stdout.\n"
+              << "  --no-demosaic        Skip the demosaicing benchmark.\n"
+              << "  --no-pipeline        Skip the processing pipeline benchmark.\n"
+              << "  --no-clut            Skip the benchmark of the HaldCLUT interpolation kernels.\n"
+              << "  --no-decode          Skip the raw decoding benchmark of the reference images.\n"
+              << "  --no-icc             Skip the benchmark of the color space conversions\n"
+              << "                       (LittleCMS vs built-in matrix/shaper transform).\n"
+              << "  --no-geometry        Skip the benchmark of the lens/rotation/perspective\n"
+              << "                       corrections (separate passes vs single pass on a mesh).\n"
+              << "  --no-scopes          Skip the benchmark of the histograms, waveforms and\n"
+              << "                       vectorscopes (separate passes vs during the conversion).\n"
+              << "  --no-checkpoints     Skip the check of the invalidation of the checkpoints of\n"
+              << "                       the preview pipeline.\n"
+              << "  -h, --help           Show this help.\n\n"
+              << "The exit status is 4 if an optimized code path is less accurate than allowed\n"
+              << "with respect to the reference one." << std::endl;
+}
+
+
+template <class T>
+bool parse_list(const std::string &s, std::vector<T> &out)
+{
+    out.clear();
+    std::istringstream src(s);
+    std::string tok;
+    while (std::getline(src, tok, ',')) {
+        std::istringstream ts(tok);
+        T val;
+        if (!(ts >> val) || val <= 0) {
+            return false;
+        }
+        out.push_back(val);
+    }
+    return !out.empty();
+}
+
+
+int parse_args(int argc, char **argv, Config &cfg)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "-h" || a == "--help") {
+            print_help(argv[0]);
+            exit(0);
+        } else if (a.substr(0, 8) == "--sizes=") {
+            if (!parse_list(a.substr(8), cfg.megapixels)) {
+                std::cerr << "Error: invalid value for --sizes" << std::endl;
+                return 1;
+            }
+        } else if (a.substr(0, 10) == "--threads=") {
+            if (!parse_list(a.substr(10), cfg.threads)) {
+                std::cerr << "Error: invalid value for --threads" << std::endl;
+                return 1;
+            }
+        } else if (a.substr(0, 9) == "--repeat=") {
+            cfg.repeat = atoi(a.substr(9).c_str());
+            if (cfg.repeat <= 0) {
+                std::cerr << "Error: invalid value for --repeat" << std::endl;
+                return 1;
+            }
+        } else if (a.substr(0, 10) == "--profile=") {
+            cfg.profile = fname_to_utf8(argv[i] + 10);
+        } else if (a.substr(0, 6) == "--dcp=") {
+            cfg.dcp = fname_to_utf8(argv[i] + 6);
+        } else if (a.substr(0, 9) == "--output=") {
+            cfg.output = fname_to_utf8(argv[i] + 9);
+        } else if (a == "--no-demosaic") {
+            cfg.demosaic = false;
+        } else if (a == "--no-pipeline") {
+            cfg.pipeline = false;
+        } else if (a == "--no-clut") {
+            cfg.clut = false;
+        } else if (a == "--no-decode") {
+            cfg.decode = false;
+        } else if (a == "--no-icc") {
+            cfg.icc = false;
+        } else if (a == "--no-geometry") {
+            cfg.geometry = false;
+        } else if (a == "--no-scopes") {
+            cfg.scopes = false;
+        } else if (a == "--no-checkpoints") {
+            cfg.checkpoints = false;
+        } else if (a.size() > 1 && a[0] == '-') {
+            std::cerr << "Error: unknown option " << a << std::endl;
+            return 1;
+        } else {
+            cfg.inputs.push_back(fname_to_utf8(argv[i]));
+        }
+    }
+
+    if (cfg.threads.empty()) {
+        cfg.threads.push_back(1);
+#ifdef _OPENMP
+        if (omp_get_num_procs() > 1) {
+            cfg.threads.push_back(omp_get_num_procs());
+        }
+#endif
+    }
+    return 0;
+}
+
+
+void set_threads(int n)
+{
+#ifdef _OPENMP
+    omp_set_num_threads(n);
+#endif
+}
+
+
+double now_ms()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+ * A deterministic test scene with smooth gradients, hard edges of different
+ * orientations, fine periodic detail (which stresses the demosaicing
+ * methods) and some noise, in the [0, 65535] range.
+ */
+Imagefloat *make_scene(int width, int height)
+{
+    Imagefloat *img = new Imagefloat(width, height);
+    const float cx = width / 2.f;
+    const float cy = height / 2.f;
+    const float k = float(RT_PI) / std::max(width, height);
+
+#ifdef _OPENMP
+#   pragma omp parallel for
+#endif
+    for (int y = 0; y < height; ++y) {
+        uint32_t seed = 2463534242u + y * 2654435761u;
+        for (int x = 0; x < width; ++x) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            const float noise = float(seed & 0xffff) / 65535.f - 0.5f;
+
+            const float dx = x - cx, dy = y - cy;
+            const float zone = 0.5f + 0.5f * std::cos(k * (dx * dx + dy * dy) / 8.f);
+            const bool block = ((x / 64) + (y / 64)) % 2;
+            const float gx = float(x) / width;
+            const float gy = float(y) / height;
+
+            float r = 0.6f * gx + 0.3f * zone + (block ? 0.1f : 0.f);
+            float g = 0.5f * gy + 0.4f * zone;
+            float b = 0.4f * (1.f - gx) + 0.3f * zone + (block ? 0.f : 0.2f);
+            r = LIM01(r + 0.02f * noise);
+            g = LIM01(g + 0.02f * noise);
+            b = LIM01(b + 0.02f * noise);
+
+            img->r(y, x) = r * 60000.f;
+            img->g(y, x) = g * 60000.f;
+            img->b(y, x) = b * 60000.f;
+        }
+    }
+    return img;
+}
+
+
+void size_from_megapixels(double mp, int &w, int &h)
+{
+    // 3:2 aspect ratio, with dimensions multiple of 6 to keep the X-Trans
+    // pattern aligned
+    w = int(std::sqrt(mp * 1e6 * 1.5) / 6 + 0.5) * 6;
+    h = int(w / 1.5 / 6 + 0.5) * 6;
+}
+
+
+void default_bench_params(ProcParams &params)
+{
+    params.dehaze.enabled = true;
+    params.fattal.enabled = true;
+    params.chmixer.enabled = true;
+    params.exposure.enabled = true;
+    params.hsl.enabled = true;
+    params.hsl.smoothing = 10;
+    params.toneEqualizer.enabled = true;
+    params.toneEqualizer.bands = {{ 10, -10, 0, 10, -10 }};
+    params.sharpening.enabled = true;
+    params.impulseDenoise.enabled = true;
+    params.defringe.enabled = true;
+    params.colorcorrection.enabled = true;
+    params.colorcorrection.regions[0].a = 0.1;
+    params.smoothing.enabled = true;
+    params.smoothing.regions[0].radius = 5;
+    params.gradient.enabled = true;
+    params.pcvignette.enabled = true;
+    params.textureBoost.enabled = true;
+    params.textureBoost.regions[0].strength = 0.5;
+    params.grain.enabled = true;
+    params.logenc.enabled = true;
+    params.saturation.enabled = true;
+    params.toneCurve.enabled = true;
+    params.rgbCurves.enabled = true;
+    params.labCurve.enabled = true;
+    params.labCurve.contrast = 10;
+    params.softlight.enabled = true;
+    params.localContrast.enabled = true;
+    params.localContrast.regions[0].contrast = 0.5;
+    params.blackwhite.enabled = true;
+}
+
+
+/**
+ * Changes a value of a processing profile: booleans are toggled, and the
+ * last number of a value (or of a list separated by ';') is changed.
+ * Integers are decremented (or set to 1 if 0), as they are often indices.
+ */
+bool perturb_value(const std::string &value, std::string &out)
+{
+    if (value == "true" || value == "false") {
+        out = value == "true" ? "false" : "true";
+        return true;
+    }
+
+    std::vector<std::string> tokens;
+    std::istringstream src(value);
+    std::string tok;
+    while (std::getline(src, tok, ';')) {
+        tokens.push_back(tok);
+    }
+    for (size_t i = tokens.size(); i > 0; --i) {
+        auto &t = tokens[i-1];
+        char *end = nullptr;
+        const double v = strtod(t.c_str(), &end);
+        if (t.empty() || *end) {
+            continue;
+        }
+        std::ostringstream buf;
+        if (t.find_first_of(".eE") == std::string::npos) {
+            const long n = strtol(t.c_str(), nullptr, 10);
+            buf << (n == 0 ? 1 : n - 1);
+        } else {
+            buf << std::setprecision(9) << (v * 0.9 + 0.05);
+        }
+        t = buf.str();
+        out.clear();
+        for (size_t j = 0; j < tokens.size(); ++j) {
+            out += (j > 0 ? ";" : "") + tokens[j];
+        }
+        if (!value.empty() && value.back() == ';') {
+            out += ";";
+        }
+        return true;
+    }
+    return false;
+}
+
+
+/**
+ * A HaldCLUT of level 8 with a mild non-linear transform, saved to a
+ * temporary file and loaded back.
+ */
+std::unique_ptr<HaldCLUT> make_clut()
+{
+    constexpr int level = 8;
+    constexpr int size = level * level * level;
+    constexpr int nodes = level * level;
+
+    Imagefloat img(size, size);
+    for (int i = 0; i < size * size; ++i) {
+        const float r = float(i % nodes) / (nodes - 1);
+        const float g = float((i / nodes) % nodes) / (nodes - 1);
+        const float b = float(i / (nodes * nodes)) / (nodes - 1);
+        const int y = i / size, x = i % size;
+        img.r(y, x) = 65535.f * std::pow(r, 0.9f) * (0.9f + 0.1f * b);
+        img.g(y, x) = 65535.f * std::sqrt(g * (0.5f + 0.5f * r));
+        img.b(y, x) = 65535.f * (b * b * 0.5f + b * 0.5f);
+    }
+
+    std::string fname = Glib::build_filename(Glib::get_tmp_dir(), "ART-bench-clut-XXXXXX");
+    int fd = Glib::mkstemp(fname);
+    if (fd < 0) {
+        return nullptr;
+    }
+    g_close(fd, nullptr);
+    g_remove(fname.c_str());
+    fname += ".tif";
+
+    std::unique_ptr<HaldCLUT> ret(new HaldCLUT());
+    if (img.saveTIFF(fname, 16) != 0 || !ret->load(fname)) {
+        ret.reset();
+    }
+    g_remove(fname.c_str());
+    return ret;
+}
+
+
+class Benchmark {
+public:
+    explicit Benchmark(const Config &cfg): cfg_(cfg) {}
+
+    // demosaicing of a synthetic mosaic sampled from scene
+    void demosaic_synthetic(const Imagefloat *scene, bool xtrans)
+    {
+        const std::string input = xtrans ? "synthetic-xtrans" : "synthetic-bayer";
+        for (auto &m : methods(xtrans)) {
+            for (int n : cfg_.threads) {
+                set_threads(n);
+                double best = -1;
+                for (int i = 0; i < cfg_.repeat; ++i) {
+                    RawImageSource src;
+                    src.setSyntheticData(scene, xtrans);
+                    best = min_time(best, run_demosaic(&src, m.second));
+                }
+                report({"demosaic", m.first, input, scene->getWidth(), scene->getHeight(), n, best});
+            }
+        }
+    }
+
+    // demosaicing of a reference raw file
+    void demosaic_raw(const Glib::ustring &fname, ImageSource *src)
+    {
+        const bool xtrans = src->getSensorType() == ST_FUJI_XTRANS;
+        if (!xtrans && src->getSensorType() != ST_BAYER) {
+            return;
+        }
+        int w, h;
+        src->getFullSize(w, h);
+        for (auto &m : methods(xtrans)) {
+            for (int n : cfg_.threads) {
+                set_threads(n);
+                double best = -1;
+                for (int i = 0; i < cfg_.repeat; ++i) {
+                    best = min_time(best, run_demosaic(src, m.second));
+                }
+                report({"demosaic", m.first, fname, w, h, n, best});
+            }
+        }
+    }
+
+    // decoding of the raw data of fname (e.g. lossless JPEG, CR3), reported
+    // per file format
+    void decode_raw(const Glib::ustring &fname, const Glib::ustring &format)
+    {
+        for (int n : cfg_.threads) {
+            set_threads(n);
+            double best = -1;
+            int w = 0, h = 0;
+            for (int i = 0; i < cfg_.repeat; ++i) {
+                RawImage ri(fname);
+                const double t0 = now_ms();
+                if (ri.loadRaw(true, 0, true, nullptr, 1.0, false) != 0) {
+                    return;
+                }
+                best = min_time(best, now_ms() - t0);
+                w = ri.get_width();
+                h = ri.get_height();
+            }
+            report({"decode", format, fname, w, h, n, best});
+        }
+    }
+
+    // all the steps of ImProcFunctions::process on a copy of img
+    void pipeline(const std::string &input, const Imagefloat *img, const ProcParams &params)
+    {
+        auto prof = PipelineProfiler::getInstance();
+        const int w = img->getWidth(), h = img->getHeight();
+
+        for (int n : cfg_.threads) {
+            set_threads(n);
+            std::vector<std::string> order;
+            std::map<std::string, double> best;
+            double best_total = -1;
+
+            for (int i = 0; i < cfg_.repeat; ++i) {
+                Imagefloat work;
+                img->copyTo(&work);
+                ImProcFunctions ipf(&params, true);
+                ipf.setViewport(0, 0, w, h);
+                LUTu hist16(65536);
+                ipf.firstAnalysis(&work, params, hist16);
+
+                prof->clear();
+                prof->set_enabled(true);
+                const double t0 = now_ms();
+                for (auto stage : { ImProcFunctions::Stage::STAGE_0, ImProcFunctions::Stage::STAGE_1, ImProcFunctions::Stage::STAGE_2, ImProcFunctions::Stage::STAGE_3 }) {
+                    if (ipf.process(ImProcFunctions::Pipeline::OUTPUT, stage, &work)) {
+                        break;
+                    }
+                }
+                best_total = min_time(best_total, now_ms() - t0);
+                prof->set_enabled(false);
+
+                std::map<std::string, double> cur;
+                for (auto &e : prof->get_events()) {
+                    if (cur.find(e.name) == cur.end() && best.find(e.name) == best.end()) {
+                        order.push_back(e.name);
+                    }
+                    cur[e.name] += e.wall_us / 1000.0;
+                }
+                for (auto &p : cur) {
+                    auto it = best.find(p.first);
+                    best[p.first] = it == best.end() ? p.second : std::min(it->second, p.second);
+                }
+            }
+
+            for (auto &s : order) {
+                report({"pipeline", s, input, w, h, n, best[s]});
+            }
+            report({"pipeline", "total", input, w, h, n, best_total});
+        }
+        prof->clear();
+    }
+
+    // interpolation of the rows of scene through clut, with each of the
+    // kernels supported by the CPU
+    void clut(const Imagefloat *scene, const HaldCLUT &clut)
+    {
+        const int w = scene->getWidth(), h = scene->getHeight();
+        std::vector<std::pair<std::string, HaldCLUT::Kernel>> kernels = {
+            { "scalar", HaldCLUT::Kernel::SCALAR }
+        };
+        if (HaldCLUT::bestKernel() == HaldCLUT::Kernel::AVX2) {
+            kernels.emplace_back("avx2", HaldCLUT::Kernel::AVX2);
+        }
+
+        std::vector<std::unique_ptr<float[]>> out;
+        for (auto &k : kernels) {
+            out.emplace_back(new float[size_t(w) * h * 4]);
+            float *dst = out.back().get();
+            for (int n : cfg_.threads) {
+                set_threads(n);
+                double best = -1;
+                for (int i = 0; i < cfg_.repeat; ++i) {
+                    const double t0 = now_ms();
+#ifdef _OPENMP
+#                   pragma omp parallel for
+#endif
+                    for (int y = 0; y < h; ++y) {
+                        clut.getRGB(0.9f, w, scene->r(y), scene->g(y), scene->b(y), dst + size_t(y) * w * 4, k.second);
+                    }
+                    best = min_time(best, now_ms() - t0);
+                }
+                report({"clut", k.first, "synthetic-rgb", w, h, n, best});
+            }
+        }
+
+        // the kernels are expected to agree up to rounding
+        for (size_t i = 1; i < kernels.size(); ++i) {
+            float maxdiff = 0.f;
+            for (size_t j = 0, end = size_t(w) * h * 4; j < end; ++j) {
+                maxdiff = std::max(maxdiff, std::abs(out[i][j] - out[0][j]));
+            }
+            std::cerr << "clut      max difference " << kernels[i].first << " vs " << kernels[0].first << ": " << maxdiff << std::endl;
+            // normalised, i.e. about 0.6 of the 16-bit steps of the lattice
+            check("clut", "max difference " + kernels[i].first + " vs " + kernels[0].first, maxdiff / 65535.f, 1e-5);
+        }
+    }
+
+    // conversion of scene from the ProPhoto working space to each of the
+    // given output profiles, with LittleCMS and with the built-in
+    // matrix/shaper transform when the profile allows it
+    void icc(const Imagefloat *scene, const std::vector<Glib::ustring> &profiles)
+    {
+        const int w = scene->getWidth(), h = scene->getHeight();
+        std::vector<float> src(size_t(w) * h * 3);
+        for (int y = 0; y < h; ++y) {
+            float *row = &src[size_t(y) * w * 3];
+            for (int x = 0; x < w; ++x) {
+                row[3*x] = scene->r(y, x) / 65535.f;
+                row[3*x+1] = scene->g(y, x) / 65535.f;
+                row[3*x+2] = scene->b(y, x) / 65535.f;
+            }
+        }
+        std::vector<float> out_lcms(src.size()), out_ms(src.size());
+
+        cmsHPROFILE iprof = ICCStore::getInstance()->workingSpace("ProPhoto");
+        constexpr cmsUInt32Number flags = cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE;
+
+        for (auto &name : profiles) {
+            cmsHPROFILE oprof = ICCStore::getInstance()->getProfile(name);
+            cmsHTRANSFORM xform = oprof ? cmsCreateTransform(iprof, TYPE_RGB_FLT, oprof, TYPE_RGB_FLT, INTENT_RELATIVE_COLORIMETRIC, flags) : nullptr;
+            if (!xform) {
+                continue;
+            }
+            auto ms = MatrixShaperTransform::create(iprof, TYPE_RGB_FLT, oprof, TYPE_RGB_FLT, INTENT_RELATIVE_COLORIMETRIC, flags);
+
+            transform_rows(name.raw() + "/lcms", w, h, src, out_lcms, [xform](const float *in, float *out, int n) { cmsDoTransform(xform, in, out, n); });
+            if (ms) {
+                transform_rows(name.raw() + "/matrixshaper", w, h, src, out_ms, [&ms](const float *in, float *out, int n) { (*ms)(in, out, n); });
+
+                // expected to agree within the precision of the LUTs of the
+                // tone curves, which must never be visible as more than one
+                // step of an 8-bit output
+                float maxdiff = 0.f;
+                for (size_t i = 0; i < src.size(); ++i) {
+                    maxdiff = std::max(maxdiff, std::abs(out_ms[i] - out_lcms[i]));
+                }
+                std::cerr << "icc       max difference matrixshaper vs lcms for " << name << ": " << maxdiff << std::endl;
+                check("icc", "max difference matrixshaper vs lcms for " + name.raw(), maxdiff, 1.0 / 255.0);
+            } else {
+                std::cerr << "icc       " << name << " is not a matrix/shaper profile, LittleCMS only" << std::endl;
+            }
+            cmsDeleteTransform(xform);
+        }
+    }
+
+    // step 2 of the application of dcp (look table and tone curve) to scene,
+    // with the exact per-pixel computation and with the baked 3D LUT
+    void dcp(const Imagefloat *scene, DCPProfile *dcp, const Glib::ustring &working_space)
+    {
+        const int w = scene->getWidth(), h = scene->getHeight();
+        const int lut_size = options.rtSettings.dcp_lut_size > 1 ? options.rtSettings.dcp_lut_size : 65;
+
+        DCPProfile::ApplyState exact, baked;
+        dcp->setStep2ApplyState(working_space, true, true, false, exact);
+        dcp->setStep2ApplyState(working_space, true, true, false, baked);
+        const double t0 = now_ms();
+        dcp->setStep2LUT(working_space, lut_size, baked);
+        std::cerr << "dcp       LUT of dimension " << lut_size << " ready in " << std::fixed << std::setprecision(1) << (now_ms() - t0) << " ms" << std::endl;
+
+        const std::pair<std::string, const DCPProfile::ApplyState *> states[2] = {
+            { "exact", &exact },
+            { "lut", &baked }
+        };
+        std::unique_ptr<Imagefloat> out[2];
+        for (int k = 0; k < 2; ++k) {
+            out[k].reset(new Imagefloat(w, h));
+            Imagefloat *dst = out[k].get();
+            for (int n : cfg_.threads) {
+                set_threads(n);
+                double best = -1;
+                for (int i = 0; i < cfg_.repeat; ++i) {
+                    const double t1 = now_ms();
+#ifdef _OPENMP
+#                   pragma omp parallel for
+#endif
+                    for (int y = 0; y < h; ++y) {
+                        std::copy(scene->r(y), scene->r(y) + w, dst->r(y));
+                        std::copy(scene->g(y), scene->g(y) + w, dst->g(y));
+                        std::copy(scene->b(y), scene->b(y) + w, dst->b(y));
+                        dcp->step2ApplyTile(dst->r(y), dst->g(y), dst->b(y), w, 1, w, *states[k].second);
+                    }
+                    best = min_time(best, now_ms() - t1);
+                }
+                report({"dcp", states[k].first, "synthetic-rgb", w, h, n, best});
+            }
+        }
+
+        // the LUT is expected to agree with the exact computation within the
+        // interpolation error, reported relative to the full range
+        float maxdiff = 0.f;
+        double sumdiff = 0.0;
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                const float d = std::max(std::abs(out[1]->r(y, x) - out[0]->r(y, x)), std::max(std::abs(out[1]->g(y, x) - out[0]->g(y, x)), std::abs(out[1]->b(y, x) - out[0]->b(y, x))));
+                maxdiff = std::max(maxdiff, d);
+                sumdiff += d;
+            }
+        }
+        std::cerr << "dcp       difference lut vs exact: max " << std::setprecision(6) << maxdiff / 65535.f << ", mean " << sumdiff / (65535.0 * w * h) << std::endl;
+        // the LUT is used only for previews: allow small visible
+        // differences in the steepest parts of the curves, but not on average
+        check("dcp", "max difference lut vs exact", maxdiff / 65535.f, 0.02);
+        check("dcp", "mean difference lut vs exact", sumdiff / (65535.0 * w * h), 0.002);
+    }
+
+    // distortion, CA, rotation and perspective correction of scene, in
+    // separate passes with the exact mapping and in a single pass with the
+    // mapping sampled on a GeometryMesh
+    void geometry(const Imagefloat *scene)
+    {
+        const int w = scene->getWidth(), h = scene->getHeight();
+        const int saved_step = options.rtSettings.geometry_mesh_step;
+        const int mesh_step = saved_step > 0 ? saved_step : 16;
+
+        ProcParams params;
+        params.rotate.enabled = true;
+        params.rotate.degree = 2.5;
+        params.distortion.enabled = true;
+        params.distortion.amount = 0.1;
+        params.cacorrection.enabled = true;
+        params.cacorrection.red = 0.001;
+        params.cacorrection.blue = -0.001;
+        params.perspective.enabled = true;
+        params.perspective.horizontal = 5;
+        params.perspective.vertical = 10;
+        params.commonTrans.autofill = true;
+
+        Imagefloat src;
+        scene->copyTo(&src);
+        FramesData meta("");
+
+        const std::pair<std::string, int> modes[2] = {
+            { "exact", 0 },
+            { "mesh", mesh_step }
+        };
+        std::unique_ptr<Imagefloat> out[2];
+        for (int k = 0; k < 2; ++k) {
+            options.rtSettings.geometry_mesh_step = modes[k].second;
+            out[k].reset(new Imagefloat(w, h));
+            for (int n : cfg_.threads) {
+                set_threads(n);
+                double best = -1;
+                for (int i = 0; i < cfg_.repeat; ++i) {
+                    ImProcFunctions ipf(&params, true);
+                    const double t0 = now_ms();
+                    ipf.transform(&src, out[k].get(), 0, 0, 0, 0, w, h, w, h, &meta, 0, true);
+                    best = min_time(best, now_ms() - t0);
+                }
+                report({"geometry", modes[k].first, "synthetic-rgb", w, h, n, best});
+            }
+        }
+        options.rtSettings.geometry_mesh_step = saved_step;
+
+        // the mesh is expected to agree with the exact mapping within the
+        // interpolation error. The single pass clips only against the source
+        // image, so the pixels that either path leaves empty are not compared
+        float maxdiff = 0.f;
+        double sumdiff = 0.0;
+        size_t count = 0;
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                if (out[0]->g(y, x) <= 0.f || out[1]->g(y, x) <= 0.f) {
+                    continue;
+                }
+                const float d = std::max(std::abs(out[1]->r(y, x) - out[0]->r(y, x)), std::max(std::abs(out[1]->g(y, x) - out[0]->g(y, x)), std::abs(out[1]->b(y, x) - out[0]->b(y, x))));
+                maxdiff = std::max(maxdiff, d);
+                sumdiff += d;
+                ++count;
+            }
+        }
+        std::cerr << "geometry  difference mesh vs exact: max " << std::setprecision(6) << maxdiff / 65535.f << ", mean " << sumdiff / (65535.0 * std::max(count, size_t(1))) << std::endl;
+        // a few hundredths of a pixel of displacement, across the hard edges
+        // of the scene for the max, and mostly over its gradients and noise
+        // for the mean
+        check("geometry", "max difference mesh vs exact", maxdiff / 65535.f, 0.05);
+        check("geometry", "mean difference mesh vs exact", sumdiff / (65535.0 * std::max(count, size_t(1))), 0.002);
+    }
+
+    // conversion of scene to the output profile alone, with all the scopes
+    // accumulated during the conversion, and followed by a separate pass for
+    // each scope
+    void scopes(const Imagefloat *scene, const ProcParams &params)
+    {
+        const int w = scene->getWidth(), h = scene->getHeight();
+
+        struct Scopes {
+            LUTu hist[5];
+            array2D<int> hc, hs;
+            array2D<int> wf[4];
+
+            Scopes()
+            {
+                for (auto &l : hist) {
+                    l(256);
+                }
+                hc(ScopeAccumulator::VECTORSCOPE_SIZE, ScopeAccumulator::VECTORSCOPE_SIZE);
+                hs(ScopeAccumulator::VECTORSCOPE_SIZE, ScopeAccumulator::VECTORSCOPE_SIZE);
+            }
+
+            ScopeAccumulator::Output output(bool histograms, bool vhc, bool vhs, bool waveforms)
+            {
+                ScopeAccumulator::Output out;
+                if (histograms) {
+                    out.hist_red = &hist[0];
+                    out.hist_green = &hist[1];
+                    out.hist_blue = &hist[2];
+                    out.hist_luma = &hist[3];
+                    out.hist_chroma = &hist[4];
+                }
+                if (vhc) {
+                    out.vectorscope_hc = &hc;
+                }
+                if (vhs) {
+                    out.vectorscope_hs = &hs;
+                }
+                if (waveforms) {
+                    out.waveform_red = &wf[0];
+                    out.waveform_green = &wf[1];
+                    out.waveform_blue = &wf[2];
+                    out.waveform_luma = &wf[3];
+                }
+                return out;
+            }
+        };
+        Scopes fused, separate;
+
+        for (int k = 0; k < 3; ++k) {
+            const char *name = k == 0 ? "convert" : (k == 1 ? "fused" : "separate");
+            for (int n : cfg_.threads) {
+                set_threads(n);
+                double best = -1;
+                for (int i = 0; i < cfg_.repeat; ++i) {
+                    Imagefloat img;
+                    scene->copyTo(&img);
+                    ImProcFunctions ipf(&params, true);
+                    const double t0 = now_ms();
+                    std::unique_ptr<Image8> out;
+                    if (k == 1) {
+                        ScopeAccumulator acc(params.icm, fused.output(true, true, true, true), 0, 0, w, h);
+                        out.reset(ipf.rgb2out(&img, 0, 0, w, h, params.icm, true, &acc));
+                    } else {
+                        out.reset(ipf.rgb2out(&img, 0, 0, w, h, params.icm));
+                    }
+                    if (k == 2) {
+                        for (int s = 0; s < 4; ++s) {
+                            ScopeAccumulator acc(params.icm, separate.output(s == 0, s == 1, s == 2, s == 3), 0, 0, w, h);
+                            acc.process(out.get(), 0, 0, &img, true);
+                        }
+                    }
+                    best = min_time(best, now_ms() - t0);
+                }
+                report({"scopes", name, "synthetic-rgb", w, h, n, best});
+            }
+        }
+
+        // both ways must give exactly the same scopes
+        size_t mismatches = 0;
+        for (int c = 0; c < 5; ++c) {
+            for (int i = 0; i < 256; ++i) {
+                mismatches += fused.hist[c][i] != separate.hist[c][i];
+            }
+        }
+        for (int y = 0; y < ScopeAccumulator::VECTORSCOPE_SIZE; ++y) {
+            for (int x = 0; x < ScopeAccumulator::VECTORSCOPE_SIZE; ++x) {
+                mismatches += fused.hc[y][x] != separate.hc[y][x];
+                mismatches += fused.hs[y][x] != separate.hs[y][x];
+            }
+        }
+        for (int c = 0; c < 4; ++c) {
+            for (int y = 0; y < 256; ++y) {
+                for (int x = 0; x < w; ++x) {
+                    mismatches += fused.wf[c][y][x] != separate.wf[c][y][x];
+                }
+            }
+        }
+        std::cerr << "scopes    mismatching bins fused vs separate: " << mismatches << std::endl;
+        check("scopes", "mismatching bins fused vs separate", mismatches, 0);
+    }
+
+    // invalidation of the checkpoints of the preview pipeline: each value
+    // of the processing profile is changed in turn, and the output resumed
+    // from the checkpoints taken with the original profile must be the same
+    // as the one computed from scratch
+    void checkpoints(const Imagefloat *scene, const ProcParams &params)
+    {
+        const int w = scene->getWidth(), h = scene->getHeight();
+
+        const auto run =
+            [&](const ProcParams &pp, PipelineCheckpointCache *cache, Imagefloat &out) -> void
+            {
+                scene->copyTo(&out);
+                ImProcFunctions ipf(&pp, true);
+                ipf.setViewport(0, 0, w, h);
+                ipf.setCheckpointCache(cache);
+                LUTu hist16(65536);
+                ipf.firstAnalysis(&out, pp, hist16);
+                // STAGE_0 is never checkpointed, the scene is the input of
+                // STAGE_1
+                for (auto stage : { ImProcFunctions::Stage::STAGE_1, ImProcFunctions::Stage::STAGE_2, ImProcFunctions::Stage::STAGE_3 }) {
+                    if (ipf.process(ImProcFunctions::Pipeline::NAVIGATOR, stage, &out)) {
+                        break;
+                    }
+                }
+            };
+
+        // a single thread, so that the results are bit-exact
+        set_threads(1);
+
+        Glib::KeyFile kf;
+        size_t changed = 0, mismatches = 0;
+        PipelineCheckpointCache cache;
+        Imagefloat base, resumed, full;
+        const double t0 = now_ms();
+        try {
+            kf.load_from_data(params.to_data());
+            const std::vector<Glib::ustring> groups = kf.get_groups();
+            for (auto &group : groups) {
+                const std::vector<Glib::ustring> keys = kf.get_keys(group);
+                for (auto &key : keys) {
+                    const std::string value = kf.get_value(group, key);
+                    std::string perturbed;
+                    if (!perturb_value(value, perturbed)) {
+                        continue;
+                    }
+                    kf.set_value(group, key, perturbed);
+                    ProcParams pp;
+                    const bool ok = pp.from_data(kf.to_data().c_str()) && pp != params;
+                    kf.set_value(group, key, value);
+                    if (!ok) {
+                        continue;
+                    }
+
+                    cache.clear();
+                    run(params, &cache, base);
+                    run(pp, &cache, resumed);
+                    run(pp, nullptr, full);
+                    ++changed;
+
+                    bool same = resumed.getWidth() == full.getWidth() && resumed.getHeight() == full.getHeight();
+                    for (int y = 0; same && y < full.getHeight(); ++y) {
+                        for (int x = 0; same && x < full.getWidth(); ++x) {
+                            same = resumed.r(y, x) == full.r(y, x) && resumed.g(y, x) == full.g(y, x) && resumed.b(y, x) == full.b(y, x);
+                        }
+                    }
+                    if (!same) {
+                        ++mismatches;
+                        std::cerr << "checkpoints not invalidated by [" << group << "] " << key << std::endl;
+                    }
+                }
+            }
+        } catch (Glib::Error &exc) {
+            std::cerr << "Error: can't change the processing profile: " << exc.what() << std::endl;
+            ++failed_checks_;
+            return;
+        }
+        report({"checkpoints", "changed values", "synthetic-rgb", w, h, 1, now_ms() - t0});
+        std::cerr << "checkpoints values changed: " << changed << ", not invalidating the checkpoints: " << mismatches << std::endl;
+        check("checkpoints", "values not invalidating the checkpoints", mismatches, 0);
+    }
+
+    const std::vector<Result> &results() const { return results_; }
+    int failed_checks() const { return failed_checks_; }
+
+private:
+    typedef std::vector<std::pair<std::string, RAWParams>> MethodList;
+
+    MethodList methods(bool xtrans)
+    {
+        MethodList ret;
+        if (xtrans) {
+            const auto &names = RAWParams::XTransSensor::getMethodStrings();
+            for (size_t i = 0; i < names.size(); ++i) {
+                RAWParams raw;
+                raw.xtranssensor.method = RAWParams::XTransSensor::Method(i);
+                raw.xtranssensor.dualDemosaicAutoContrast = false;
+                ret.emplace_back(names[i], raw);
+            }
+        } else {
+            const auto &names = RAWParams::BayerSensor::getMethodStrings();
+            for (size_t i = 0; i < names.size(); ++i) {
+                RAWParams raw;
+                raw.bayersensor.method = RAWParams::BayerSensor::Method(i);
+                raw.bayersensor.dualDemosaicAutoContrast = false;
+                // pixel shift needs several frames
+                if (raw.bayersensor.method != RAWParams::BayerSensor::Method::PIXELSHIFT) {
+                    ret.emplace_back(names[i], raw);
+                }
+            }
+        }
+        return ret;
+    }
+
+    double run_demosaic(ImageSource *src, const RAWParams &raw)
+    {
+        double contrast = 0;
+        const double t0 = now_ms();
+        src->demosaic(raw, false, contrast);
+        return now_ms() - t0;
+    }
+
+    template <class Xform>
+    void transform_rows(const std::string &name, int w, int h, const std::vector<float> &src, std::vector<float> &dst, Xform xform)
+    {
+        for (int n : cfg_.threads) {
+            set_threads(n);
+            double best = -1;
+            for (int i = 0; i < cfg_.repeat; ++i) {
+                const double t0 = now_ms();
+#ifdef _OPENMP
+#               pragma omp parallel for
+#endif
+                for (int y = 0; y < h; ++y) {
+                    const size_t off = size_t(y) * w * 3;
+                    xform(&src[off], &dst[off], w);
+                }
+                best = min_time(best, now_ms() - t0);
+            }
+            report({"icc", name, "synthetic-rgb", w, h, n, best});
+        }
+    }
+
+    static double min_time(double best, double t)
+    {
+        return best < 0 ? t : std::min(best, t);
+    }
+
+    void report(const Result &r)
+    {
+        std::cerr << std::left << std::setw(9) << r.benchmark << " "
+                  << std::setw(26) << r.name << " "
+                  << std::setw(18) << Glib::path_get_basename(r.input) << " "
+                  << std::right << std::setw(5) << r.width << "x" << std::left << std::setw(5) << r.height << " "
+                  << std::right << std::setw(3) << r.threads << " thr "
+                  << std::fixed << std::setprecision(1) << std::setw(9) << r.time_ms << " ms "
+                  << std::setw(9) << r.mpix_per_s() << " MP/s" << std::endl;
+        results_.push_back(r);
+    }
+
+    // accuracy of an optimized code path with respect to the reference one
+    void check(const std::string &benchmark, const std::string &what, double value, double tolerance)
+    {
+        if (value > tolerance) {
+            std::cerr << std::left << std::setw(9) << benchmark << " FAILED: " << what << " is " << std::setprecision(6) << value << ", tolerance " << tolerance << std::endl;
+            ++failed_checks_;
+        }
+    }
+
+    const Config &cfg_;
+    std::vector<Result> results_;
+    int failed_checks_ = 0;
+};
+
+
+bool write_report(const Config &cfg, const std::vector<Result> &results)
+{
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "version", RTVERSION);
+    cJSON_AddNumberToObject(root, "repeat", cfg.repeat);
+#ifdef _OPENMP
+    cJSON_AddNumberToObject(root, "cpus", omp_get_num_procs());
+#else
+    cJSON_AddNumberToObject(root, "cpus", 1);
+#endif
+    cJSON_AddStringToObject(root, "isa", cpu::isa_name(cpu::get_isa()));
+    auto bp = BufferPool::getInstance()->get_stats();
+    cJSON *pool = cJSON_CreateObject();
+    cJSON_AddNumberToObject(pool, "hits", bp.hits);
+    cJSON_AddNumberToObject(pool, "misses", bp.misses);
+    cJSON_AddNumberToObject(pool, "mb_reused", bp.bytes_reused >> 20);
+    cJSON_AddItemToObject(root, "buffer_pool", pool);
+    cJSON *res = cJSON_CreateArray();
+    cJSON_AddItemToObject(root, "results", res);
+    for (auto &r : results) {
+        cJSON *o = cJSON_CreateObject();
+        cJSON_AddStringToObject(o, "benchmark", r.benchmark.c_str());
+        cJSON_AddStringToObject(o, "name", r.name.c_str());
+        cJSON_AddStringToObject(o, "input", r.input.c_str());
+        cJSON_AddNumberToObject(o, "width", r.width);
+        cJSON_AddNumberToObject(o, "height", r.height);
+        cJSON_AddNumberToObject(o, "threads", r.threads);
+        cJSON_AddNumberToObject(o, "time_ms", r.time_ms);
+        cJSON_AddNumberToObject(o, "mpix_per_s", r.mpix_per_s());
+        cJSON_AddItemToArray(res, o);
+    }
+
+    char *data = cJSON_Print(root);
+    cJSON_Delete(root);
+    if (!data) {
+        return false;
+    }
+
+    bool ok = true;
+    if (cfg.output.empty()) {
+        std::cout << data << std::endl;
+    } else {
+        FILE *out = g_fopen(cfg.output.c_str(), "wb");
+        ok = out && fputs(data, out) >= 0;
+        if (out) {
+            ok = (fclose(out) == 0) && ok;
+        }
+    }
+    free(data);
+    return ok;
+}
+
+} // namespace
+
+
+int main(int argc, char **argv)
+{
+#ifdef WITH_MIMALLOC
+    mi_version();
+#endif
+
+    setlocale(LC_ALL, "");
+    setlocale(LC_NUMERIC, "C");
+
+    Config cfg;
+    if (parse_args(argc, argv, cfg)) {
+        return 1;
+    }
+
+    Gio::init();
+
+#ifdef BUILD_BUNDLE
+    Glib::ustring exePath = getExecutablePath(argv[0]);
+    if (Glib::path_is_absolute(DATA_SEARCH_PATH)) {
+        options.ART_base_dir = DATA_SEARCH_PATH;
+    } else if (strcmp(DATA_SEARCH_PATH, ".") == 0) {
+        options.ART_base_dir = exePath;
+    } else {
+        options.ART_base_dir = Glib::build_filename(exePath, DATA_SEARCH_PATH);
+    }
+#else
+    options.ART_base_dir = DATA_SEARCH_PATH;
+#endif
+    options.rtSettings.lensfunDbDirectory = LENSFUN_DB_PATH;
+
+    try {
+        Options::load(true);
+    } catch (Options::Error &e) {
+        std::cerr << "Error: " << e.get_msg() << std::endl;
+        return 2;
+    }
+
+    // measure the actual computations, not the caches
+    options.rtSettings.demosaic_cache_size = 0;
+    options.rtSettings.clut_cache_size = 0;
+    // ...but the checkpoints one needs the cache of the preview pipeline
+    options.rtSettings.preview_checkpoint_cache_size = std::max(options.rtSettings.preview_checkpoint_cache_size, 64);
+
+    ProcParams params;
+    if (!cfg.profile.empty()) {
+        if (params.load(nullptr, cfg.profile)) {
+            std::cerr << "Error: can't load the processing profile " << cfg.profile << std::endl;
+            return 2;
+        }
+    } else {
+        default_bench_params(params);
+    }
+
+    DCPProfile *dcp = nullptr;
+    if (!cfg.dcp.empty()) {
+        dcp = DCPStore::getInstance()->getProfile(cfg.dcp);
+        if (!dcp) {
+            std::cerr << "Error: can't load the DCP profile " << cfg.dcp << std::endl;
+            return 2;
+        }
+    }
+
+    std::cerr << RTNAME << " " << RTVERSION << " benchmark, instruction set: " << cpu::isa_name(cpu::get_isa()) << std::endl;
+
+    Benchmark bench(cfg);
+
+    std::unique_ptr<HaldCLUT> clut;
+    if (cfg.clut) {
+        clut = make_clut();
+        if (!clut) {
+            std::cerr << "Error: can't create the HaldCLUT for the benchmark" << std::endl;
+        }
+    }
+
+    for (double mp : cfg.megapixels) {
+        int w, h;
+        size_from_megapixels(mp, w, h);
+        std::unique_ptr<Imagefloat> scene(make_scene(w, h));
+        if (cfg.demosaic) {
+            bench.demosaic_synthetic(scene.get(), false);
+            bench.demosaic_synthetic(scene.get(), true);
+        }
+        if (cfg.pipeline) {
+            bench.pipeline("synthetic-rgb", scene.get(), params);
+        }
+        if (clut) {
+            bench.clut(scene.get(), *clut);
+        }
+        if (cfg.icc) {
+            bench.icc(scene.get(), { "RTv4_sRGB", "RTv2_sRGB", "RTv4_Medium", "RTv4_Rec2020", "RTv4_Large", "RTv4_DisplayP3" });
+        }
+        if (dcp) {
+            bench.dcp(scene.get(), dcp, params.icm.workingProfile);
+        }
+        if (cfg.geometry) {
+            bench.geometry(scene.get());
+        }
+        if (cfg.scopes) {
+            bench.scopes(scene.get(), params);
+        }
+    }
+
+    if (cfg.checkpoints) {
+        // every value of the profile is tested, on a small image
+        std::unique_ptr<Imagefloat> scene(make_scene(240, 160));
+        bench.checkpoints(scene.get(), params);
+    }
+
+    int errors = 0;
+    for (auto &fname : cfg.inputs) {
+        Glib::ustring ext = getExtension(fname).lowercase();
+        const bool is_raw = !(ext == "jpg" || ext == "jpeg" || ext == "tif" || ext == "tiff" || ext == "png" || ImageIOManager::getInstance()->canLoad(ext));
+        int err = 0;
+        InitialImage *ii = InitialImage::load(fname, is_raw, &err, nullptr);
+        if (!ii) {
+            std::cerr << "Error: can't load " << fname << std::endl;
+            ++errors;
+            continue;
+        }
+        if (cfg.decode && is_raw) {
+            bench.decode_raw(fname, ext);
+        }
+        ImageSource *src = ii->getImageSource();
+        src->setCurrentFrame(0);
+        src->preprocess(params.raw, params.lensProf, params.coarse, false);
+        if (cfg.demosaic && is_raw) {
+            bench.demosaic_raw(fname, src);
+        }
+        if (cfg.pipeline) {
+            double contrast = 0;
+            src->demosaic(params.raw, false, contrast);
+            int w, h;
+            src->getFullSize(w, h);
+            Imagefloat img(w, h);
+            src->getImage(ColorTemp(), TR_NONE, &img, PreviewProps(0, 0, w, h, 1), params.exposure, params.raw);
+            src->convertColorSpace(&img, params.icm, ColorTemp());
+            bench.pipeline(fname, &img, params);
+        }
+        ii->decreaseRef();
+    }
+
+    if (!write_report(cfg, bench.results())) {
+        std::cerr << "Error: can't write the report" << std::endl;
+        return 2;
+    }
+
+    if (bench.failed_checks()) {
+        return 4;
+    }
+    return errors ? 3 : 0;
+}
@@ -44,6 +44,8 @@
 #include "makeicc.h"
 #include "../rtengine/clutstore.h"
 #include "../rtengine/settings.h"
+#include "../rtengine/imagesource.h"
+#include "../rtengine/pipelineprofiler.h"
 
 #ifndef WIN32
 #include <glibmm/fileutils.h>
@@ -58,6 +60,13 @@
 
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
 
 #ifdef WITH_MIMALLOC
 #  include <mimalloc.h>
@@ -84,6 +93,106 @@ bool check_partial_profile(const PartialProfile &pp)
     return pp->applyTo(params);
 }
 
+
+// Bounds the (estimated) memory used by the files processed concurrently
+// with --jobs. A job is always admitted when nothing else holds memory, so
+// that files larger than the budget are still processed, one at a time.
+// Likewise, a job that needs to grow its reservation proceeds anyway when
+// all the other jobs are waiting as well, since none of them would ever
+// release its memory otherwise.
+class MemoryBudget {
+public:
+    explicit MemoryBudget(size_t size): size_(size), used_(0), jobs_(0), waiting_(0) {}
+
+    class Reservation {
+    public:
+        explicit Reservation(MemoryBudget *budget): budget_(budget), amount_(0)
+        {
+            if (budget_) {
+                budget_->add_job(1);
+            }
+        }
+
+        ~Reservation()
+        {
+            set(0);
+            if (budget_) {
+                budget_->add_job(-1);
+            }
+        }
+
+        // blocks until the reservation can be grown to the given amount
+        void set(size_t amount)
+        {
+            if (budget_) {
+                budget_->update(amount_, amount);
+            }
+            amount_ = amount;
+        }
+
+    private:
+        MemoryBudget *budget_;
+        size_t amount_;
+    };
+
+    // rough estimates of the peak footprint of the various phases: decoding
+    // expands the (compressed) input file, while processing holds the raw
+    // data, the demosaiced image, the working image and a few temporaries
+    static size_t estimate_load(const Glib::ustring &fname)
+    {
+        size_t sz = 0;
+        try {
+            sz = Gio::File::create_for_path(fname)->query_info(G_FILE_ATTRIBUTE_STANDARD_SIZE)->get_size();
+        } catch (Glib::Exception &) {
+        }
+        return sz * 4;
+    }
+    
+    static size_t estimate_processing(int w, int h)
+    {
+        return size_t(std::max(w, 0)) * size_t(std::max(h, 0)) * 64;
+    }
+
+    static size_t estimate_output(int w, int h)
+    {
+        return size_t(std::max(w, 0)) * size_t(std::max(h, 0)) * 3 * sizeof(float);
+    }
+
+private:
+    void add_job(int delta)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        jobs_ += delta;
+        cond_.notify_all();
+    }
+
+    void update(size_t from, size_t to)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (to > from && !fits(from, to)) {
+            ++waiting_;
+            // the other waiters must re-check whether everybody is waiting
+            cond_.notify_all();
+            cond_.wait(lock, [&]() { return fits(from, to) || waiting_ >= jobs_; });
+            --waiting_;
+        }
+        used_ = used_ - from + to;
+        cond_.notify_all();
+    }
+
+    bool fits(size_t from, size_t to) const
+    {
+        return size_ == 0 || used_ == from || used_ - from + to <= size_;
+    }
+
+    size_t size_;
+    size_t used_;
+    int jobs_;    // live reservations
+    int waiting_; // reservations blocked in update()
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
 } // namespace
 
 
@@ -370,7 +479,9 @@ int processLineParams ( int argc, char **argv )
     int bits = -1;
     bool isFloat = false;
     std::string outputType = "";
-    unsigned errors = 0;
+    std::atomic<unsigned> errors(0);
+    int num_jobs = 1;
+    size_t mem_budget = 0;
 
     for ( int iArg = 1; iArg < argc; iArg++) {
         Glib::ustring currParam (argv[iArg]);
@@ -381,7 +492,36 @@ int processLineParams ( int argc, char **argv )
         if ( currParam.at (0) == '-' && currParam.size() > 1) {
             switch ( currParam.at (1) ) {
             case '-':
-                // GTK --argument, we're skipping it
+                if (currParam.substr(0, 7) == "--jobs=") {
+                    num_jobs = atoi(currParam.substr(7).c_str());
+                    if (num_jobs <= 0) {
+#ifdef _OPENMP
+                        num_jobs = omp_get_num_procs();
+#else
+                        num_jobs = 1;
+#endif
+                    }
+                } else if (currParam.substr(0, 13) == "--mem-budget=") {
+                    int mb = atoi(currParam.substr(13).c_str());
+                    if (mb < 0) {
+                        std::cerr << "Error: the value of --mem-budget must be a non-negative number of MB!" << std::endl;
+                        return -3;
+                    }
+                    mem_budget = size_t(mb) << 20;
+                } else if (currParam.substr(0, 10) == "--profile=") {
+                    options.rtSettings.pipeline_profile_file = fname_to_utf8(argv[iArg] + 10);
+                } else if (currParam.substr(0, 17) == "--profile-format=") {
+                    auto f = currParam.substr(17);
+                    if (f == "json") {
+                        options.rtSettings.pipeline_profile_format = 0;
+                    } else if (f == "trace") {
+                        options.rtSettings.pipeline_profile_format = 1;
+                    } else {
+                        std::cerr << "Error: the value of --profile-format must be either \"json\" or \"trace\"!" << std::endl;
+                        return -3;
+                    }
+                }
+                // other GTK --arguments are skipped
                 break;
 
             case 'O':
@@ -725,186 +865,251 @@ int processLineParams ( int argc, char **argv )
         std::thread(monitor).detach();
     }
 
-    for ( size_t iFile = 0; iFile < inputFiles.size(); iFile++) {
-        cpl.incr();
-
-        // Has to be reinstanciated at each profile to have a ProcParams object with default values
-        rtengine::procparams::ProcParams currentParams;
+    if (outputType.empty()) {
+        outputType = "jpg";
+    }
+    auto oext = output_ext[outputType];
+    if (oext.empty()) {
+        oext = outputType;
+    }
 
-        Glib::ustring inputFile = inputFiles[iFile];
-        //cpl.info(Glib::ustring::compose("Output is %1-bit %2.", bits, (isFloat ? "floating-point" : "integer")));
-        if (progress) {
-            cpl.msg(Glib::ustring::compose("Processing: %1 (%2/%3)", inputFile, iFile+1, inputFiles.size()));
-        } else {
-            cpl.info(Glib::ustring::compose("Processing: %1", inputFile));
-        }
+    // the profile store is lazily initialized
+    std::mutex profiles_mutex;
+    
+    const auto process_file =
+        [&](size_t iFile, MemoryBudget *budget) -> void
+        {
+            MemoryBudget::Reservation reservation(budget);
+            cpl.incr();
+            // the progress listener is shared, so it is given to the engine
+            // only when the files are processed one at a time
+            rtengine::ProgressListener *job_pl = budget ? nullptr : pl;
+
+            // Has to be reinstanciated at each profile to have a ProcParams object with default values
+            rtengine::procparams::ProcParams currentParams;
+
+            Glib::ustring inputFile = inputFiles[iFile];
+            //cpl.info(Glib::ustring::compose("Output is %1-bit %2.", bits, (isFloat ? "floating-point" : "integer")));
+            if (progress) {
+                cpl.msg(Glib::ustring::compose("Processing: %1 (%2/%3)", inputFile, iFile+1, inputFiles.size()));
+            } else {
+                cpl.info(Glib::ustring::compose("Processing: %1", inputFile));
+            }
         
-        rtengine::InitialImage* ii = nullptr;
-        rtengine::ProcessingJob* job = nullptr;
-        int errorCode;
-        bool isRaw = false;
-
-        Glib::ustring outputFile;
-
-        if (outputType.empty()) {
-            outputType = "jpg";
-        }
+            rtengine::InitialImage* ii = nullptr;
+            rtengine::ProcessingJob* job = nullptr;
+            int errorCode;
+            bool isRaw = false;
 
-        auto oext = output_ext[outputType];
-        if (oext.empty()) {
-            oext = outputType;
-        }
+            Glib::ustring outputFile;
 
-        if (outputPath.empty()) {
-            Glib::ustring s = inputFile;
-            Glib::ustring::size_type ext = s.find_last_of('.');
-            outputFile = s.substr(0, ext) + "." + oext;
-        } else if (outputDirectory) {
-            Glib::ustring s = Glib::path_get_basename(inputFile);
-            Glib::ustring::size_type ext = s.find_last_of('.');
-            outputFile = Glib::build_filename(outputPath, s.substr(0, ext) + "." + oext);
-        } else {
-            if (leaveUntouched) {
-                outputFile = outputPath;
-            } else {
-                Glib::ustring s = outputPath;
+            if (outputPath.empty()) {
+                Glib::ustring s = inputFile;
                 Glib::ustring::size_type ext = s.find_last_of('.');
                 outputFile = s.substr(0, ext) + "." + oext;
+            } else if (outputDirectory) {
+                Glib::ustring s = Glib::path_get_basename(inputFile);
+                Glib::ustring::size_type ext = s.find_last_of('.');
+                outputFile = Glib::build_filename(outputPath, s.substr(0, ext) + "." + oext);
+            } else {
+                if (leaveUntouched) {
+                    outputFile = outputPath;
+                } else {
+                    Glib::ustring s = outputPath;
+                    Glib::ustring::size_type ext = s.find_last_of('.');
+                    outputFile = s.substr(0, ext) + "." + oext;
+                }
             }
-        }
 
-        if (inputFile == outputFile) {
-            cpl.error(Glib::ustring::compose("cannot overwrite: %1", inputFile));
-            continue;
-        }
+            if (inputFile == outputFile) {
+                cpl.error(Glib::ustring::compose("cannot overwrite: %1", inputFile));
+                return;
+            }
 
-        if (!overwriteFiles && Glib::file_test(outputFile, Glib::FILE_TEST_EXISTS ) ) {
-            cpl.error(Glib::ustring::compose("%1 already exists: use -Y option to overwrite. This image has been skipped.", outputFile));
-            continue;
-        }
+            if (!overwriteFiles && Glib::file_test(outputFile, Glib::FILE_TEST_EXISTS ) ) {
+                cpl.error(Glib::ustring::compose("%1 already exists: use -Y option to overwrite. This image has been skipped.", outputFile));
+                return;
+            }
 
-        // Load the image
-        isRaw = true;
-        Glib::ustring ext = getExtension(inputFile).lowercase();
+            // Load the image
+            isRaw = true;
+            Glib::ustring ext = getExtension(inputFile).lowercase();
 
-        if (ext == "jpg" || ext == "jpeg" || ext == "tif" || ext == "tiff" || ext == "png" || rtengine::ImageIOManager::getInstance()->canLoad(ext)) {
-            isRaw = false;
-        }
+            if (ext == "jpg" || ext == "jpeg" || ext == "tif" || ext == "tiff" || ext == "png" || rtengine::ImageIOManager::getInstance()->canLoad(ext)) {
+                isRaw = false;
+            }
 
-        ii = rtengine::InitialImage::load(inputFile, isRaw, &errorCode, nullptr);
+            reservation.set(MemoryBudget::estimate_load(inputFile));
+            ii = rtengine::InitialImage::load(inputFile, isRaw, &errorCode, nullptr);
 
-        if (!ii) {
-            errors++;
-            cpl.error(Glib::ustring::compose("impossible to load file: %1", inputFile));
-            continue;
-        }
+            if (!ii) {
+                errors++;
+                cpl.error(Glib::ustring::compose("impossible to load file: %1", inputFile));
+                return;
+            }
 
-        if (useDefault) {
-            if (isRaw) {
-                if (options.defProfRaw == Options::DEFPROFILE_DYNAMIC) {
-                    rawParams = ProfileStore::getInstance()->loadDynamicProfile(ii->getMetaData());
-                }
+            {
+                int w = 0, h = 0;
+                ii->getImageSource()->getFullSize(w, h, 0);
+                reservation.set(MemoryBudget::estimate_processing(w, h));
+            }
+
+            if (useDefault) {
+                // the dynamic profiles are per-file, don't overwrite the shared
+                // defaults as files can be processed concurrently
+                PartialProfile dynParams;
+                if (isRaw) {
+                    const PartialProfile *defParams = &rawParams;
+                    if (options.defProfRaw == Options::DEFPROFILE_DYNAMIC) {
+                        std::lock_guard<std::mutex> lock(profiles_mutex);
+                        dynParams = ProfileStore::getInstance()->loadDynamicProfile(ii->getMetaData());
+                        defParams = &dynParams;
+                    }
                 
-                cpl.info("Merging default raw processing profile.");
-                rawParams->applyTo(currentParams);
-            } else {
-                if (options.defProfImg == Options::DEFPROFILE_DYNAMIC) {
-                    imgParams = ProfileStore::getInstance()->loadDynamicProfile(ii->getMetaData());
-                }
+                    cpl.info("Merging default raw processing profile.");
+                    (*defParams)->applyTo(currentParams);
+                } else {
+                    const PartialProfile *defParams = &imgParams;
+                    if (options.defProfImg == Options::DEFPROFILE_DYNAMIC) {
+                        std::lock_guard<std::mutex> lock(profiles_mutex);
+                        dynParams = ProfileStore::getInstance()->loadDynamicProfile(ii->getMetaData());
+                        defParams = &dynParams;
+                    }
 
-                cpl.info("Merging default non-raw processing profile.");
-                imgParams->applyTo(currentParams);
+                    cpl.info("Merging default non-raw processing profile.");
+                    (*defParams)->applyTo(currentParams);
+                }
             }
-        }
 
-        bool sideCarFound = false;
-        unsigned int i = 0;
+            bool sideCarFound = false;
+            unsigned int i = 0;
 
-        // Iterate the procparams file list in order to build the final ProcParams
-        do {
-            if (sideProcParams && i == sideCarFilePos) {
-                // using the sidecar file
-                Glib::ustring sideProcessingParams = options.getParamFile(inputFile);
+            // Iterate the procparams file list in order to build the final ProcParams
+            do {
+                if (sideProcParams && i == sideCarFilePos) {
+                    // using the sidecar file
+                    Glib::ustring sideProcessingParams = options.getParamFile(inputFile);
 
-                // the "load" method don't reset the procparams values anymore, so values found in the procparam file override the one of currentParams
-                if (!Glib::file_test(sideProcessingParams, Glib::FILE_TEST_EXISTS) || currentParams.load(nullptr, sideProcessingParams)) {
-                    cpl.info(Glib::ustring::compose("Warning: sidecar file requested but not found for: %1", sideProcessingParams));
-                } else {
-                    sideCarFound = true;
-                    cpl.info("Merging sidecar procparams.");
+                    // the "load" method don't reset the procparams values anymore, so values found in the procparam file override the one of currentParams
+                    if (!Glib::file_test(sideProcessingParams, Glib::FILE_TEST_EXISTS) || currentParams.load(nullptr, sideProcessingParams)) {
+                        cpl.info(Glib::ustring::compose("Warning: sidecar file requested but not found for: %1", sideProcessingParams));
+                    } else {
+                        sideCarFound = true;
+                        cpl.info("Merging sidecar procparams.");
+                    }
+                }
+
+                if (processingParams.size() > i) {
+                    cpl.info(Glib::ustring::compose("Merging procparams #%1", i));
+                    processingParams[i]->applyTo(currentParams);
                 }
+
+                i++;
+            } while (i < processingParams.size() + (sideProcParams ? 1 : 0));
+
+            if (sideProcParams && !sideCarFound && skipIfNoSidecar) {
+                delete ii;
+                errors++;
+                cpl.error(Glib::ustring::compose("no sidecar procparams found for: %1", inputFile));
+                return;
             }
 
-            if (processingParams.size() > i) {
-                cpl.info(Glib::ustring::compose("Merging procparams #%1", i));
-                processingParams[i]->applyTo(currentParams);
+            auto p = rtengine::ImageIOManager::getInstance()->getSaveProfile(outputType);
+            if (p) {
+                p->applyTo(currentParams);
             }
 
-            i++;
-        } while (i < processingParams.size() + (sideProcParams ? 1 : 0));
+            job = create_processing_job(ii, currentParams, fast_export);
 
-        if (sideProcParams && !sideCarFound && skipIfNoSidecar) {
-            delete ii;
-            errors++;
-            cpl.error(Glib::ustring::compose("no sidecar procparams found for: %1", inputFile));
-            continue;
-        }
+            if (!job) {
+                errors++;
+                cpl.error(Glib::ustring::compose("impossible to create processing job for: %1", inputFile));
+                ii->decreaseRef();
+                return;
+            }
 
-        auto p = rtengine::ImageIOManager::getInstance()->getSaveProfile(outputType);
-        if (p) {
-            p->applyTo(currentParams);
-        }
+            // Process image
+            rtengine::IImagefloat *resultImage = rtengine::processImage(job, errorCode, job_pl);
+
+            if (!resultImage) {
+                errors++;
+                cpl.error(Glib::ustring::compose("failure in processing: %1", inputFile));
+                rtengine::ProcessingJob::destroy(job);
+                return;
+            }
+
+            // only the output image is kept while encoding, let other files in
+            reservation.set(MemoryBudget::estimate_output(resultImage->getWidth(), resultImage->getHeight()));
+
+            // save image to disk
+            if (outputType == "jpg") {
+                errorCode = resultImage->saveAsJPEG(outputFile, compression, subsampling);
+            } else if (outputType == "tif") {
+                errorCode = resultImage->saveAsTIFF(outputFile, bits, isFloat, compression == 0);
+            } else if (outputType == "png") {
+                errorCode = resultImage->saveAsPNG(outputFile, bits);
+            } else {
+                errorCode = rtengine::ImageIOManager::getInstance()->save(resultImage, outputType, outputFile, nullptr) ? 0 : 1;
+                //errorCode = resultImage->saveToFile(outputFile);
+            }
 
-        job = create_processing_job(ii, currentParams, fast_export);
+            if (errorCode) {
+                errors++;
+                cpl.error(Glib::ustring::compose("failure in saving to: %1", outputFile));
+            } else {
+                if (copyParamsFile) {
+                    Glib::ustring outputProcessingParams = outputFile + paramFileExtension;
+                    if (!options.params_out_embed || currentParams.saveEmbedded(job_pl, outputFile) != 0) {
+                        currentParams.save(job_pl, outputProcessingParams);
+                    }
+                }
+            }
 
-        if (!job) {
-            errors++;
-            cpl.error(Glib::ustring::compose("impossible to create processing job for: %1", inputFile));
             ii->decreaseRef();
-            continue;
-        }
+            resultImage->free();
+        };
 
-        // Process image
-        rtengine::IImagefloat *resultImage = rtengine::processImage(job, errorCode, pl);
+    rtengine::PipelineProfiler::getInstance()->set_enabled(!options.rtSettings.pipeline_profile_file.empty());
 
-        if (!resultImage) {
-            errors++;
-            cpl.error(Glib::ustring::compose("failure in processing: %1", inputFile));
-            rtengine::ProcessingJob::destroy(job);
-            continue;
+    if (num_jobs <= 1) {
+        for (size_t iFile = 0; iFile < inputFiles.size(); ++iFile) {
+            process_file(iFile, nullptr);
         }
-
-        // save image to disk
-        if (outputType == "jpg") {
-            errorCode = resultImage->saveAsJPEG(outputFile, compression, subsampling);
-        } else if (outputType == "tif") {
-            errorCode = resultImage->saveAsTIFF(outputFile, bits, isFloat, compression == 0);
-        } else if (outputType == "png") {
-            errorCode = resultImage->saveAsPNG(outputFile, bits);
-        } else {
-            errorCode = rtengine::ImageIOManager::getInstance()->save(resultImage, outputType, outputFile, nullptr) ? 0 : 1;
-            //errorCode = resultImage->saveToFile(outputFile);
+    } else {
+        // processImage() is reentrant (the GUI already runs the batch queue
+        // concurrently with the editor): the shared stores (ICC, DCP, LCP,
+        // CLUT, dark frames and flat fields) and the disk caches are
+        // internally locked, and the XMP toolkit is initialized with a lock
+        // in Exiv2Metadata::init(). What is shared by the jobs here is
+        // serialized explicitly (profiles_mutex, MemoryBudget, cpl)
+        MemoryBudget budget(mem_budget);
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> workers;
+        for (int i = 0; i < num_jobs; ++i) {
+            workers.emplace_back(
+                [&]() -> void
+                {
+#ifdef _OPENMP
+                    // share the cores among the concurrent jobs
+                    omp_set_num_threads(std::max(omp_get_num_procs() / num_jobs, 1));
+#endif
+                    for (size_t iFile = next++; iFile < inputFiles.size(); iFile = next++) {
+                        process_file(iFile, &budget);
+                    }
+                });
         }
-
-        if (errorCode) {
-            errors++;
-            cpl.error(Glib::ustring::compose("failure in saving to: %1", outputFile));
-        } else {
-            if (copyParamsFile) {
-                Glib::ustring outputProcessingParams = outputFile + paramFileExtension;
-                if (!options.params_out_embed || currentParams.saveEmbedded(pl, outputFile) != 0) {
-                    currentParams.save(pl, outputProcessingParams);
-                }
-            }
+        for (auto &t : workers) {
+            t.join();
         }
-
-        ii->decreaseRef();
-        resultImage->free();
     }
 
     if (progress) {
         std::cout << "100" << std::endl;
     }
 
+    if (!rtengine::savePipelineProfile()) {
+        errors++;
+    }
+
     return errors > 0 ? -2 : 0;
 }
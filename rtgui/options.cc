@@ -579,6 +579,20 @@ void Options::setDefaults()
     rtSettings.thread_pool_size = 0;
     rtSettings.ctl_scripts_fast_preview = true;
     rtSettings.imgio_raw_cache_size = 10;
+    rtSettings.demosaic_cache_size = 0;
+    rtSettings.preview_checkpoint_cache_size = 256;
+    rtSettings.buffer_pool_size = 512;
+    rtSettings.clut_cache_size = 256;
+    rtSettings.cpu_isa = "auto";
+    rtSettings.dcp_lut_size = 65;
+    rtSettings.exiftool_workers = 4;
+    rtSettings.pipeline_profile_file = "";
+    rtSettings.pipeline_profile_format = 0;
+    rtSettings.preview_cancellation = true;
+    rtSettings.concurrent_crop_updates = true;
+    rtSettings.progressive_preview_threshold = 250;
+    rtSettings.mask_cache_size = 256;
+    rtSettings.geometry_mesh_step = 16;
     
     show_exiftool_makernotes = false;
 
@@ -1161,6 +1175,62 @@ void Options::readFromFile(Glib::ustring fname)
                     rtSettings.imgio_raw_cache_size = keyFile.get_integer("Performance", "RAWImageIOCacheSize");
                 }
 
+                if (keyFile.has_key("Performance", "DemosaicCacheSize")) {
+                    rtSettings.demosaic_cache_size = keyFile.get_integer("Performance", "DemosaicCacheSize");
+                }
+
+                if (keyFile.has_key("Performance", "PreviewCheckpointCacheSize")) {
+                    rtSettings.preview_checkpoint_cache_size = keyFile.get_integer("Performance", "PreviewCheckpointCacheSize");
+                }
+
+                if (keyFile.has_key("Performance", "BufferPoolSize")) {
+                    rtSettings.buffer_pool_size = keyFile.get_integer("Performance", "BufferPoolSize");
+                }
+
+                if (keyFile.has_key("Performance", "CLUTCacheSize")) {
+                    rtSettings.clut_cache_size = keyFile.get_integer("Performance", "CLUTCacheSize");
+                }
+
+                if (keyFile.has_key("Performance", "CPUInstructionSet")) {
+                    rtSettings.cpu_isa = keyFile.get_string("Performance", "CPUInstructionSet");
+                }
+
+                if (keyFile.has_key("Performance", "DCPLUTSize")) {
+                    rtSettings.dcp_lut_size = keyFile.get_integer("Performance", "DCPLUTSize");
+                }
+
+                if (keyFile.has_key("Performance", "ExiftoolWorkers")) {
+                    rtSettings.exiftool_workers = keyFile.get_integer("Performance", "ExiftoolWorkers");
+                }
+
+                if (keyFile.has_key("Performance", "PipelineProfileFile")) {
+                    rtSettings.pipeline_profile_file = keyFile.get_string("Performance", "PipelineProfileFile");
+                }
+
+                if (keyFile.has_key("Performance", "PipelineProfileFormat")) {
+                    rtSettings.pipeline_profile_format = keyFile.get_integer("Performance", "PipelineProfileFormat");
+                }
+
+                if (keyFile.has_key("Performance", "PreviewCancellation")) {
+                    rtSettings.preview_cancellation = keyFile.get_boolean("Performance", "PreviewCancellation");
+                }
+
+                if (keyFile.has_key("Performance", "ConcurrentCropUpdates")) {
+                    rtSettings.concurrent_crop_updates = keyFile.get_boolean("Performance", "ConcurrentCropUpdates");
+                }
+
+                if (keyFile.has_key("Performance", "ProgressivePreviewThreshold")) {
+                    rtSettings.progressive_preview_threshold = keyFile.get_integer("Performance", "ProgressivePreviewThreshold");
+                }
+
+                if (keyFile.has_key("Performance", "MaskCacheSize")) {
+                    rtSettings.mask_cache_size = keyFile.get_integer("Performance", "MaskCacheSize");
+                }
+
+                if (keyFile.has_key("Performance", "GeometryMeshStep")) {
+                    rtSettings.geometry_mesh_step = keyFile.get_integer("Performance", "GeometryMeshStep");
+                }
+
                 if (keyFile.has_key("Performance", "PreviewResamplingQuality")) {
                     preview_resampling_quality = PreviewResamplingQuality(keyFile.get_integer("Performance", "PreviewResamplingQuality"));
                 }
@@ -1912,6 +1982,20 @@ void Options::saveToFile(Glib::ustring fname)
         keyFile.set_boolean("Performance", "CTLScriptsFastPreview", rtSettings.ctl_scripts_fast_preview);
         keyFile.set_integer("Performance", "WBPreviewMode", wb_preview_mode);
         keyFile.set_integer("Performance", "RAWImageIOCacheSize", rtSettings.imgio_raw_cache_size);
+        keyFile.set_integer("Performance", "DemosaicCacheSize", rtSettings.demosaic_cache_size);
+        keyFile.set_integer("Performance", "PreviewCheckpointCacheSize", rtSettings.preview_checkpoint_cache_size);
+        keyFile.set_integer("Performance", "BufferPoolSize", rtSettings.buffer_pool_size);
+        keyFile.set_integer("Performance", "CLUTCacheSize", rtSettings.clut_cache_size);
+        keyFile.set_string("Performance", "CPUInstructionSet", rtSettings.cpu_isa);
+        keyFile.set_integer("Performance", "DCPLUTSize", rtSettings.dcp_lut_size);
+        keyFile.set_integer("Performance", "ExiftoolWorkers", rtSettings.exiftool_workers);
+        keyFile.set_string("Performance", "PipelineProfileFile", rtSettings.pipeline_profile_file);
+        keyFile.set_integer("Performance", "PipelineProfileFormat", rtSettings.pipeline_profile_format);
+        keyFile.set_boolean("Performance", "PreviewCancellation", rtSettings.preview_cancellation);
+        keyFile.set_boolean("Performance", "ConcurrentCropUpdates", rtSettings.concurrent_crop_updates);
+        keyFile.set_integer("Performance", "ProgressivePreviewThreshold", rtSettings.progressive_preview_threshold);
+        keyFile.set_integer("Performance", "MaskCacheSize", rtSettings.mask_cache_size);
+        keyFile.set_integer("Performance", "GeometryMeshStep", rtSettings.geometry_mesh_step);
         keyFile.set_integer("Performance", "PreviewResamplingQuality", int(preview_resampling_quality));
         
         keyFile.set_integer("Inspector", "Mode", int(rtSettings.thumbnail_inspector_mode));
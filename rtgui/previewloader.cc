@@ -25,6 +25,7 @@
 #include <chrono>
 #include <deque>
 #include <atomic>
+#include <iostream>
 #include "options.h"
 #include "../rtengine/threadpool.h"
 
@@ -77,14 +78,18 @@ public:
 
     typedef std::set<Job, JobCompare> JobSet;
 
-    Impl(): num_concurrent_threads_(0), job_count_(0)
+    Impl(): num_concurrent_threads_(0), job_count_(0), loaded_count_(0)
     {
     }
 
     MyMutex mutex_;
     std::deque<Job> jobs_;
     std::atomic<int> num_concurrent_threads_;
-    size_t job_count_;
+    std::atomic<size_t> job_count_;
+
+    // folder-open throughput, reported in verbose mode
+    std::chrono::steady_clock::time_point start_time_;
+    std::atomic<size_t> loaded_count_;
 
     void processNextJob()
     {
@@ -114,6 +119,7 @@ public:
 
             if (tmb) {
                 DEBUG("Preview Ready\n");
+                ++loaded_count_;
                 j.listener_->previewReady(j.dir_id_, new FileBrowserEntry(tmb, j.dir_entry_));
             }
 
@@ -127,6 +133,11 @@ public:
 
         // signal at end
         if (last && jobs_.empty()) {
+            if (options.rtSettings.verbose) {
+                const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time_).count();
+                const size_t n = loaded_count_;
+                std::cout << "PreviewLoader: loaded " << n << " previews in " << secs << " s (" << (secs > 0 ? n / secs : 0.0) << " images/s)" << std::endl;
+            }
             j.listener_->previewsFinished(j.dir_id_);
         }
     }
@@ -159,6 +170,11 @@ void PreviewLoader::add(int dir_id, const Glib::ustring& dir_entry, PreviewLoade
         {
             MyMutex::MyLock lock(impl_->mutex_);
 
+            if (impl_->jobs_.empty() && impl_->num_concurrent_threads_ == 0) {
+                impl_->start_time_ = std::chrono::steady_clock::now();
+                impl_->loaded_count_ = 0;
+            }
+
             // create a new job and append to queue
             DEBUG("saving job %s", dir_entry.c_str());
             impl_->jobs_.push_back(Impl::Job(dir_id, dir_entry, l));
@@ -45,7 +45,7 @@ inline void ART_print_help(std::ostream &out, const char *progname, bool gui)
         out << "  " << pn << " --check-lut <lut-filename>   Check the validity of the given LUT file." << std::endl;
         out << std::endl;
         out << "Options:" << std::endl;
-        out << "  " << pn << "[-o <output>|-O <output>] [-q] [-a] [-s|-S] [-p <one" << paramFileExtension << "> [-p <two" << paramFileExtension << "> ...] ] [-d] [ -j[1-100] -js<1-3> | -t[z] -b<8|16|16f|32> | -n -b<8|16> | -Ttype ] [-Y] [-f] -c <input>" << std::endl;
+        out << "  " << pn << "[-o <output>|-O <output>] [-q] [-a] [-s|-S] [-p <one" << paramFileExtension << "> [-p <two" << paramFileExtension << "> ...] ] [-d] [ -j[1-100] -js<1-3> | -t[z] -b<8|16|16f|32> | -n -b<8|16> | -Ttype ] [-Y] [-f] [--jobs=<n>] [--mem-budget=<MB>] [--profile=<file> [--profile-format=json|trace]] -c <input>" << std::endl;
         out << std::endl;
         out << "  -c <files>       Specify one or more input files or folders. When specifying\n"
             << "                   folders, ART will look for image file types which comply with\n"
@@ -97,6 +97,14 @@ inline void ART_print_help(std::ostream &out, const char *progname, bool gui)
         out << "  -Y               Overwrite output if present." << std::endl;
         out << "  -f               Use the custom fast-export processing pipeline." << std::endl;
         out << "  -V               Verbose output." << std::endl;
+        out << "  --jobs=<n>       Process up to n files concurrently (0 = number of CPUs).\n"
+            << "                   The CPU cores are shared among the files in flight." << std::endl;
+        out << "  --mem-budget=<MB> Limit the estimated memory used by the files processed\n"
+            << "                   concurrently with --jobs (default: unlimited)." << std::endl;
+        out << "  --profile=<file> Record the time, CPU usage and memory of each processing\n"
+            << "                   step and write the report to <file>." << std::endl;
+        out << "  --profile-format=<json|trace> Format of the --profile report: a per-step\n"
+            << "                   JSON summary (default) or a Chrome trace." << std::endl;
         out << "  --progress       Show progress info in a format compatible with zenity." << std::endl;
         out << std::endl;
         out << "Your " << pparamsExt << " files can be incomplete, ART will build the final values as follows:" << std::endl;
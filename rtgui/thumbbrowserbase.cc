@@ -639,6 +639,18 @@ void ThumbBrowserBase::arrangeFiles(bool checkfilter)
     // We could lock it one more time, there's no harm excepted (negligible) speed penalty
     //GThreadLock lock;
 
+    // the entries whose slot did not change are not moved, so that e.g. a
+    // filter change relays out only the entries after the first one shown
+    // or hidden, and a resize of the window only the ones changing row
+    const auto place =
+        [](ThumbBrowserEntryBase *entry, int x, int y, int w, int h) -> void
+        {
+            if (entry->getStartX() != x || entry->getStartY() != y || entry->getEffectiveWidth() != w || entry->getEffectiveHeight() != h) {
+                entry->setPosition(x, y, w, h);
+            }
+            entry->drawable = true;
+        };
+
     int rowHeight = 0;
     for (const auto entry : fd) {
         if (checkfilter) {
@@ -667,8 +679,7 @@ void ThumbBrowserBase::arrangeFiles(bool checkfilter)
             if (ct < fd.size()) {
                 const int maxw = fd[ct]->getMinimalWidth();
 
-                fd[ct]->setPosition(currx, curry, maxw, rowHeight);
-                fd[ct]->drawable = true;
+                place(fd[ct], currx, curry, maxw, rowHeight);
                 currx += maxw;
                 curry += rowHeight;
             }
@@ -735,8 +746,7 @@ void ThumbBrowserBase::arrangeFiles(bool checkfilter)
                 }
 
                 if (ct < fd.size()) {
-                    fd[ct]->setPosition(currx, curry, colWidths[i], rowHeight);
-                    fd[ct]->drawable = true;
+                    place(fd[ct], currx, curry, colWidths[i], rowHeight);
                     currx += colWidths[i];
                 }
             }
@@ -22,23 +22,137 @@
 #include "../rtengine/image8.h"
 #include "options.h"
 #include <iostream>
+#include <memory>
+#include <cstring>
 #include <glib/gstdio.h>
+#include <glibmm/fileutils.h>
+#include <unistd.h>
+#include <zlib.h>
 
 extern Options options;
 
 namespace art { namespace thumbimgcache {
 
-/******************************************************************************
- * file format:
- *
- * "ART\n" header
- * monitor hash
- * size of the procparams
- * compressed procparams
- * width
- * height
- * image data
- ******************************************************************************/
+namespace {
+
+constexpr char MAGIC[4] = { 'A', 'R', 'T', 'P' };
+constexpr guint32 VERSION = 1;
+
+// rows per compressed tile
+constexpr int TILE_ROWS = 32;
+// the smallest level of the pyramid
+constexpr int MIN_LEVEL_HEIGHT = 32;
+
+
+class Reader {
+public:
+    Reader(const char *data, size_t size): data_(data), size_(size), pos_(0) {}
+
+    bool get(void *dst, size_t n)
+    {
+        if (pos_ + n > size_) {
+            return false;
+        }
+        memcpy(dst, data_ + pos_, n);
+        pos_ += n;
+        return true;
+    }
+
+    template <class T>
+    bool get(T &v) { return get(&v, sizeof(T)); }
+
+    const char *ptr() const { return data_ + pos_; }
+    bool skip(size_t n)
+    {
+        if (pos_ + n > size_) {
+            return false;
+        }
+        pos_ += n;
+        return true;
+    }
+
+private:
+    const char *data_;
+    size_t size_;
+    size_t pos_;
+};
+
+
+template <class T>
+void put(std::string &out, const T &v)
+{
+    out.append(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+
+// 2x2 box downscaling
+rtengine::Image8 *halve(const rtengine::IImage8 *src)
+{
+    const int W = std::max(src->getWidth() / 2, 1);
+    const int H = std::max(src->getHeight() / 2, 1);
+    const int sw = src->getWidth();
+    const int sh = src->getHeight();
+    rtengine::Image8 *ret = new rtengine::Image8(W, H);
+
+    for (int y = 0; y < H; ++y) {
+        const unsigned char *r0 = src->r(std::min(2 * y, sh - 1));
+        const unsigned char *r1 = src->r(std::min(2 * y + 1, sh - 1));
+        unsigned char *dst = ret->r(y);
+        for (int x = 0; x < W; ++x) {
+            const int x0 = std::min(2 * x, sw - 1) * 3;
+            const int x1 = std::min(2 * x + 1, sw - 1) * 3;
+            for (int c = 0; c < 3; ++c) {
+                dst[3 * x + c] = (r0[x0 + c] + r0[x1 + c] + r1[x0 + c] + r1[x1 + c] + 2) / 4;
+            }
+        }
+    }
+
+    return ret;
+}
+
+
+struct Tile {
+    guint64 offset;
+    guint32 size;
+};
+
+
+struct Level {
+    guint32 width;
+    guint32 height;
+    guint32 tile_rows;
+    std::vector<Tile> tiles;
+};
+
+
+bool compress_level(const rtengine::IImage8 *img, Level &level, std::vector<std::vector<Bytef>> &data)
+{
+    level.width = img->getWidth();
+    level.height = img->getHeight();
+    level.tile_rows = TILE_ROWS;
+    level.tiles.clear();
+
+    const uLong row_size = uLong(level.width) * 3;
+    for (guint32 y = 0; y < level.height; y += TILE_ROWS) {
+        const guint32 rows = std::min(guint32(TILE_ROWS), level.height - y);
+        const uLong src_size = row_size * rows;
+        uLongf dst_size = compressBound(src_size);
+        std::vector<Bytef> buf(dst_size);
+        // rows are contiguous in Image8
+        if (compress2(buf.data(), &dst_size, reinterpret_cast<const Bytef *>(img->r(y)), src_size, 1) != Z_OK) {
+            return false;
+        }
+        buf.resize(dst_size);
+        level.tiles.push_back({0, guint32(dst_size)});
+        data.emplace_back(std::move(buf));
+    }
+
+    return true;
+}
+
+} // namespace
+
+
 rtengine::IImage8 *load(const Glib::ustring &cache_fname, const rtengine::procparams::ProcParams &pparams, int h)
 {
     if (!options.thumb_cache_processed) {
@@ -51,93 +165,113 @@ rtengine::IImage8 *load(const Glib::ustring &cache_fname, const rtengine::procpa
         return nullptr;
     }
 
-    FILE *f = g_fopen(fname.c_str(), "rb");
+    std::unique_ptr<GMappedFile, void(*)(GMappedFile *)> mapping(g_mapped_file_new(fname.c_str(), FALSE, nullptr), g_mapped_file_unref);
+    if (!mapping) {
+        return nullptr;
+    }
 
-    if (!f) {
+    const char *contents = g_mapped_file_get_contents(mapping.get());
+    const size_t length = g_mapped_file_get_length(mapping.get());
+    if (!contents) {
         return nullptr;
     }
+    Reader rd(contents, length);
 
     // header
-    char buffer[64];
-    fgets(buffer, 5, f);
-    if (strcmp(buffer, "ART\n") != 0) {
+    char magic[sizeof(MAGIC)];
+    guint32 version = 0;
+    if (!rd.get(magic, sizeof(MAGIC)) || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || !rd.get(version) || version != VERSION) {
         return nullptr;
     }
 
     // monitor hash
-    if (fread(buffer, sizeof(char), 33, f) < 33) {
+    guint32 hashsz = 0;
+    if (!rd.get(hashsz)) {
         return nullptr;
     }
-    buffer[33] = '\0';
-    if (strcmp(buffer, rtengine::ICCStore::getInstance()->getThumbnailMonitorHash().c_str()) != 0) {
-        fclose(f);
+    const std::string &hash = rtengine::ICCStore::getInstance()->getThumbnailMonitorHash();
+    if (hashsz != hash.size() || length - (rd.ptr() - contents) < hashsz || hash.compare(0, hashsz, rd.ptr(), hashsz) != 0) {
         return nullptr;
     }
+    rd.skip(hashsz);
 
     // size of the profile data
     guint32 profsz = 0;
-    if (fread(&profsz, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        fclose(f);
+    if (!rd.get(profsz)) {
         return nullptr;
     }
 
     rtengine::procparams::ProcParams imgparams;
     {
         std::vector<uint8_t> profzdata(profsz);
-        if (fread(&profzdata[0], sizeof(uint8_t), profsz, f) < profsz) {
-            fclose(f);
+        if (!rd.get(profzdata.data(), profsz)) {
             return nullptr;
         }
         std::string profdata = rtengine::decompress(profzdata);
         if (!imgparams.from_data(profdata.c_str())) {
-            fclose(f);
             return nullptr;
         }
     }
     if (imgparams != pparams) {
-        fclose(f);
         return nullptr;
     }
 
-    guint32 width = 0, height = 0;
-
-    if (fread(&width, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        fclose(f);
+    // pick the smallest level which is at least h pixels high
+    guint32 numlevels = 0;
+    if (!rd.get(numlevels)) {
         return nullptr;
     }
-
-    if (fread(&height, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        fclose(f);
-        return nullptr;
+    Level level;
+    bool found = false;
+    for (guint32 i = 0; i < numlevels; ++i) {
+        Level l;
+        guint32 numtiles = 0;
+        if (!rd.get(l.width) || !rd.get(l.height) || !rd.get(l.tile_rows) || !rd.get(numtiles)) {
+            return nullptr;
+        }
+        l.tiles.resize(numtiles);
+        for (auto &t : l.tiles) {
+            if (!rd.get(t.offset) || !rd.get(t.size)) {
+                return nullptr;
+            }
+        }
+        if (l.height >= guint32(h)) {
+            level = std::move(l);
+            found = true;
+        }
     }
 
-    if (std::min(width , height) <= 0) {
-        fclose(f);
+    if (!found || level.width == 0 || level.height == 0 || level.tile_rows == 0 || level.tiles.size() != (level.height + level.tile_rows - 1) / level.tile_rows) {
         return nullptr;
     }
 
-    if (guint32(h) != height) {
-        fclose(f);
-        return nullptr;
+    std::unique_ptr<rtengine::Image8> image(new rtengine::Image8(level.width, level.height));
+    const uLong row_size = uLong(level.width) * 3;
+    for (size_t i = 0; i < level.tiles.size(); ++i) {
+        const auto &t = level.tiles[i];
+        const guint32 y = i * level.tile_rows;
+        const guint32 rows = std::min(level.tile_rows, level.height - y);
+        uLongf dst_size = row_size * rows;
+        if (t.offset + t.size > length ||
+            uncompress(reinterpret_cast<Bytef *>(image->r(y)), &dst_size, reinterpret_cast<const Bytef *>(contents + t.offset), t.size) != Z_OK ||
+            dst_size != row_size * rows) {
+            return nullptr;
+        }
     }
 
-    rtengine::Image8 *image = new rtengine::Image8(width, height);
-    image->readData(f);
-    fclose(f);
-
-    // if (guint32(h) < height) {
-    //     int w = int(float(width) * float(guint32(h) / height));
-    //     rtengine::Image8 *resized = new rtengine::Image8(w, h);
-    //     image->resizeImgTo<>(w, h, rtengine::TI_Nearest, resized);
-    //     delete image;
-    //     image = resized;
-    // }
+    if (level.height != guint32(h)) {
+        const int w = std::max(int(double(level.width) * h / level.height + 0.5), 1);
+        rtengine::Image8 *resized = new rtengine::Image8(w, h);
+        image->resizeImgTo(w, h, rtengine::TI_Bilinear, resized);
+        image.reset(resized);
+    }
 
     if (options.rtSettings.verbose > 1) {
-        std::cout << "read from cache: " << fname << " " << width << "x" << height << std::endl;
+        std::cout << "read from cache: " << fname << " " << image->getWidth() << "x" << image->getHeight()
+                  << " (level " << level.width << "x" << level.height << ")" << std::endl;
     }
 
-    return image;
+    return image.release();
 }
 
 
@@ -148,30 +282,89 @@ bool store(const Glib::ustring &cache_fname, const rtengine::procparams::ProcPar
     }
     
     Glib::ustring fname = cache_fname + ".artt";
-    FILE *f = g_fopen(fname.c_str(), "wb");
 
-    if (!f) {
-        return false;
+    // build the pyramid
+    std::vector<Level> levels;
+    std::vector<std::vector<Bytef>> tiles;
+    {
+        std::unique_ptr<rtengine::Image8> prev;
+        const rtengine::IImage8 *cur = img;
+        while (true) {
+            levels.emplace_back();
+            if (!compress_level(cur, levels.back(), tiles)) {
+                return false;
+            }
+            if (cur->getHeight() / 2 < MIN_LEVEL_HEIGHT) {
+                break;
+            }
+            prev.reset(halve(cur));
+            cur = prev.get();
+        }
     }
 
-    fputs("ART\n", f);
-    fputs(rtengine::ICCStore::getInstance()->getThumbnailMonitorHash().c_str(), f);
+    std::string header(MAGIC, sizeof(MAGIC));
+    put(header, VERSION);
+    const std::string &hash = rtengine::ICCStore::getInstance()->getThumbnailMonitorHash();
+    put(header, guint32(hash.size()));
+    header += hash;
     std::vector<uint8_t> profzdata = rtengine::compress(pparams.to_data(), 1);
-    guint32 profsz = guint32(profzdata.size());
-    fwrite(&profsz, sizeof(guint32), 1, f);
-    fwrite(&profzdata[0], sizeof(uint8_t), profsz, f);
+    put(header, guint32(profzdata.size()));
+    header.append(profzdata.begin(), profzdata.end());
+    put(header, guint32(levels.size()));
 
-    guint32 w = guint32(img->getWidth());
-    guint32 h = guint32(img->getHeight());
-    fwrite(&w, sizeof(guint32), 1, f);
-    fwrite(&h, sizeof(guint32), 1, f);
+    // assign the offsets of the tiles, which follow the header
+    size_t tables_size = 0;
+    for (auto &l : levels) {
+        tables_size += 4 * sizeof(guint32) + l.tiles.size() * (sizeof(guint64) + sizeof(guint32));
+    }
+    guint64 offset = header.size() + tables_size;
+    for (auto &l : levels) {
+        for (auto &t : l.tiles) {
+            t.offset = offset;
+            offset += t.size;
+        }
+    }
+    for (auto &l : levels) {
+        put(header, l.width);
+        put(header, l.height);
+        put(header, l.tile_rows);
+        put(header, guint32(l.tiles.size()));
+        for (auto &t : l.tiles) {
+            put(header, t.offset);
+            put(header, t.size);
+        }
+    }
 
-    img->writeData(f);
+    // write to a temporary file in the same directory first, and then
+    // rename it: load() maps the file in memory, so it must never be
+    // rewritten in place. If the rename fails (e.g. on Windows, when the
+    // old file is still mapped) the old entry is kept
+    std::string templ = fname + ".tmp-XXXXXX";
+    int fd = Glib::mkstemp(templ);
+    if (fd < 0) {
+        return false;
+    }
+    FILE *f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        g_remove(templ.c_str());
+        return false;
+    }
 
-    fclose(f);
+    bool ok = fwrite(header.data(), 1, header.size(), f) == header.size();
+    for (auto &t : tiles) {
+        ok = ok && fwrite(t.data(), 1, t.size(), f) == t.size();
+    }
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok || g_rename(templ.c_str(), fname.c_str()) != 0) {
+        g_remove(templ.c_str());
+        return false;
+    }
 
     if (options.rtSettings.verbose > 1) {
-        std::cout << "saved in cache: " << fname << " " << w << "x" << h << std::endl;
+        std::cout << "saved in cache: " << fname << " " << img->getWidth() << "x" << img->getHeight()
+                  << ", " << levels.size() << " levels" << std::endl;
     }
     
     return true;
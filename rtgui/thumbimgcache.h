@@ -32,13 +32,21 @@ namespace art { namespace thumbimgcache {
 /******************************************************************************
  * file format:
  *
- * "ART\n" header
- * monitor hash
- * size of the procparams
+ * "ARTP" header, format version (uint32)
+ * size of the monitor hash (uint32), monitor hash
+ * size of the procparams (uint32)
  * compressed procparams
- * width
- * height
- * image data
+ * number of levels (uint32)
+ * for each level of the pyramid, from the largest to the smallest:
+ *   width, height, rows per tile, number of tiles (uint32)
+ *   for each tile: offset from the start of the file (uint64), size (uint32)
+ * zlib-compressed tiles of 8-bit RGB rows
+ *
+ * The image processed for the thumbnail is stored together with a pyramid
+ * of downscaled copies, so that a thumbnail of any height up to the one
+ * that was processed can be served from the cache. The file is mapped in
+ * memory and only the tiles of the level closest to the requested height
+ * are decompressed.
  ******************************************************************************/
 rtengine::IImage8 *load(const Glib::ustring &cache_fname, const rtengine::procparams::ProcParams &pparams, int h);
 
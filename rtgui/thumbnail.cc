@@ -43,7 +43,7 @@ using namespace rtengine::procparams;
 Thumbnail::Thumbnail(CacheManager* cm, const Glib::ustring& fname, CacheImageData* cf)
     : fname(fname), cfs(*cf), cachemgr(cm), ref(1), enqueueNumber(0), tpp(nullptr),
       pparamsValid(false), needsReProcessing(true), imageLoading(false), lastImg(nullptr),
-      lastW(0), lastH(0), lastScale(0), initial_(false), first_process_(true)
+      lastW(0), lastH(0), lastScale(0), initial_(false), first_process_(true), cfs_stamp_(0)
 {
     loadProcParams(false);
 
@@ -60,7 +60,7 @@ Thumbnail::Thumbnail(CacheManager* cm, const Glib::ustring& fname, CacheImageDat
 Thumbnail::Thumbnail (CacheManager* cm, const Glib::ustring& fname, const std::string& md5)
     : fname(fname), cachemgr(cm), ref(1), enqueueNumber(0), tpp(nullptr), pparamsValid(false),
       needsReProcessing(true), imageLoading(false), lastImg(nullptr),
-      lastW(0), lastH(0), lastScale(0.0), initial_(true), first_process_(true)
+      lastW(0), lastH(0), lastScale(0.0), initial_(true), first_process_(true), cfs_stamp_(0)
 {
 
 
@@ -179,7 +179,7 @@ void Thumbnail::_generateThumbnailImage(bool save_in_cache, bool info_only)
         needsReProcessing = true;
 
         if (save_in_cache) {
-            cfs.save(getCacheFileName("data", ".txt"));
+            cachemgr->saveImageData(fname, cfs);
         }
 
         generateExifDateTimeStrings ();
@@ -528,7 +528,7 @@ void Thumbnail::imageDeveloped ()
 {
 
     cfs.recentlySaved = true;
-    cfs.save (getCacheFileName ("data", ".txt"));
+    cachemgr->saveImageData(fname, cfs);
 
     if (options.saveParamsCache) {
         pparams.save (cachemgr->getProgressListener(), getCacheFileName ("profiles", paramFileExtension));
@@ -686,7 +686,7 @@ rtengine::IImage8* Thumbnail::processThumbImage (const rtengine::procparams::Pro
             return nullptr;
         } else if (options.thumb_lazy_caching) {
             _saveThumbnail();
-            cfs.save(getCacheFileName("data", ".txt"));
+            cachemgr->saveImageData(fname, cfs);
         }
     }
 
@@ -709,7 +709,9 @@ rtengine::IImage8* Thumbnail::processThumbImage (const rtengine::procparams::Pro
             }
             // Full thumbnail: apply profile
             image = tpp->processImage(pparams, static_cast<rtengine::eSensorType>(cfs.sensortype), h, rtengine::TI_Bilinear, &cfs, scale );
-            art::thumbimgcache::store(fn, pparams, image);
+            // the cache is now valid for pparams: later zoom changes can be
+            // served from it
+            first_process_ = art::thumbimgcache::store(fn, pparams, image);
         } else if (options.rtSettings.verbose) {
             std::cout << "cached thumb image: " << fname << std::endl;
         }
@@ -811,6 +813,7 @@ int Thumbnail::infoFromImage (const Glib::ustring& fname)
         return 0;
     }
 
+    ++cfs_stamp_;
     int deg = 0;
     cfs.timeValid = false;
     cfs.exifValid = false;
@@ -1006,7 +1009,7 @@ void Thumbnail::updateCache (bool updatePParams, bool updateCacheImageData)
     }
 
     if (updateCacheImageData) {
-        cfs.save (getCacheFileName ("data", ".txt"));
+        cachemgr->saveImageData(fname, cfs);
     }
 
     if (updatePParams && pparamsValid) {
@@ -21,6 +21,7 @@
 #define _THUMBNAIL_
 
 #include <string>
+#include <atomic>
 #include <glibmm.h>
 #include "cachemanager.h"
 #include "options.h"
@@ -65,6 +66,7 @@ class Thumbnail: public PParamsSnapshotListener {
 
     bool initial_;
     bool first_process_;
+    std::atomic<unsigned int> cfs_stamp_; // changes whenever the EXIF data of cfs is re-read
 
     // rating info
     struct Rating {
@@ -170,6 +172,7 @@ public:
     bool isSupported();
 
     const CacheImageData *getCacheImageData() { return &cfs; }
+    unsigned int getCacheImageDataStamp() const { return cfs_stamp_; }
     std::string getMD5() { return cfs.md5; }
 
     int getRank()